@@ -22,14 +22,23 @@
  */
 #include "sst_constants.h"
 #include "read_write.h"
+#include "chip_driver.h"
 #include "communication_util.h"
 #include "program_sector.h"
+#include "checksum.h"
+#include "read_sector.h"
+#include "health.h"
+#include "bench.h"
+#include "production.h"
+#include "scheduler.h"
+#include "tx_queue.h"
 #include "globals.h"
 #include "pinout.h"
 #include <Arduino.h>
 
 // required to be declared in one file
 ArduinoState arduinoState;
+ChipTimings chipTimings;
 
 //=============================================================================
 //             SETUP AND LOOP
@@ -40,6 +49,7 @@ void setup() {
     setupAddressPins();
     setDataPinsIn();
     setupLEDs();
+    setupHealth();
 
     Serial.begin(SERIAL_BAUD_RATE);
     delay(10);
@@ -49,12 +59,41 @@ void setup() {
     connectToDriver();
     setLEDStatus(WORKING);
     arduinoState = WAITING_FOR_COMMAND;
+
+    schedulerAddTask(serialTask, 0, true);
+    schedulerAddTask(txQueuePump, 0, false);
+    schedulerAddTask(flashTask, 0, true);
+    schedulerAddTask(productionTask, 0, true);  // productionPoll keeps its own interval
 }
 
 void loop() {
-    if (Serial.available() > 0) {
-        processSerial();
-    }
+    schedulerRun();
+}
+
+//=============================================================================
+//             TASKS
+//=============================================================================
+
+/* Whether the serial task is handling input from the driver: a transaction (or a command) is in progress, so the
+other tasks must not send anything to the driver. */
+static bool handlingSerial = false;
+
+/** @brief Task which handles serial input from the driver, a whole transaction at a time (see scheduler.h). */
+static void serialTask() {
+    if (Serial.available() == 0) return;
+    handlingSerial = true;
+    processSerial();
+    handlingSerial = false;
+}
+
+/** @brief Task which advances the chip's background operations: see chipPollPrepareSector. */
+static void flashTask() {
+    chipPollPrepareSector();
+}
+
+/** @brief Task which detects chips being inserted and removed in production mode, between transactions. */
+static void productionTask() {
+    if (!handlingSerial && arduinoState == WAITING_FOR_COMMAND) productionPoll();
 }
 
 /** @brief Processes serial input from the driver. */
@@ -69,9 +108,39 @@ static void processSerial() {
         case PROGRAM_SECTOR_GOT_DATA:
             processSerialProgramSector();
             return;
+        case BEGIN_DELTA_SECTOR:
+            processSerialDeltaSector();
+            return;
         case BEGIN_ERASE_CHIP:
             processSerialEraseChip();
             return;
+        case BEGIN_ERASE_RANGE:
+            processSerialEraseRange();
+            return;
+        case BEGIN_SECTOR_CRC:
+            processSerialSectorCrc();
+            return;
+        case BEGIN_CRC_TREE:
+            processSerialCrcTree();
+            return;
+        case BEGIN_READ_SECTOR:
+            processSerialReadSector();
+            return;
+        case BEGIN_END_CHIP:
+            processSerialEndChip();
+            return;
+        case BEGIN_BAUD_CHANGE:
+            processSerialBaudChange();
+            return;
+        case BEGIN_VERIFY_POLICY:
+            processSerialVerifyPolicy();
+            return;
+        case BEGIN_BENCH:
+            processSerialBench();
+            return;
+        case BEGIN_LINK_TEST:
+            processSerialLinkTest();
+            return;
         case DONE:
             while (true) delay(1000000);
     }
@@ -92,6 +161,10 @@ static void checkForDebugMode() {
         digitalWrite(WAITING_FOR_COMMUNICATION_LED, HIGH);
         digitalWrite(WORKING_LED, HIGH);
         const int bytes_per_line = 16;
+        Serial.print(CHIP_NAME);
+        Serial.print(" (ID 0x");
+        Serial.print(chipReadId(), HEX);
+        Serial.print(")");
         setDataPinsIn();
         int newline_counter = bytes_per_line;  // so that we print the initial memory address '0x0'
         for (uint32_t i = 0; i < SST_FLASH_SIZE; i++) {
@@ -124,13 +197,19 @@ static void checkForDebugMode() {
  * 
  * If the Arduino receives a valid command, changes state accordingly. Sends a NAK message
  * if the command is not valid, or if the Arduino receives MAX_COMMAND_LENGTH without a null byte.
+ * If the driver stops sending part way through a command for longer than COMMAND_TIMEOUT_MS, the
+ * partial command is abandoned.
  */
 static void processIncomingCommand() {
     byte commandBuffer[MAX_COMMAND_LENGTH];
     uint16_t commandBufferIndex = 0;
 
     while (commandBufferIndex < MAX_COMMAND_LENGTH) {
-        byte b = blockingSerialRead();
+        byte b;
+        if (!timedSerialRead(&b, COMMAND_TIMEOUT_MS)) {
+            abandonTransaction("command");
+            return;
+        }
 
         if (b != (byte)'\0') {
             commandBuffer[commandBufferIndex] = b;
@@ -156,15 +235,50 @@ static void checkForCommand(char *command) {
     if (strcmp(command, PROGRAM_SECTOR_MESSAGE) == 0) {
         arduinoState = BEGIN_PROGRAM_SECTOR;
         sendACK();
+    } else if (strcmp(command, DELTA_SECTOR_MESSAGE) == 0) {
+        arduinoState = BEGIN_DELTA_SECTOR;
+        sendACK();
     } else if (strcmp(command, ERASE_CHIP_MESSAGE) == 0) {
         arduinoState = BEGIN_ERASE_CHIP;
         sendACK();
-        Serial.write("CONFIRM?");
-        Serial.write((byte)'\0');
+        txQueueWrite(CONFIRM_ERASE_MESSAGE);
+        txQueueWrite((byte)'\0');
+    } else if (strcmp(command, ERASE_RANGE_MESSAGE) == 0) {
+        arduinoState = BEGIN_ERASE_RANGE;
+        sendACK();
+    } else if (strcmp(command, SECTOR_CRC_MESSAGE) == 0) {
+        arduinoState = BEGIN_SECTOR_CRC;
+        sendACK();
+    } else if (strcmp(command, CRC_TREE_MESSAGE) == 0) {
+        arduinoState = BEGIN_CRC_TREE;
+        sendACK();
+    } else if (strcmp(command, READ_SECTOR_MESSAGE) == 0) {
+        arduinoState = BEGIN_READ_SECTOR;
+        sendACK();
+    } else if (strcmp(command, HEALTH_MESSAGE) == 0) {
+        sendHealth();
+    } else if (strcmp(command, PRODUCTION_MESSAGE) == 0) {
+        startProduction();
+    } else if (strcmp(command, END_CHIP_MESSAGE) == 0) {
+        arduinoState = BEGIN_END_CHIP;
+        sendACK();
+    } else if (strcmp(command, BAUD_MESSAGE) == 0) {
+        arduinoState = BEGIN_BAUD_CHANGE;
+        sendACK();
+    } else if (strcmp(command, VERIFY_POLICY_MESSAGE) == 0) {
+        arduinoState = BEGIN_VERIFY_POLICY;
+        sendACK();
+    } else if (strcmp(command, BENCH_MESSAGE) == 0) {
+        arduinoState = BEGIN_BENCH;
+        sendACK();
+    } else if (strcmp(command, LINK_TEST_MESSAGE) == 0) {
+        arduinoState = BEGIN_LINK_TEST;
+        sendACK();
     } else if (strcmp(command, DONE_MESSAGE) == 0) {
         arduinoState = DONE;
         setLEDStatus(FINISHED);
         sendACK();
+        txQueueFlush();  // tasks stop running here
         while (true) delay(1000000);
     } else {
         String badCommand = String(command);
@@ -179,13 +293,19 @@ static void checkForCommand(char *command) {
 /**
  * @brief Processes serial input while the Arduino is erasing the chip. This has
  * the effect of erasing the chip if the driver confirms the erase operation, or
- * returning to WAITING_FOR_COMMAND otherwise.
+ * returning to WAITING_FOR_COMMAND otherwise. If the driver does not confirm within
+ * ERASE_CHIP_CONFIRM_TIMEOUT_MS, the erase is abandoned and the chip is left untouched.
  */
 static void processSerialEraseChip() {
-    byte b = blockingSerialRead();
+    byte b;
+    if (!timedSerialRead(&b, ERASE_CHIP_CONFIRM_TIMEOUT_MS)) {
+        abandonTransaction("chip erase (waiting for confirmation)");
+        return;
+    }
+
     if (b == ACK) {
-        setDataPinsOut();
-        eraseChip();
+        chipEraseChip();
+        healthRecordChipErase();
         sendACK();
         arduinoState = WAITING_FOR_COMMAND;
     } else if (b == NAK) {
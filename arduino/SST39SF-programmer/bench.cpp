@@ -0,0 +1,155 @@
+/*
+ * Implementation of the on-device benchmark. See bench.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "bench.h"
+#include "sst_constants.h"
+#include "communication_util.h"
+#include "tx_queue.h"
+#include "globals.h"
+#include "read_write.h"
+#include "chip_driver.h"
+#include "checksum.h"
+#include "health.h"
+#include "scheduler.h"
+#include "pinout.h"
+
+#if BUS_BACKEND == BUS_BACKEND_XMEM
+static const char BUS_BACKEND_NAME[] = "XMEM bus";
+#else
+static const char BUS_BACKEND_NAME[] = "bit-banged bus";
+#endif
+
+/** @brief The timings and result of benchmarking one sector: see the record in bench.h. */
+struct BenchRecord {
+    uint8_t status;
+    uint32_t eraseUs;
+    uint32_t programUs;
+    uint16_t programPolls;
+    uint16_t programSamples;
+    uint32_t verifyUs;
+    uint32_t crcUs;
+    uint16_t mismatches;
+};
+
+/**
+ * @brief Fills a buffer with a sector's test pattern.
+ * 
+ * @param pattern one of the BENCH_PATTERN_ values in protocol.h
+ * @param sectorIndex the index of the sector, which seeds BENCH_PATTERN_RANDOM
+ * @param data the buffer: SST_SECTOR_SIZE bytes
+ */
+static void fillPattern(uint8_t pattern, uint16_t sectorIndex, byte *data) {
+    uint32_t state = 0x9E3779B9 ^ sectorIndex;
+    for (uint16_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        switch (pattern) {
+            case BENCH_PATTERN_ZEROES:
+                data[index] = 0x00;
+                break;
+            case BENCH_PATTERN_ALTERNATING:
+                data[index] = index % 2 == 0 ? 0x55 : 0xAA;
+                break;
+            default:  // BENCH_PATTERN_RANDOM: a linear congruential generator's high byte
+                state = state * 1664525 + 1013904223;
+                data[index] = state >> 24;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Erases, programs and verifies a sector with test data, timing each phase.
+ * 
+ * @param sectorIndex the index of the sector
+ * @param data the test data: SST_SECTOR_SIZE bytes
+ * @return the timings and result
+ */
+static BenchRecord benchSector(uint16_t sectorIndex, const byte *data) {
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    BenchRecord record = BenchRecord();
+
+    uint32_t start = micros();
+    if (!chipPrepareSector(sectorIndex)) {
+        record.status = BENCH_NOT_ERASABLE;
+        return record;
+    }
+    record.eraseUs = micros() - start;
+
+    start = micros();
+    chipProgramSector(sectorIndex, data);
+    record.programUs = micros() - start;
+    record.programPolls = chipTimings.programPolls;
+    record.programSamples = chipTimings.programSamples;
+    healthRecordSector(sectorIndex, chipTimings);
+
+    start = micros();
+    setDataPinsIn();
+    for (uint16_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if (readByte(startAddress + index) != data[index]) record.mismatches++;
+    }
+    record.verifyUs = micros() - start;
+
+    start = micros();
+    rangeCrc32(startAddress, SST_SECTOR_SIZE);
+    record.crcUs = micros() - start;
+
+    record.status = BENCH_OK;
+    return record;
+}
+
+// See header comment.
+void processSerialBench() {
+    arduinoState = WAITING_FOR_COMMAND;
+    uint16_t firstSector;
+    uint16_t sectorCount;
+    byte pattern;
+    if (!timedSerialReadUint16(&firstSector, BENCH_TIMEOUT_MS) || !timedSerialReadUint16(&sectorCount, BENCH_TIMEOUT_MS)
+            || !timedSerialRead(&pattern, BENCH_TIMEOUT_MS)) {
+        abandonTransaction("benchmark (receiving sector range)");
+        return;
+    }
+
+    if (sectorCount == 0 || (uint32_t)firstSector + sectorCount > SST_NUMBER_SECTORS) {
+        sendNAKMessage("While benchmarking, got " + String(sectorCount) + " sectors from sector " + String(firstSector) + ", which is not a range of sectors on the chip.");
+        return;
+    }
+    if (pattern > BENCH_PATTERN_RANDOM) {
+        sendNAKMessage("While benchmarking, got pattern " + String(pattern) + ", which is not a test pattern.");
+        return;
+    }
+    sendACK();
+    txQueueWrite(CHIP_NAME);
+    txQueueWrite(", ");
+    txQueueWrite(BUS_BACKEND_NAME);
+    txQueueWrite((byte)'\0');
+
+    byte data[SST_SECTOR_SIZE];
+    for (uint16_t sectorIndex = firstSector; sectorIndex < firstSector + sectorCount; sectorIndex++) {
+        fillPattern(pattern, sectorIndex, data);
+        BenchRecord record = benchSector(sectorIndex, data);
+
+        txQueueWrite(record.status);
+        serialWriteUint32(record.eraseUs);
+        serialWriteUint32(record.programUs);
+        serialWriteUint16(record.programPolls);
+        serialWriteUint16(record.programSamples);
+        serialWriteUint32(record.verifyUs);
+        serialWriteUint32(record.crcUs);
+        serialWriteUint16(record.mismatches);
+        schedulerYield();  // let the record go out while the next sector is benchmarked
+    }
+}
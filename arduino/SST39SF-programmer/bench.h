@@ -0,0 +1,47 @@
+/*
+ * On-device benchmark: erases, programs and verifies a range of sectors with test patterns that the Arduino makes up
+ * itself, timing each phase, so that the chip, the chip driver and the bus backend can be measured without the serial
+ * link (or the host) in the way.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_BENCH_H
+#define SST39SF_PROGRAMMER_BENCH_H
+
+/**
+ * @brief Processes serial input while the Arduino is running a benchmark. The Arduino must be in the BEGIN_BENCH
+ * state when calling this function, and is in WAITING_FOR_COMMAND when it returns.
+ * 
+ * The driver sends the index of the first sector (2 bytes), the number of sectors (2 bytes), and the test pattern (1
+ * byte: one of the BENCH_PATTERN_ values in protocol.h). If the range is not within the chip or the pattern is not
+ * one of them, the Arduino replies with a NAK message. Otherwise, it replies ACK and a null-terminated description of
+ * what is being measured (the chip family and the bus backend), then for each sector in turn, once it is done:
+ * 
+ *     status         1 byte    BENCH_OK, or BENCH_NOT_ERASABLE (see protocol.h)
+ *     eraseUs        4 bytes   erasing the sector, polling the toggle bit for completion
+ *     programUs      4 bytes   programming the pattern with chipProgramSector
+ *     programPolls   2 bytes   toggle-bit reads made for the polled writes (see ChipTimings)
+ *     programSamples 2 bytes   number of polled writes: the others, if any, waited a fixed delay instead
+ *     verifyUs       4 bytes   reading the sector back and comparing it byte by byte, as VERIFY_FULL does
+ *     crcUs          4 bytes   reading the sector back into a CRC-32, as VERIFY_CRC and SECTORCRC do
+ *     mismatches     2 bytes   bytes which did not read back as programmed
+ * 
+ * That is BENCH_RECORD_LENGTH bytes, all values little-endian. The sectors' contents are lost, and their programming
+ * is recorded in the wear telemetry as usual.
+ */
+void processSerialBench();
+
+#endif  // SST39SF_PROGRAMMER_BENCH_H
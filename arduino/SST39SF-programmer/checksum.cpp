@@ -0,0 +1,139 @@
+/*
+ * Implementation of checksum functionality. See checksum.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "checksum.h"
+#include "sst_constants.h"
+#include "communication_util.h"
+#include "tx_queue.h"
+#include "globals.h"
+#include "read_write.h"
+
+//=============================================================================
+//             CRC-32
+//=============================================================================
+
+// See header comment.
+uint32_t crc32Update(uint32_t crc, byte b) {
+    // bitwise rather than table-driven: a 1KB table would be a large fraction of the Arduino's RAM
+    crc ^= b;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (crc & 1) {
+            crc = (crc >> 1) ^ 0xEDB88320;
+        } else {
+            crc >>= 1;
+        }
+    }
+    return crc;
+}
+
+// See header comment.
+uint32_t crc32Final(uint32_t crc) {
+    return ~crc;
+}
+
+// See header comment.
+uint32_t rangeCrc32(uint32_t startAddress, uint16_t length) {
+    uint32_t crc = CRC32_INITIAL;
+
+    setDataPinsIn();
+    for (uint32_t index = 0; index < length; index++) {
+        crc = crc32Update(crc, readByte(startAddress + index));
+    }
+    return crc32Final(crc);
+}
+
+// See header comment.
+uint32_t sectorCrc32(uint16_t sectorIndex) {
+    return rangeCrc32(((uint32_t)sectorIndex) * SST_SECTOR_SIZE, SST_SECTOR_SIZE);  // cast needed to avoid truncation
+}
+
+//=============================================================================
+//             SECTOR CRC COMMAND
+//=============================================================================
+
+// See header comment.
+void processSerialSectorCrc() {
+    uint16_t sectorIndex;
+    if (!timedSerialReadUint16(&sectorIndex, SECTOR_CRC_TIMEOUT_MS)) {
+        abandonTransaction("sector CRC (receiving sector index)");
+        return;
+    }
+
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        sendNAKMessage("While computing sector CRC, got sector index " + String(sectorIndex) + ", which is too large.");
+    } else {
+        uint32_t crc = sectorCrc32(sectorIndex);
+        sendACK();
+        serialWriteUint16(sectorIndex);
+        serialWriteUint32(crc);
+    }
+    arduinoState = WAITING_FOR_COMMAND;
+}
+
+//=============================================================================
+//             CHECKSUM TREE COMMAND
+//=============================================================================
+
+/**
+ * @brief Gets the size of a node of the checksum tree at a level (see processSerialCrcTree).
+ * 
+ * @param level the level: one of the CRC_TREE_ levels in protocol.h
+ * @return the size of a node at that level in bytes, or 0 if the level is not one of them
+ */
+static uint32_t crcTreeNodeSize(uint8_t level) {
+    switch (level) {
+        case CRC_TREE_CHIP: return SST_FLASH_SIZE;
+        case CRC_TREE_SECTOR: return SST_SECTOR_SIZE;
+        case CRC_TREE_BLOCK: return CRC_TREE_BLOCK_SIZE;
+        case CRC_TREE_LINE: return CRC_TREE_LINE_SIZE;
+        default: return 0;
+    }
+}
+
+// See header comment.
+void processSerialCrcTree() {
+    arduinoState = WAITING_FOR_COMMAND;
+    byte level;
+    uint32_t startAddress;
+    if (!timedSerialRead(&level, CRC_TREE_TIMEOUT_MS) || !timedSerialReadUint32(&startAddress, CRC_TREE_TIMEOUT_MS)) {
+        abandonTransaction("checksum tree (receiving node)");
+        return;
+    }
+
+    uint32_t nodeSize = crcTreeNodeSize(level);
+    if (nodeSize == 0 || startAddress % nodeSize != 0 || startAddress >= SST_FLASH_SIZE) {
+        sendNAKMessage("While walking checksum tree, got level " + String(level) + " and address 0x" + String(startAddress, HEX) + ", which is not a node.");
+        return;
+    }
+    sendACK();
+
+    if (level == CRC_TREE_LINE) {
+        serialWriteUint16(CRC_TREE_LINE_SIZE);
+        setDataPinsIn();
+        for (uint8_t index = 0; index < CRC_TREE_LINE_SIZE; index++) txQueueWrite(readByte(startAddress + index));
+        return;
+    }
+
+    // each child's CRC is sent as soon as it is computed: the driver is reading them meanwhile
+    uint16_t childCount = level == CRC_TREE_CHIP ? SST_NUMBER_SECTORS : CRC_TREE_FANOUT;
+    uint16_t childSize = nodeSize / childCount;
+    serialWriteUint16(childCount);
+    for (uint16_t child = 0; child < childCount; child++) {
+        serialWriteUint32(rangeCrc32(startAddress + (uint32_t)child * childSize, childSize));
+    }
+}
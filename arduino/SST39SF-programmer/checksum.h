@@ -0,0 +1,103 @@
+/*
+ * Checksum (CRC-32) functionality, which allows the driver to check what is on the chip without reading it back
+ * over serial.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_CHECKSUM_H
+#define SST39SF_PROGRAMMER_CHECKSUM_H
+
+#include <Arduino.h>
+
+//=============================================================================
+//             CRC-32
+//=============================================================================
+
+/* The CRC is the standard CRC-32 (as used by zlib, PNG, etc.): reflected polynomial 0xEDB88320, initial value
+0xFFFFFFFF, final value inverted. The driver computes the same CRC (see Crc32.cs). */
+
+/** @brief Initial value of a CRC-32 register, before any bytes have been added. */
+const uint32_t CRC32_INITIAL = 0xFFFFFFFF;
+
+/**
+ * @brief Adds a byte to a CRC-32 register. Start with CRC32_INITIAL, and pass the final register to crc32Final.
+ * 
+ * @param crc the CRC-32 register
+ * @param b the byte to add
+ * @return the updated CRC-32 register
+ */
+uint32_t crc32Update(uint32_t crc, byte b);
+
+/**
+ * @brief Gets the CRC-32 of the bytes added to a register.
+ * 
+ * @param crc the CRC-32 register
+ * @return the CRC-32
+ */
+uint32_t crc32Final(uint32_t crc);
+
+/**
+ * @brief Reads part of the SST39SF and computes its CRC-32. Sets the data pins to input.
+ * 
+ * @param startAddress the address of the first byte. The part must be on the chip.
+ * @param length the number of bytes
+ * @return the CRC-32 of the part's contents
+ */
+uint32_t rangeCrc32(uint32_t startAddress, uint16_t length);
+
+/**
+ * @brief Reads a sector of the SST39SF and computes its CRC-32. Sets the data pins to input.
+ * 
+ * @param sectorIndex the index of the sector (zero-indexed). Must be in range.
+ * @return the CRC-32 of the sector's contents
+ */
+uint32_t sectorCrc32(uint16_t sectorIndex);
+
+//=============================================================================
+//             SECTOR CRC COMMAND
+//=============================================================================
+
+/**
+ * @brief Processes serial input while the Arduino is computing a sector CRC. The Arduino must be in the 
+ * BEGIN_SECTOR_CRC state when calling this function.
+ * 
+ * Receives a sector index (2 bytes, little-endian). If it is in range, sends an ACK, echoes the sector index, and
+ * sends the CRC-32 of that sector (4 bytes, little-endian). Otherwise, sends a NAK message. Either way, transitions
+ * state to WAITING_FOR_COMMAND.
+ */
+void processSerialSectorCrc();
+
+//=============================================================================
+//             CHECKSUM TREE COMMAND
+//=============================================================================
+
+/**
+ * @brief Processes serial input while the Arduino is walking the checksum tree. The Arduino must be in the
+ * BEGIN_CRC_TREE state when calling this function.
+ * 
+ * The tree lets the driver find which bytes of the chip differ from what it expects in a few round trips, rather
+ * than reading whole sectors: the chip's children are its sectors, a sector's are its CRC_TREE_BLOCK_SIZE byte
+ * blocks, a block's are its CRC_TREE_LINE_SIZE byte lines, and a line's are its bytes. The driver asks for the
+ * children of a node, and only descends into the ones whose CRCs differ from its own.
+ * 
+ * Receives a level (1 byte: one of the CRC_TREE_ levels in protocol.h) and the address of the node's first byte (4
+ * bytes, little-endian). If they name a node, sends an ACK, the number of children (2 bytes, little-endian), and the
+ * CRC-32 of each child (4 bytes each, little-endian), or, for a line, its bytes. Otherwise, sends a NAK message.
+ * Either way, transitions state to WAITING_FOR_COMMAND.
+ */
+void processSerialCrcTree();
+
+#endif  // SST39SF_PROGRAMMER_CHECKSUM_H
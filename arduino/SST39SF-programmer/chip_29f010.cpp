@@ -0,0 +1,238 @@
+/*
+ * Chip driver for the Am29F010 and compatible 29F010-style flash. See chip_driver.h for more information.
+ * 
+ * The command set is the same as the SST39SF's, but erase sectors are 16KB: four of our sectors. As we can't hold
+ * 16KB in RAM to rewrite the rest of an erase sector, one of our sectors is only erased if the other three in its
+ * erase sector are blank, and can otherwise only be programmed if it is already blank. Writing an image to a blank
+ * chip thus works, but reprogramming a sector whose erase sector holds other data requires erasing the chip (or the
+ * whole erase sector, with ERASERANGE) first.
+ * 
+ * Deciding whether a sector can be erased means reading up to the whole erase sector, which must not happen while the
+ * sector's data is arriving (the serial receive buffer would overflow), so unlike the SST39SF's, the erase does not
+ * run while the data is received: chipPrepareSector does it all once the data is in.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sst_constants.h"
+
+#if CHIP_FAMILY == CHIP_FAMILY_29F010
+
+#include "chip_driver.h"
+#include "communication_util.h"
+#include "globals.h"
+#include "read_write.h"
+
+#include <Arduino.h>
+
+//=============================================================================
+//             CONSTANTS
+//=============================================================================
+
+const char CHIP_NAME[] = "29F010";
+const uint8_t CHIP_MANUFACTURER_ID = 0x01;  // AMD: other makers' compatibles have their own
+const uint8_t CHIP_ERASE_BLOCK_SECTORS = 4;
+
+const uint32_t ERASE_SECTOR_SIZE = (uint32_t)CHIP_ERASE_BLOCK_SECTORS * SST_SECTOR_SIZE;  // 16KB
+const uint32_t BYTE_PROGRAM_TIMEOUT_MS = 2;       // 300us maximum, but millis() only has 1ms resolution
+const uint32_t SECTOR_ERASE_TIMEOUT_MS = 10000;   // 8s maximum (the driver waits this long for programming)
+const uint32_t CHIP_ERASE_TIMEOUT_MS = 64000;     // 64s maximum
+
+//=============================================================================
+//             CHIP DRIVER
+//=============================================================================
+
+// See header comment.
+uint16_t chipReadId() {
+    setDataPinsOut();
+    sendCommand(0x90);  // autoselect
+    setDataPinsIn();
+    uint16_t id = (((uint16_t)readByte(0x0)) << 8) | readByte(0x1);
+    setDataPinsOut();
+    sendByte(0x0, 0xF0);  // reset
+    setDataPinsIn();
+    return id;
+}
+
+/**
+ * @brief Checks whether a sector is blank (every byte is 0xFF). Sets the data pins to input.
+ * 
+ * @param startAddress the starting address of the sector
+ * @return whether the sector is blank
+ */
+static bool sectorIsBlank(uint32_t startAddress) {
+    setDataPinsIn();
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if (readByte(startAddress + index) != 0xFF) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Checks whether the sectors of an erase sector other than one of them are all blank, so that erasing it
+ * loses nothing outside that one. Sets the data pins to input.
+ * 
+ * @param startAddress the starting address of the sector
+ * @return whether the rest of its erase sector is blank
+ */
+static bool restOfEraseSectorIsBlank(uint32_t startAddress) {
+    uint32_t eraseSectorStart = startAddress - startAddress % ERASE_SECTOR_SIZE;
+    for (uint32_t address = eraseSectorStart; address < eraseSectorStart + ERASE_SECTOR_SIZE;
+            address += SST_SECTOR_SIZE) {
+        if (address != startAddress && !sectorIsBlank(address)) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Erases an erase sector, and records how long it took. Sets the data pins to input.
+ * 
+ * @param eraseSectorStart the starting address of the erase sector
+ */
+static void eraseEraseSector(uint32_t eraseSectorStart) {
+    setDataPinsOut();
+    sendCommand(0x80);
+    sendUnlockSequence();
+    sendByte(eraseSectorStart, 0x30);
+    uint32_t start = micros();
+    if (!waitForToggleBit(eraseSectorStart, SECTOR_ERASE_TIMEOUT_MS)) {
+        fail("Erasing erase sector at 0x" + String(eraseSectorStart, HEX) + " did not complete in time.");
+    }
+    chipTimings.eraseUs = micros() - start;
+}
+
+// See header comment.
+void chipBeginPrepareSector(uint16_t sectorIndex) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipBeginPrepareSector: index is out of bounds (too large).");
+    }
+#endif
+
+    // nothing can be started without reading the chip: see the header comment
+    chipTimings = ChipTimings();
+    setDataPinsIn();
+}
+
+// See header comment.
+bool chipPollPrepareSector() {
+    return true;
+}
+
+// See header comment.
+bool chipPrepareSector(uint16_t sectorIndex) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipPrepareSector: index is out of bounds (too large).");
+    }
+#endif
+
+    chipTimings = ChipTimings();
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    if (sectorIsBlank(startAddress)) return true;
+    if (!restOfEraseSectorIsBlank(startAddress)) return false;
+    eraseEraseSector(startAddress - startAddress % ERASE_SECTOR_SIZE);
+    return true;
+}
+
+// See header comment.
+void chipProgramSector(uint16_t sectorIndex, const byte *sectorData) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipProgramSector: index is out of bounds (too large).");
+    }
+#endif
+
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if (sectorData[index] == 0xFF) continue;  // already erased: programming 0xFF is a no-op
+        setDataPinsOut();
+        sendCommand(0xA0);
+        sendByte(startAddress + index, sectorData[index]);
+        // program time varies a lot between parts, so poll rather than waiting the maximum every time
+        if (!waitForToggleBit(startAddress + index, BYTE_PROGRAM_TIMEOUT_MS, &chipTimings.programPolls)) {
+            fail("Programming byte at 0x" + String(startAddress + index, HEX) + " did not complete in time.");
+        }
+        chipTimings.programSamples++;
+    }
+    setDataPinsIn();
+}
+
+/**
+ * @brief Checks whether a sector can be changed to new data by programming alone: that is, whether no byte needs a
+ * bit set that is currently clear. Sets the data pins to input.
+ * 
+ * @param startAddress the starting address of the sector
+ * @param sectorData the new data: SST_SECTOR_SIZE bytes
+ * @return whether programming alone is enough
+ */
+static bool programmable(uint32_t startAddress, const byte *sectorData) {
+    setDataPinsIn();
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if ((sectorData[index] & ~readByte(startAddress + index)) != 0) return false;
+    }
+    return true;
+}
+
+// See header comment.
+bool chipPatchSector(uint16_t sectorIndex, const byte *sectorData) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipPatchSector: index is out of bounds (too large).");
+    }
+#endif
+
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    if (!programmable(startAddress, sectorData)) return false;
+
+    chipTimings = ChipTimings();
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if (readByte(startAddress + index) == sectorData[index]) continue;
+        setDataPinsOut();
+        sendCommand(0xA0);
+        sendByte(startAddress + index, sectorData[index]);
+        if (!waitForToggleBit(startAddress + index, BYTE_PROGRAM_TIMEOUT_MS, &chipTimings.programPolls)) {
+            fail("Programming byte at 0x" + String(startAddress + index, HEX) + " did not complete in time.");
+        }
+        chipTimings.programSamples++;
+    }
+    return true;
+}
+
+// See header comment.
+void chipEraseBlock(uint16_t sectorIndex) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipEraseBlock: index is out of bounds (too large).");
+    }
+#endif
+
+    chipTimings = ChipTimings();
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    eraseEraseSector(startAddress - startAddress % ERASE_SECTOR_SIZE);
+}
+
+// See header comment.
+void chipEraseChip() {
+    setDataPinsOut();
+    sendCommand(0x80);
+    sendCommand(0x10);
+    if (!waitForToggleBit(0x0, CHIP_ERASE_TIMEOUT_MS)) {
+        fail("Erasing chip did not complete in time.");
+    }
+}
+
+#endif  // CHIP_FAMILY == CHIP_FAMILY_29F010
@@ -0,0 +1,156 @@
+/*
+ * Chip driver for the AT28C256 EEPROM. See chip_driver.h for more information.
+ * 
+ * The AT28C256 needs no erase: any byte can be rewritten directly. Bytes are written a 64-byte page at a time: the
+ * chip latches up to a page of bytes, then writes them all in one write cycle of at most 10ms. Each byte of a page
+ * must be latched within 150us of the previous one, so pages are loaded with nothing in between but the bus writes.
+ * 
+ * Writes are preceded by the software data protection sequence, so they work whether or not protection is enabled
+ * (and leave it enabled).
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sst_constants.h"
+
+#if CHIP_FAMILY == CHIP_FAMILY_AT28C256
+
+#include "chip_driver.h"
+#include "communication_util.h"
+#include "globals.h"
+#include "read_write.h"
+
+#include <Arduino.h>
+
+//=============================================================================
+//             CONSTANTS
+//=============================================================================
+
+const char CHIP_NAME[] = "AT28C256";
+const uint8_t CHIP_MANUFACTURER_ID = 0;  // see chipReadId
+const uint8_t CHIP_ERASE_BLOCK_SECTORS = 1;
+
+const uint8_t PAGE_SIZE = 64;
+const uint8_t BYTE_LOAD_WINDOW_US = 150;     // the write cycle starts this long after the last byte is latched
+const uint32_t WRITE_CYCLE_TIMEOUT_MS = 11;  // 10ms maximum
+
+//=============================================================================
+//             PAGE WRITES
+//=============================================================================
+
+/**
+ * @brief Writes a page, and waits for the write cycle to complete. Sets the data pins to input.
+ * 
+ * @param startAddress the starting address of the page (a multiple of PAGE_SIZE)
+ * @param pageData the data to write: PAGE_SIZE bytes
+ */
+static void writePage(uint32_t startAddress, const byte *pageData) {
+    setDataPinsOut();
+    sendCommand(0xA0);  // software data protection: write enable
+    for (uint8_t index = 0; index < PAGE_SIZE; index++) {
+        sendByte(startAddress + index, pageData[index]);
+    }
+    delayMicroseconds(BYTE_LOAD_WINDOW_US);  // status reads are only valid once the write cycle has started
+    if (!waitForToggleBit(startAddress, WRITE_CYCLE_TIMEOUT_MS, &chipTimings.programPolls)) {
+        fail("Writing page at 0x" + String(startAddress, HEX) + " did not complete in time.");
+    }
+    chipTimings.programSamples++;
+}
+
+//=============================================================================
+//             CHIP DRIVER
+//=============================================================================
+
+// See header comment.
+uint16_t chipReadId() {
+    return 0;  // device identification needs 12V on A9, which we can't do
+}
+
+// See header comment.
+void chipBeginPrepareSector(uint16_t sectorIndex) {
+    chipPrepareSector(sectorIndex);
+}
+
+// See header comment.
+bool chipPollPrepareSector() {
+    return true;
+}
+
+// See header comment.
+bool chipPrepareSector(uint16_t sectorIndex) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipPrepareSector: index is out of bounds (too large).");
+    }
+#endif
+
+    chipTimings = ChipTimings();
+    return true;  // EEPROM: nothing to erase
+}
+
+// See header comment.
+void chipProgramSector(uint16_t sectorIndex, const byte *sectorData) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipProgramSector: index is out of bounds (too large).");
+    }
+#endif
+
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+
+    for (uint32_t offset = 0; offset < SST_SECTOR_SIZE; offset += PAGE_SIZE) {
+        writePage(startAddress + offset, sectorData + offset);
+    }
+}
+
+// See header comment.
+bool chipPatchSector(uint16_t sectorIndex, const byte *sectorData) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipPatchSector: index is out of bounds (too large).");
+    }
+#endif
+
+    // EEPROM: any byte can be rewritten, so only write the pages that change
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    chipTimings = ChipTimings();
+    setDataPinsIn();
+    for (uint32_t offset = 0; offset < SST_SECTOR_SIZE; offset += PAGE_SIZE) {
+        for (uint8_t index = 0; index < PAGE_SIZE; index++) {
+            if (readByte(startAddress + offset + index) != sectorData[offset + index]) {
+                writePage(startAddress + offset, sectorData + offset);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// See header comment.
+void chipEraseBlock(uint16_t sectorIndex) {
+    chipPrepareSector(sectorIndex);  // EEPROM: nothing to erase
+}
+
+// See header comment.
+void chipEraseChip() {
+    byte blankPage[PAGE_SIZE];
+    memset(blankPage, 0xFF, PAGE_SIZE);
+
+    for (uint32_t address = 0; address < SST_FLASH_SIZE; address += PAGE_SIZE) {
+        writePage(address, blankPage);
+    }
+}
+
+#endif  // CHIP_FAMILY == CHIP_FAMILY_AT28C256
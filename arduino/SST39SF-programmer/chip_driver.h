@@ -0,0 +1,138 @@
+/*
+ * Interface to the command set of the chip being programmed. Each supported chip family has its own implementation
+ * (chip_sst39sf.cpp, chip_at28c256.cpp, chip_29f010.cpp), and exactly one is compiled in, selected by CHIP_FAMILY in
+ * sst_constants.h. Everything above this interface (the serial protocol, sectors of SST_SECTOR_SIZE bytes) is the
+ * same for every family.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_CHIP_DRIVER_H
+#define SST39SF_PROGRAMMER_CHIP_DRIVER_H
+
+#include <Arduino.h>
+
+/** @brief Human-readable name of the chip family, e.g. "SST39SF". */
+extern const char CHIP_NAME[];
+
+/** @brief Manufacturer ID (the high byte of chipReadId) of chips in this family, or 0 if the family has no software
+ * ID. */
+extern const uint8_t CHIP_MANUFACTURER_ID;
+
+/** @brief Number of sectors in each of the chip's erase blocks, which start at multiples of it: erasing one of their
+ * sectors erases them all. */
+extern const uint8_t CHIP_ERASE_BLOCK_SECTORS;
+
+/**
+ * @brief What the chip driver measured while preparing and programming a sector, for wear telemetry (see health.h).
+ * chipPrepareSector resets it.
+ */
+struct ChipTimings {
+    uint32_t eraseUs;         // how long the erase took, or 0 if the sector was not erased
+    uint16_t programPolls;    // toggle-bit status reads until programming completed, over the sampled writes
+    uint16_t programSamples;  // number of writes (bytes or pages) whose completion was polled
+};
+
+/** @brief Global variable that holds the timings of the last sector prepared/programmed. */
+extern ChipTimings chipTimings;
+
+/**
+ * @brief Reads the chip's software ID. Sets the data pins to input.
+ * 
+ * @return the manufacturer ID in the high byte and the device ID in the low byte, or 0 if the family has no
+ * software ID
+ */
+uint16_t chipReadId();
+
+/**
+ * @brief Starts making a sector ready to be programmed, without waiting for the chip: an erase runs inside the chip
+ * while the Arduino does something else, such as receiving the sector's data. Must be followed by chipPrepareSector
+ * for the same sector before anything else is done with the chip. Sets the data pins to input.
+ * 
+ * Must not read the chip: the sector's data arrives while the erase runs, and the serial receive buffer would
+ * overflow. A family that needs to read the chip to decide how to prepare a sector starts nothing here, and leaves
+ * it all to chipPrepareSector.
+ * 
+ * If compiled with DEBUG defined, fails if the sector index is out of range.
+ * 
+ * @param sectorIndex the index of the sector (zero-indexed)
+ */
+void chipBeginPrepareSector(uint16_t sectorIndex);
+
+/**
+ * @brief Checks, without waiting, whether the preparation started by chipBeginPrepareSector has finished. Calling
+ * this now and then while the chip is busy makes the erase time recorded in chipTimings more accurate (otherwise it
+ * is only known to have finished by the time chipPrepareSector is called). Sets the data pins to input.
+ * 
+ * @return true if nothing is in progress
+ */
+bool chipPollPrepareSector();
+
+/**
+ * @brief Makes a sector ready to be programmed by chipProgramSector, erasing it if the family needs it: finishes
+ * what chipBeginPrepareSector started for this sector, or does the whole thing if it wasn't. Sets the data pins to
+ * input.
+ * 
+ * Families whose erase blocks are larger than a sector cannot erase one sector on its own: see the implementation
+ * for what they do instead.
+ * 
+ * If compiled with DEBUG defined, fails if the sector index is out of range.
+ * 
+ * @param sectorIndex the index of the sector (zero-indexed)
+ * @return true if the sector can now be programmed, false if it can't be without losing data outside of it
+ */
+bool chipPrepareSector(uint16_t sectorIndex);
+
+/**
+ * @brief Programs a sector, which must have been prepared with chipPrepareSector. Returns once programming is
+ * complete. Sets the data pins to input.
+ * 
+ * If compiled with DEBUG defined, fails if the sector index is out of range.
+ * 
+ * @param sectorIndex the index of the sector (zero-indexed)
+ * @param sectorData the data to program into the sector: SST_SECTOR_SIZE bytes
+ */
+void chipProgramSector(uint16_t sectorIndex, const byte *sectorData);
+
+/**
+ * @brief Programs just the bytes of a sector that differ from new data, without erasing it, if the family can: flash
+ * can only clear bits without an erase, so if any byte needs a bit set, changes nothing and returns false. Returns
+ * once programming is complete. Sets the data pins to input.
+ * 
+ * If compiled with DEBUG defined, fails if the sector index is out of range.
+ * 
+ * @param sectorIndex the index of the sector (zero-indexed)
+ * @param sectorData the data the sector should hold: SST_SECTOR_SIZE bytes
+ * @return true if the sector now holds the data, false if it needs preparing and programming in full instead
+ */
+bool chipPatchSector(uint16_t sectorIndex, const byte *sectorData);
+
+/**
+ * @brief Erases the whole erase block holding a sector (see CHIP_ERASE_BLOCK_SECTORS), whatever its other sectors
+ * hold: the caller must make sure that loses nothing it means to keep. Unlike chipPrepareSector, which only erases
+ * what it can without losing data, this is for when the whole block is to be erased anyway. Resets chipTimings, and
+ * records how long the erase took in it. Families with nothing to erase (EEPROMs) change nothing. Sets the data pins
+ * to input.
+ * 
+ * If compiled with DEBUG defined, fails if the sector index is out of range.
+ * 
+ * @param sectorIndex the index of a sector in the block (zero-indexed)
+ */
+void chipEraseBlock(uint16_t sectorIndex);
+
+/** @brief Erases the whole chip (every byte reads back as 0xFF). Sets the data pins to input. */
+void chipEraseChip();
+
+#endif  // SST39SF_PROGRAMMER_CHIP_DRIVER_H
@@ -0,0 +1,211 @@
+/*
+ * Chip driver for the SST39SF010/020/040. See chip_driver.h for more information.
+ * 
+ * Sectors are the SST39SF's own 4KB erase sectors, so each sector is erased on its own before it is programmed.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sst_constants.h"
+
+#if CHIP_FAMILY == CHIP_FAMILY_SST39SF
+
+#include "chip_driver.h"
+#include "communication_util.h"
+#include "globals.h"
+#include "read_write.h"
+
+#include <Arduino.h>
+
+//=============================================================================
+//             CONSTANTS
+//=============================================================================
+
+const char CHIP_NAME[] = "SST39SF";
+const uint8_t CHIP_MANUFACTURER_ID = 0xBF;
+const uint8_t CHIP_ERASE_BLOCK_SECTORS = 1;
+
+/* Byte programming takes at most 20us. That is less than a single bus read, so a fixed delay is quicker than polling
+for completion. Erases are long enough that polling pays off. Every PROGRAM_SAMPLE_INTERVAL'th byte is polled
+anyway, to measure how programming time changes as the sector wears. */
+const uint8_t BYTE_PROGRAM_US = 25;
+const uint16_t PROGRAM_SAMPLE_INTERVAL = 64;
+const uint32_t BYTE_PROGRAM_TIMEOUT_MS = 2;
+const uint32_t SECTOR_ERASE_TIMEOUT_MS = 30;  // 25ms maximum
+const uint32_t CHIP_ERASE_TIMEOUT_MS = 105;   // 100ms maximum
+
+/* The sector that chipBeginPrepareSector was last called for, until chipPrepareSector is called for it, or -1. */
+static int32_t beganSector = -1;
+static bool erasePending = false;  // whether its erase has not yet been seen to finish
+static uint32_t eraseStart;        // micros() when its erase was started
+
+//=============================================================================
+//             CHIP DRIVER
+//=============================================================================
+
+// See header comment.
+uint16_t chipReadId() {
+    setDataPinsOut();
+    sendCommand(0x90);  // software ID entry
+    setDataPinsIn();
+    uint16_t id = (((uint16_t)readByte(0x0)) << 8) | readByte(0x1);
+    setDataPinsOut();
+    sendCommand(0xF0);  // software ID exit
+    setDataPinsIn();
+    return id;
+}
+
+/**
+ * @brief Waits for the erase started by chipBeginPrepareSector to finish, if it hasn't already, and records how long
+ * it took. Sets the data pins to input.
+ */
+static void finishErase() {
+    if (!erasePending) return;
+    if (!waitForToggleBit(((uint32_t)beganSector) * SST_SECTOR_SIZE, SECTOR_ERASE_TIMEOUT_MS)) {
+        fail("Erasing sector " + String(beganSector) + " did not complete in time.");
+    }
+    chipTimings.eraseUs = micros() - eraseStart;
+    erasePending = false;
+}
+
+// See header comment.
+void chipBeginPrepareSector(uint16_t sectorIndex) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipBeginPrepareSector: index is out of bounds (too large).");
+    }
+#endif
+
+    finishErase();  // the chip ignores commands while it is erasing
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+
+    chipTimings = ChipTimings();
+    setDataPinsOut();
+    sendCommand(0x80);
+    sendUnlockSequence();
+    sendByte(startAddress, 0x30);  // the chip uses the high address bits to select the sector
+    eraseStart = micros();
+    beganSector = sectorIndex;
+    erasePending = true;
+    setDataPinsIn();
+}
+
+// See header comment.
+bool chipPollPrepareSector() {
+    if (!erasePending) return true;
+    if (toggleBitToggling(((uint32_t)beganSector) * SST_SECTOR_SIZE)) return false;
+    chipTimings.eraseUs = micros() - eraseStart;
+    erasePending = false;
+    return true;
+}
+
+// See header comment.
+bool chipPrepareSector(uint16_t sectorIndex) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipPrepareSector: index is out of bounds (too large).");
+    }
+#endif
+
+    if (beganSector != (int32_t)sectorIndex) chipBeginPrepareSector(sectorIndex);
+    finishErase();
+    beganSector = -1;
+    return true;
+}
+
+// See header comment.
+void chipProgramSector(uint16_t sectorIndex, const byte *sectorData) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipProgramSector: index is out of bounds (too large).");
+    }
+#endif
+
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+
+    setDataPinsOut();
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        sendCommand(0xA0);
+        sendByte(startAddress + index, sectorData[index]);
+        if (index % PROGRAM_SAMPLE_INTERVAL == 0) {
+            if (!waitForToggleBit(startAddress + index, BYTE_PROGRAM_TIMEOUT_MS, &chipTimings.programPolls)) {
+                fail("Programming byte at 0x" + String(startAddress + index, HEX) + " did not complete in time.");
+            }
+            chipTimings.programSamples++;
+            setDataPinsOut();
+        } else {
+            delayMicroseconds(BYTE_PROGRAM_US);  // wait for chip to write
+        }
+    }
+    setDataPinsIn();
+}
+
+/**
+ * @brief Checks whether a sector can be changed to new data by programming alone: that is, whether no byte needs a
+ * bit set that is currently clear. Sets the data pins to input.
+ * 
+ * @param startAddress the starting address of the sector
+ * @param sectorData the new data: SST_SECTOR_SIZE bytes
+ * @return whether programming alone is enough
+ */
+static bool programmable(uint32_t startAddress, const byte *sectorData) {
+    setDataPinsIn();
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if ((sectorData[index] & ~readByte(startAddress + index)) != 0) return false;
+    }
+    return true;
+}
+
+// See header comment.
+bool chipPatchSector(uint16_t sectorIndex, const byte *sectorData) {
+#ifdef DEBUG
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        fail("DEBUG assertion failed during chipPatchSector: index is out of bounds (too large).");
+    }
+#endif
+
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    if (!programmable(startAddress, sectorData)) return false;
+
+    chipTimings = ChipTimings();
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if (readByte(startAddress + index) == sectorData[index]) continue;
+        setDataPinsOut();
+        sendCommand(0xA0);
+        sendByte(startAddress + index, sectorData[index]);
+        if (!waitForToggleBit(startAddress + index, BYTE_PROGRAM_TIMEOUT_MS, &chipTimings.programPolls)) {
+            fail("Programming byte at 0x" + String(startAddress + index, HEX) + " did not complete in time.");
+        }
+        chipTimings.programSamples++;
+    }
+    return true;
+}
+
+// See header comment.
+void chipEraseBlock(uint16_t sectorIndex) {
+    chipPrepareSector(sectorIndex);  // erase blocks are sectors
+}
+
+// See header comment.
+void chipEraseChip() {
+    setDataPinsOut();
+    sendCommand(0x80);
+    sendCommand(0x10);
+    if (!waitForToggleBit(0x0, CHIP_ERASE_TIMEOUT_MS)) {
+        fail("Erasing chip did not complete in time.");
+    }
+}
+
+#endif  // CHIP_FAMILY == CHIP_FAMILY_SST39SF
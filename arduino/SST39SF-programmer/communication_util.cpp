@@ -17,9 +17,12 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include "communication_util.h"
+#include "tx_queue.h"
 #include "pinout.h"
 #include "sst_constants.h"
 #include "globals.h"
+#include "read_write.h"
+#include "scheduler.h"
 
 //=============================================================================
 //             UTILITIES
@@ -122,15 +125,59 @@ void setLEDStatus(LEDStatus status) {
 //             DRIVER COMMUNICATION FUNCTIONS
 //=============================================================================
 
+/* The baud rate the link is running at (see processSerialBaudChange). */
+static uint32_t currentBaudRate = SERIAL_BAUD_RATE;
+
+// See header comment.
+bool timedSerialRead(byte *b, uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (Serial.available() == 0) {
+        if (millis() - start >= timeoutMs) return false;
+        schedulerYield();
+    }
+    *b = (byte)Serial.read();
+    return true;
+}
+
+// See header comment.
+bool timedSerialReadUint16(uint16_t *value, uint32_t timeoutMs) {
+    byte low, high;
+    if (!timedSerialRead(&low, timeoutMs) || !timedSerialRead(&high, timeoutMs)) return false;
+    *value = (((uint16_t)high) << 8) | ((uint16_t)low);
+    return true;
+}
+
+// See header comment.
+bool timedSerialReadUint32(uint32_t *value, uint32_t timeoutMs) {
+    uint16_t low, high;
+    if (!timedSerialReadUint16(&low, timeoutMs) || !timedSerialReadUint16(&high, timeoutMs)) return false;
+    *value = (((uint32_t)high) << 16) | ((uint32_t)low);
+    return true;
+}
+
+// See header comment.
+void serialWriteUint16(uint16_t value) {
+    txQueueWrite((byte)value);
+    txQueueWrite((byte)(value >> 8));
+}
+
 // See header comment.
-byte blockingSerialRead() {
-    while (Serial.available() == 0);
-    return (byte)Serial.read();
+void serialWriteUint32(uint32_t value) {
+    serialWriteUint16((uint16_t)value);
+    serialWriteUint16((uint16_t)(value >> 16));
+}
+
+// See header comment.
+void abandonTransaction(String transaction) {
+    setDataPinsIn();
+    while (Serial.available() > 0) Serial.read();
+    sendNAKMessage("Timed out waiting for driver during " + transaction + ": abandoned.");
+    arduinoState = WAITING_FOR_COMMAND;
 }
 
 // See header comment.
 void sendACK() {
-    Serial.write(ACK);
+    txQueueWrite(ACK);
 }
 
 // See header comment.
@@ -141,18 +188,18 @@ void sendNAKMessage(String errorMessage) {
         char errorMessagePrefix[] = "Error too long. Truncated:\n";
         unsigned int errorMessagePrefixLength = (unsigned int)sizeof(errorMessagePrefix);  // includes null terminator
 
-        Serial.write(NAK);
+        txQueueWrite(NAK);
 
         // then the prefix informing the user that error output has been truncated
-        Serial.write(errorMessagePrefix, errorMessagePrefixLength-1);  // don't send null terminator of prefix
+        txQueueWrite((const byte *)errorMessagePrefix, errorMessagePrefixLength-1);  // don't send null terminator of prefix
         // then as much as the error message as we can
-        Serial.write((byte*)errorMessage.c_str(), MAX_NAK_MESSAGE_LENGTH 
+        txQueueWrite((byte*)errorMessage.c_str(), MAX_NAK_MESSAGE_LENGTH 
                                                   - (errorMessagePrefixLength-1) // subtract what we already sent
                                                   - 1);                          // reserve one more character so we can ensure null-termination
-        Serial.write((byte)0);  // null-terminate
+        txQueueWrite((byte)0);  // null-terminate
     } else {
-        Serial.write(NAK);
-        Serial.write((byte*)errorMessage.c_str(), errorMessageLength);
+        txQueueWrite(NAK);
+        txQueueWrite((byte*)errorMessage.c_str(), errorMessageLength);
     }
 }
 
@@ -180,18 +227,140 @@ void connectToDriver() {
             }
         }
         
-        Serial.write("WAITING");
-        Serial.write((byte)'\0');
+        txQueueWrite(WAIT_MESSAGE);
+        txQueueWrite((byte)'\0');
+        serialWriteUint16(SST_NUMBER_SECTORS);
+        txQueueFlush();  // the scheduler isn't running yet to send it
 
         delay(1000);
     }
 }
 
+/**
+ * @brief Checks whether a baud rate is one that BAUD can switch to.
+ * 
+ * @param baudRate the baud rate
+ * @return whether it is one of SERIAL_BAUD_RATES
+ */
+static bool baudRateSupported(uint32_t baudRate) {
+    for (uint8_t i = 0; i < SERIAL_BAUD_RATE_COUNT; i++) {
+        if (SERIAL_BAUD_RATES[i] == baudRate) return true;
+    }
+    return false;
+}
+
+// See header comment.
+void processSerialBaudChange() {
+    arduinoState = WAITING_FOR_COMMAND;
+    uint32_t baudRate;
+    if (!timedSerialReadUint32(&baudRate, BAUD_CHANGE_TIMEOUT_MS)) {
+        abandonTransaction("baud rate change (receiving baud rate)");
+        return;
+    }
+    if (!baudRateSupported(baudRate)) {
+        sendNAKMessage("Baud rate " + String(baudRate) + " is not supported.");
+        return;
+    }
+
+    sendACK();
+    txQueueFlush();  // the ACK must go out at the old rate
+    Serial.begin(baudRate);
+
+    byte pattern[BAUD_TEST_PATTERN_LENGTH];
+    bool echoed = true;
+    for (uint8_t i = 0; i < BAUD_TEST_PATTERN_LENGTH && echoed; i++) {
+        echoed = timedSerialRead(&pattern[i], BAUD_CHANGE_TIMEOUT_MS);
+    }
+    byte b;
+    if (echoed) {
+        txQueueWrite(pattern, BAUD_TEST_PATTERN_LENGTH);
+        if (timedSerialRead(&b, BAUD_CHANGE_TIMEOUT_MS) && b == ACK) {
+            currentBaudRate = baudRate;
+            sendACK();
+            return;
+        }
+    }
+
+    // the link doesn't work at the new rate: go back to the old one, which the driver will also go back to
+    txQueueFlush();
+    Serial.begin(currentBaudRate);
+    while (Serial.available() > 0) Serial.read();
+}
+
+/**
+ * @brief Gets a byte of the link test pattern, which LINK_TEST_SINK and LINK_TEST_SOURCE payloads are filled with:
+ * counting bytes, running on from one payload to the next, so that a lost or extra byte shows up in all that follow.
+ * 
+ * @param position the byte's position in the whole stream of payloads
+ * @return the byte
+ */
+static byte linkTestPatternByte(uint32_t position) {
+    return (byte)position;
+}
+
+// See header comment.
+void processSerialLinkTest() {
+    arduinoState = WAITING_FOR_COMMAND;
+    byte mode;
+    uint16_t payloadLength;
+    uint16_t payloadCount;
+    if (!timedSerialRead(&mode, LINK_TEST_TIMEOUT_MS) || !timedSerialReadUint16(&payloadLength, LINK_TEST_TIMEOUT_MS)
+            || !timedSerialReadUint16(&payloadCount, LINK_TEST_TIMEOUT_MS)) {
+        abandonTransaction("link test (receiving parameters)");
+        return;
+    }
+    if (mode > LINK_TEST_SOURCE) {
+        sendNAKMessage("While testing the link, got mode " + String(mode) + ", which is not a link test mode.");
+        return;
+    }
+    if (payloadLength == 0 || payloadLength > LINK_TEST_MAX_PAYLOAD_LENGTH || payloadCount == 0) {
+        sendNAKMessage("While testing the link, got " + String(payloadCount) + " payloads of " + String(payloadLength) + " bytes: payloads must be from 1 to " + String(LINK_TEST_MAX_PAYLOAD_LENGTH) + " bytes, and there must be at least one.");
+        return;
+    }
+    sendACK();
+
+    uint32_t totalLength = ((uint32_t)payloadLength) * payloadCount;  // cast needed to avoid truncation
+    byte b;
+    if (mode == LINK_TEST_ECHO) {
+        for (uint32_t position = 0; position < totalLength; position++) {
+            if (!timedSerialRead(&b, LINK_TEST_TIMEOUT_MS)) {
+                abandonTransaction("link test (echoing payloads)");
+                return;
+            }
+            txQueueWrite(b);
+            txQueuePump();  // echo each byte straight away, rather than when the queue next gets pumped
+        }
+        sendACK();
+    } else if (mode == LINK_TEST_SINK) {
+        uint32_t firstArrival = 0;
+        uint32_t mismatches = 0;
+        for (uint32_t position = 0; position < totalLength; position++) {
+            if (!timedSerialRead(&b, LINK_TEST_TIMEOUT_MS)) {
+                abandonTransaction("link test (receiving payloads)");
+                return;
+            }
+            if (position == 0) firstArrival = micros();
+            if (b != linkTestPatternByte(position)) mismatches++;
+        }
+        uint32_t elapsedUs = micros() - firstArrival;
+        sendACK();
+        serialWriteUint32(elapsedUs);
+        serialWriteUint32(mismatches);
+    } else {
+        for (uint32_t position = 0; position < totalLength; position++) {
+            txQueueWrite(linkTestPatternByte(position));
+            if (position % 16 == 15) txQueuePump();  // keep HardwareSerial's buffer topped up, as txQueueWrite does
+        }
+        sendACK();
+    }
+}
+
 // See header comment.
 void fail(String errorMessage) {
     setLEDStatus(ERROR);
     while (true) {
         sendNAKMessage(errorMessage);
+        txQueueFlush();  // nothing else runs from here on to send it
         delay(5000);
     }
 }
\ No newline at end of file
@@ -20,24 +20,27 @@
 #define SST39SF_PROGRAMMER_COMMUNICATION_UTIL_H
 
 #include <Arduino.h>
+#include "protocol.h"
 
 //=============================================================================
 //             CONSTANTS
 //=============================================================================
 
-#define SERIAL_BAUD_RATE 115200
-
-#define ACK ((byte)0x06)
-#define NAK ((byte)0x15)
-
-#define MAX_NAK_MESSAGE_LENGTH 256
-#define MAX_COMMAND_LENGTH ((uint16_t)32)  // includes null terminator
-
-const uint8_t SECTOR_INDEX_LENGTH_BYTES = 2;
-
-const char PROGRAM_SECTOR_MESSAGE[] = "PROGRAMSECTOR";
-const char ERASE_CHIP_MESSAGE[] = "ERASECHIP";
-const char DONE_MESSAGE[] = "DONE";
+/* Inactivity timeouts for each kind of transaction, in milliseconds. If the driver goes quiet for longer than this
+in the middle of a transaction (e.g. because it crashed), the transaction is abandoned and the Arduino returns to
+WAITING_FOR_COMMAND rather than waiting forever. */
+const uint32_t COMMAND_TIMEOUT_MS = 1000;              // between bytes of a command
+const uint32_t PROGRAM_SECTOR_TIMEOUT_MS = 5000;       // between bytes of a sector programming transaction
+const uint32_t DELTA_SECTOR_TIMEOUT_MS = 1000;         // between bytes of a delta sector programming transaction
+const uint32_t ERASE_CHIP_CONFIRM_TIMEOUT_MS = 300000; // the driver is waiting on the user to confirm here
+const uint32_t ERASE_RANGE_TIMEOUT_MS = 1000;          // between bytes of an erase range request
+const uint32_t SECTOR_CRC_TIMEOUT_MS = 1000;           // between bytes of a sector CRC request
+const uint32_t CRC_TREE_TIMEOUT_MS = 1000;             // between bytes of a checksum tree request
+const uint32_t READ_SECTOR_TIMEOUT_MS = 1000;          // between bytes of a sector read request
+const uint32_t END_CHIP_TIMEOUT_MS = 1000;             // between bytes of an end chip request
+const uint32_t VERIFY_POLICY_TIMEOUT_MS = 1000;        // between bytes of a verification policy request
+const uint32_t BENCH_TIMEOUT_MS = 1000;                // between bytes of a benchmark request
+const uint32_t LINK_TEST_TIMEOUT_MS = 1000;            // between bytes of a link test
 
 //=============================================================================
 //             UTILITIES
@@ -81,11 +84,62 @@ void setLEDStatus(LEDStatus status);
 
 /**
  * @brief Reads a byte of input from serial (with Serial.read()). Unlike Serial.read(), this function
- * is blocking and waits until a byte of input is available.
+ * waits until a byte of input is available, for at most timeoutMs milliseconds.
+ * 
+ * @param b pointer to where the byte that was read will be stored
+ * @param timeoutMs the maximum amount of time to wait for a byte, in milliseconds
+ * @return true if a byte was read, false if we timed out waiting for one
+ */
+bool timedSerialRead(byte *b, uint32_t timeoutMs);
+
+/**
+ * @brief Abandons a transaction after the driver has gone quiet in the middle of it. Releases the data bus, discards
+ * any partial input, sends a NAK message recording the timeout (which the driver logs if it is still listening) and
+ * transitions state to WAITING_FOR_COMMAND.
+ * 
+ * Most transactions only touch flash once all of their input has been received, and leave it as it was before the
+ * abandoned transaction started. PROGRAMSECTOR is the exception: it starts preparing the sector while its data is
+ * received, so an abandoned one leaves the sector prepared (see chipPrepareSector): erased on flash, or on families
+ * with erase blocks larger than a sector, erased only if the rest of its block is blank, and otherwise left as it was.
+ * Nothing outside the sector is lost.
  * 
- * @return the byte that was read
+ * @param transaction description of the transaction that was abandoned, for the NAK message
  */
-byte blockingSerialRead();
+void abandonTransaction(String transaction);
+
+/**
+ * @brief Reads a 16-bit value from serial, transmitted little-endian, waiting at most timeoutMs milliseconds for
+ * each byte.
+ * 
+ * @param value pointer to where the value will be stored
+ * @param timeoutMs the maximum amount of time to wait for each byte, in milliseconds
+ * @return true if the value was read, false if we timed out waiting for it
+ */
+bool timedSerialReadUint16(uint16_t *value, uint32_t timeoutMs);
+
+/**
+ * @brief Reads a 32-bit value from serial, transmitted little-endian, waiting at most timeoutMs milliseconds for
+ * each byte.
+ * 
+ * @param value pointer to where the value will be stored
+ * @param timeoutMs the maximum amount of time to wait for each byte, in milliseconds
+ * @return true if the value was read, false if we timed out waiting for it
+ */
+bool timedSerialReadUint32(uint32_t *value, uint32_t timeoutMs);
+
+/**
+ * @brief Writes a 16-bit value to serial, little-endian.
+ * 
+ * @param value the value to write
+ */
+void serialWriteUint16(uint16_t value);
+
+/**
+ * @brief Writes a 32-bit value to serial, little-endian.
+ * 
+ * @param value the value to write
+ */
+void serialWriteUint32(uint32_t value);
 
 /** @brief Sends an ACK byte to the driver. This is the ASCII byte 0x06. */
 void sendACK();
@@ -99,9 +153,45 @@ void sendACK();
 void sendNAKMessage(String errorMessage);
 
 /** @brief Connects to the driver. This involves opening the serial port, repeatedly sending 
- * the 'WATITING\0' message, and waiting for the driver to acknowledge. */
+ * the 'WATITING\0' message, and waiting for the driver to acknowledge. Each 'WAITING\0' is followed by the number of
+ * sectors on the chip (SST_NUMBER_SECTORS, 2 bytes, little-endian), which the driver checks its jobs against: it
+ * can't tell which CHIP_FAMILY the sketch was built for otherwise. */
 void connectToDriver();
 
+/**
+ * @brief Processes serial input after the driver has sent BAUD, switching the link to a new baud rate if it works at
+ * that rate. The driver sends the new rate (4 bytes, little-endian). If it is not one of SERIAL_BAUD_RATES, sends a
+ * NAK message. Otherwise:
+ * 
+ * 1. The Arduino sends an ACK at the old rate, and both sides switch to the new rate.
+ * 2. The driver sends BAUD_TEST_PATTERN_LENGTH bytes of test pattern, which the Arduino echoes.
+ * 3. If the echo was intact, the driver sends an ACK and the Arduino replies with an ACK: the link stays at the new
+ *    rate. Anything else from the driver (such as a NAK), or silence for BAUD_CHANGE_TIMEOUT_MS at any point, and
+ *    the Arduino goes back to the old rate without replying.
+ * 
+ * Transitions state to WAITING_FOR_COMMAND.
+ */
+void processSerialBaudChange();
+
+/**
+ * @brief Processes serial input after the driver has sent LINKTEST, which measures the serial link alone. The driver
+ * sends the mode (1 byte: one of the LINK_TEST_ modes in protocol.h), the payload length (2 bytes, from 1 to
+ * LINK_TEST_MAX_PAYLOAD_LENGTH) and the number of payloads (2 bytes, at least 1). If any is out of range, sends a NAK
+ * message. Otherwise, sends an ACK, then:
+ * 
+ *     LINK_TEST_ECHO    the driver sends the payloads, one at a time, and the Arduino echoes each byte as it arrives.
+ *                       Once all are echoed, it sends an ACK.
+ *     LINK_TEST_SINK    the driver sends all of the payloads, which must be the link test pattern (see
+ *                       linkTestPatternByte). Once all have arrived, the Arduino sends an ACK, the time from the
+ *                       first byte's arrival to the last's in microseconds (4 bytes), and the number of bytes which
+ *                       were not the pattern (4 bytes).
+ *     LINK_TEST_SOURCE  the Arduino sends all of the payloads, filled with the link test pattern, then an ACK.
+ * 
+ * The payloads are not buffered, so any length can be echoed. If the driver goes quiet for LINK_TEST_TIMEOUT_MS (for
+ * instance, because bytes were lost), the test is abandoned. Transitions state to WAITING_FOR_COMMAND.
+ */
+void processSerialLinkTest();
+
 /**
  * @brief Goes into an infinite loop, sending a NAK message (see communication_util.h, sendNAKMessage) 
  * to serial at regular intervals.
@@ -34,8 +34,28 @@ enum ArduinoState {
     PROGRAM_SECTOR_INDEX_CONFIRMED,
     PROGRAM_SECTOR_GOT_DATA,
 
+    BEGIN_DELTA_SECTOR,
+
     BEGIN_ERASE_CHIP,
 
+    BEGIN_ERASE_RANGE,
+
+    BEGIN_SECTOR_CRC,
+
+    BEGIN_CRC_TREE,
+
+    BEGIN_READ_SECTOR,
+
+    BEGIN_END_CHIP,
+
+    BEGIN_BAUD_CHANGE,
+
+    BEGIN_VERIFY_POLICY,
+
+    BEGIN_BENCH,
+
+    BEGIN_LINK_TEST,
+
     DONE
 };
 
@@ -0,0 +1,154 @@
+/*
+ * Implementation of wear telemetry. See health.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "health.h"
+#include "sst_constants.h"
+#include "communication_util.h"
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+//=============================================================================
+//             EEPROM LAYOUT
+//=============================================================================
+
+/* The EEPROM starts with a header identifying what the telemetry is for, followed by a SectorHealth for each
+sector. If the header doesn't match (first run, or the firmware was built for a different chip), the telemetry
+is reset: timings from a different chip would be meaningless. */
+struct HealthHeader {
+    uint32_t magic;
+    uint8_t chipFamily;
+    uint16_t numberSectors;
+};
+
+const uint32_t HEALTH_MAGIC = 0x48545353;  // 'SSTH', little-endian
+const int HEALTH_HEADER_ADDRESS = 0;
+const int HEALTH_RECORDS_ADDRESS = sizeof(HealthHeader);
+
+static_assert(sizeof(HealthHeader) + SST_NUMBER_SECTORS * sizeof(SectorHealth) <= 4096,
+              "Health telemetry does not fit in the Arduino Mega's EEPROM.");
+
+//=============================================================================
+//             IMPLEMENTATION UTILITIES
+//=============================================================================
+
+/**
+ * @brief Gets the EEPROM address of a sector's record.
+ * 
+ * @param sectorIndex the index of the sector
+ * @return the address of its record
+ */
+static int recordAddress(uint16_t sectorIndex) {
+    return HEALTH_RECORDS_ADDRESS + sectorIndex * sizeof(SectorHealth);
+}
+
+/**
+ * @brief Converts a duration to units of HEALTH_TIME_UNIT_US, saturating. Never returns 0 for a non-zero duration,
+ * as 0 means 'not measured'.
+ * 
+ * @param us the duration, in microseconds
+ * @return the duration, in units of HEALTH_TIME_UNIT_US
+ */
+static uint16_t toTimeUnits(uint32_t us) {
+    uint32_t units = (us + HEALTH_TIME_UNIT_US - 1) / HEALTH_TIME_UNIT_US;
+    return units > 0xFFFF ? 0xFFFF : (uint16_t)units;
+}
+
+/**
+ * @brief Adds a value to an exponentially weighted moving average, with a weight of 1/8.
+ * 
+ * @param average the average so far, or 0 if there is none
+ * @param value the value to add
+ * @return the new average
+ */
+static uint16_t updateAverage(uint16_t average, uint16_t value) {
+    if (average == 0) return value;
+    int32_t updated = (int32_t)average + ((int32_t)value - (int32_t)average) / 8;
+    return (uint16_t)updated;
+}
+
+//=============================================================================
+//             RECORDING
+//=============================================================================
+
+// See header comment.
+void setupHealth() {
+    HealthHeader header;
+    EEPROM.get(HEALTH_HEADER_ADDRESS, header);
+    if (header.magic == HEALTH_MAGIC && header.chipFamily == CHIP_FAMILY && header.numberSectors == SST_NUMBER_SECTORS) {
+        return;
+    }
+
+    SectorHealth empty = SectorHealth();
+    for (uint16_t i = 0; i < SST_NUMBER_SECTORS; i++) {
+        EEPROM.put(recordAddress(i), empty);
+    }
+    header.magic = HEALTH_MAGIC;
+    header.chipFamily = CHIP_FAMILY;
+    header.numberSectors = SST_NUMBER_SECTORS;
+    EEPROM.put(HEALTH_HEADER_ADDRESS, header);  // last, so that an interrupted reset is redone
+}
+
+// See header comment.
+void healthRecordSector(uint16_t sectorIndex, const ChipTimings &timings) {
+    SectorHealth record;
+    EEPROM.get(recordAddress(sectorIndex), record);
+
+    if (record.cycles < 0xFFFFFFFF) record.cycles++;
+    if (timings.eraseUs > 0) {
+        uint16_t eraseTime = toTimeUnits(timings.eraseUs);
+        if (record.firstEraseTime == 0) record.firstEraseTime = eraseTime;
+        record.averageEraseTime = updateAverage(record.averageEraseTime, eraseTime);
+        record.lastEraseTime = eraseTime;
+    }
+    if (timings.programSamples > 0) {
+        uint16_t polls = (uint16_t)(((uint32_t)timings.programPolls * 16) / timings.programSamples);
+        record.averagePolls = updateAverage(record.averagePolls, polls);
+    }
+
+    EEPROM.put(recordAddress(sectorIndex), record);  // put only writes bytes that changed
+}
+
+// See header comment.
+void healthRecordChipErase() {
+    for (uint16_t i = 0; i < SST_NUMBER_SECTORS; i++) {
+        uint32_t cycles;
+        EEPROM.get(recordAddress(i), cycles);  // cycles is the first field of the record
+        if (cycles < 0xFFFFFFFF) cycles++;
+        EEPROM.put(recordAddress(i), cycles);
+    }
+}
+
+//=============================================================================
+//             HEALTH COMMAND
+//=============================================================================
+
+// See header comment.
+void sendHealth() {
+    sendACK();
+    serialWriteUint16(SST_NUMBER_SECTORS);
+    for (uint16_t i = 0; i < SST_NUMBER_SECTORS; i++) {
+        SectorHealth record;
+        EEPROM.get(recordAddress(i), record);
+        serialWriteUint32(record.cycles);
+        serialWriteUint16(record.firstEraseTime);
+        serialWriteUint16(record.averageEraseTime);
+        serialWriteUint16(record.lastEraseTime);
+        serialWriteUint16(record.averagePolls);
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * Wear telemetry: per-sector erase/program timings, kept in the Arduino's internal EEPROM so that they survive
+ * resets, and readable by the driver with the HEALTH command. Flash cells take longer to erase and program as they
+ * wear, so a sector whose timings have grown well beyond its first recorded ones is likely to start failing soon.
+ * 
+ * The records describe the socket, not a chip: nothing tells one chip from another of the same kind, so they carry on
+ * across chip swaps (including production mode's, see production.h), and are only meaningful while the same chip
+ * stays in the socket.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_HEALTH_H
+#define SST39SF_PROGRAMMER_HEALTH_H
+
+#include <Arduino.h>
+#include "chip_driver.h"
+
+//=============================================================================
+//             RECORDS
+//=============================================================================
+
+/**
+ * @brief The telemetry kept for one sector. Times are in units of HEALTH_TIME_UNIT_US (saturating), and averages are
+ * exponentially weighted (each new value has a weight of 1/8).
+ * 
+ * This is also the layout of each record in the reply to HEALTH: 12 bytes, all fields little-endian.
+ */
+struct SectorHealth {
+    uint32_t cycles;            // number of times the sector has been programmed (or erased by a chip erase)
+    uint16_t firstEraseTime;    // duration of the first erase that was measured, 0 if none has been
+    uint16_t averageEraseTime;  // moving average of erase durations
+    uint16_t lastEraseTime;     // duration of the most recent erase
+    uint16_t averagePolls;      // moving average of toggle-bit reads per polled write, x16 (i.e. 16 = 1 read)
+};
+
+/** @brief Unit of the times in SectorHealth, in microseconds. */
+const uint16_t HEALTH_TIME_UNIT_US = 100;
+
+//=============================================================================
+//             RECORDING
+//=============================================================================
+
+/**
+ * @brief Checks that the telemetry in EEPROM is for this firmware's chip family and size, and resets it if not (or
+ * if there is none). Call once at startup.
+ */
+void setupHealth();
+
+/**
+ * @brief Records that a sector has been programmed, with the timings the chip driver measured.
+ * 
+ * Only bytes that change are written to EEPROM. EEPROM cells last about as many writes as flash sectors do erases,
+ * but the records are the socket's, so they are rewritten for every chip programmed in it: over many chips (as in
+ * production mode), the Arduino's EEPROM wears out long before any of them.
+ * 
+ * @param sectorIndex the index of the sector
+ * @param timings the timings measured while preparing and programming it
+ */
+void healthRecordSector(uint16_t sectorIndex, const ChipTimings &timings);
+
+/** @brief Records that the whole chip has been erased (one cycle for every sector, with no timings). */
+void healthRecordChipErase();
+
+//=============================================================================
+//             HEALTH COMMAND
+//=============================================================================
+
+/**
+ * @brief Sends the telemetry to the driver: an ACK, the number of sectors (2 bytes, little-endian), then a
+ * SectorHealth record for each sector in order.
+ */
+void sendHealth();
+
+#endif  // SST39SF_PROGRAMMER_HEALTH_H
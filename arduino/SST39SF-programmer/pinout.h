@@ -19,15 +19,60 @@
 #ifndef SST39SF_PROGRAMMER_PINOUT_H
 #define SST39SF_PROGRAMMER_PINOUT_H
 
+//=============================================================================
+//  Bus backend: set BUS_BACKEND to how the SST39SF is wired
+//=============================================================================
+//
+//      BUS_BACKEND           Wiring                                      Implementation
+//
+//   BUS_BACKEND_PINS    Every chip pin on its own Arduino pin, and     read_write.cpp
+//                       bus cycles bit-banged with digitalWrite
+//   BUS_BACKEND_XMEM    The ATmega2560's external memory interface,    read_write_xmem.cpp
+//                       with an address latch: bus cycles are single
+//                       ld/st instructions, with hardware strobes
+//
+//=============================================================================
+
+#define BUS_BACKEND_PINS 1
+#define BUS_BACKEND_XMEM 2
+
+#ifndef BUS_BACKEND
+#define BUS_BACKEND BUS_BACKEND_PINS
+#endif
+
 //=============================================================================
 //  Pins that talk to the SST39SF
 //=============================================================================
 
+#if BUS_BACKEND == BUS_BACKEND_PINS
+
 #define WRITE_ENABLE 2           // Write enable pin, active low
 #define OUTPUT_ENABLE 3          // Output enable pin, active low
 #define ADDR0 22                 // Starting pin of the address bus: pins count up from here
 #define DQ0 44                   // Starting pin of the data bus: pins count up from here
 
+#elif BUS_BACKEND == BUS_BACKEND_XMEM
+
+/* The external memory interface drives these pins itself, so they are fixed:
+
+    Mega pins    AVR port         SST39SF
+    22-29        PA0-7 (AD0-7)    DQ0-7, and the D inputs of a 74AHC573 latch whose outputs drive A0-7
+    37-31        PC0-6 (A8-14)    A8-14 (PC7, pin 30, is driven by the interface but not connected)
+    41           PG0 (WR)         WE#
+    40           PG1 (RD)         OE#
+    39           PG2 (ALE)        LE of the 74AHC573
+
+CE# is tied to ground, as for the pins backend. Addresses 0x8000-0xFFFF of the AVR's data space are a 32KB window
+onto the chip. Chip address bits above A14 select the window, and come from the low bits of XMEM_BANK_PORT. */
+#define XMEM_WINDOW_BASE 0x8000  // Start of the window in the AVR's data space: above the internal SRAM
+#define XMEM_WINDOW_BITS 15      // Chip address bits covered by the window (A0-14)
+#define XMEM_BANK_PORT PORTL     // A15 and up, from bit 0 up (Mega pins 49, 48, 47, 46 for A15-18)
+#define XMEM_BANK_DDR DDRL
+
+#else
+#error "Unknown BUS_BACKEND: see pinout.h"
+#endif
+
 //=============================================================================
 //  Pins for debugging/Arduino status
 //=============================================================================
@@ -0,0 +1,177 @@
+/*
+ * Implementation of production line mode. See production.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "production.h"
+#include "sst_constants.h"
+#include "communication_util.h"
+#include "tx_queue.h"
+#include "globals.h"
+#include "chip_driver.h"
+#include "checksum.h"
+
+//=============================================================================
+//             CONSTANTS AND STATE
+//=============================================================================
+
+const uint32_t PRODUCTION_POLL_INTERVAL_MS = 100;
+/* Number of polls in a row that must agree before a chip counts as inserted or removed. A half-inserted chip, or a
+floating bus, can read as anything for a poll or two. */
+const uint8_t PRODUCTION_STABLE_POLLS = 3;
+
+enum ProductionState {
+    PRODUCTION_OFF,
+    PRODUCTION_WAITING_FOR_CHIP,
+    PRODUCTION_PROGRAMMING,      // a chip has been detected, and the host is programming it
+    PRODUCTION_WAITING_FOR_REMOVAL
+};
+
+/** @brief What the Arduino has recorded about the chip being programmed. */
+struct ProductionChip {
+    uint16_t id;
+    uint16_t sectorsProgrammed;
+    uint16_t sectorsFailed;
+    uint32_t crc;                // CRC-32 register over the programmed data
+    uint32_t detectedMs;
+};
+
+static ProductionState productionState = PRODUCTION_OFF;
+static ProductionChip chip;
+static uint32_t lastPollMs;
+static uint16_t lastId;
+static uint8_t stablePolls;
+
+//=============================================================================
+//             COMMANDS
+//=============================================================================
+
+// See header comment.
+void startProduction() {
+    if (CHIP_MANUFACTURER_ID == 0) {
+        sendNAKMessage(String("Production mode needs a chip with a software ID, which the ") + CHIP_NAME +
+                       " does not have.");
+        return;
+    }
+    productionState = PRODUCTION_WAITING_FOR_CHIP;
+    stablePolls = 0;
+    setLEDStatus(WAITING_FOR_COMMUNICATION);
+    sendACK();
+}
+
+// See header comment.
+void processSerialEndChip() {
+    uint16_t expectedSectors;
+    uint32_t expectedCrc;
+    if (!timedSerialReadUint16(&expectedSectors, END_CHIP_TIMEOUT_MS)
+            || !timedSerialReadUint32(&expectedCrc, END_CHIP_TIMEOUT_MS)) {
+        abandonTransaction("ending chip (receiving expected result)");
+        return;
+    }
+
+    if (productionState != PRODUCTION_PROGRAMMING) {
+        sendNAKMessage("Got ENDCHIP, but no chip is being programmed in production mode.");
+    } else {
+        uint32_t crc = crc32Final(chip.crc);
+        bool passed = chip.sectorsFailed == 0 && chip.sectorsProgrammed == expectedSectors && crc == expectedCrc;
+
+        sendACK();
+        txQueueWrite(passed ? (byte)1 : (byte)0);
+        serialWriteUint16(chip.sectorsProgrammed);
+        serialWriteUint16(chip.sectorsFailed);
+        serialWriteUint32(crc);
+        serialWriteUint32(millis() - chip.detectedMs);
+
+        setLEDStatus(passed ? FINISHED : ERROR);
+        productionState = PRODUCTION_WAITING_FOR_REMOVAL;
+        stablePolls = 0;
+    }
+    arduinoState = WAITING_FOR_COMMAND;
+}
+
+//=============================================================================
+//             POLLING AND RECORDING
+//=============================================================================
+
+/**
+ * @brief Polls the chip's software ID, and returns whether it has read the same thing for PRODUCTION_STABLE_POLLS
+ * polls in a row.
+ * 
+ * @param present set to whether that thing is the ID of a chip of this family
+ * @return whether the reading is stable
+ */
+static bool pollChip(bool *present) {
+    uint16_t id = chipReadId();
+    if (id == lastId) {
+        if (stablePolls < PRODUCTION_STABLE_POLLS) stablePolls++;
+    } else {
+        lastId = id;
+        stablePolls = 1;
+    }
+    *present = (uint8_t)(id >> 8) == CHIP_MANUFACTURER_ID;
+    return stablePolls >= PRODUCTION_STABLE_POLLS;
+}
+
+// See header comment.
+void productionPoll() {
+    if (productionState != PRODUCTION_WAITING_FOR_CHIP && productionState != PRODUCTION_WAITING_FOR_REMOVAL) return;
+    if (millis() - lastPollMs < PRODUCTION_POLL_INTERVAL_MS) return;
+    lastPollMs = millis();
+
+    bool present;
+    if (!pollChip(&present)) return;
+
+    if (productionState == PRODUCTION_WAITING_FOR_CHIP && present) {
+        chip = ProductionChip();
+        chip.id = lastId;
+        chip.crc = CRC32_INITIAL;
+        chip.detectedMs = millis();
+        productionState = PRODUCTION_PROGRAMMING;
+        setLEDStatus(WORKING);
+        txQueueWrite(CHIP_INSERTED_MESSAGE);
+        txQueueWrite((byte)'\0');
+        serialWriteUint16(chip.id);
+    } else if (productionState == PRODUCTION_WAITING_FOR_REMOVAL && !present) {
+        productionState = PRODUCTION_WAITING_FOR_CHIP;
+        stablePolls = 0;
+        setLEDStatus(WAITING_FOR_COMMUNICATION);
+        txQueueWrite(CHIP_REMOVED_MESSAGE);
+        txQueueWrite((byte)'\0');
+    }
+}
+
+// See header comment.
+bool productionChipActive() {
+    return productionState == PRODUCTION_PROGRAMMING;
+}
+
+// See header comment.
+bool productionChipFailed() {
+    return productionState == PRODUCTION_PROGRAMMING && chip.sectorsFailed > 0;
+}
+
+// See header comment.
+void productionRecordSector(bool passed, const byte *sectorData) {
+    if (productionState != PRODUCTION_PROGRAMMING) return;
+    if (!passed) {
+        chip.sectorsFailed++;
+        return;
+    }
+    chip.sectorsProgrammed++;
+    for (uint16_t i = 0; i < SST_SECTOR_SIZE; i++) {
+        chip.crc = crc32Update(chip.crc, sectorData[i]);
+    }
+}
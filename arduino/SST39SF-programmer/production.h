@@ -0,0 +1,91 @@
+/*
+ * Production line mode: the Arduino watches the socket for chips being swapped, so that an operator can program
+ * chip after chip without relaunching the driver.
+ * 
+ * After the PRODUCTION command, whenever the Arduino is idle it polls the chip's software ID. When a chip appears
+ * (the same ID, with the family's manufacturer ID, on several polls in a row), it sends the host a CHIPINSERTED event
+ * and the host programs the chip with ordinary PROGRAMSECTOR commands, then sends ENDCHIP. The Arduino answers
+ * ENDCHIP with a result record, shows pass (green) or fail (red) on the status LEDs, and waits for the chip to be
+ * removed (sending a CHIPREMOVED event) before watching for the next one.
+ * 
+ * While a chip is being programmed in production mode, a sector that can't be prepared or fails verification does not
+ * stop the Arduino: the failure is recorded for the result record, the sector is acknowledged as usual, and the rest
+ * of the chip's sectors are acknowledged without being programmed. The host learns the outcome from ENDCHIP.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_PRODUCTION_H
+#define SST39SF_PROGRAMMER_PRODUCTION_H
+
+#include <Arduino.h>
+
+//=============================================================================
+//             COMMANDS
+//=============================================================================
+
+/**
+ * @brief Handles the PRODUCTION command: enters production line mode and sends an ACK, or sends a NAK message if the
+ * chip family has no software ID to detect chips by.
+ */
+void startProduction();
+
+/**
+ * @brief Processes serial input while the Arduino is ending a chip. The Arduino must be in the BEGIN_END_CHIP state
+ * when calling this function.
+ * 
+ * Receives the number of sectors the host programmed (2 bytes) and the CRC-32 of their data, in the order they were
+ * programmed (4 bytes), both little-endian. If a chip is being programmed, sends an ACK followed by the result record:
+ * 
+ *     pass (1 byte: 1 if every sector was programmed and verified, and the count and CRC match, else 0),
+ *     sectors programmed (2 bytes), sectors failed (2 bytes), CRC-32 of the programmed data (4 bytes),
+ *     time since the chip was detected in milliseconds (4 bytes)
+ * 
+ * and sets the status LEDs to show the result. Otherwise, sends a NAK message. Either way, transitions state to
+ * WAITING_FOR_COMMAND.
+ */
+void processSerialEndChip();
+
+//=============================================================================
+//             POLLING AND RECORDING
+//=============================================================================
+
+/**
+ * @brief Watches the socket for chips being inserted and removed, sending the host an event when one is. Does nothing
+ * if not in production mode. Call whenever the Arduino is waiting for a command and has no serial input.
+ */
+void productionPoll();
+
+/**
+ * @brief Returns whether a chip is being programmed in production mode, and has already failed (so its remaining
+ * sectors need not be programmed).
+ */
+bool productionChipFailed();
+
+/**
+ * @brief Returns whether a chip is being programmed in production mode, in which case programming failures are
+ * recorded (see productionRecordSector) instead of being reported to the host straight away.
+ */
+bool productionChipActive();
+
+/**
+ * @brief Records the outcome of programming a sector, if a chip is being programmed in production mode.
+ * 
+ * @param passed whether the sector was programmed and verified
+ * @param sectorData the data programmed into the sector (SST_SECTOR_SIZE bytes), which is added to the chip's CRC
+ */
+void productionRecordSector(bool passed, const byte *sectorData);
+
+#endif  // SST39SF_PROGRAMMER_PRODUCTION_H
@@ -18,13 +18,40 @@
  */
 #include "sst_constants.h"
 #include "communication_util.h"
+#include "tx_queue.h"
 #include "globals.h"
 #include "read_write.h"
+#include "chip_driver.h"
+#include "health.h"
+#include "production.h"
+#include "checksum.h"
+#include "scheduler.h"
+
+/* How many bytes of sector data are received between yields to the other tasks, which include checking whether the
+sector's erase has finished (see receiveSectorData). Receiving only yields by itself while it waits for data. */
+const uint16_t RECEIVE_YIELD_INTERVAL = 16;
+
+// The verification policy, as set by processSerialVerifyPolicy
+static uint8_t verifyPolicy = VERIFY_FULL;
+static uint16_t verifySampleCount = 0;  // bytes read back per sector, for VERIFY_SAMPLED
+
+/**
+ * @brief Computes the CRC-32 of a sector's worth of data.
+ * 
+ * @param sectorData the data: SST_SECTOR_SIZE bytes
+ * @return the CRC-32
+ */
+static uint32_t sectorDataCrc32(const byte *sectorData) {
+    uint32_t crc = CRC32_INITIAL;
+    for (uint16_t index = 0; index < SST_SECTOR_SIZE; index++) crc = crc32Update(crc, sectorData[index]);
+    return crc32Final(crc);
+}
 
 /**
  * @brief Gets the sector index from the driver, and validates that it is within range. If this occurs,
  * transitions state to PROGRAM_SECTOR_GOT_INDEX. Otherwise, if the index is out of range, sends the 
- * driver a NAK message and transitions state to WAITING_FOR_COMMAND.
+ * driver a NAK message and transitions state to WAITING_FOR_COMMAND. If the driver goes quiet for longer
+ * than PROGRAM_SECTOR_TIMEOUT_MS, abandons the transaction (see abandonTransaction).
  * 
  * @param sectorIndex Pointer to where the sector index will be stored. If the state is 
  * PROGRAM_SECTOR_GOT_INDEX when this function returns, then the sector index has been
@@ -34,8 +61,10 @@ static void getAndValidateSectorIndex(uint16_t *sectorIndex) {
     byte sectorIndexBytes[SECTOR_INDEX_LENGTH_BYTES];
 
     for (uint8_t i = 0; i < SECTOR_INDEX_LENGTH_BYTES; i++) {
-        byte b = blockingSerialRead();
-        sectorIndexBytes[i] = b;
+        if (!timedSerialRead(&sectorIndexBytes[i], PROGRAM_SECTOR_TIMEOUT_MS)) {
+            abandonTransaction("sector programming (receiving sector index)");
+            return;
+        }
     }
     // sector index is transmitted as little endian
     *sectorIndex = (((uint16_t)sectorIndexBytes[1]) << 8) | ((uint16_t)sectorIndexBytes[0]);  
@@ -46,8 +75,8 @@ static void getAndValidateSectorIndex(uint16_t *sectorIndex) {
     } else {
         sendACK();
         // echo the sector index back to the driver
-        Serial.write(sectorIndexBytes[0]);
-        Serial.write(sectorIndexBytes[1]);
+        txQueueWrite(sectorIndexBytes[0]);
+        txQueueWrite(sectorIndexBytes[1]);
         arduinoState = PROGRAM_SECTOR_GOT_INDEX;
     }
 }
@@ -56,11 +85,17 @@ static void getAndValidateSectorIndex(uint16_t *sectorIndex) {
  * @brief Confirms that the sector index we echoed to the driver was acknowledged. If the driver responds with an ACK
  * (acknowledges), transitions state to PROGRAM_SECTOR_INDEX_CONFIRMED. If the driver responds with a NAK,
  * transitions state to BEGIN_PROGRAM_SECTOR (ready to receive index again). Else, if the driver repsonds with something
- * else (which is unexpected), sends a NAK message and transitions to WAITING_FOR_COMMAND.
+ * else (which is unexpected), sends a NAK message and transitions to WAITING_FOR_COMMAND. If the driver does not
+ * respond within PROGRAM_SECTOR_TIMEOUT_MS, abandons the transaction.
  * 
  */
 static void confirmSectorIndex() {
-    byte b = blockingSerialRead();
+    byte b;
+    if (!timedSerialRead(&b, PROGRAM_SECTOR_TIMEOUT_MS)) {
+        abandonTransaction("sector programming (confirming sector index)");
+        return;
+    }
+
     if (b == ACK) {
         arduinoState = PROGRAM_SECTOR_INDEX_CONFIRMED;
     } else if (b == NAK) {
@@ -73,17 +108,34 @@ static void confirmSectorIndex() {
 
 /**
  * @brief Receives the sector data from the driver. After receiving all data, echoes it back to the
- * driver and transitions state to PROGRAM_SECTOR_GOT_DATA.
+ * driver (or, unless the verification policy is VERIFY_FULL, just its CRC-32, which costs the link 4 bytes rather
+ * than a whole sector) and transitions state to PROGRAM_SECTOR_GOT_DATA. If the driver goes quiet for longer than
+ * PROGRAM_SECTOR_TIMEOUT_MS part way through, abandons the transaction.
+ * 
+ * The sector is being erased meanwhile (see processSerialProgramSector): every RECEIVE_YIELD_INTERVAL bytes, yields
+ * to the flash task, which checks whether the erase has finished, so that the erase time reported in the health
+ * telemetry is accurate even if the data arrives faster than it can be read.
  * 
  * @param sectorData Buffer to write the data into. Must be at least SST_SECTOR_SIZE large.
+ * @param dataCrc Where the CRC-32 of the data is stored, if it is computed (that is, unless the verification policy is
+ * VERIFY_FULL).
  */
-static void receiveSectorData(byte *sectorData) {
+static void receiveSectorData(byte *sectorData, uint32_t *dataCrc) {
     for (uint16_t i = 0; i < SST_SECTOR_SIZE; i++) {
-        sectorData[i] = blockingSerialRead();
+        if (i % RECEIVE_YIELD_INTERVAL == 0) schedulerYield();
+        if (!timedSerialRead(&sectorData[i], PROGRAM_SECTOR_TIMEOUT_MS)) {
+            abandonTransaction("sector programming (receiving sector data)");
+            return;
+        }
     }
     
     // got all the data, echo it back
-    Serial.write(sectorData, SST_SECTOR_SIZE);
+    if (verifyPolicy == VERIFY_FULL) {
+        txQueueWrite(sectorData, SST_SECTOR_SIZE);
+    } else {
+        *dataCrc = sectorDataCrc32(sectorData);
+        serialWriteUint32(*dataCrc);
+    }
 
     arduinoState = PROGRAM_SECTOR_GOT_DATA;
 }
@@ -92,12 +144,18 @@ static void receiveSectorData(byte *sectorData) {
  * @brief Confirms that the sector data we echoed to the driver was acknowledged. If the driver responds with an ACK
  * (acknowledges), returns true. If the driver responds with a NAK, transitions state to PROGRAM_SECTOR_INDEX_CONFIRMED 
  * (ready to receive data again) and returns false. Else, if the driver repsonds with something else (which is unexpected), 
- * sends a NAK message, transitions to WAITING_FOR_COMMAND, and returns false.
+ * sends a NAK message, transitions to WAITING_FOR_COMMAND, and returns false. If the driver does not respond within
+ * PROGRAM_SECTOR_TIMEOUT_MS, abandons the transaction and returns false.
  * 
  * @return whether the sector data we echoed was acknowledged
  */
 static bool confirmSectorData() {
-    byte b = blockingSerialRead();
+    byte b;
+    if (!timedSerialRead(&b, PROGRAM_SECTOR_TIMEOUT_MS)) {
+        abandonTransaction("sector programming (confirming sector data)");
+        return false;
+    }
+
     if (b == ACK) {
         return true;
     } else if (b == NAK) {
@@ -111,38 +169,96 @@ static bool confirmSectorData() {
 }
 
 /**
- * @brief Programs a sector. On success, sends the driver an ACK and transitions state to 
- * WAITING_FOR_COMMAND. On failure, goes into a loop, sending a NAK message to the driver 
- * at regular intervals.
+ * @brief Checks that a sector holds what was programmed into it, as far as the verification policy says to. In
+ * production mode, checks at least its CRC, even under VERIFY_NONE: a chip's result record must say what is on it.
+ * 
+ * @param sectorIndex the index of the sector
+ * @param sectorData what it should hold: SST_SECTOR_SIZE bytes
+ * @param dataCrc the CRC-32 of sectorData, which VERIFY_CRC compares against (unused by the other policies)
+ * @return false if the sector was found not to hold sectorData, true otherwise
+ */
+static bool verifySector(uint16_t sectorIndex, const byte *sectorData, uint32_t dataCrc) {
+    int32_t startAddress = ((int32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+
+    switch (verifyPolicy) {
+        case VERIFY_NONE:
+            if (!productionChipActive()) return true;
+            return rangeCrc32(startAddress, SST_SECTOR_SIZE) == dataCrc;
+        case VERIFY_CRC:
+            return rangeCrc32(startAddress, SST_SECTOR_SIZE) == dataCrc;
+        case VERIFY_SAMPLED:
+            // spot checks at random offsets, so that over many sectors every offset gets checked
+            for (uint16_t sample = 0; sample < verifySampleCount; sample++) {
+                uint16_t index = random(SST_SECTOR_SIZE);
+                if (readByte(startAddress + index) != sectorData[index]) return false;
+            }
+            return true;
+        default:  // VERIFY_FULL
+            for (int32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+                if (readByte(startAddress + index) != sectorData[index]) return false;
+            }
+            return true;
+    }
+}
+
+/**
+ * @brief Programs a sector, and verifies it (see verifySector). On success, sends the driver an ACK and transitions
+ * state to WAITING_FOR_COMMAND. If the sector can't be programmed without losing data outside of it (see
+ * chipPrepareSector), sends the driver a NAK message and transitions state to WAITING_FOR_COMMAND.
+ * On failure, goes into a loop, sending a NAK message to the driver at regular intervals.
+ * 
+ * In production mode, failures are recorded for the chip's result record instead, and acknowledged (see
+ * production.h).
  * 
  * @param sectorIndex the index of the sector to program
  * @param sectorData the data to program into that sector
+ * @param dataCrc the CRC-32 of sectorData, if the verification policy is VERIFY_CRC
+ * @param patch whether to try programming just the bytes which change first (see chipPatchSector). A patched sector
+ * is not recorded in the health telemetry, which is about erases.
  */
-static void programSector(uint16_t sectorIndex, byte *sectorData) {
-    int32_t startAddress = ((int32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+static void programSector(uint16_t sectorIndex, byte *sectorData, uint32_t dataCrc, bool patch) {
+    arduinoState = WAITING_FOR_COMMAND;
 
-    setDataPinsOut();
-    eraseSector(sectorIndex);
-    for (int32_t index = 0; index < SST_SECTOR_SIZE; index++) {
-        writeByte(startAddress + index, sectorData[index]);
-    }    
+    if (productionChipFailed()) {
+        // the chip has already failed: don't spend time programming the rest of it
+        sendACK();
+        return;
+    }
 
-    setDataPinsIn();
-    for (int32_t index = 0; index < SST_SECTOR_SIZE; index++) {
-        byte b = readByte(startAddress + index);
-        if (b != sectorData[index]) {
-            fail("Programming sector failed: byte read back is not the same as what should have been programmed.");
+    bool patched = patch && chipPatchSector(sectorIndex, sectorData);
+    if (!patched) {
+        if (!chipPrepareSector(sectorIndex)) {
+            if (productionChipActive()) {
+                productionRecordSector(false, sectorData);
+                sendACK();
+            } else {
+                sendNAKMessage("Sector " + String(sectorIndex) + " is not blank, and erasing it would erase other sectors in its erase block. Erase the chip first.");
+            }
+            return;
+        }
+        chipProgramSector(sectorIndex, sectorData);
+    }
+
+    if (!verifySector(sectorIndex, sectorData, dataCrc)) {
+        if (productionChipActive()) {
+            productionRecordSector(false, sectorData);
+            sendACK();
+            return;
         }
+        fail("Programming sector failed: what was read back is not the same as what should have been programmed.");
     }
+    if (!patched) healthRecordSector(sectorIndex, chipTimings);
+    productionRecordSector(true, sectorData);
     
     sendACK();
-    arduinoState = WAITING_FOR_COMMAND;
 }
 
 // see header comment
 void processSerialProgramSector() {
-    uint16_t sectorIndex;
+    uint16_t sectorIndex = 0;
     byte sectorData[SST_SECTOR_SIZE]; 
+    uint32_t dataCrc = 0;
+    bool preparing = false;  // whether chipBeginPrepareSector has been called for sectorIndex
 
     /* The only way to get out of this loop is the return in the default case of 
     the switch statement. This only happens when the Arduino state changes to
@@ -159,15 +275,226 @@ void processSerialProgramSector() {
                 confirmSectorIndex();
                 break;
             case PROGRAM_SECTOR_INDEX_CONFIRMED:
-                receiveSectorData(sectorData);
+                /* Start erasing the sector now, so that the erase runs while its data is received rather than
+                after. If the data is NAKed, we come back here and the erase carries on. */
+                if (!preparing && !productionChipFailed()) {
+                    chipBeginPrepareSector(sectorIndex);
+                    preparing = true;
+                }
+                receiveSectorData(sectorData, &dataCrc);
                 break;
             case PROGRAM_SECTOR_GOT_DATA:
                 if (confirmSectorData()) {
-                    programSector(sectorIndex, sectorData);
+                    // finishes the preparation (see chipPrepareSector)
+                    programSector(sectorIndex, sectorData, dataCrc, false);
+                    preparing = false;
                 }
                 break;
             default:
+                if (preparing) {
+                    // the transfer was given up on part way through: still leave the sector erased, and the chip idle
+                    chipPrepareSector(sectorIndex);
+                }
                 return;
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Receives the runs of a delta from the driver, and XORs them into a sector's data (see
+ * processSerialDeltaSector). A run which doesn't fit in the sector is still received in full, so that the driver
+ * and the Arduino stay in step, but is not applied.
+ * 
+ * @param sectorData the sector's current data, which the runs are applied to: SST_SECTOR_SIZE bytes
+ * @param runCount the number of runs to receive
+ * @param inBounds set to false if any run did not fit in the sector
+ * @return false if the driver went quiet (the transaction has been abandoned), true otherwise
+ */
+static bool receiveDeltaRuns(byte *sectorData, uint16_t runCount, bool *inBounds) {
+    for (uint16_t run = 0; run < runCount; run++) {
+        uint16_t offset;
+        uint16_t length;
+        if (!timedSerialReadUint16(&offset, DELTA_SECTOR_TIMEOUT_MS)
+                || !timedSerialReadUint16(&length, DELTA_SECTOR_TIMEOUT_MS)) {
+            abandonTransaction("delta sector programming (receiving run header)");
+            return false;
+        }
+        bool fits = (uint32_t)offset + length <= SST_SECTOR_SIZE;
+        if (!fits) *inBounds = false;
+
+        for (uint16_t i = 0; i < length; i++) {
+            byte b;
+            if (!timedSerialRead(&b, DELTA_SECTOR_TIMEOUT_MS)) {
+                abandonTransaction("delta sector programming (receiving run data)");
+                return false;
+            }
+            if (fits) sectorData[offset + i] ^= b;
+        }
+    }
+    return true;
+}
+
+// see header comment
+void processSerialDeltaSector() {
+    byte sectorData[SST_SECTOR_SIZE];
+    arduinoState = WAITING_FOR_COMMAND;
+
+    uint16_t sectorIndex;
+    uint32_t baseCrc;
+    if (!timedSerialReadUint16(&sectorIndex, DELTA_SECTOR_TIMEOUT_MS)
+            || !timedSerialReadUint32(&baseCrc, DELTA_SECTOR_TIMEOUT_MS)) {
+        abandonTransaction("delta sector programming (receiving sector index)");
+        return;
+    }
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        sendNAKMessage("While programming sector from a delta, got sector index " + String(sectorIndex) + ", which is too large.");
+        return;
+    }
+
+    /* Read the whole sector before replying: the driver sends the delta as soon as it has the ACK, and reading the
+    chip while it arrives could overflow the serial receive buffer. */
+    int32_t startAddress = ((int32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    uint32_t crc = CRC32_INITIAL;
+    setDataPinsIn();
+    for (int32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        sectorData[index] = readByte(startAddress + index);
+        crc = crc32Update(crc, sectorData[index]);
+    }
+    if (crc32Final(crc) != baseCrc) {
+        sendNAKMessage("Sector " + String(sectorIndex) + " does not hold what the driver expected: it can't be programmed from a delta.");
+        return;
+    }
+    sendACK();
+
+    uint32_t targetCrc;
+    uint16_t runCount;
+    if (!timedSerialReadUint32(&targetCrc, DELTA_SECTOR_TIMEOUT_MS)
+            || !timedSerialReadUint16(&runCount, DELTA_SECTOR_TIMEOUT_MS)) {
+        abandonTransaction("delta sector programming (receiving delta header)");
+        return;
+    }
+    bool inBounds = true;
+    if (!receiveDeltaRuns(sectorData, runCount, &inBounds)) return;
+    if (!inBounds) {
+        sendNAKMessage("While programming sector " + String(sectorIndex) + " from a delta, got a run which does not fit in the sector.");
+        return;
+    }
+
+    if (sectorDataCrc32(sectorData) != targetCrc) {
+        sendNAKMessage("While programming sector " + String(sectorIndex) + " from a delta, the result's CRC did not match: the delta was corrupted.");
+        return;
+    }
+
+    programSector(sectorIndex, sectorData, targetCrc, true);
+}
+
+// see header comment
+void processSerialVerifyPolicy() {
+    arduinoState = WAITING_FOR_COMMAND;
+    byte policy;
+    uint16_t sampleCount;
+    if (!timedSerialRead(&policy, VERIFY_POLICY_TIMEOUT_MS)
+            || !timedSerialReadUint16(&sampleCount, VERIFY_POLICY_TIMEOUT_MS)) {
+        abandonTransaction("verification policy (receiving policy)");
+        return;
+    }
+
+    if (policy > VERIFY_SAMPLED) {
+        sendNAKMessage("While setting verification policy, got policy " + String(policy) + ", which is not a policy.");
+    } else if (policy == VERIFY_SAMPLED && (sampleCount == 0 || sampleCount > SST_SECTOR_SIZE)) {
+        sendNAKMessage("While setting verification policy, got " + String(sampleCount) + " bytes to sample per sector, which is not from 1 to " + String(SST_SECTOR_SIZE) + ".");
+    } else {
+        verifyPolicy = policy;
+        verifySampleCount = sampleCount;
+        sendACK();
+    }
+}
+
+/**
+ * @brief Checks whether a sector is blank (every byte is 0xFF). Sets the data pins to input.
+ * 
+ * @param sectorIndex the index of the sector
+ * @return whether the sector is blank
+ */
+static bool sectorIsBlank(uint16_t sectorIndex) {
+    uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+    setDataPinsIn();
+    for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+        if (readByte(startAddress + index) != 0xFF) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Erases a sector which is not blank, and records it in the wear telemetry. If its whole erase block is in the
+ * range being erased, erases the block; otherwise, only erases it if that loses nothing outside it (see
+ * chipPrepareSector). Families whose chipPrepareSector leaves the sector as it was (EEPROMs) have it programmed with
+ * 0xFF instead. Sets the data pins to input.
+ * 
+ * @param sectorIndex the index of the sector
+ * @param firstSector the first sector of the range being erased
+ * @param sectorCount the number of sectors in the range
+ * @param laterErased set to which of the later sectors of the block were not blank, and have been erased with it:
+ * bit 0 for the next sector, and so on. The sectors before it in the block, if any, are blank already.
+ * @return ERASE_RANGE_ERASED, ERASE_RANGE_NOT_ERASABLE or ERASE_RANGE_FAILED
+ */
+static uint8_t eraseSector(uint16_t sectorIndex, uint16_t firstSector, uint16_t sectorCount, uint8_t *laterErased) {
+    uint16_t blockStart = sectorIndex - sectorIndex % CHIP_ERASE_BLOCK_SECTORS;
+    uint16_t blockEnd = blockStart + CHIP_ERASE_BLOCK_SECTORS;
+    *laterErased = 0;
+    if (blockStart >= firstSector && (uint32_t)blockEnd <= (uint32_t)firstSector + sectorCount) {
+        for (uint16_t later = blockEnd - 1; later > sectorIndex; later--) {
+            *laterErased = (*laterErased << 1) | (sectorIsBlank(later) ? 0 : 1);
+        }
+        chipEraseBlock(sectorIndex);
+    } else if (!chipPrepareSector(sectorIndex)) {
+        return ERASE_RANGE_NOT_ERASABLE;
+    }
+    if (!sectorIsBlank(sectorIndex)) {
+        byte blankData[SST_SECTOR_SIZE];
+        memset(blankData, 0xFF, SST_SECTOR_SIZE);
+        // flash can't set bits without an erase, so this only changes anything on an EEPROM
+        if (!chipPatchSector(sectorIndex, blankData) || !sectorIsBlank(sectorIndex)) return ERASE_RANGE_FAILED;
+    }
+    healthRecordSector(sectorIndex, chipTimings);
+    return ERASE_RANGE_ERASED;
+}
+
+// see header comment
+void processSerialEraseRange() {
+    arduinoState = WAITING_FOR_COMMAND;
+    uint16_t firstSector;
+    uint16_t sectorCount;
+    if (!timedSerialReadUint16(&firstSector, ERASE_RANGE_TIMEOUT_MS)
+            || !timedSerialReadUint16(&sectorCount, ERASE_RANGE_TIMEOUT_MS)) {
+        abandonTransaction("erase range (receiving sector range)");
+        return;
+    }
+
+    if (sectorCount == 0 || (uint32_t)firstSector + sectorCount > SST_NUMBER_SECTORS) {
+        sendNAKMessage("While erasing a range, got " + String(sectorCount) + " sectors from sector " + String(firstSector) + ", which is not a range of sectors on the chip.");
+        return;
+    }
+    sendACK();
+
+    uint8_t blockErased = 0;  // the sectors still to come which the last block erase erased (see eraseSector)
+    for (uint16_t sectorIndex = firstSector; sectorIndex < firstSector + sectorCount; sectorIndex++) {
+        uint32_t start = micros();
+        uint8_t status = ERASE_RANGE_BLANK;
+        chipTimings = ChipTimings();
+        bool erasedWithBlock = blockErased & 1;
+        blockErased >>= 1;
+        if (erasedWithBlock) {
+            // its erase time was recorded against the sector which erased the block
+            status = sectorIsBlank(sectorIndex) ? ERASE_RANGE_ERASED : ERASE_RANGE_FAILED;
+        } else if (!sectorIsBlank(sectorIndex)) {
+            status = eraseSector(sectorIndex, firstSector, sectorCount, &blockErased);
+        }
+        uint32_t elapsedUs = micros() - start;
+
+        txQueueWrite(status);
+        serialWriteUint32(elapsedUs);
+        serialWriteUint32(status == ERASE_RANGE_ERASED ? chipTimings.eraseUs : 0);
+        schedulerYield();  // let the record go out while the next sector is erased
+    }
+}
@@ -29,8 +29,64 @@
  * function. Calling this function when the Arduino is in any other state has unspecified 
  * behavior.
  * 
+ * The sector data is echoed back to the driver in full, or only its CRC-32, and the programmed sector read back, as
+ * the verification policy says (see processSerialVerifyPolicy).
+ * 
  * There are no guarantees that this function will return in a specific timeframe.
  */
 void processSerialProgramSector();
 
+/**
+ * @brief Processes serial input while the Arduino is programming a sector from a delta: the driver, which knows what
+ * the sector holds, sends only what changes. The Arduino must be in the BEGIN_DELTA_SECTOR state when calling this
+ * function, and is in WAITING_FOR_COMMAND when it returns. The exchange (all values little-endian) is:
+ * 
+ * 1. The driver sends the sector index (2 bytes) and the CRC-32 of what it expects the sector to hold (4 bytes). The
+ *    Arduino reads the sector, and replies ACK if the CRC matches, or a NAK message if not: the driver then programs
+ *    the sector in full instead.
+ * 2. The driver sends the CRC-32 of the new data (4 bytes), the number of runs (2 bytes), then each run: its offset
+ *    in the sector (2 bytes), its length (2 bytes), and that many bytes, which are XORed into the sector's data.
+ * 3. If the result's CRC matches, the Arduino programs it (without an erase, if the chip can: see chipPatchSector),
+ *    verifies it as the verification policy says, and replies ACK. Otherwise (a run out of the sector, or data lost on the way), replies with a NAK
+ *    message, and the sector is not changed. Failures to program are handled as for processSerialProgramSector.
+ * 
+ * The two CRCs take the place of the echoes of processSerialProgramSector's exchange. If the driver goes quiet for
+ * longer than DELTA_SECTOR_TIMEOUT_MS, abandons the transaction.
+ */
+void processSerialDeltaSector();
+
+/**
+ * @brief Processes serial input while the Arduino is setting the verification policy: how the sectors programmed
+ * from then on are checked. The Arduino must be in the BEGIN_VERIFY_POLICY state when calling this function, and is in
+ * WAITING_FOR_COMMAND when it returns.
+ * 
+ * The driver sends the policy (1 byte: one of the VERIFY_ values in protocol.h) and the number of bytes to read back
+ * per sector for VERIFY_SAMPLED (2 bytes, little-endian: from 1 to SST_SECTOR_SIZE, and ignored for the others). The
+ * Arduino replies ACK, or a NAK message if either is out of range, in which case the policy is not changed. The policy
+ * lasts until it is set again; until then, it is VERIFY_FULL. If the driver goes quiet for longer than
+ * VERIFY_POLICY_TIMEOUT_MS, abandons the transaction.
+ */
+void processSerialVerifyPolicy();
+
+/**
+ * @brief Processes serial input while the Arduino is erasing a range of sectors. The Arduino must be in the
+ * BEGIN_ERASE_RANGE state when calling this function, and is in WAITING_FOR_COMMAND when it returns.
+ * 
+ * The driver sends the index of the first sector (2 bytes) and the number of sectors (2 bytes). If the range is not
+ * within the chip, the Arduino replies with a NAK message. Otherwise, it replies ACK, then erases the sectors in
+ * turn, skipping those that already read back blank (every byte 0xFF), and once each is done, sends:
+ * 
+ *     status      1 byte    one of the ERASE_RANGE_ values in protocol.h
+ *     elapsedUs   4 bytes   time spent on the sector, including checking whether it was blank
+ *     eraseUs     4 bytes   the erase itself, polled for completion, or 0 if the sector was not erased
+ * 
+ * That is ERASE_RANGE_RECORD_LENGTH bytes, all values little-endian. Nothing outside the range is ever erased: on
+ * families whose erase blocks are larger than a sector (see CHIP_ERASE_BLOCK_SECTORS), a block which lies wholly in
+ * the range is erased at once, its first sector which was not blank getting the erase time, and a sector of any
+ * other block is only erased if the rest of its block is blank (see chipPrepareSector), and is otherwise
+ * ERASE_RANGE_NOT_ERASABLE. EEPROMs, which have nothing to erase, have the sector programmed with 0xFF instead. Each sector erased is recorded in the wear telemetry. If the driver goes quiet for longer than
+ * ERASE_RANGE_TIMEOUT_MS while sending the range, abandons the transaction.
+ */
+void processSerialEraseRange();
+
 #endif  // SST39SF_PROGRAMMER_PROGRAM_SECTOR_H
\ No newline at end of file
@@ -0,0 +1,139 @@
+/*
+ * The serial protocol between the Arduino and the host: constants that both sides must agree on. This header is
+ * plain C++ with no Arduino dependencies, so that host programs (see /host/) compile against the same definitions
+ * as the firmware. The C# driver mirrors these in Arduino.cs.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_PROTOCOL_H
+#define SST39SF_PROGRAMMER_PROTOCOL_H
+
+#include <stdint.h>
+
+//=============================================================================
+//             LINK
+//=============================================================================
+
+#define SERIAL_BAUD_RATE 115200  // 8N1, until the driver changes it with BAUD
+
+/* Baud rates that BAUD can switch to, fastest first. All of them are within the UART's tolerance at 16MHz (with
+double speed mode); whether the rest of the link (USB-serial bridge, cable, host) keeps up is what the driver's
+--calibrate finds out. */
+const uint32_t SERIAL_BAUD_RATES[] = { 2000000, 1000000, 500000, 250000, 230400, 115200 };
+const uint8_t SERIAL_BAUD_RATE_COUNT = 6;
+
+/* Number of bytes in the test pattern that the Arduino echoes back at a new baud rate (see processSerialBaudChange
+in communication_util.h). If either side has not seen the whole exchange within BAUD_CHANGE_TIMEOUT_MS, both go back
+to the old rate. */
+const uint8_t BAUD_TEST_PATTERN_LENGTH = 64;
+const uint32_t BAUD_CHANGE_TIMEOUT_MS = 500;
+
+#define ACK ((uint8_t)0x06)
+#define NAK ((uint8_t)0x15)  // followed by a null-terminated error message
+
+#define MAX_NAK_MESSAGE_LENGTH 256
+#define MAX_COMMAND_LENGTH ((uint16_t)32)  // includes null terminator
+
+/* Number of bytes in a sector: always 4096 bytes. This is the unit that the driver programs in, whatever the chip's
+own erase block size is (see chip_driver.h). */
+#define SST_SECTOR_SIZE 4096
+
+/* Sector indices are sent as 2 bytes, and all multi-byte values as little-endian. */
+const uint8_t SECTOR_INDEX_LENGTH_BYTES = 2;
+
+//=============================================================================
+//             MESSAGES
+//=============================================================================
+
+/* All messages are sent null-terminated. */
+
+// Messages the Arduino sends the host
+const char WAIT_MESSAGE[] = "WAITING";  // followed by the chip's number of sectors (2 bytes): see connectToDriver
+const char CONFIRM_ERASE_MESSAGE[] = "CONFIRM?";
+const char CHIP_INSERTED_MESSAGE[] = "CHIPINSERTED";  // production mode events: see production.h
+const char CHIP_REMOVED_MESSAGE[] = "CHIPREMOVED";
+
+// Commands the host sends the Arduino
+const char PROGRAM_SECTOR_MESSAGE[] = "PROGRAMSECTOR";
+const char DELTA_SECTOR_MESSAGE[] = "DELTASECTOR";  // see processSerialDeltaSector in program_sector.h
+const char ERASE_CHIP_MESSAGE[] = "ERASECHIP";
+const char ERASE_RANGE_MESSAGE[] = "ERASERANGE";  // see processSerialEraseRange in program_sector.h
+const char SECTOR_CRC_MESSAGE[] = "SECTORCRC";
+const char CRC_TREE_MESSAGE[] = "CRCTREE";  // see processSerialCrcTree in checksum.h
+const char READ_SECTOR_MESSAGE[] = "READSECTOR";
+const char HEALTH_MESSAGE[] = "HEALTH";
+const char PRODUCTION_MESSAGE[] = "PRODUCTION";
+const char END_CHIP_MESSAGE[] = "ENDCHIP";
+const char BAUD_MESSAGE[] = "BAUD";
+const char VERIFY_POLICY_MESSAGE[] = "VERIFYPOLICY";  // see processSerialVerifyPolicy in program_sector.h
+const char BENCH_MESSAGE[] = "BENCH";  // see bench.h
+const char LINK_TEST_MESSAGE[] = "LINKTEST";  // see processSerialLinkTest in communication_util.h
+const char DONE_MESSAGE[] = "DONE";
+
+/* Levels of the checksum tree that CRCTREE walks: the chip, made of sectors, made of blocks, made of lines, made of
+bytes. Every node but the chip has CRC_TREE_FANOUT children. */
+const uint8_t CRC_TREE_CHIP = 0;
+const uint8_t CRC_TREE_SECTOR = 1;
+const uint8_t CRC_TREE_BLOCK = 2;
+const uint8_t CRC_TREE_LINE = 3;
+const uint8_t CRC_TREE_FANOUT = 16;
+const uint16_t CRC_TREE_BLOCK_SIZE = 256;
+const uint8_t CRC_TREE_LINE_SIZE = 16;
+
+/* Length of the header of each run in a DELTASECTOR delta: its offset in the sector and its length. */
+const uint8_t DELTA_RUN_HEADER_LENGTH = 4;
+
+/* How programmed sectors are verified (see processSerialVerifyPolicy in program_sector.h). VERIFY_FULL, the default,
+echoes the sector's data to the driver and compares every byte read back from the chip; the others echo only the
+data's CRC-32 (VERIFY_CRC_ECHO_LENGTH bytes), then compare the CRC of the whole sector read back, a random sample of
+its bytes, or nothing (except in production mode, which always compares at least the CRC). */
+const uint8_t VERIFY_NONE = 0;
+const uint8_t VERIFY_CRC = 1;
+const uint8_t VERIFY_FULL = 2;
+const uint8_t VERIFY_SAMPLED = 3;
+const uint8_t VERIFY_CRC_ECHO_LENGTH = 4;
+
+/* What ERASERANGE did with each sector, and the length of each per-sector record in its reply (see
+processSerialEraseRange in program_sector.h). */
+const uint8_t ERASE_RANGE_ERASED = 0;        // the sector was erased
+const uint8_t ERASE_RANGE_BLANK = 1;         // the sector was already blank, and was left alone
+const uint8_t ERASE_RANGE_NOT_ERASABLE = 2;  // erasing it would erase sectors outside the range: it was left alone
+const uint8_t ERASE_RANGE_FAILED = 3;        // the sector did not read back blank after the erase
+const uint8_t ERASE_RANGE_RECORD_LENGTH = 9;
+
+/* Test patterns that BENCH programs, what it did with each sector, and the length of each per-sector record in its
+reply (see bench.h). */
+const uint8_t BENCH_PATTERN_ZEROES = 0;       // every bit programmed
+const uint8_t BENCH_PATTERN_ALTERNATING = 1;  // 0x55 and 0xAA in turn
+const uint8_t BENCH_PATTERN_RANDOM = 2;       // pseudo-random, different for every sector
+const uint8_t BENCH_OK = 0;                   // the sector was benchmarked
+const uint8_t BENCH_NOT_ERASABLE = 1;         // it could not be erased on its own (see chipPrepareSector): left alone
+const uint8_t BENCH_RECORD_LENGTH = 23;
+
+/* What LINKTEST does with its payloads (see processSerialLinkTest in communication_util.h), and the largest payload it
+takes: a sector, the largest block of data the other commands send in one go. */
+const uint8_t LINK_TEST_ECHO = 0;    // the driver sends each payload, and the Arduino echoes it
+const uint8_t LINK_TEST_SINK = 1;    // the driver sends the payloads, and the Arduino times their arrival
+const uint8_t LINK_TEST_SOURCE = 2;  // the Arduino sends the payloads
+const uint16_t LINK_TEST_MAX_PAYLOAD_LENGTH = SST_SECTOR_SIZE;
+
+/* Length of each per-sector record in the reply to HEALTH (see SectorHealth in health.h). */
+const uint8_t HEALTH_RECORD_LENGTH = 12;
+
+/* Length of the result record in the reply to ENDCHIP (see production.h). */
+const uint8_t PRODUCTION_RESULT_LENGTH = 13;
+
+#endif  // SST39SF_PROGRAMMER_PROTOCOL_H
@@ -0,0 +1,57 @@
+/*
+ * Implementation of sector read functionality. See read_sector.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "read_sector.h"
+#include "sst_constants.h"
+#include "communication_util.h"
+#include "tx_queue.h"
+#include "globals.h"
+#include "read_write.h"
+#include "checksum.h"
+
+/* How many bytes of the sector are read between moving the transmit queue on to the UART (see tx_queue.h). */
+const uint16_t READ_PUMP_INTERVAL = 16;
+
+// See header comment.
+void processSerialReadSector() {
+    uint16_t sectorIndex;
+    if (!timedSerialReadUint16(&sectorIndex, READ_SECTOR_TIMEOUT_MS)) {
+        abandonTransaction("sector read (receiving sector index)");
+        return;
+    }
+
+    if (sectorIndex >= SST_NUMBER_SECTORS) {
+        sendNAKMessage("While reading sector, got sector index " + String(sectorIndex) + ", which is too large.");
+    } else {
+        uint32_t startAddress = ((uint32_t)sectorIndex) * SST_SECTOR_SIZE;  // cast needed to avoid truncation
+        uint32_t crc = CRC32_INITIAL;
+
+        sendACK();
+        serialWriteUint16(sectorIndex);
+        setDataPinsIn();
+        for (uint32_t index = 0; index < SST_SECTOR_SIZE; index++) {
+            byte b = readByte(startAddress + index);
+            crc = crc32Update(crc, b);
+            txQueueWrite(b);
+            // keep the UART busy: the queue is only moved on to it by itself once full
+            if (index % READ_PUMP_INTERVAL == READ_PUMP_INTERVAL - 1) txQueuePump();
+        }
+        serialWriteUint32(crc32Final(crc));
+    }
+    arduinoState = WAITING_FOR_COMMAND;
+}
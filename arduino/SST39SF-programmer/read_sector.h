@@ -0,0 +1,33 @@
+/*
+ * Sector read functionality, which lets the host read back the contents of the chip.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_READ_SECTOR_H
+#define SST39SF_PROGRAMMER_READ_SECTOR_H
+
+/**
+ * @brief Processes serial input while the Arduino is reading a sector. The Arduino must be in the BEGIN_READ_SECTOR
+ * state when calling this function.
+ * 
+ * Receives a sector index (2 bytes, little-endian). If it is in range, sends an ACK, echoes the sector index, and
+ * sends the contents of that sector (SST_SECTOR_SIZE bytes) followed by their CRC-32 (4 bytes, little-endian), so
+ * that the host can detect bytes corrupted in transit. Otherwise, sends a NAK message. Either way, transitions state
+ * to WAITING_FOR_COMMAND.
+ */
+void processSerialReadSector();
+
+#endif  // SST39SF_PROGRAMMER_READ_SECTOR_H
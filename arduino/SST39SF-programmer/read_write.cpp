@@ -1,6 +1,7 @@
 /*
  * Implementation of functionality that handles reading from / writing to the
- * SST39SF chip. See read_write.h for more information.
+ * SST39SF chip. See read_write.h for more information. The bus cycles here are for
+ * the pins backend: see read_write_xmem.cpp for the XMEM backend.
  * 
  * Copyright (C) 2023 Alexander Gillon
  * 
@@ -19,14 +20,21 @@
  */
 #include "read_write.h"
 #include "sst_constants.h"
-#include "communication_util.h""
+#include "communication_util.h"
 #include "globals.h"
 #include "pinout.h"
+#include "scheduler.h"
 
 #include <Arduino.h>
 
+#if BUS_BACKEND == BUS_BACKEND_PINS
+
 // todo: potentially speed up via using noops for delays 
 
+/* What is currently on the address bus (setupAddressPins clears it). Only pins whose bit changes are written, which
+for sequential accesses is usually one or two out of ADDRESS_BUS_LENGTH. */
+static uint32_t currentAddress = 0;
+
 //=============================================================================
 //             IMPLEMENTATION UTILITIES
 //=============================================================================
@@ -98,6 +106,7 @@ void setupAddressPins() {
         pinMode(i, OUTPUT);
         digitalWrite(i, LOW);
     }
+    currentAddress = 0;
 }
 
 // See header comment.
@@ -119,7 +128,7 @@ void setDataPinsOut() {
 //=============================================================================
 
 /**
- * @brief Set the address bus to a specific address. Requires the address pins to be set to input.
+ * @brief Set the address bus to a specific address. Requires the address pins to be set to output.
  * 
  * Note: the length of an address depends on which variant of the chip is being used, and
  * is defined as ADDRESS_BUS_LENGTH in constants.h.
@@ -127,9 +136,13 @@ void setDataPinsOut() {
  * @param address the address to put on the address bus
  */
 static void setAddressBus(uint32_t address) {
+    uint32_t changed = address ^ currentAddress;
     for (int i = 0; i < ADDRESS_BUS_LENGTH; i++) {
-        digitalWrite(ADDR0 + i, bitRead(address, i));
+        if (bitRead(changed, i)) {
+            digitalWrite(ADDR0 + i, bitRead(address, i));
+        }
     }
+    currentAddress = address;
 }
 
 /**
@@ -196,19 +209,8 @@ byte readByte(uint32_t address) {
     return input;
 }
 
-/**
- * @brief 'Sends' a byte to an address. Requires the data pins to be set to output.
- * 
- * NOTE: This function is named as 'send' rather than 'write' because it is not capable of writing arbitrary
- * data to arbitrary addresses. As per the datasheet of the SST39SF, programming flash data requires a special
- * command sequence to be sent to the chip. Use writeByte to write arbitrary data.
- * 
- * Fails if compiled with DEBUG defined and the data pins are not set to output.
- * 
- * @param address the address to send to
- * @param data the data to send
- */
-static void sendByte(uint32_t address, byte data) {
+// See header comment.
+void sendByte(uint32_t address, byte data) {
 #ifdef DEBUG
     checkDataPinsOut("sendByte");
 #endif
@@ -225,77 +227,46 @@ static void sendByte(uint32_t address, byte data) {
     digitalWrite(WRITE_ENABLE, HIGH);
 }
 
-// See header comment.
-void writeByte(uint32_t address, byte data) {
-#ifdef DEBUG
-    checkDataPinsOut("writeByte");
-#endif
-
-    sendByte(0x5555, 0xAA);
-    sendByte(0x2AAA, 0x55);
-    sendByte(0x5555, 0xA0);
-    sendByte(address, data);
-
-    delayMicroseconds(25);  // wait for chip to write
-}
+#endif  // BUS_BACKEND == BUS_BACKEND_PINS
 
 //=============================================================================
-//             ERASING DATA
+//             JEDEC COMMAND SEQUENCES
 //=============================================================================
 
 // See header comment.
-void eraseSectorStartingAt(uint32_t address) {
-#ifdef DEBUG
-    checkDataPinsOut("eraseSectorStartingAt");
-
-    if (address >= SST_FLASH_SIZE) {
-        fail("DEBUG assertion failed during eraseSectorStartingAt: address is out of bounds (too large).");
-    }
-
-    uint32_t sectorNumber = address / SST_SECTOR_SIZE;
-    uint32_t startingAddressOfSector = sectorNumber * SST_SECTOR_SIZE;
-    if (address != startingAddressOfSector) {
-        fail("DEBUG assertion failed during eraseSectorStartingAt: address is not the starting address of a sector.");
-    }
-#endif
-
+void sendUnlockSequence() {
     sendByte(0x5555, 0xAA);
     sendByte(0x2AAA, 0x55);
-    sendByte(0x5555, 0x80);
-    sendByte(0x5555, 0xAA);
-    sendByte(0x2AAA, 0x55);
-    sendByte(address, 0x30);
-
-    delay(30);  // wait for sector to erase
 }
 
 // See header comment.
-void eraseSector(uint16_t sectorIndex) {
-#ifdef DEBUG
-    checkDataPinsOut("eraseSector");
-
-    if (sectorIndex >= SST_NUMBER_SECTORS) {
-        fail("DEBUG assertion failed during eraseSector: index is out of bounds (too large).");
-    }
-#endif
-
-    uint32_t sectorIndex32 = sectorIndex;  // needed, or else the multiplication below will get truncated for larger sector indices
-    eraseSectorStartingAt(sectorIndex32 * SST_SECTOR_SIZE);
+void sendCommand(byte command) {
+    sendUnlockSequence();
+    sendByte(0x5555, command);
 }
 
 // See header comment.
-void eraseChip() {
-#ifdef DEBUG
-    checkDataPinsOut("eraseChip");
-#endif
-
-    sendByte(0x5555, 0xAA);
-    sendByte(0x2AAA, 0x55);
-    sendByte(0x5555, 0x80);
-    sendByte(0x5555, 0xAA);
-    sendByte(0x2AAA, 0x55);
-    sendByte(0x5555, 0x10);
+bool toggleBitToggling(uint32_t address) {
+    const byte TOGGLE_BIT = 0x40;  // DQ6
 
-    delay(105);  // wait for chip to erase
+    setDataPinsIn();
+    byte first = readByte(address);
+    return ((first ^ readByte(address)) & TOGGLE_BIT) != 0;
 }
 
+// See header comment.
+bool waitForToggleBit(uint32_t address, uint32_t timeoutMs, uint16_t *polls) {
+    const byte TOGGLE_BIT = 0x40;  // DQ6
+
+    setDataPinsIn();
+    uint32_t start = millis();
+    byte previous = readByte(address);
+    while (true) {
+        byte current = readByte(address);
+        if (polls != NULL && *polls < 0xFFFF) (*polls)++;
+        if (((previous ^ current) & TOGGLE_BIT) == 0) return true;
+        if (millis() - start > timeoutMs) return false;
+        previous = current;
+        schedulerYield(true);  // the chip is mid-operation: only tasks which don't access it can run
+    }
+}
@@ -1,5 +1,7 @@
 /*
- * Functionality that handles reading from / writing to the SST39SF chip.
+ * Functionality that handles reading from / writing to the chip at the bus level. Chip-specific command sets
+ * (programming, erasing) are in the chip_*.cpp files: see chip_driver.h. How bus cycles are driven depends on
+ * BUS_BACKEND: see pinout.h.
  * 
  * Copyright (C) 2023 Alexander Gillon
  * 
@@ -25,13 +27,14 @@
 //             PIN CONFIGURATION
 //=============================================================================
 
-/** @brief Sets the control pins (WRITE_ENABLE) and (OUTPUT_ENABLE) to disabled. */
+/** @brief Sets the control pins (WRITE_ENABLE) and (OUTPUT_ENABLE) to disabled. With the XMEM backend, enables the
+external memory interface instead. */
 void setupControlPins();
-/** @brief Sets the address pins to output mode, and clears them. */
+/** @brief Sets the address pins to output mode, and clears them. With the XMEM backend, just the bank pins. */
 void setupAddressPins();
-/** @brief Sets the data pins to input mode. */
+/** @brief Sets the data pins to input mode. Does nothing with the XMEM backend, which does this for each cycle. */
 void setDataPinsIn();
-/** @brief Sets the data pins to output mode. */
+/** @brief Sets the data pins to output mode. Does nothing with the XMEM backend, which does this for each cycle. */
 void setDataPinsOut();
 
 //=============================================================================
@@ -49,67 +52,55 @@ void setDataPinsOut();
 byte readByte(uint32_t address);
 
 /**
- * @brief Writes a byte to an address. Requires the data pins to be set to output.
+ * @brief 'Sends' a byte to an address: a single bus write cycle. Requires the data pins to be set to output.
  * 
- * NOTE: this function writes to the SST39SF via the required command sequence, as defined in the datasheet.
+ * NOTE: This function is named as 'send' rather than 'write' because, on flash chips, it is not capable of writing
+ * arbitrary data to arbitrary addresses: programming requires a command sequence, which is specific to the chip
+ * (see chip_driver.h).
  * 
  * Fails if compiled with DEBUG defined and the data pins are not set to output.
  * 
- * @param address the address to write to
- * @param data the data to write
+ * @param address the address to send to
+ * @param data the data to send
  */
-void writeByte(uint32_t address, byte data);
+void sendByte(uint32_t address, byte data);
 
 //=============================================================================
-//             ERASING DATA
+//             JEDEC COMMAND SEQUENCES
 //=============================================================================
 
+/* All of the supported chip families use the JEDEC-style software command sequences: a command is written to 0x5555
+after an unlock sequence of 0xAA to 0x5555 and 0x55 to 0x2AAA. The commands themselves differ between families. */
+
+/** @brief Sends the unlock sequence (0xAA to 0x5555, 0x55 to 0x2AAA). Requires the data pins to be set to output. */
+void sendUnlockSequence();
+
 /**
- * @brief Erases a sector starting at a certain memory address. Requires the data pins to be set to output.
- * 
- * NOTE: addresses that do not correspond to the start of a sector will not fail, and will likely have
- * unintended results. The SST39SF uses the most significant bits of the address bus to select which 
- * sector to erase: passing in an address that is not the start of a sector will likely cause the sector
- * in which that address is contained to be erased, as the lower bits would be ignored 
- * (however no guarantees are made). 
- * 
- * NOTE: addresses are not bounds checked. Using values larger than the addressable memory on the chip
- * will have unintended results, likely erasing the sector that is the same moduluo the size of the
- * address space (however no guarantees are made). 
- * 
- * If compiled with the DEBUG flag:
- *   - Input validation of the address will occur, and the operation will instead fail if the address 
- *     could not be the start of a sector or if the starting address is out of range.
- *   - Fails if the data pins are not set to output.
+ * @brief Sends a command: the unlock sequence, followed by the command byte to 0x5555. Requires the data pins to
+ * be set to output.
  * 
- * @param address the starting address of a sector
+ * @param command the command byte
  */
-void eraseSectorStartingAt(uint32_t address);
+void sendCommand(byte command);
 
 /**
- * @brief Erases the nth sector of the SST39SF (zero-indexed). Requires the data pins to be set to output.
+ * @brief Waits for an internal operation of the chip (program, erase, EEPROM write cycle) to complete, by polling
+ * the toggle bit (DQ6), which toggles on every read while the operation is in progress. Sets the data pins to input.
  * 
- * I.e. eraseSector(0) erases the first sector, eraseSector(1) erases the second, etc.
- * 
- * NOTE: the sector index is not bounds checked. Using values larger than the number of sectors will
- * have unintended results, likely erasing the sector that is the same moduluo the number of sectors
- * (however no guarantees are made). 
- * 
- * If compiled with the DEBUG flag:
- *   - The sector index is instead bounds checked, and the operation will fail if the sector index is out
- *     of bounds.
- *   - Fails if the data pins are not set to output.
- * 
- * @param sectorIndex the index of the sector to erase (zero-indexed)
+ * @param address an address within the area being programmed or erased
+ * @param timeoutMs the maximum time to wait, in milliseconds
+ * @param polls if not NULL, the number of status reads it took is added to the value here
+ * @return true if the operation completed, false if it was still in progress after timeoutMs
  */
-void eraseSector(uint16_t sectorIndex);
+bool waitForToggleBit(uint32_t address, uint32_t timeoutMs, uint16_t *polls = NULL);
 
 /**
- * @brief Erases the SST39SF chip. Requires the data pins to be set to output.
- * 
- * Fails if compiled with DEBUG defined and the data pins are not set to output.
+ * @brief Checks, without waiting, whether an internal operation of the chip is in progress: reads the toggle bit
+ * (DQ6) twice, and sees whether it changed. Sets the data pins to input.
  * 
+ * @param address an address within the area being programmed or erased
+ * @return true if the operation is still in progress
  */
-void eraseChip();
+bool toggleBitToggling(uint32_t address);
 
 #endif  // SST39SF_PROGRAMMER_READ_WRITE_H
\ No newline at end of file
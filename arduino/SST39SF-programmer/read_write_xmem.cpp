@@ -0,0 +1,106 @@
+/*
+ * Implementation of the bus cycles in read_write.h for the XMEM backend: the SST39SF is mapped into the ATmega2560's
+ * external data space (see pinout.h for the wiring), so that each bus cycle is a single ld/st instruction, and the
+ * interface times the RD/WR/ALE strobes in hardware. See read_write.cpp for the pins backend.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "pinout.h"
+
+#if BUS_BACKEND == BUS_BACKEND_XMEM
+
+#include "read_write.h"
+#include "sst_constants.h"
+
+#include <Arduino.h>
+
+// Chip address bits within the window, and the bits above it which select the window
+#define XMEM_WINDOW_MASK ((1UL << XMEM_WINDOW_BITS) - 1)
+#if ADDRESS_BUS_LENGTH > XMEM_WINDOW_BITS
+#define XMEM_BANK_MASK ((1 << (ADDRESS_BUS_LENGTH - XMEM_WINDOW_BITS)) - 1)
+#else
+#define XMEM_BANK_MASK 0  // the whole chip fits in the window
+#endif
+
+/* What is currently on the bank pins (setupAddressPins clears them). They are only written when it changes, which
+for sequential accesses is once every 32KB. */
+static uint8_t currentBank = 0;
+
+//=============================================================================
+//             PIN CONFIGURATION
+//=============================================================================
+
+// See header comment.
+void setupControlPins() {
+    /* Enable the interface, with no sector limit (so the whole external space is the upper sector) and one wait
+    state on its strobes: RD/WR are then low for about 125ns at 16MHz, comfortably more than the chip's access time
+    plus the latch's propagation delay. Port C is used in full, for A8-15. */
+    XMCRB = 0;
+    XMCRA = _BV(SRE) | _BV(SRW10);
+}
+
+// See header comment.
+void setupAddressPins() {
+    XMEM_BANK_DDR |= XMEM_BANK_MASK;
+    XMEM_BANK_PORT &= ~XMEM_BANK_MASK;
+    currentBank = 0;
+}
+
+// See header comment.
+void setDataPinsIn() {
+    // The interface sets the direction of AD0-7 itself, for each bus cycle
+}
+
+// See header comment.
+void setDataPinsOut() {
+    // The interface sets the direction of AD0-7 itself, for each bus cycle
+}
+
+//=============================================================================
+//             BUS MANAGEMENT
+//=============================================================================
+
+/**
+ * @brief Puts the window that an address is in onto the bank pins, and gets where the address is in the AVR's data
+ * space.
+ *
+ * @param address the chip address
+ * @return uint16_t the address in the AVR's data space which the chip address appears at
+ */
+static uint16_t selectWindow(uint32_t address) {
+    uint8_t bank = (uint8_t)(address >> XMEM_WINDOW_BITS) & XMEM_BANK_MASK;
+    if (bank != currentBank) {
+        XMEM_BANK_PORT = (XMEM_BANK_PORT & ~XMEM_BANK_MASK) | bank;
+        currentBank = bank;
+    }
+    return (uint16_t)(XMEM_WINDOW_BASE + (address & XMEM_WINDOW_MASK));
+}
+
+//=============================================================================
+//             READING/WRITING DATA
+//=============================================================================
+
+// See header comment.
+byte readByte(uint32_t address) {
+    return _MMIO_BYTE(selectWindow(address));
+}
+
+// See header comment.
+void sendByte(uint32_t address, byte data) {
+    _MMIO_BYTE(selectWindow(address)) = data;
+}
+
+#endif  // BUS_BACKEND == BUS_BACKEND_XMEM
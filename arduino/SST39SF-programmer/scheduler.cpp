@@ -0,0 +1,71 @@
+/*
+ * Implementation of the cooperative scheduler. See scheduler.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "scheduler.h"
+#include "communication_util.h"
+
+/** @brief A task, and when its last step started. */
+struct Task {
+    TaskStep step;
+    uint32_t intervalMs;
+    bool usesBus;
+    bool running;  // whether a step is on the stack (i.e. we were called from a yield inside it)
+    uint32_t lastStartMs;
+};
+
+static Task tasks[MAX_TASKS];
+static uint8_t taskCount = 0;
+
+// See header comment.
+void schedulerAddTask(TaskStep step, uint32_t intervalMs, bool usesBus) {
+    if (taskCount >= MAX_TASKS) fail("Too many tasks: increase MAX_TASKS.");
+    Task &task = tasks[taskCount++];
+    task.step = step;
+    task.intervalMs = intervalMs;
+    task.usesBus = usesBus;
+    task.running = false;
+    task.lastStartMs = millis() - intervalMs;  // due straight away
+}
+
+/**
+ * @brief Runs a step of each task which is due, and which may run now.
+ * 
+ * @param busBusy whether tasks which access the chip must not run
+ */
+static void runDueTasks(bool busBusy) {
+    for (uint8_t i = 0; i < taskCount; i++) {
+        Task &task = tasks[i];
+        if (task.running || (busBusy && task.usesBus)) continue;
+        if (task.intervalMs != 0 && millis() - task.lastStartMs < task.intervalMs) continue;
+
+        task.lastStartMs = millis();
+        task.running = true;
+        task.step();
+        task.running = false;
+    }
+}
+
+// See header comment.
+void schedulerRun() {
+    runDueTasks(false);
+}
+
+// See header comment.
+void schedulerYield(bool busBusy) {
+    runDueTasks(busBusy);
+}
@@ -0,0 +1,59 @@
+/*
+ * A small cooperative scheduler. The firmware's work is split into tasks: handling serial input from the driver
+ * (which runs whole transactions), sending queued output to the driver (see tx_queue.h), advancing the chip's
+ * background operations (such as a sector erase started while the sector's data is received), and production mode's
+ * chip insertion detection. Each task is a function which does a step of work and returns; loop() runs them in turn.
+ * 
+ * A task which has to wait (for a byte from the driver, or for the chip to finish an operation) calls
+ * schedulerYield while it waits, which runs the other tasks that are due, so that a long transaction never holds up
+ * the rest of the firmware. Tasks are never re-entered: a task running inside a yield is not run again until it
+ * returns.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_SCHEDULER_H
+#define SST39SF_PROGRAMMER_SCHEDULER_H
+
+#include <Arduino.h>
+
+/** @brief A step of a task's work. It must return once the step is done, calling schedulerYield if it waits. */
+typedef void (*TaskStep)();
+
+/** @brief Maximum number of tasks. */
+const uint8_t MAX_TASKS = 4;
+
+/**
+ * @brief Adds a task. Tasks run in the order they were added. Call from setup().
+ * 
+ * @param step the task's step function
+ * @param intervalMs the minimum time between the starts of two of its steps, or 0 to run it whenever possible
+ * @param usesBus whether its steps access the chip: if so, it is not run by a yield from a task which is part way
+ * through an operation on the chip (see schedulerYield)
+ */
+void schedulerAddTask(TaskStep step, uint32_t intervalMs, bool usesBus);
+
+/** @brief Runs a step of each task which is due. Call from loop(). */
+void schedulerRun();
+
+/**
+ * @brief Runs a step of each task which is due and not already running, from a task which is waiting.
+ * 
+ * @param busBusy whether the waiting task is part way through an operation on the chip (e.g. polling it for the end
+ * of a program or erase), in which case tasks which access the chip are not run
+ */
+void schedulerYield(bool busBusy = false);
+
+#endif  // SST39SF_PROGRAMMER_SCHEDULER_H
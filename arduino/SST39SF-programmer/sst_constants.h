@@ -1,5 +1,5 @@
 /*
- * Constants that define parameters of the SST39SF chip.
+ * Constants that define parameters of the chip being programmed (an SST39SF, unless CHIP_FAMILY says otherwise).
  * 
  * Copyright (C) 2023 Alexander Gillon
  * 
@@ -19,6 +19,28 @@
 #ifndef SST39SF_PROGRAMMER_SST_CONSTANTS_H
 #define SST39SF_PROGRAMMER_SST_CONSTANTS_H
 
+#include "protocol.h"  // for SST_SECTOR_SIZE
+
+//=============================================================================
+//  Chip family: set CHIP_FAMILY to the kind of chip in the socket
+//=============================================================================
+//
+//      CHIP_FAMILY                 Chips                      Implementation
+//
+//   CHIP_FAMILY_SST39SF    SST39SF010/020/040              chip_sst39sf.cpp
+//   CHIP_FAMILY_AT28C256   AT28C256 (EEPROM)               chip_at28c256.cpp
+//   CHIP_FAMILY_29F010     Am29F010 and compatibles        chip_29f010.cpp
+//
+//=============================================================================
+
+#define CHIP_FAMILY_SST39SF 1
+#define CHIP_FAMILY_AT28C256 2
+#define CHIP_FAMILY_29F010 3
+
+#ifndef CHIP_FAMILY
+#define CHIP_FAMILY CHIP_FAMILY_SST39SF
+#endif
+
 //=============================================================================
 //  Chip constants: change these if you are using a different size chip
 //=============================================================================
@@ -28,13 +50,25 @@
 //         SST39SF010              17                     131072
 //         SST39SF020              18                     262144
 //         SST39SF040              19                     524288
+//         AT28C256                15                      32768
+//         Am29F010                17                     131072
 //
 //=============================================================================
 
+#if CHIP_FAMILY == CHIP_FAMILY_SST39SF
 #define ADDRESS_BUS_LENGTH 18    // Length of the address bus: depends on chip size
-#define DATA_BUS_LENGTH 8        // Length of the data bus: always 8 bits
 #define SST_FLASH_SIZE 262144    // Number of bytes of flash on the chip: depends on chip size
-#define SST_SECTOR_SIZE 4096     // Number of bytes in a sector: always 4096 bytes
+#elif CHIP_FAMILY == CHIP_FAMILY_AT28C256
+#define ADDRESS_BUS_LENGTH 15
+#define SST_FLASH_SIZE 32768
+#elif CHIP_FAMILY == CHIP_FAMILY_29F010
+#define ADDRESS_BUS_LENGTH 17
+#define SST_FLASH_SIZE 131072
+#else
+#error "Unknown CHIP_FAMILY: see sst_constants.h"
+#endif
+
+#define DATA_BUS_LENGTH 8        // Length of the data bus: always 8 bits
 #define SST_NUMBER_SECTORS (SST_FLASH_SIZE / SST_SECTOR_SIZE)  
 
 #endif  // SST39SF_PROGRAMMER_SST_CONSTANTS_H
\ No newline at end of file
@@ -0,0 +1,71 @@
+/*
+ * Implementation of the transmit queue. See tx_queue.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "tx_queue.h"
+
+/* How many bytes txQueueWrite adds between moving bytes on to HardwareSerial: at 115200 baud, its buffer takes over
+5ms to drain, so this is often enough to keep it from running dry. */
+const uint16_t PUMP_INTERVAL = 16;
+
+/* The queue is a ring buffer. Only the main program touches it (HardwareSerial's interrupt only sees what has been
+moved into its own buffer), so nothing here needs to be volatile. */
+static byte queue[TX_QUEUE_SIZE];
+static uint16_t head = 0;   // index of the next byte to send
+static uint16_t count = 0;  // number of bytes waiting to be sent
+
+// See header comment.
+void txQueueWrite(byte b) {
+    while (count == TX_QUEUE_SIZE) txQueuePump();
+    queue[(head + count) % TX_QUEUE_SIZE] = b;
+    count++;
+}
+
+// See header comment.
+void txQueueWrite(const byte *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        txQueueWrite(data[i]);
+        if (i % PUMP_INTERVAL == PUMP_INTERVAL - 1) txQueuePump();
+    }
+}
+
+// See header comment.
+void txQueueWrite(const char *s) {
+    while (*s != '\0') txQueueWrite((byte)*s++);
+}
+
+// See header comment.
+void txQueuePump() {
+    int room = Serial.availableForWrite();
+    while (count > 0 && room > 0) {
+        // send up to the end of the ring at most, then go round again for the part at the start
+        uint16_t chunk = count;
+        if (chunk > TX_QUEUE_SIZE - head) chunk = TX_QUEUE_SIZE - head;
+        if (chunk > (uint16_t)room) chunk = (uint16_t)room;
+
+        Serial.write(queue + head, chunk);
+        head = (head + chunk) % TX_QUEUE_SIZE;
+        count -= chunk;
+        room -= chunk;
+    }
+}
+
+// See header comment.
+void txQueueFlush() {
+    while (count > 0) txQueuePump();
+    Serial.flush();
+}
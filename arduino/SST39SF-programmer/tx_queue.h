@@ -0,0 +1,70 @@
+/*
+ * Transmit queue: everything the firmware sends the driver goes through here, rather than straight to Serial.
+ * 
+ * HardwareSerial's own transmit buffer is only 64 bytes, so writing a sector's worth of data to it blocks the CPU as
+ * soon as it fills, for as long as the UART takes to send the rest. The queue holds TX_QUEUE_SIZE bytes more, and is
+ * moved into HardwareSerial's buffer (which its data register empty interrupt sends from) only as room appears,
+ * without ever waiting for it. The scheduler's TX task does this between the other tasks' steps and at their yields
+ * (see scheduler.h), so a sector read from the chip or echoed to the driver keeps going out while the firmware reads
+ * the chip or waits for the driver.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_TX_QUEUE_H
+#define SST39SF_PROGRAMMER_TX_QUEUE_H
+
+#include <Arduino.h>
+
+/** @brief Number of bytes the queue holds, on top of HardwareSerial's transmit buffer. */
+const uint16_t TX_QUEUE_SIZE = 512;
+
+/**
+ * @brief Adds a byte to the queue. If the queue is full, sends from it until there is room.
+ * 
+ * @param b the byte
+ */
+void txQueueWrite(byte b);
+
+/**
+ * @brief Adds bytes to the queue, moving them on to HardwareSerial as they go (see txQueuePump), so that the UART
+ * is kept busy while a long run of bytes is added. If the queue fills, sends from it until there is room for the
+ * rest.
+ * 
+ * @param data the bytes
+ * @param length the number of bytes
+ */
+void txQueueWrite(const byte *data, uint16_t length);
+
+/**
+ * @brief Adds a string to the queue, without its null terminator (as Serial.write does).
+ * 
+ * @param s the null-terminated string
+ */
+void txQueueWrite(const char *s);
+
+/**
+ * @brief Moves as much of the queue into HardwareSerial's transmit buffer as fits, without waiting. This is the TX
+ * task's step.
+ */
+void txQueuePump();
+
+/**
+ * @brief Waits until everything in the queue has been sent on the wire: for example, before changing the baud rate,
+ * or before the firmware stops running tasks.
+ */
+void txQueueFlush();
+
+#endif  // SST39SF_PROGRAMMER_TX_QUEUE_H
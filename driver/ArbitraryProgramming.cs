@@ -14,15 +14,17 @@
  *
  *   -------------------------------------------------------------------------------------------------------------------
  *
- *   NOTE: instructions are allowed to touch the same sectors. This is because instructions are first applied to a
- *   'copy' of the SST39SF's sectors in the memory of this process, before then writing all the modified sectors to
- *   the chip. Otherwise, if we immediately wrote changes to the SST39SF chip, then some instructions may be
- *   overwritten (as programming a sector on the SST39SF erases it before writing).
+ *   NOTE: instructions are allowed to touch the same sectors. This is because the instructions are first compiled
+ *   into an in-memory image of the chip, before then writing all the modified sectors to the chip. Otherwise, if we
+ *   immediately wrote changes to the SST39SF chip, then some instructions may be overwritten (as programming a sector
+ *   on the SST39SF erases it before writing). Compiling reads each binary file exactly once, and merges the bytes
+ *   written into an ordered list of runs (maximal ranges of consecutive written bytes, whichever files they came
+ *   from), which is what is programmed: bytes of a touched sector outside every run are programmed as 0x00.
  *
  *   NOTE: overlapping instructions (i.e. instructions that would cause part of one binary file to be overwritten by
  *   part of another) are forbidden by default. Supply the additional -o command line flag to allow overlapping
  *   instructions. If instructions overlap, they are applied in the order they are encountered (i.e. later instructions
- *   overwrite earlier ones).
+ *   overwrite earlier ones, byte by byte).
  *
  *   Take caution when writing overlapping instruction files.
  *
@@ -51,8 +53,8 @@
  */
 using System;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.IO;
-using System.Security;
 using System.Text;
 
 /// <summary> Class which handles writes to arbitrary addresses on the SST39SF. Uses a special file format,
@@ -63,256 +65,248 @@ internal static class ArbitraryProgramming {
     //=============================================================================
     
     /// <summary>
-    /// Executes the instructions in the instruction file. See ArbitraryProgramming.cs for instruction file format.
+    /// Builds the plan for the instructions in the instruction file. See ArbitraryProgramming.cs for instruction file
+    /// format. On error, prints an error message and exits.
     ///
-    /// This is achieved by first applying all instructions to a 'copy' of the SST39SF's sectors in the memory of this
-    /// process, before then writing all the modified sectors to the chip. This allows multiple instructions to
-    /// touch the same sector - if we immediately wrote changes to the SST39SF chip, then some instructions may be
+    /// This is achieved by compiling all instructions into an in-memory image of the SST39SF (see Compile). The plan
+    /// then writes every sector touched by the image's runs to the chip. This allows multiple instructions to touch
+    /// the same sector - if we immediately wrote changes to the SST39SF chip, then some instructions may be
     /// overwritten (as programming a sector on the SST39SF erases it before writing).
     /// </summary>
-    /// <param name="arduino">A serial port connected to the Arduino.</param>
     /// <param name="path">Path to the instruction file.</param>
     /// <param name="overlapsEnabled">Whether overlapping binary files in the instruction file is allowed.</param>
-    internal static void ExecuteInstructions(Arduino arduino, string path, bool overlapsEnabled) {
-        /* Maps the index of a sector that has been touched by the instructions to the data of that sector. This is
-         * needed so that we can handle multiple instructions touching the same sector - if we immediately wrote
-         * changes to the SST39SF chip, then some instructions may be overwritten (as programming a sector on the
-         * SST39SF erases it before writing). This dictionary allows us to unify changes before writing the entire
-         * modified sectors to the chip. */
-        Dictionary<int, byte[]> sectorIndexToData = new Dictionary<int, byte[]>();
-        List<Tuple<int, string>> instructions = new List<Tuple<int, string>>();
-
+    /// <returns>A plan which programs every sector touched by the instructions.</returns>
+    internal static ProgrammingPlan BuildPlan(string path, bool overlapsEnabled) {
         string instructionFilePath = path.Trim('"').Trim('\'');
-        using (StreamReader instructionFile = OpenInstructionFile(instructionFilePath)) {
-            while (true) {
-                string instruction = instructionFile.ReadLine();
-                if (instruction == null) break;
-                if (instruction[0] == '#') continue;
+        List<Instruction> instructions = ReadInstructions(instructionFilePath);
 
-                int firstSpaceIndex = instruction.IndexOf(' ');
-                int address = ConvertAddress(instruction.Substring(0, firstSpaceIndex), instruction, instructionFilePath);
-                string binaryPath = instruction.Substring(firstSpaceIndex+1);
-                
-                instructions.Add(new Tuple<int, string>(address, binaryPath));
+        Stopwatch stopwatch = Stopwatch.StartNew();
+        byte[] image = new byte[Arduino.MAX_FLASH_SIZE];
+        List<Run> runs = Compile(instructions, overlapsEnabled, image);
+
+        /* Maps the index of each sector touched by a run to its data, and to the number of its bytes the runs
+         * cover. */
+        Dictionary<int, byte[]> sectorIndexToData = new Dictionary<int, byte[]>();
+        Dictionary<int, int> sectorIndexToCoverage = new Dictionary<int, int>();
+        foreach (Run run in runs) {
+            for (int sectorIndex = run.Start / Arduino.SST_SECTOR_SIZE;
+                 sectorIndex <= (run.End - 1) / Arduino.SST_SECTOR_SIZE; sectorIndex++) {
+                int sectorAddress = sectorIndex * Arduino.SST_SECTOR_SIZE;
+                if (!sectorIndexToData.ContainsKey(sectorIndex)) {
+                    byte[] sectorData = new byte[Arduino.SST_SECTOR_SIZE];
+                    Buffer.BlockCopy(image, sectorAddress, sectorData, 0, Arduino.SST_SECTOR_SIZE);
+                    sectorIndexToData[sectorIndex] = sectorData;
+                    sectorIndexToCoverage[sectorIndex] = 0;
+                }
+                sectorIndexToCoverage[sectorIndex] += Math.Min(run.End, sectorAddress + Arduino.SST_SECTOR_SIZE)
+                                                      - Math.Max(run.Start, sectorAddress);
             }
         }
-        
-        CheckOverlap(instructions, overlapsEnabled);
-        
-        foreach (Tuple<int, string> instruction in instructions) {
-            int startingAddress = instruction.Item1;
-            string filePath = instruction.Item2;
-            ProcessInstruction(sectorIndexToData, startingAddress, filePath);
-        }
-        
-        ProgramSectors(arduino, sectorIndexToData);
-        
-        Console.WriteLine("Finished processing instructions from instruction file.");
+        stopwatch.Stop();
+
+        PrintSummary(instructions, runs, sectorIndexToCoverage, stopwatch.ElapsedMilliseconds);
+        return new ProgrammingPlan("-a " + instructionFilePath, sectorIndexToData);
     }
-    
+
     //=============================================================================
-    //             CHECKING FOR OVERLAPS IN INSTRUCTIONS
+    //             READING INSTRUCTIONS
     //=============================================================================
-    
+
     /// <summary>
-    /// POCO class to record a 'file interval'. Essentially an interval in the memory of the SST39SF where that file
-    /// resides. This is used to check whether any files would overlap in memory if we were to execute all the
-    /// instructions.
+    /// POCO class to record an instruction, of the form 'program [DATA] (read from [PATH]) to the SST39SF, starting
+    /// at address [ADDRESS]'.
     /// </summary>
-    private class FileInterval {
-        public long StartingAddress { get; private set; }
-        public long EndingAddress { get; private set; }
+    private class Instruction {
+        public int Address { get; private set; }
         public string FilePath { get; private set; }
+        public byte[] Data { get; private set; }
 
-        public FileInterval(long startingAddress, long endingAddress, string filePath) {
-            StartingAddress = startingAddress;
-            EndingAddress = endingAddress;
+        /** The address just past the end of the data. */
+        public int End {
+            get { return Address + Data.Length; }
+        }
+
+        public Instruction(int address, string filePath, byte[] data) {
+            Address = address;
             FilePath = filePath;
+            Data = data;
         }
     }
 
     /// <summary>
-    /// Checks for overlapping instructions in the arbitrary programming instruction file. If overlaps are enabled,
-    /// prints a warning on finding an overlap and continues. Otherwise, prints an error message and aborts.
-    ///
-    /// There is no guarantee that this function will print all overlaps. The only guarantee is that if an overlap
-    /// exists, this function will find it.
+    /// Reads the instructions in an instruction file, and the data of each. On error, prints an error message and
+    /// exits.
     /// </summary>
-    /// <param name="instructions">The instructions in the instruction file, as pairs of starting address
-    /// and file paths.</param>
-    /// <param name="overlapsEnabled">Whether overlapping instructions are allowed.</param>
-    private static void CheckOverlap(List<Tuple<int, string>> instructions, bool overlapsEnabled) {
-        List<FileInterval> fileIntervals = new List<FileInterval>();
-        
-        foreach (Tuple<int, string> instruction in instructions) {
-            int startingAddress = instruction.Item1;
-            string filePath = instruction.Item2;
-            fileIntervals.Add(new FileInterval(startingAddress, startingAddress + FileLength(filePath), filePath));
-        }
-        
-        fileIntervals.Sort((fileInterval1, fileInterval2) => fileInterval1.StartingAddress.CompareTo(fileInterval2.StartingAddress));
+    /// <param name="instructionFilePath">The path of the instruction file.</param>
+    /// <returns>The instructions, in the order they appear in the file.</returns>
+    private static List<Instruction> ReadInstructions(string instructionFilePath) {
+        List<Instruction> instructions = new List<Instruction>();
+        using (StreamReader instructionFile = OpenInstructionFile(instructionFilePath)) {
+            while (true) {
+                string instruction = instructionFile.ReadLine();
+                if (instruction == null) break;
+                if (instruction[0] == '#') continue;
 
-        for (int i = 0; i < fileIntervals.Count - 1; i++) {
-            FileInterval thisInterval = fileIntervals[i];
-            FileInterval nextInterval = fileIntervals[i + 1];
-            if (nextInterval.StartingAddress < thisInterval.EndingAddress) {
-                string message = String.Format("{0}: file {1} of length 0x{2:X}, which starts at address 0x{3:X} and " +
-                                               "ends at address 0x{4:X} overlaps with file {5} of length 0x{6:X}, which " +
-                                               "starts at address 0x{7:X} and ends at address 0x{8:X}.",
-                    overlapsEnabled ? "Warning" : "Error", thisInterval.FilePath, 
-                    thisInterval.EndingAddress - thisInterval.StartingAddress, thisInterval.StartingAddress, 
-                    thisInterval.EndingAddress, nextInterval.FilePath, 
-                    nextInterval.EndingAddress - nextInterval.StartingAddress, nextInterval.StartingAddress,
-                    nextInterval.EndingAddress);
-                if (overlapsEnabled) {
-                    Console.WriteLine(message);
-                } else {
-                    Util.PrintAndExit(message);   
-                }
+                int firstSpaceIndex = instruction.IndexOf(' ');
+                int address = ConvertAddress(instruction.Substring(0, firstSpaceIndex), instruction, instructionFilePath);
+                string binaryPath = instruction.Substring(firstSpaceIndex+1);
+                Util.WriteLineVerbose("Received instruction to write file " + binaryPath + " starting at address 0x" +
+                                      address.ToString("X") + ".");
+
+                instructions.Add(new Instruction(address, binaryPath, ReadBinaryFile(address, binaryPath)));
             }
         }
+        return instructions;
     }
 
     /// <summary>
-    /// Gets the length of a file, in bytes. On error, prints an error message and exits.
+    /// Reads the whole of an instruction's binary file, checking that it fits on the chip where it is to be written.
+    /// On error, prints an error message and exits.
     /// </summary>
-    /// <param name="path">Path to the file.</param>
-    /// <returns>The length of that file, in bytes.</returns>
-    private static long FileLength(string path) {
-        try {
-            return new FileInfo(path).Length;
-        } catch (ArgumentException e) {
-            Util.PrintAndExit("Binary file path is invalid:\n" + e);
-        } catch (PathTooLongException) {
-            Util.PrintAndExit("Path " + path + " is too long.");
-        } catch (SecurityException) {
-            Util.PrintAndExit("Internal error (SecurityException): " + path);
-        } catch (UnauthorizedAccessException) {
-            Util.PrintAndExit("Invalid permissions to open " + path);
-        } catch (NotSupportedException e) {
-            Util.PrintAndExit("Binary file path is invalid:\n" + e);
-        }
+    /// <param name="address">The starting address of the instruction.</param>
+    /// <param name="path">The path of the file in the instruction.</param>
+    /// <returns>The contents of the file.</returns>
+    private static byte[] ReadBinaryFile(int address, string path) {
+        using (FileStream binaryFile = Util.OpenBinaryFile(path)) {
+            if (binaryFile.Length == 0) Util.PrintAndExit("Error: file " + path + " is empty.");
+            if (address < 0 || address + binaryFile.Length > Arduino.MAX_FLASH_SIZE) {
+                Util.PrintAndExit(String.Format("Error: file {0} of length 0x{1:X}, which starts at address 0x{2:X}, " +
+                                                "does not fit on the largest chip (0x{3:X} bytes).", path,
+                    binaryFile.Length, address, Arduino.MAX_FLASH_SIZE));
+            }
 
-        return -1;  // for the compiler
+            byte[] data = new byte[binaryFile.Length];
+            int bytesRead = 0;
+            while (bytesRead < data.Length) {
+                int count = binaryFile.Read(data, bytesRead, data.Length - bytesRead);
+                if (count == 0) {
+                    Util.PrintAndExit("Internal error: binary filestream ended before its length while reading " +
+                                      path + ".");
+                }
+                bytesRead += count;
+            }
+            return data;
+        }
     }
-    
+
     //=============================================================================
-    //             PROCESSING INSTRUCTIONS
+    //             COMPILING INSTRUCTIONS
     //=============================================================================
-    
+
     /// <summary>
-    /// Processes an instruction on our in-memory copy of the SST39SF's sectors (sectorIndexToData).
-    /// An instruction is of the form 'program [FILE] to the SST39SF, starting at address [ADDRESS]'.
+    /// POCO class to record a run: a maximal range of consecutive bytes written by the instructions, whichever
+    /// instructions wrote them.
     /// </summary>
-    /// <param name="sectorIndexToData">A map from sector index to sector data of all sectors that have been
-    /// affected by instructions so far. This is our in-memory copy of the SST39SF's sectors, and where we
-    /// apply any changes from the current instruction to (creating new sectors in the dictionary if they do
-    /// not exist).</param>
-    /// <param name="address">The startingAddress of the instruction.</param>
-    /// <param name="path">The path of the file in the instruction.</param>
-    private static void ProcessInstruction(Dictionary<int, byte[]> sectorIndexToData, int address, string path) {
-        Util.WriteLineVerbose("Received instruction to write file " + path + " starting at address 0x" + address.ToString("X") + ".");
+    private class Run {
+        public int Start { get; private set; }
+        public int Length { get; private set; }
 
-        using (FileStream binaryFile = Util.OpenBinaryFile(path)) {
-            if (binaryFile.Length == 0) Util.PrintAndExit("Error: file " + path + " is empty.");
+        /** The address just past the end of the run. */
+        public int End {
+            get { return Start + Length; }
+        }
 
-            ProcessFirstSector(sectorIndexToData, address, binaryFile);
-            
-            int sector = address / Arduino.SST_SECTOR_SIZE + 1;
-            ProcessRemainingSectors(sectorIndexToData, sector, binaryFile);
+        public Run(int start, int length) {
+            Start = start;
+            Length = length;
         }
     }
-    
+
     /// <summary>
-    /// Processes the first sector of an instruction on our in-memory copy of the SST39SF's sectors (sectorIndexToData).
-    /// This involves padding the beginning of the data so that it aligns with sector boundaries, if this is the
-    /// first time we have modified this specific sector. 
+    /// Compiles the instructions into an image of the SST39SF, applying them in order so that where they overlap, the
+    /// last one wins, and merges the bytes they write into runs. Each instruction is reported against each latest
+    /// earlier instruction it overwrites (the last to have written some of its bytes), once: if instructions A, B and C
+    /// all cover the same bytes, A-B and B-C are reported, but not A-C. Overlaps are reported as warnings if they are
+    /// enabled, and otherwise as an error, and the program aborts at the first.
+    ///
+    /// This takes time linear in the size of the chip and the data, however the instructions are laid out, so it
+    /// takes milliseconds even for instruction files with thousands of small patches.
     /// </summary>
-    /// <param name="sectorIndexToData">A map from sector index to sector data of all sectors that have been
-    /// affected by instructions so far. This is our in-memory copy of the SST39SF's sectors, and where we
-    /// apply any changes from the current sector to (creating a new sector in the dictionary if it does
-    /// not exist).</param>
-    /// <param name="startingAddress">The startingAddress that the first piece of data should start at.</param>
-    /// <param name="binaryFile">The data to write at that startingAddress. Data is read from here until the end
-    /// of the sector (which is a variable amount based on starting startingAddress).</param>
-    private static void ProcessFirstSector(Dictionary<int, byte[]> sectorIndexToData, int startingAddress,
-        FileStream binaryFile) {
-        // First, we calculate which sector the starting address is a part of, and pad the beginning of the data
-        // with null bytes so that we can overwrite the entire sector while still having the data start at the
-        // right place
-        int sectorIndex = startingAddress / Arduino.SST_SECTOR_SIZE;
-        int sectorAddress = sectorIndex * Arduino.SST_SECTOR_SIZE;
-        int bytesToSkip = startingAddress - sectorAddress;
-        int remainingBytes = Arduino.SST_SECTOR_SIZE - bytesToSkip;
+    /// <param name="instructions">The instructions, in the order they appear in the instruction file.</param>
+    /// <param name="overlapsEnabled">Whether overlapping instructions are allowed.</param>
+    /// <param name="image">The image to compile into: Arduino.MAX_FLASH_SIZE bytes, all zero. Bytes not written by
+    /// any instruction are left zero.</param>
+    /// <returns>The runs, in order of address.</returns>
+    private static List<Run> Compile(List<Instruction> instructions, bool overlapsEnabled, byte[] image) {
+        // The index of the instruction which last wrote each byte of the image, plus one: 0 if none has
+        int[] writers = new int[image.Length];
+        for (int i = 0; i < instructions.Count; i++) {
+            Instruction instruction = instructions[i];
+            Buffer.BlockCopy(instruction.Data, 0, image, instruction.Address, instruction.Data.Length);
 
-        byte[] firstSectorData;
-        if (sectorIndexToData.ContainsKey(sectorIndex)) {
-            // We have already modified this sector: use the modified sector so we don't drop instructions
-            firstSectorData = sectorIndexToData[sectorIndex];
-        } else {
-            firstSectorData = new byte[Arduino.SST_SECTOR_SIZE];
-            sectorIndexToData[sectorIndex] = firstSectorData;
+            HashSet<int> overlapped = new HashSet<int>();
+            for (int address = instruction.Address; address < instruction.End; address++) {
+                int writer = writers[address];
+                if (writer != 0 && overlapped.Add(writer)) {
+                    ReportOverlap(instructions[writer - 1], instruction, overlapsEnabled);
+                }
+                writers[address] = i + 1;
+            }
         }
-        
-        /* Reads the data to be programmed into our in-memory sector. Starting at bytesToSkip implicitly pads
-         * firstSectorData with the correct amount of null bytes, if this is the first time we have modified this
-         * sector. Otherwise, if this is not the first time we have modified this sector, this simply starts
-         * writing the data at the appropriate place. */
-        if (binaryFile.Read(firstSectorData, bytesToSkip, remainingBytes) < remainingBytes
-                && binaryFile.Position != binaryFile.Length) {
-            Util.PrintAndExit("Internal error: binary filestream did not read a full sector, but is not" +
-                              "at the end of file.");
+
+        List<Run> runs = new List<Run>();
+        int runStart = -1;
+        for (int address = 0; address <= writers.Length; address++) {
+            bool written = address < writers.Length && writers[address] != 0;
+            if (written && runStart < 0) {
+                runStart = address;
+            } else if (!written && runStart >= 0) {
+                runs.Add(new Run(runStart, address - runStart));
+                runStart = -1;
+            }
         }
+        return runs;
     }
 
     /// <summary>
-    /// Processes the remaining sectors of an instruction (after the first has been programmed with ProgramFirstSector),
-    /// on our in-memory copy of the SST39SF's sectors (sectorIndexToData). These can be processed easily as the data
-    /// now aligns with sector boundaries.
+    /// Reports a pair of overlapping instructions. If overlaps are enabled, prints a warning and continues.
+    /// Otherwise, prints an error message and aborts.
     /// </summary>
-    /// <param name="sectorIndexToData">A map from sector index to sector data of all sectors that have been
-    /// affected by instructions so far. This is our in-memory copy of the SST39SF's sectors, and where we
-    /// apply any changes from the current instruction to (creating new sectors in the dictionary if they do
-    /// not exist).</param>
-    /// <param name="sectorIndex">The index of the sector to begin programming data at.</param>
-    /// <param name="binaryFile">The data to program.</param>
-    private static void ProcessRemainingSectors(Dictionary<int, byte[]> sectorIndexToData,
-        int sectorIndex, FileStream binaryFile) {
-        while (binaryFile.Position < binaryFile.Length) {
-            byte[] sectorData;
-            if (sectorIndexToData.ContainsKey(sectorIndex)) {
-                // We have already modified this sector: use the modified sector so we don't drop instructions
-                sectorData = sectorIndexToData[sectorIndex];
-            } else {
-                sectorData = new byte[Arduino.SST_SECTOR_SIZE];
-                sectorIndexToData[sectorIndex] = sectorData;
-            }
-            
-            // Reads the data to be programmed into our in-memory sector.
-            if (binaryFile.Read(sectorData, 0, Arduino.SST_SECTOR_SIZE) < Arduino.SST_SECTOR_SIZE 
-                    && binaryFile.Position != binaryFile.Length) {
-                Util.PrintAndExit("Internal error: binary filestream did not read a full sector, but is not" +
-                                  "at the end of file.");
-            }
-            
-            sectorIndex++;
+    /// <param name="earlier">The instruction which comes first in the instruction file.</param>
+    /// <param name="later">The instruction which comes later, and overwrites part of the earlier one.</param>
+    /// <param name="overlapsEnabled">Whether overlapping instructions are allowed.</param>
+    private static void ReportOverlap(Instruction earlier, Instruction later, bool overlapsEnabled) {
+        string message = String.Format("{0}: file {1} of length 0x{2:X}, which starts at address 0x{3:X} and " +
+                                       "ends at address 0x{4:X} overlaps with file {5} of length 0x{6:X}, which " +
+                                       "starts at address 0x{7:X} and ends at address 0x{8:X}.",
+            overlapsEnabled ? "Warning" : "Error", earlier.FilePath, earlier.Data.Length, earlier.Address,
+            earlier.End, later.FilePath, later.Data.Length, later.Address, later.End);
+        if (overlapsEnabled) {
+            Console.WriteLine(message);
+        } else {
+            Util.PrintAndExit(message);
         }
     }
 
-    //=============================================================================
-    //             WRITING CHANGES TO SST39SF CHIP
-    //=============================================================================
-
     /// <summary>
-    /// Programs the SST39SF with the modified sectors.
+    /// Prints what the instructions compiled into: the runs (if verbose), and how many sectors they touch, wholly or
+    /// in part.
     /// </summary>
-    /// <param name="arduino">A serial port connected to the Arduino.</param>
-    /// <param name="sectorIndexToData">A map from sector index to sector data of all sectors that have been
-    /// affected by instructions. This is our in-memory copy of the SST39SF's sectors.</param>
-    private static void ProgramSectors(Arduino arduino, Dictionary<int, byte[]> sectorIndexToData) {
-        foreach (KeyValuePair<int, byte[]> entry in sectorIndexToData) {
-            SectorProgramming.ProgramSector(arduino, new MemoryStream(entry.Value), entry.Key);
+    /// <param name="instructions">The instructions.</param>
+    /// <param name="runs">The runs they compiled into.</param>
+    /// <param name="sectorIndexToCoverage">Map from the index of each sector touched to the number of its bytes the
+    /// runs cover.</param>
+    /// <param name="elapsedMs">How long compiling took.</param>
+    private static void PrintSummary(List<Instruction> instructions, List<Run> runs,
+        Dictionary<int, int> sectorIndexToCoverage, long elapsedMs) {
+        long bytesRead = 0;
+        foreach (Instruction instruction in instructions) bytesRead += instruction.Data.Length;
+        long bytesWritten = 0;
+        foreach (Run run in runs) {
+            bytesWritten += run.Length;
+            Util.WriteLineVerbose(String.Format("Run 0x{0:X5} - 0x{1:X5} ({2} bytes).", run.Start, run.End - 1,
+                run.Length));
         }
+        int fullSectors = 0;
+        foreach (int coverage in sectorIndexToCoverage.Values) {
+            if (coverage == Arduino.SST_SECTOR_SIZE) fullSectors++;
+        }
+
+        Console.WriteLine(String.Format("Compiled {0} instructions ({1} bytes) into {2} runs ({3} bytes) in {4} ms: " +
+                                        "{5} sectors to program, {6} wholly written and {7} partly written (the rest " +
+                                        "of each is programmed as 0x00).", instructions.Count, bytesRead, runs.Count,
+            bytesWritten, elapsedMs, sectorIndexToCoverage.Count, fullSectors,
+            sectorIndexToCoverage.Count - fullSectors));
     }
 
     //=============================================================================
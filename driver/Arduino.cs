@@ -36,15 +36,32 @@ internal class Arduino : SerialPort {
     //  SST39SF010         131072    //
     //  SST39SF020         262144    //
     //  SST39SF040         524288    //
+    //  AT28C256            32768    //
+    //  Am29F010           131072    //
     //===============================//
-    internal const int SST_FLASH_SIZE = 262144;
+    /* The largest chip the sketch can be built for. Jobs are only checked against this until the driver connects:
+     * the Arduino then says how many sectors its chip has (see ChipSectors). */
+    internal const int MAX_FLASH_SIZE = 524288;
     internal const int SST_SECTOR_SIZE = 4096;  // the same for all chips
     
     
         
     /***** COMMUNICATION PARAMETERS *****/
     
-    private const int BAUD_RATE = 115200;
+    internal const int BAUD_RATE = 115200;  // until changed with BAUD (see Calibration.cs)
+    
+    // Rates that BAUD can switch to, fastest first, and the test pattern exchange: these must match protocol.h
+    internal static readonly int[] SERIAL_BAUD_RATES = { 2000000, 1000000, 500000, 250000, 230400, 115200 };
+    internal const int BAUD_TEST_PATTERN_LENGTH = 64;
+    internal const int BAUD_CHANGE_TIMEOUT_MS = 500;
+    internal const int DELTA_RUN_HEADER_LENGTH = 4;  // offset and length of a run in a DELTASECTOR delta
+
+    // Verification policies, and the length of the CRC echo that all but VERIFY_FULL use (see VerifyPolicy.cs)
+    internal const byte VERIFY_NONE = 0;
+    internal const byte VERIFY_CRC = 1;
+    internal const byte VERIFY_FULL = 2;
+    internal const byte VERIFY_SAMPLED = 3;
+    internal const int VERIFY_CRC_ECHO_LENGTH = 4;
 
     // Default arduino serial communication is 8N1
     private const int DATA_BITS = 8;
@@ -57,13 +74,27 @@ internal class Arduino : SerialPort {
         
     /***** MESSAGE LITERALS *****/
     
+    // These, and the data constants below, must match the firmware's protocol.h
     // Messages the Arduino sends us
     internal const string ARDUINO_WAIT_MESSAGE = "WAITING\0";
     internal const string CONFIRM_ERASE_MESSAGE = "CONFIRM?\0";
+    internal const string CHIP_INSERTED_MESSAGE = "CHIPINSERTED\0";
+    internal const string CHIP_REMOVED_MESSAGE = "CHIPREMOVED\0";
     
     // Messages we send the Arduino
     internal const string PROGRAM_SECTOR_MESSAGE = "PROGRAMSECTOR";
+    internal const string DELTA_SECTOR_MESSAGE = "DELTASECTOR";
     internal const string ERASE_CHIP_MESSAGE = "ERASECHIP";
+    internal const string ERASE_RANGE_MESSAGE = "ERASERANGE";
+    internal const string SECTOR_CRC_MESSAGE = "SECTORCRC";
+    internal const string CRC_TREE_MESSAGE = "CRCTREE";
+    internal const string HEALTH_MESSAGE = "HEALTH";
+    internal const string PRODUCTION_MESSAGE = "PRODUCTION";
+    internal const string END_CHIP_MESSAGE = "ENDCHIP";
+    internal const string BAUD_MESSAGE = "BAUD";
+    internal const string VERIFY_POLICY_MESSAGE = "VERIFYPOLICY";
+    internal const string BENCH_MESSAGE = "BENCH";
+    internal const string LINK_TEST_MESSAGE = "LINKTEST";
     internal const string DONE_MESSAGE = "DONE";
     
     
@@ -84,6 +115,12 @@ internal class Arduino : SerialPort {
     private Stack<int> _timeoutStack = new Stack<int>();
     /** Logger, which logs incoming/outgoing transmissions to a file for debugging. */
     private ArduinoDriverLogger _logger;
+
+    /** How the Arduino verifies the sectors it programs: see VerifyPolicy.cs. Set by VerifyPolicy.Apply. */
+    internal VerifyPolicy VerifyPolicy { get; set; }
+
+    /** The number of sectors on the chip that the sketch was built for, as the Arduino says when connecting. */
+    internal int ChipSectors { get; set; }
     
     //=============================================================================
     //             CONSTRUCTOR
@@ -96,7 +133,8 @@ internal class Arduino : SerialPort {
     /// <param name="serialPortName">The name of the serial port to open (e.g. 'COM3').</param>
     internal Arduino(string serialPortName) : base(serialPortName, BAUD_RATE, PARITY, DATA_BITS, STOP_BITS) {
         Open();
-        _logger = new ArduinoDriverLogger();
+        _logger = new ArduinoDriverLogger(BAUD_RATE);
+        VerifyPolicy = VerifyPolicy.Full;
     }
     
     //=============================================================================
@@ -210,6 +248,16 @@ internal class Arduino : SerialPort {
         _logger.Close();
     }
     
+    /// Wraps SerialPort.BaudRate for logging purposes. Functions the same as SerialPort.BaudRate to the caller, except
+    /// for logging changes to it, so that a captured session can be replayed at the same rates.
+    public new int BaudRate {
+        get { return base.BaudRate; }
+        set {
+            base.BaudRate = value;
+            _logger.LogBaudRate(value);
+        }
+    }
+
     /// Wraps SerialPort.ReadByte() for logging purposes. Functions the same as SerialPort.ReadByte() to
     /// the caller, except for logging the byte that was read.
     public new int ReadByte() {
@@ -34,48 +34,215 @@ internal static class ArduinoDriver {
     private enum OperationMode {
         WRITE_BINARY,     // write a binary file directly to the chip, starting at address 0
         ARBITRARY_WRITE,  // arbitrary writes based on a file with instructions: see ArbitraryProgramming.cs for format
-        ERASE_CHIP        // erase the chip
+        ERASE_CHIP,       // erase the chip, or a range of its sectors
+        HEALTH,           // print the chip's wear telemetry
+        CALIBRATE,        // measure the programmer setup, and save its timing profile for the port
+        VERIFY,           // check that the chip holds a binary file or image container, by sector CRCs
+        BENCH,            // time erasing, programming and verifying sectors on the Arduino, with no data on the link
+        LINK_TEST         // measure the serial link's latency and throughput at each baud rate
     }
     
     // the number of times to retry any communication operation with the Arduino before giving up
     internal const int NUM_RETRIES = 2;
     
+    /* Fixed timeouts. Where an operation's latency is tracked (see LatencyTracker.cs), these are only used until it
+     * has been observed a few times, and as the upper bound after that. */
     internal const int NORMAL_TIMEOUT = 2000;     // ms 
     internal const int EXTENDED_TIMEOUT = 10000;  // ms 
 
     internal const bool VERBOSE = true;  // prints extra debugging output
     
+    /// <summary> POCO class which holds the parsed command line arguments. </summary>
+    private class Options {
+        public string SerialPortName { get; set; }  // null for pack
+        public OperationMode Mode { get; set; }
+        public string FilePath { get; set; }        // only present for -w/-a/-v, null otherwise
+        public string PackPath { get; set; }        // pack: the image container to write, null otherwise
+        public bool OverlapsEnabled { get; set; }   // -o: only valid with -a
+        public bool PlanOnly { get; set; }          // --plan: only valid with -w/-a
+        public bool Resume { get; set; }            // --resume: only valid with -w/-a
+        public bool Incremental { get; set; }       // --incremental: only valid with -w/-a
+        public bool Compress { get; set; }          // --compress: only valid with pack
+        public int TagSector { get; set; }          // --tag: only valid with -w/-a, -1 if not present
+        public bool Production { get; set; }        // --production: only valid with -w/-a
+        public string FieldsPath { get; set; }      // --fields: only valid with -w/-a, null if not present
+        public int ScratchSector { get; set; }      // --calibrate: the sector it may program, -1 if not present
+        public VerifyPolicy Verify { get; set; }    // --verify: only valid with -w/-a, full if not present
+        public int BenchFirstSector { get; set; }   // --bench: the first sector to benchmark
+        public int BenchSectorCount { get; set; }   // --bench: the number of sectors to benchmark
+        public byte BenchPattern { get; set; }      // --pattern: only valid with --bench, random if not present
+        public int LinkPayloadLength { get; set; }  // --linktest: the length of each payload
+        public int LinkPayloadCount { get; set; }   // --linktest: the number of payloads each way at each baud rate
+        public int EraseFirstSector { get; set; }   // -e: the first sector to erase
+        public int EraseSectorCount { get; set; }   // -e: the number of sectors to erase, 0 for the whole chip
+    }
+    
     //=============================================================================
     //             MAIN
     //=============================================================================
 
     /// Main function: parses arguments and drives the Arduino accordingly.
     public static int Main(string[] args) {
-        string serialPortName;
-        OperationMode mode;
-        string path;
-        bool overlapsEnabled;
-        ParseArgs(args, out serialPortName, out mode, out path, out overlapsEnabled);
-        Arduino arduino = ConnectToArduino(serialPortName);
+        Options options = ParseArgs(args);
 
-        switch (mode) {
+        // Write jobs are planned in full before connecting, so that bad input fails before touching the chip
+        ProgrammingPlan plan = null;
+        if (options.Mode == OperationMode.WRITE_BINARY || options.Mode == OperationMode.VERIFY) {
+            plan = ProgrammingPlan.FromFile(options.FilePath);
+        } else if (options.Mode == OperationMode.ARBITRARY_WRITE) {
+            plan = ArbitraryProgramming.BuildPlan(options.FilePath, options.OverlapsEnabled);
+        }
+
+        if (options.PackPath != null) {
+            byte[] hash = ImageContainer.Write(options.PackPath, plan, options.Compress);
+            Console.WriteLine("Packed " + plan.SectorCount + " sectors into " + options.PackPath + ".");
+            Console.WriteLine("Image hash: " + BitConverter.ToString(hash).Replace("-", ""));
+            return 0;
+        }
+        if (options.Production && (options.Resume || options.Incremental || options.TagSector >= 0)) {
+            PrintHelpAndExit("--production can't be combined with --resume, --incremental or --tag.");
+        }
+        // A chip's production result must come from reading it back: with none, an empty socket would pass
+        if (options.Production && options.Verify.Policy == Arduino.VERIFY_NONE) {
+            PrintHelpAndExit("--production can't be combined with --verify none: use --verify crc for the quickest " +
+                             "check.");
+        }
+        // Each unit's plan is different (if only by its timestamp), so a unit's journal can't be resumed
+        if (options.FieldsPath != null && options.Resume) {
+            PrintHelpAndExit("--fields can't be combined with --resume: use --incremental to skip the sectors that " +
+                             "are already programmed.");
+        }
+        UnitTemplate template = null;
+        if (options.FieldsPath != null) template = UnitTemplate.Load(options.FieldsPath, plan);
+        if (options.TagSector >= 0 && plan.ContainsSector(options.TagSector)) {
+            Util.PrintAndExit("The job programs sector " + options.TagSector + ", which --tag reserves for the " +
+                              "identity tag.");
+        }
+        if (options.PlanOnly) {
+            TimingProfile profile = TimingProfile.ForPort(options.SerialPortName);
+            (template == null ? plan : template.BuildUnit()).PrintEstimate(profile, options.Verify);
+            if (template != null) template.PrintFields();
+            return 0;
+        }
+        
+        Arduino arduino = ConnectToArduino(options.SerialPortName);
+        CheckJobOnChip(options, plan, arduino);
+        if (options.Verify != VerifyPolicy.Full) options.Verify.Apply(arduino);
+
+        if (options.Production) {
+            Production.Run(arduino, plan, template);  // runs until the operator stops the program
+        }
+        if (template != null) plan = template.BuildUnit();
+
+        JobJournal journal = null;
+        TagCache cache = null;
+        if (options.Mode == OperationMode.WRITE_BINARY || options.Mode == OperationMode.ARBITRARY_WRITE) {
+            string journalPath = options.FilePath + JobJournal.JOURNAL_EXTENSION;
+            journal = options.Resume ? JobJournal.ResumeOrCreate(journalPath, plan, arduino)
+                                     : JobJournal.Create(journalPath, plan);
+            if (options.TagSector >= 0) cache = TagCache.Open(arduino, options.TagSector);
+        }
+
+        int exitCode = 0;
+        switch (options.Mode) {
             case OperationMode.WRITE_BINARY:
-                WriteBinary(arduino, path);
+                plan.Execute(arduino, journal, options.Incremental, cache);
+                FinishWrite(arduino, journal, cache, template);
+                Console.WriteLine("Finished writing binary to SST39SF.");
                 break;
             case OperationMode.ARBITRARY_WRITE:
-                ArbitraryProgramming.ExecuteInstructions(arduino, path, overlapsEnabled);
+                plan.Execute(arduino, journal, options.Incremental, cache);
+                FinishWrite(arduino, journal, cache, template);
+                Console.WriteLine("Finished processing instructions from instruction file.");
                 break;
             case OperationMode.ERASE_CHIP:
-                ChipErase.EraseChip(arduino);
+                if (options.EraseSectorCount == 0) {
+                    ChipErase.EraseChip(arduino);
+                } else if (!ChipErase.EraseRange(arduino, options.EraseFirstSector, options.EraseSectorCount)) {
+                    exitCode = 1;
+                }
+                break;
+            case OperationMode.HEALTH:
+                Health.PrintHealth(arduino);
+                break;
+            case OperationMode.CALIBRATE:
+                Calibration.Run(arduino, options.SerialPortName, options.ScratchSector);
+                break;
+            case OperationMode.VERIFY:
+                if (!plan.Verify(arduino)) exitCode = 1;
+                break;
+            case OperationMode.BENCH:
+                if (!Bench.Run(arduino, options.BenchFirstSector, options.BenchSectorCount, options.BenchPattern)) {
+                    exitCode = 1;
+                }
+                break;
+            case OperationMode.LINK_TEST:
+                if (!LinkTest.Run(arduino, options.LinkPayloadLength, options.LinkPayloadCount)) exitCode = 1;
                 break;
             default:
                 Util.PrintAndExitFlushLogs("Internal error: unrecognized OperationMode during switch/case.", arduino);
                 break;
         }
 
+        LatencyTracker.PrintSummary();
         Util.SendCommandMessage(arduino, Arduino.DONE_MESSAGE);
         arduino.CleanupForExit();
-        return 0;
+        return exitCode;
+    }
+
+    /// <summary>
+    /// Finishes a write job: saves the chip's identity tag cache, if any, uses up the unit number, if any, and deletes
+    /// the job's journal.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="journal">The journal of the job.</param>
+    /// <param name="cache">The chip's identity tag cache, or null.</param>
+    /// <param name="template">The per-unit fields the job was patched with, or null.</param>
+    private static void FinishWrite(Arduino arduino, JobJournal journal, TagCache cache, UnitTemplate template) {
+        if (cache != null) cache.Save(arduino);
+        if (template != null) {
+            Console.WriteLine("Programmed unit " + template.NextUnit + ".");
+            template.CommitUnit();
+        }
+        journal.Finish();
+    }
+
+    /// <summary>
+    /// Checks that every sector the job uses is on the chip. Until connecting, sectors are only checked against the
+    /// largest chip the sketch can be built for (Arduino.MAX_FLASH_SIZE). On error, prints a message and exits.
+    /// </summary>
+    /// <param name="options">The parsed command line arguments.</param>
+    /// <param name="plan">The plan of the write or verify job, or null.</param>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    private static void CheckJobOnChip(Options options, ProgrammingPlan plan, Arduino arduino) {
+        if (plan != null) {
+            foreach (int sectorIndex in plan.SectorIndices) CheckOnChip(arduino, sectorIndex, plan.Description);
+        }
+        if (options.TagSector >= 0) CheckOnChip(arduino, options.TagSector, "--tag " + options.TagSector);
+        if (options.ScratchSector >= 0) {
+            CheckOnChip(arduino, options.ScratchSector, "--calibrate " + options.ScratchSector);
+        }
+        if (options.Mode == OperationMode.ERASE_CHIP && options.EraseSectorCount > 0) {
+            CheckOnChip(arduino, options.EraseFirstSector + options.EraseSectorCount - 1,
+                        "-e " + options.EraseFirstSector + " " + options.EraseSectorCount);
+        }
+        if (options.Mode == OperationMode.BENCH) {
+            CheckOnChip(arduino, options.BenchFirstSector + options.BenchSectorCount - 1,
+                        "--bench " + options.BenchFirstSector + " " + options.BenchSectorCount);
+        }
+    }
+
+    /// <summary>
+    /// Checks that a sector is on the chip. On error, prints a message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="job">What uses the sector, for the error message (e.g. '-w program.bin').</param>
+    private static void CheckOnChip(Arduino arduino, int sectorIndex, string job) {
+        if (sectorIndex < arduino.ChipSectors) return;
+        Util.PrintAndExitFlushLogs(job + " uses sector " + sectorIndex + ", but the chip only has sectors 0 to " +
+                                   (arduino.ChipSectors - 1) + ". Check that the sketch was built for this chip " +
+                                   "(CHIP_FAMILY).", arduino);
     }
     
     //=============================================================================
@@ -86,45 +253,217 @@ internal static class ArduinoDriver {
     /// Parses the command line arguments. On error, prints a message and exits.
     /// </summary>
     /// <param name="args">The command line arguments to parse.</param>
-    /// <param name="serialPortName">[out] The parsed name of the serial port.</param>
-    /// <param name="mode">[out] The parsed operation mode.</param>
-    /// <param name="path">[out] A parsed path, that has been verified to exist (only present for the -w/-a options,
-    /// null otherwise).</param>
-    /// <param name="overlapsEnabled">[out] If the mode is ARBITRARY_WRITE, whether the user passed the optional -o flag. Otherwise, false.</param>
-    private static void ParseArgs(string[] args, out string serialPortName, out OperationMode mode, out string path, out bool overlapsEnabled) {
+    /// <returns>The parsed arguments. FilePath and PackPath have been converted to full paths.</returns>
+    private static Options ParseArgs(string[] args) {
         if (args.Length <= 0) {
             PrintHelpAndExit("No serial port supplied.");
         } else if (args.Length <= 1) {
-            PrintHelpAndExit("No mode supplied.");
+            PrintHelpAndExit(args[0] == "pack" ? "pack supplied, but no path to image container supplied."
+                                               : "No mode supplied.");
         }
 
-        serialPortName = args[0];
-        mode = ParseMode(args[1]);
+        /* pack takes the place of the serial port, as it does not connect to the Arduino: the mode that follows is
+         * the write job to pack. */
+        Options options = new Options();
+        options.TagSector = -1;
+        options.ScratchSector = -1;
+        options.Verify = VerifyPolicy.Full;
+        options.BenchPattern = Bench.PATTERN_RANDOM;
+        options.LinkPayloadLength = LinkTest.DEFAULT_PAYLOAD_LENGTH;
+        options.LinkPayloadCount = LinkTest.DEFAULT_PAYLOAD_COUNT;
+        int modeArg = 1;
+        if (args[0] == "pack") {
+            options.PackPath = Path.GetFullPath(args[1]);
+            if (!ImageContainer.IsContainerPath(options.PackPath)) {
+                PrintHelpAndExit("Image containers must have the extension " + ImageContainer.EXTENSION + ".");
+            }
+            modeArg = 2;
+            if (args.Length <= modeArg) PrintHelpAndExit("No mode supplied to pack.");
+        } else {
+            options.SerialPortName = args[0];
+        }
+        options.Mode = ParseMode(args[modeArg]);
+        if (options.PackPath != null && options.Mode != OperationMode.WRITE_BINARY
+                && options.Mode != OperationMode.ARBITRARY_WRITE) {
+            PrintHelpAndExit("pack is only valid with -w or -a.");
+        }
 
-        path = null;
-        overlapsEnabled = false;
-        switch (mode) {
+        int nextArg = modeArg + 1;
+        switch (options.Mode) {
             case OperationMode.WRITE_BINARY:
-                if (args.Length <= 2) PrintHelpAndExit("-w supplied, but no path to binary file supplied.");
-                path = Path.GetFullPath(args[2]);
+                if (args.Length <= nextArg) PrintHelpAndExit("-w supplied, but no path to binary file supplied.");
+                options.FilePath = Path.GetFullPath(args[nextArg++]);
                 break;
             case OperationMode.ARBITRARY_WRITE:
-                if (args.Length <= 2) PrintHelpAndExit("-a supplied, but no path to instruction file supplied.");
-                path = Path.GetFullPath(args[2]);
-                overlapsEnabled = args.Length >= 4 && args[3].Equals("-o");
+                if (args.Length <= nextArg) PrintHelpAndExit("-a supplied, but no path to instruction file supplied.");
+                options.FilePath = Path.GetFullPath(args[nextArg++]);
+                break;
+            case OperationMode.VERIFY:
+                if (args.Length <= nextArg) PrintHelpAndExit("-v supplied, but no path to file supplied.");
+                options.FilePath = Path.GetFullPath(args[nextArg++]);
                 break;
             case OperationMode.ERASE_CHIP:
+                // optionally, the first sector and the number of sectors to erase, rather than the whole chip
+                if (args.Length > nextArg && !args[nextArg].StartsWith("-")) {
+                    // checked against the chip itself once connected: see CheckJobOnChip
+                    int maxSectors = Arduino.MAX_FLASH_SIZE / Arduino.SST_SECTOR_SIZE;
+                    int eraseFirst;
+                    int eraseCount;
+                    if (args.Length <= nextArg + 1 || !int.TryParse(args[nextArg], out eraseFirst)
+                            || !int.TryParse(args[nextArg + 1], out eraseCount) || eraseFirst < 0 || eraseCount < 1
+                            || eraseFirst + eraseCount > maxSectors) {
+                        PrintHelpAndExit("-e may only be followed by the first sector to erase and the number of " +
+                                         "sectors, which must be on the chip.");
+                        return null;  // for the compiler
+                    }
+                    options.EraseFirstSector = eraseFirst;
+                    options.EraseSectorCount = eraseCount;
+                    nextArg += 2;
+                }
+                break;
+            case OperationMode.HEALTH:
+                break;
+            case OperationMode.CALIBRATE:
+                if (args.Length > nextArg && !args[nextArg].StartsWith("-")) {
+                    int scratchSector;
+                    if (!int.TryParse(args[nextArg], out scratchSector) || scratchSector < 0
+                            || scratchSector >= Arduino.MAX_FLASH_SIZE / Arduino.SST_SECTOR_SIZE) {
+                        PrintHelpAndExit("--calibrate may only be followed by the index of a sector on the chip.");
+                    }
+                    options.ScratchSector = scratchSector;
+                    nextArg++;
+                }
+                break;
+            case OperationMode.BENCH:
+                int sectorCount = Arduino.MAX_FLASH_SIZE / Arduino.SST_SECTOR_SIZE;
+                int firstSector;
+                int benchCount;
+                if (args.Length <= nextArg + 1 || !int.TryParse(args[nextArg], out firstSector)
+                        || !int.TryParse(args[nextArg + 1], out benchCount) || firstSector < 0 || benchCount < 1
+                        || firstSector + benchCount > sectorCount) {
+                    PrintHelpAndExit("--bench must be followed by the first sector to benchmark and the number of " +
+                                     "sectors, which must be on the chip.");
+                    return null;  // for the compiler
+                }
+                options.BenchFirstSector = firstSector;
+                options.BenchSectorCount = benchCount;
+                nextArg += 2;
+                break;
+            case OperationMode.LINK_TEST:
+                // the payload length, then the number of payloads: the number, or both, may be left out
+                for (int linkArg = 0; linkArg < 2 && args.Length > nextArg && !args[nextArg].StartsWith("-");
+                        linkArg++) {
+                    int value;
+                    int max = linkArg == 0 ? LinkTest.MAX_PAYLOAD_LENGTH : ushort.MaxValue;
+                    if (!int.TryParse(args[nextArg], out value) || value < 1 || value > max) {
+                        PrintHelpAndExit("--linktest may only be followed by a payload length, from 1 to " +
+                                         LinkTest.MAX_PAYLOAD_LENGTH + ", and a number of payloads, from 1 to " +
+                                         ushort.MaxValue + ".");
+                    }
+                    if (linkArg == 0) {
+                        options.LinkPayloadLength = value;
+                    } else {
+                        options.LinkPayloadCount = value;
+                    }
+                    nextArg++;
+                }
                 break;
             default:
                 Util.PrintAndExit("Internal error: unrecognized OperationMode during switch/case.");
                 break;
         }
+
+        for (int i = nextArg; i < args.Length; i++) {
+            ParseOption(options, args, ref i);
+        }
+        return options;
+    }
+
+    /// <summary>
+    /// Parses an optional flag that follows the mode and its arguments. On error (unknown flag, or a flag that
+    /// does not apply to the mode), prints a message and exits.
+    /// </summary>
+    /// <param name="options">The options parsed so far, which the flag is applied to.</param>
+    /// <param name="args">The command line arguments.</param>
+    /// <param name="i">[ref] The index of the flag in args. Flags which take a value advance this past it.</param>
+    private static void ParseOption(Options options, string[] args, ref int i) {
+        bool isWrite = options.PackPath == null && (options.Mode == OperationMode.WRITE_BINARY
+                                                    || options.Mode == OperationMode.ARBITRARY_WRITE);
+        switch (args[i]) {
+            case "-o":
+                if (options.Mode != OperationMode.ARBITRARY_WRITE) PrintHelpAndExit("-o is only valid with -a.");
+                options.OverlapsEnabled = true;
+                break;
+            case "--plan":
+                if (!isWrite) PrintHelpAndExit("--plan is only valid with -w or -a.");
+                options.PlanOnly = true;
+                break;
+            case "--resume":
+                if (!isWrite) PrintHelpAndExit("--resume is only valid with -w or -a.");
+                options.Resume = true;
+                break;
+            case "--incremental":
+                if (!isWrite) PrintHelpAndExit("--incremental is only valid with -w or -a.");
+                options.Incremental = true;
+                break;
+            case "--production":
+                if (!isWrite) PrintHelpAndExit("--production is only valid with -w or -a.");
+                options.Production = true;
+                break;
+            case "--tag":
+                if (!isWrite) PrintHelpAndExit("--tag is only valid with -w or -a.");
+                int tagSector;
+                if (i + 1 >= args.Length || !int.TryParse(args[i + 1], out tagSector) || tagSector < 0
+                        || tagSector >= Arduino.MAX_FLASH_SIZE / Arduino.SST_SECTOR_SIZE) {
+                    PrintHelpAndExit("--tag must be followed by the index of a sector on the chip.");
+                    return;  // for the compiler
+                }
+                options.TagSector = tagSector;
+                i++;
+                break;
+            case "--fields":
+                if (!isWrite) PrintHelpAndExit("--fields is only valid with -w or -a.");
+                if (i + 1 >= args.Length) PrintHelpAndExit("--fields supplied, but no path to fields file supplied.");
+                options.FieldsPath = Path.GetFullPath(args[++i]);
+                break;
+            case "--verify":
+                if (!isWrite) PrintHelpAndExit("--verify is only valid with -w or -a.");
+                VerifyPolicy policy = i + 1 < args.Length ? VerifyPolicy.Parse(args[i + 1]) : null;
+                if (policy == null) {
+                    PrintHelpAndExit("--verify must be followed by none, crc, full, sampled or sampled:<N>, where " +
+                                     "<N> is from 1 to " + Arduino.SST_SECTOR_SIZE + ".");
+                    return;  // for the compiler
+                }
+                options.Verify = policy;
+                i++;
+                break;
+            case "--pattern":
+                if (options.Mode != OperationMode.BENCH) PrintHelpAndExit("--pattern is only valid with --bench.");
+                int pattern = i + 1 < args.Length ? Bench.ParsePattern(args[i + 1]) : -1;
+                if (pattern < 0) PrintHelpAndExit("--pattern must be followed by zeroes, alternating or random.");
+                options.BenchPattern = (byte)pattern;
+                i++;
+                break;
+            case "--compress":
+                if (options.PackPath == null) PrintHelpAndExit("--compress is only valid with pack.");
+                options.Compress = true;
+                break;
+            default:
+                PrintHelpAndExit("Unrecognized option " + args[i] + ".");
+                break;
+        }
     }
 
     /// <summary>
     /// Parses the mode string into an operation mode: <br/>
     ///   -w: WriteBinary <br/>
+    ///   -a: ArbitraryWrite <br/>
     ///   -e: EraseChip <br/>
+    ///   --health: Health <br/>
+    ///   --calibrate: Calibrate <br/>
+    ///   -v: Verify <br/>
+    ///   --bench: Bench <br/>
+    ///   --linktest: LinkTest <br/>
     ///   All others: prints an error message and exits
     /// </summary>
     /// <param name="mode">The string to parse as an operation mode.</param>
@@ -134,6 +473,11 @@ internal static class ArduinoDriver {
             case "-w": return OperationMode.WRITE_BINARY;
             case "-a": return OperationMode.ARBITRARY_WRITE;
             case "-e": return OperationMode.ERASE_CHIP;
+            case "--health": return OperationMode.HEALTH;
+            case "--calibrate": return OperationMode.CALIBRATE;
+            case "-v": return OperationMode.VERIFY;
+            case "--bench": return OperationMode.BENCH;
+            case "--linktest": return OperationMode.LINK_TEST;
             default: 
                 PrintHelpAndExit("Mode not recognized.");
                 return OperationMode.WRITE_BINARY;  // for the compiler: can't get here
@@ -197,9 +541,11 @@ internal static class ArduinoDriver {
             }
 
             // If any of these are true, we either got a (possibly correct) message, or have received too much unrelated stuff
+            /* A null byte only ends a message that has started: before the W, it may be part of the number of
+             * sectors that follows an earlier broadcast. */
             if (messageBytes.Count >= Arduino.ARDUINO_WAIT_MESSAGE.Length
                     || bytesBeforeMessageStart.Count >= Arduino.ARDUINO_WAIT_MESSAGE.Length
-                    || inputByte == '\0') {
+                    || (messageStarted && inputByte == '\0')) {
                 ProcessArduinoMessage(arduino, bytesBeforeMessageStart, messageBytes);
                 /* We may respond ACK right as the Arduino sends another 'WAITING' broadcast. As a result, we wait
                  here long enough to ensure that if the Arduino did send another broadcast, we received it, and then
@@ -207,11 +553,29 @@ internal static class ArduinoDriver {
                 Thread.Sleep(50);
                 arduino.DiscardInBuffer();
                 arduino.PopTimeoutStack();
+                UseCalibratedBaudRate(arduino, serialPortName);
                 return arduino;
             }
         }
     }
 
+    /// <summary>
+    /// Switches the link to the baud rate that --calibrate found for the port, if it has been calibrated. If the link
+    /// no longer works at that rate, prints a warning and stays at the default rate.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino, at the default baud rate.</param>
+    /// <param name="serialPortName">The name of the serial port.</param>
+    private static void UseCalibratedBaudRate(Arduino arduino, string serialPortName) {
+        int baudRate = TimingProfile.ForPort(serialPortName).BaudRate;
+        if (baudRate == arduino.BaudRate) return;
+        if (Calibration.ChangeBaudRate(arduino, baudRate)) {
+            Console.WriteLine("Switched to the calibrated baud rate, " + baudRate + ".");
+        } else {
+            Console.WriteLine("Warning: the link does not work at the calibrated baud rate, " + baudRate + ", so " +
+                              "this job runs at " + arduino.BaudRate + ". Run --calibrate again.");
+        }
+    }
+
     /// <summary>
     /// Opens a serial port with a specified name. On failure (port does not exist, is already in use, etc.),
     /// exits and prints an error message.
@@ -238,7 +602,8 @@ internal static class ArduinoDriver {
 
     /// <summary>
     /// Processes the message that the Arduino sent us during communication initialization. If the Arduino sent us
-    /// the correct message, responds with an ACK and returns. Else, prints an error message and exits.
+    /// the correct message, reads the number of sectors on the chip that follows it, responds with an ACK and
+    /// returns. Else, prints an error message and exits.
     /// </summary>
     /// <param name="arduino">A serial port connected to the Arduino</param>
     /// <param name="receivedBeforeMessageStart">Bytes received from the Arduino before the start of the message
@@ -248,8 +613,21 @@ internal static class ArduinoDriver {
     private static void ProcessArduinoMessage(Arduino arduino, List<byte> receivedBeforeMessageStart, List<byte> waitingMessageBytes) {
         string waitingMessage = System.Text.Encoding.ASCII.GetString(waitingMessageBytes.ToArray());
         if (waitingMessage.Equals(Arduino.ARDUINO_WAIT_MESSAGE)) {
+            byte[] sectorsBytes = new byte[2];
+            try {
+                arduino.ReadFully(sectorsBytes, 0, sectorsBytes.Length);
+            } catch (TimeoutException) {
+                Util.PrintAndExitFlushLogs("Timed out (>2 seconds) while waiting for the number of sectors on the " +
+                                           "chip during communication initialization.", arduino);
+            }
+            arduino.ChipSectors = sectorsBytes[0] | (sectorsBytes[1] << 8);
+            if (arduino.ChipSectors < 1 || arduino.ChipSectors > Arduino.MAX_FLASH_SIZE / Arduino.SST_SECTOR_SIZE) {
+                Util.PrintAndExitFlushLogs("Arduino says the chip has " + arduino.ChipSectors + " sectors: check " +
+                                           "that the sketch and the driver are from the same version.", arduino);
+            }
             arduino.Ack();
-            Console.WriteLine("Received communication initialization message from Arduino: acknowledged.");
+            Console.WriteLine("Received communication initialization message from Arduino: acknowledged. The chip " +
+                              "has " + arduino.ChipSectors + " sectors.");
         } else {
             // Didn't get the correct message from the Arduino: print what we did get (including bytes before
             // message start) and exit.
@@ -269,39 +647,6 @@ internal static class ArduinoDriver {
         }
     }
     
-    //=============================================================================
-    //             METHODS THAT PROGRAM THE SST39SF
-    //=============================================================================
-
-    /// <summary>
-    /// Writes a binary file to the SST39SF chip.
-    /// </summary>
-    /// <param name="arduino">A serial connection to the Arduino.</param>
-    /// <param name="binaryPath">The path of the file to write to the SST39SF.</param>
-    private static void WriteBinary(Arduino arduino, string binaryPath) {
-        using (FileStream binaryFile = Util.OpenBinaryFile(binaryPath)) {
-            if (binaryFile.Length > Arduino.SST_FLASH_SIZE) {
-                Util.PrintAndExitFlushLogs("File is too large to fit on the SST chip. Check that size " +
-                                           "constants have been set correctly", arduino);
-            }
-
-            int binaryLength = (int)binaryFile.Length;
-            int numberOfSectors = binaryLength / Arduino.SST_SECTOR_SIZE;
-            
-            for (int sectorIndex = 0; sectorIndex < numberOfSectors; sectorIndex++) {
-                SectorProgramming.ProgramSector(arduino, binaryFile, sectorIndex);
-            }
-
-            // There is a bit more data: program a partial sector
-            if (binaryLength % Arduino.SST_SECTOR_SIZE != 0) {
-                // ProgramSector handles padding the data
-                SectorProgramming.ProgramSector(arduino, binaryFile, numberOfSectors);
-            }
-            
-            Console.WriteLine("Finished writing binary to SST39SF.");
-        }
-    }
-
     //=============================================================================
     //             UTILITY METHODS
     //=============================================================================
@@ -315,19 +660,100 @@ internal static class ArduinoDriver {
         const string helpMessage =
             "usage: ArduinoDriver.exe <SERIALPORT> <MODE> [OPTS]\n" +
             "\n" +
-            "    ArduinoDriver.exe <SERIALPORT> -w <BIN>                     Writes a binary file to the SST39SF\n" +
+            "    ArduinoDriver.exe <SERIALPORT> -w <BIN> [--plan] [--resume] [--incremental] [--tag <SECTOR>]\n" +
+            "                                           [--production] [--fields <FIELDS>] [--verify <POLICY>]\n" +
+            "                                                                Writes a binary file to the SST39SF\n" +
             "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
-            "        <BIN>               Path to the binary file to write to the SST39SF\n" +
+            "        <BIN>               Path to the binary file, or image container (.sstimg, see pack), to write\n" +
+            "                            to the SST39SF\n" +
+            "        --plan              Print the plan and an estimate of its cost instead of writing: does not\n" +
+            "                            connect to the Arduino.\n" +
+            "        --resume            Resume an interrupted write from its journal (<BIN>.journal), skipping\n" +
+            "                            sectors that were already programmed.\n" +
+            "        --incremental       Skip sectors which already hold their data, checked by CRC.\n" +
+            "        --tag <SECTOR>      Keep an identity tag in sector <SECTOR> of the chip, and a cache of what\n" +
+            "                            was last written to it on this computer: only sectors which differ from\n" +
+            "                            the cache are checked and programmed. The job must not use <SECTOR>.\n" +
+            "        --production        Production line mode: program every chip that is inserted into the\n" +
+            "                            socket, until stopped with Ctrl+C. Not for AT28C256s.\n" +
+            "        --fields <FIELDS>   Patch per-unit fields (serial number, ID, timestamp, CRC) into the image,\n" +
+            "                            numbering each chip programmed: see UnitTemplate.cs for file format. The\n" +
+            "                            next unit number is kept in <FIELDS>.next. Not with --resume.\n" +
+            "        --verify <POLICY>   How each programmed sector is verified: full (the default) reads back and\n" +
+            "                            compares every byte; crc compares the CRC of the whole sector read back;\n" +
+            "                            sampled[:<N>] compares <N> random bytes (default 64); none reads nothing\n" +
+            "                            back (check afterwards with -v), and not with --production. Only full\n" +
+            "                            echoes each sector's data back in full: the others echo its CRC.\n" +
             "\n" +
-            "    ArduinoDriver.exe <SERIALPORT> -a <INSTRUCTION FILE> [-o]   Writes data to arbitrary positions on the\n" +
+            "    ArduinoDriver.exe <SERIALPORT> -a <INSTRUCTION FILE> [-o] [--plan] [--resume] [--incremental]\n" +
+            "                                      [--tag <SECTOR>] [--production] [--fields <FIELDS>]\n" +
+            "                                      [--verify <POLICY>]\n" +
+            "                                                                Writes data to arbitrary positions on the\n" +
             "                                                                SST39SF. See ArbitraryProgramming.cs for file\n"+
             "                                                                format.\n" +
             "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
             "        <INSTRUCTION FILE>  Path to the instruction file: see ArbitraryProgramming.cs for file format\n" +
             "        -o                  Enable overlaps. By default, if instructions overlap, the program aborts. Passing this flag disables checking for overlaps.\n" +
+            "        --plan              As for -w.\n" +
+            "        --resume            As for -w (the journal is <INSTRUCTION FILE>.journal).\n" +
+            "        --incremental       As for -w.\n" +
+            "        --tag <SECTOR>      As for -w.\n" +
+            "        --production        As for -w.\n" +
+            "        --fields <FIELDS>   As for -w.\n" +
+            "        --verify <POLICY>   As for -w.\n" +
+            "\n" +
+            "    ArduinoDriver.exe <SERIALPORT> -v <BIN>                     Checks that the SST39SF holds a binary file\n" +
+            "                                                                or image container, by sector CRCs, and shows\n" +
+            "                                                                which bytes differ. Exits with 1 if any\n" +
+            "                                                                sector does not match.\n" +
+            "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
+            "        <BIN>               As for -w.\n" +
+            "\n" +
+            "    ArduinoDriver.exe pack <OUTPUT> -w <BIN> | -a <INSTRUCTION FILE> [-o] [--compress]\n" +
+            "                                                                Packs a write job into an image container,\n" +
+            "                                                                for -w and -v: does not connect to the\n" +
+            "                                                                Arduino.\n" +
+            "        <OUTPUT>            Path of the image container to write (.sstimg)\n" +
+            "        --compress          Store sectors compressed where that makes them smaller.\n" +
             "\n" +
-            "    ArduinoDriver.exe <SERIALPORT> -e                           Erases the SST39SF\n" +
-            "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n";
+            "    ArduinoDriver.exe <SERIALPORT> -e [<FIRST> <COUNT>]         Erases the SST39SF, or just <COUNT> sectors\n" +
+            "                                                                from sector <FIRST>: sectors that are\n" +
+            "                                                                already blank are left alone, and the time\n" +
+            "                                                                each erase took is printed. Exits with 1 if\n" +
+            "                                                                any sector could not be erased.\n" +
+            "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
+            "\n" +
+            "    ArduinoDriver.exe <SERIALPORT> --health                     Prints per-sector erase/program timings\n" +
+            "                                                                recorded by the Arduino, flagging sectors\n" +
+            "                                                                that are slowing down with wear.\n" +
+            "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
+            "\n" +
+            "    ArduinoDriver.exe <SERIALPORT> --calibrate [<SECTOR>]       Finds the fastest baud rate the link carries\n" +
+            "                                                                and measures the setup's timings. Later\n" +
+            "                                                                jobs on <SERIALPORT> use that baud rate,\n" +
+            "                                                                and --plan estimates with the timings.\n" +
+            "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
+            "        <SECTOR>            A sector that may be programmed (its contents are lost), to measure erase\n" +
+            "                            and program times. Without it, the byte program time is not measured.\n" +
+            "\n" +
+            "    ArduinoDriver.exe <SERIALPORT> --bench <FIRST> <COUNT> [--pattern <PATTERN>]\n" +
+            "                                                                Erases, programs and verifies <COUNT>\n" +
+            "                                                                sectors from sector <FIRST> with a test\n" +
+            "                                                                pattern made up on the Arduino, and prints\n" +
+            "                                                                how long each phase took. Their contents\n" +
+            "                                                                are lost. Exits with 1 if any sector fails.\n" +
+            "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
+            "        --pattern <PATTERN> zeroes (every bit programmed), alternating (0x55, 0xAA, ...) or random\n" +
+            "                            (the default).\n" +
+            "\n" +
+            "    ArduinoDriver.exe <SERIALPORT> --linktest [<LENGTH> [<COUNT>]]\n" +
+            "                                                                Measures the round trip latency and the\n" +
+            "                                                                throughput each way of the serial link, at\n" +
+            "                                                                each baud rate it carries. Exits with 1 if\n" +
+            "                                                                any payload arrives garbled.\n" +
+            "        <SERIALPORT>        Name of the serial port to connect to the Arduino on (e.g. \"COM3\")\n" +
+            "        <LENGTH>            The length of each payload, from 1 to 4096 bytes (default 64).\n" +
+            "        <COUNT>             The number of payloads sent each way at each baud rate (default 100).\n";
         Console.Write(helpMessage);
         Environment.Exit(1);
     }
@@ -1,5 +1,9 @@
 ﻿/*
  * Class which handles logging of Arduino communication.
+ *
+ * Besides the human-readable ArduinoDriver.log, every session is captured to ArduinoDriver.capture: the exact bytes
+ * sent and received, with the time of each transfer, so that the session can be replayed against a simulated or real
+ * programmer with sst39sf-replay (see /host/sst39sf_replay.cpp, which documents the format).
  * 
  * Copyright (C) 2023 Alexander Gillon
  * 
@@ -18,6 +22,7 @@
  */
 using System;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.IO;
 using System.Text;
 
@@ -30,6 +35,13 @@ internal class ArduinoDriverLogger {
     //=============================================================================
     
     private const int LINE_LENGTH = 8;
+
+    // Capture file header and record types: these must match sst39sf_replay.cpp
+    private static readonly byte[] CAPTURE_MAGIC = Encoding.ASCII.GetBytes("SSTCAP1\0");
+    private const byte CAPTURE_SEND = (byte)'S';
+    private const byte CAPTURE_RECEIVE = (byte)'R';
+    private const byte CAPTURE_DISCARD = (byte)'D';
+    private const byte CAPTURE_BAUD = (byte)'B';
     
     //=============================================================================
     //             INSTANCE VARIABLES
@@ -45,17 +57,24 @@ internal class ArduinoDriverLogger {
      * as this is the true order that they were sent and received in. Otherwise, transmissions may be out of order. */
     private List<byte> _sendBuffer = new List<byte>(LINE_LENGTH);     // Buffer of bytes that have been sent
     private List<byte> _receiveBuffer = new List<byte>(LINE_LENGTH);  // Buffer of bytes that have been received 
+
+    private BinaryWriter _capture;                          // writer attached to the capture file
+    private Stopwatch _captureClock = Stopwatch.StartNew();  // time since the capture started
     
     //=============================================================================
     //             CONSTRUCTOR
     //=============================================================================
     
-    /// <summary> Constructor. Opens a log file called ArduinoDriver.log in the current directory. On error, prints a
-    /// message and exits. </summary>
-    public ArduinoDriverLogger() {
+    /// <summary> Constructor. Opens a log file called ArduinoDriver.log and a capture file called
+    /// ArduinoDriver.capture in the current directory. On error, prints a message and exits. </summary>
+    /// <param name="baudRate">The baud rate the serial port was opened at.</param>
+    public ArduinoDriverLogger(int baudRate) {
         try {
             _logFileStream = new FileStream("ArduinoDriver.log", FileMode.Create);
             _logfile = new StreamWriter(_logFileStream, Encoding.ASCII);
+            _capture = new BinaryWriter(new BufferedStream(new FileStream("ArduinoDriver.capture", FileMode.Create)));
+            _capture.Write(CAPTURE_MAGIC);
+            _capture.Write(baudRate);
         } catch (Exception e) {
             Util.PrintAndExit("Error while opening log file:\n" + e);   
         }
@@ -90,10 +109,22 @@ internal class ArduinoDriverLogger {
     //=============================================================================
     
     /// <summary>
-    /// Logs that a byte has been sent.
+    /// Writes a record to the capture file. Little-endian, as BinaryWriter always is.
+    /// </summary>
+    /// <param name="type">The type of record: one of the CAPTURE_ constants.</param>
+    /// <param name="data">The record's data.</param>
+    private void Capture(byte type, byte[] data) {
+        _capture.Write(type);
+        _capture.Write((long)(_captureClock.ElapsedTicks * 1000000.0 / Stopwatch.Frequency));  // microseconds
+        _capture.Write(data.Length);
+        _capture.Write(data);
+    }
+
+    /// <summary>
+    /// Adds a byte that has been sent to the log file's send buffer.
     /// </summary>
     /// <param name="b">The byte that has been sent.</param>
-    internal void LogSend(byte b) {
+    private void AddSend(byte b) {
         if (_receiveBuffer.Count > 0) FlushReceive();
         _sendBuffer.Add(b);
         if (_sendBuffer.Count >= LINE_LENGTH) {
@@ -101,13 +132,34 @@ internal class ArduinoDriverLogger {
         }
     }
 
+    /// <summary>
+    /// Adds a byte that has been received to the log file's receive buffer.
+    /// </summary>
+    /// <param name="b">The byte that has been received.</param>
+    private void AddReceive(byte b) {
+        if (_sendBuffer.Count > 0) FlushSend();
+        _receiveBuffer.Add(b);
+        if (_receiveBuffer.Count >= LINE_LENGTH) {
+            FlushReceive();
+        }
+    }
+
+    /// <summary>
+    /// Logs that a byte has been sent.
+    /// </summary>
+    /// <param name="b">The byte that has been sent.</param>
+    internal void LogSend(byte b) {
+        LogSend(new[] { b });
+    }
+
     /// <summary>
     /// Logs that some bytes have been sent.
     /// </summary>
     /// <param name="bs">The bytes that have been sent.</param>
     internal void LogSend(byte[] bs) {
+        Capture(CAPTURE_SEND, bs);
         foreach (byte b in bs) {
-            LogSend(b);
+            AddSend(b);
         }
     }
 
@@ -116,11 +168,7 @@ internal class ArduinoDriverLogger {
     /// </summary>
     /// <param name="b">The byte that has been received.</param>
     internal void LogReceive(byte b) {
-        if (_sendBuffer.Count > 0) FlushSend();
-        _receiveBuffer.Add(b);
-        if (_receiveBuffer.Count >= LINE_LENGTH) {
-            FlushReceive();
-        }
+        LogReceive(new[] { b });
     }
 
     /// <summary>
@@ -128,10 +176,20 @@ internal class ArduinoDriverLogger {
     /// </summary>
     /// <param name="bs">The bytes that have been received.</param>
     internal void LogReceive(byte[] bs) {
+        if (bs.Length == 0) return;
+        Capture(CAPTURE_RECEIVE, bs);
         foreach (byte b in bs) {
-            LogReceive(b);
+            AddReceive(b);
         }
     }
+
+    /// <summary>
+    /// Logs that the baud rate of the serial port has changed. Only the capture file records this.
+    /// </summary>
+    /// <param name="baudRate">The new baud rate.</param>
+    internal void LogBaudRate(int baudRate) {
+        Capture(CAPTURE_BAUD, BitConverter.GetBytes(baudRate));
+    }
     
     /// <summary>
     /// Logs that some bytes have been discarded.
@@ -140,6 +198,7 @@ internal class ArduinoDriverLogger {
     /// <param name="exiting">Whether the calling program is in the process of exiting.</param>
     internal void LogDiscard(byte[] bs, bool exiting) {
         if (bs.Length == 0) return;
+        Capture(CAPTURE_DISCARD, bs);
         Flush();
         for (int i = 0; i < LINE_LENGTH; i++) {
             _logfile.Write("     ");
@@ -151,7 +210,7 @@ internal class ArduinoDriverLogger {
         _logfile.Write("    |    ");
         _logfile.Write(exiting ? "Discarded on exit:\n" : "Discarded:\n");
         foreach (byte b in bs) {
-            LogReceive(b);
+            AddReceive(b);
         }
         Flush();
         for (int i = 0; i < LINE_LENGTH; i++) {
@@ -233,16 +292,18 @@ internal class ArduinoDriverLogger {
         // At most one will occur, so order doesn't matter
         if (_receiveBuffer.Count > 0) FlushReceive();
         if (_sendBuffer.Count > 0) FlushSend();
+        _capture.Flush();
     }
     
     //=============================================================================
     //             CLEANUP AND EXIT
     //=============================================================================
     
-    /// <summary> Flushes and closes the log file. </summary>
+    /// <summary> Flushes and closes the log file and the capture file. </summary>
     internal void Close() {
         Flush();
         _logfile.Dispose();
         _logFileStream.Dispose();
+        _capture.Dispose();
     }
 }
@@ -0,0 +1,217 @@
+﻿/*
+ * Class which runs the Arduino's on-device benchmark (the BENCH command): the Arduino erases, programs and verifies a
+ * range of sectors with test patterns it makes up itself, and times each phase. Nothing but the results goes over the
+ * serial link, so they measure the chip, the firmware's chip driver and its bus backend alone, whatever the link is
+ * like: run it to qualify a batch of chips or a firmware build before deploying it.
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+
+/// <summary> Class which runs the Arduino's on-device benchmark and prints its results. </summary>
+internal static class Bench {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    // Test patterns, the reply's per-sector records and their statuses: these must match protocol.h
+    internal const byte PATTERN_ZEROES = 0;
+    internal const byte PATTERN_ALTERNATING = 1;
+    internal const byte PATTERN_RANDOM = 2;
+    private const int RECORD_LENGTH = 23;
+    private const byte STATUS_NOT_ERASABLE = 1;
+
+    private const int MAX_DESCRIPTION_LENGTH = 64;
+    /* Longest wait for one sector's record: a 29F010 takes up to 8s to erase, and programming and reading a sector
+     * back over a bit-banged bus takes a few more. */
+    private const int SECTOR_TIMEOUT = 20000;  // ms
+
+    //=============================================================================
+    //             CORE FUNCTION - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Parses a test pattern as it is given on the command line: zeroes, alternating or random.
+    /// </summary>
+    /// <param name="s">The string to parse.</param>
+    /// <returns>The pattern, or -1 if s is not one.</returns>
+    internal static int ParsePattern(string s) {
+        switch (s) {
+            case "zeroes": return PATTERN_ZEROES;
+            case "alternating": return PATTERN_ALTERNATING;
+            case "random": return PATTERN_RANDOM;
+            default: return -1;
+        }
+    }
+
+    /// <summary>
+    /// Benchmarks a range of sectors, whose contents are lost, and prints the timings of each and a summary. On
+    /// error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="firstSector">The index of the first sector.</param>
+    /// <param name="sectorCount">The number of sectors.</param>
+    /// <param name="pattern">The test pattern: one of the PATTERN_ constants.</param>
+    /// <returns>Whether every sector was erased, and read back as it was programmed.</returns>
+    internal static bool Run(Arduino arduino, int firstSector, int sectorCount, byte pattern) {
+        Util.SendCommandMessage(arduino, Arduino.BENCH_MESSAGE);
+        byte[] request = { (byte)firstSector, (byte)(firstSector >> 8), (byte)sectorCount, (byte)(sectorCount >> 8),
+                           pattern };
+        arduino.Write(request, 0, request.Length);
+        Util.WaitForAck(arduino, "benchmark", false);
+
+        Console.WriteLine("Benchmarking " + sectorCount + " sectors from sector " + firstSector + " on the Arduino (" +
+                          ReadDescription(arduino) + ")...");
+        Console.WriteLine("    Sector    Erase         Program       Polled writes    Polls/write    Verify        " +
+                          "CRC read");
+
+        List<double[]> timings = new List<double[]>();  // erase, program, verify and CRC read times in ms, per sector
+        long polls = 0;
+        long polledWrites = 0;
+        int failed = 0;
+        byte[] record = new byte[RECORD_LENGTH];
+        for (int sectorIndex = firstSector; sectorIndex < firstSector + sectorCount; sectorIndex++) {
+            ReadRecord(arduino, record);
+            if (record[0] == STATUS_NOT_ERASABLE) {
+                Console.WriteLine(String.Format("    {0,-6}    not erased: it is not blank, and erasing it would " +
+                                                "erase other sectors in its erase block", sectorIndex));
+                failed++;
+                continue;
+            }
+
+            double[] sector = { ReadUInt32(record, 1) / 1000.0, ReadUInt32(record, 5) / 1000.0,
+                                ReadUInt32(record, 13) / 1000.0, ReadUInt32(record, 17) / 1000.0 };
+            int sectorPolls = ReadUInt16(record, 9);
+            int sectorPolledWrites = ReadUInt16(record, 11);
+            int mismatches = ReadUInt16(record, 21);
+            timings.Add(sector);
+            polls += sectorPolls;
+            polledWrites += sectorPolledWrites;
+            if (mismatches > 0) failed++;
+
+            Console.WriteLine(String.Format("    {0,-6}    {1,8:F1} ms   {2,8:F1} ms   {3,13}    {4,11:F2}    " +
+                                            "{5,7:F1} ms   {6,7:F1} ms{7}", sectorIndex, sector[0], sector[1],
+                sectorPolledWrites, sectorPolledWrites == 0 ? 0.0 : (double)sectorPolls / sectorPolledWrites,
+                sector[2], sector[3], mismatches > 0 ? "    " + mismatches + " BYTES WRONG" : ""));
+        }
+
+        Console.WriteLine();
+        if (timings.Count > 0) PrintSummary(timings, polls, polledWrites);
+        if (failed > 0) {
+            Console.WriteLine(failed + " of " + sectorCount + " sectors failed.");
+        } else {
+            Console.WriteLine("All sectors read back as programmed.");
+        }
+        return failed == 0;
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Prints the average time of each phase over the sectors benchmarked, and the throughput it amounts to.
+    /// </summary>
+    /// <param name="timings">The erase, program, verify and CRC read times of each sector, in milliseconds.</param>
+    /// <param name="polls">The total number of status reads made for polled writes.</param>
+    /// <param name="polledWrites">The total number of polled writes.</param>
+    private static void PrintSummary(List<double[]> timings, long polls, long polledWrites) {
+        string[] phases = { "Erase (polled)", "Program", "Verify (byte compare)", "CRC read" };
+        Console.WriteLine("Average per sector:");
+        for (int phase = 0; phase < phases.Length; phase++) {
+            double totalMs = 0;
+            foreach (double[] sector in timings) totalMs += sector[phase];
+            double averageMs = totalMs / timings.Count;
+            Console.WriteLine(String.Format("    {0,-22}  {1,8:F1} ms    {2}", phases[phase], averageMs,
+                averageMs > 0 ? String.Format("{0,10:F0} bytes/s", Arduino.SST_SECTOR_SIZE * 1000.0 / averageMs)
+                              : "      (none)"));
+        }
+
+        long writes = (long)timings.Count * Arduino.SST_SECTOR_SIZE;
+        Console.WriteLine(String.Format("{0} of {1} byte writes (or page writes) were polled for completion, taking " +
+                                        "{2:F2} status reads each on average; the rest waited a fixed delay, or " +
+                                        "needed no programming.", polledWrites, writes,
+            polledWrites == 0 ? 0.0 : (double)polls / polledWrites));
+    }
+
+    /// <summary>
+    /// Reads the null-terminated description of what is being measured, which follows the ACK. On error, prints an
+    /// error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>The description.</returns>
+    private static string ReadDescription(Arduino arduino) {
+        List<byte> bytes = new List<byte>();
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            while (true) {
+                byte b = (byte)arduino.ReadByte();
+                if (b == Arduino.NULL_BYTE) break;
+                if (bytes.Count >= MAX_DESCRIPTION_LENGTH) {
+                    Util.PrintAndExitFlushLogs("Arduino sent a benchmark description longer than " +
+                                               MAX_DESCRIPTION_LENGTH + " bytes. Exiting.", arduino);
+                }
+                bytes.Add(b);
+            }
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to " +
+                                       "describe the benchmark.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+        return System.Text.Encoding.ASCII.GetString(bytes.ToArray());
+    }
+
+    /// <summary>
+    /// Reads a sector's record. On timeout, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="record">The buffer to read it into: RECORD_LENGTH bytes.</param>
+    private static void ReadRecord(Arduino arduino, byte[] record) {
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = SECTOR_TIMEOUT;
+        try {
+            arduino.ReadFully(record, 0, record.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to " +
+                                       "benchmark a sector.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+    }
+
+    /// <summary>
+    /// Reads a 16-bit value, transmitted little-endian.
+    /// </summary>
+    /// <param name="bytes">The buffer holding the value.</param>
+    /// <param name="offset">The offset of the value in the buffer.</param>
+    /// <returns>The value.</returns>
+    private static int ReadUInt16(byte[] bytes, int offset) {
+        return bytes[offset] | (bytes[offset + 1] << 8);
+    }
+
+    /// <summary>
+    /// Reads a 32-bit value, transmitted little-endian.
+    /// </summary>
+    /// <param name="bytes">The buffer holding the value.</param>
+    /// <param name="offset">The offset of the value in the buffer.</param>
+    /// <returns>The value.</returns>
+    private static uint ReadUInt32(byte[] bytes, int offset) {
+        return (uint)ReadUInt16(bytes, offset) | ((uint)ReadUInt16(bytes, offset + 2) << 16);
+    }
+}
@@ -0,0 +1,200 @@
+﻿/*
+ * Class which measures a programmer setup for --calibrate, and switches the serial link's baud rate.
+ *
+ * Calibration finds the fastest baud rate in Arduino.SERIAL_BAUD_RATES that the link carries intact (every setup's
+ * USB-serial bridge, cable and host differ), then measures at that rate: the round trip latency, the time to read a
+ * byte of the chip, and, given a scratch sector to program, the chip's erase and byte program times. The result is
+ * saved as the port's timing profile (see TimingProfile.cs): later jobs on the port switch to its baud rate when
+ * they connect, and --plan estimates with it.
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Threading;
+
+/// <summary> Class which measures the timing profile of a programmer setup, and changes the baud rate of the serial
+/// link. </summary>
+internal static class Calibration {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    private const int SAMPLES = 8;  // number of times to repeat each measurement: the median is kept
+
+    /* Bytes on the wire and round trips in a BAUD exchange (command and ACK, rate and ACK, test pattern and echo,
+     * ACK and ACK), and in a SECTORCRC (command and ACK, index and ACK, sector index and CRC). */
+    private const int BAUD_EXCHANGE_BYTES = 5 + 1 + 4 + 1 + 2 * Arduino.BAUD_TEST_PATTERN_LENGTH + 1 + 1;
+    private const int BAUD_EXCHANGE_ROUND_TRIPS = 4;
+    private const int SECTOR_CRC_BYTES = 10 + 1 + 2 + 1 + 6;
+    private const int SECTOR_CRC_ROUND_TRIPS = 2;
+
+    //=============================================================================
+    //             CORE FUNCTIONS - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Calibrates the programmer setup on a serial port, prints the timing profile and saves it for the port. Leaves
+    /// the link at the fastest baud rate that works. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="serialPortName">The name of the serial port, which the profile is saved for.</param>
+    /// <param name="scratchSector">A sector which may be programmed to measure erase and program times, or -1 to
+    /// take the erase time from the wear telemetry and keep the byte program time.</param>
+    internal static void Run(Arduino arduino, string serialPortName, int scratchSector) {
+        TimingProfile profile = TimingProfile.ForPort(serialPortName);
+
+        Console.WriteLine("Finding the fastest baud rate that the link carries...");
+        foreach (int baudRate in Arduino.SERIAL_BAUD_RATES) {
+            // rates slower than the current one are not worth trying: the current one works
+            bool works = baudRate == arduino.BaudRate || ChangeBaudRate(arduino, baudRate);
+            Console.WriteLine(String.Format("    {0,7} baud: {1}", baudRate, works ? "works" : "failed"));
+            if (works) break;
+        }
+        profile.BaudRate = arduino.BaudRate;
+
+        // changing to the rate the link is already at is a full BAUD exchange, without the risk
+        Console.WriteLine("Measuring round trips...");
+        double[] samples = new double[SAMPLES];
+        for (int i = 0; i < SAMPLES; i++) {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            if (!ChangeBaudRate(arduino, arduino.BaudRate)) {
+                Util.PrintAndExitFlushLogs("The link stopped working at " + arduino.BaudRate + " baud while it was " +
+                                           "being measured. Run --calibrate again.", arduino);
+            }
+            samples[i] = (stopwatch.Elapsed.TotalMilliseconds - BAUD_EXCHANGE_BYTES * profile.ByteTimeMs)
+                         / BAUD_EXCHANGE_ROUND_TRIPS;
+        }
+        profile.TurnaroundMs = Math.Max(0.0, Median(samples));
+
+        // the Arduino reads every byte of the sector to CRC it, as it does to verify a programmed sector
+        Console.WriteLine("Measuring reads...");
+        int readSector = scratchSector >= 0 ? scratchSector : 0;
+        for (int i = 0; i < SAMPLES; i++) {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            SectorChecksum.ReadSectorCrc(arduino, readSector);
+            double readMs = stopwatch.Elapsed.TotalMilliseconds - SECTOR_CRC_ROUND_TRIPS * profile.TurnaroundMs
+                            - SECTOR_CRC_BYTES * profile.ByteTimeMs;
+            samples[i] = readMs * 1000.0 / Arduino.SST_SECTOR_SIZE;
+        }
+        profile.ByteVerifyUs = Math.Max(0.0, Median(samples));
+
+        if (scratchSector >= 0) {
+            Console.WriteLine("Programming sector " + scratchSector + " to measure erase and program times...");
+            byte[] zeroes = new byte[Arduino.SST_SECTOR_SIZE];  // so that every byte has to be programmed
+            SectorProgramming.ProgramSector(arduino, new MemoryStream(zeroes), scratchSector);
+            profile.SectorEraseMs = Health.LastEraseMs(arduino, scratchSector);
+
+            // the erase overlaps receiving the data (see ProgrammingPlan.PrintEstimate), and the sector is read back
+            double eraseTailMs = Math.Max(0.0, profile.SectorEraseMs - Arduino.SST_SECTOR_SIZE * profile.ByteTimeMs);
+            double programMs = LatencyTracker.SectorProgramming.LastMs - profile.TurnaroundMs - eraseTailMs
+                               - Arduino.SST_SECTOR_SIZE * profile.ByteVerifyUs / 1000.0;
+            profile.ByteProgramUs = Math.Max(0.0, programMs * 1000.0 / Arduino.SST_SECTOR_SIZE);
+        } else {
+            double eraseMs = Health.AverageEraseMs(arduino);
+            if (eraseMs > 0) profile.SectorEraseMs = eraseMs;
+            Console.WriteLine(String.Format("No scratch sector given: byte program time not measured (keeping " +
+                                            "{0:F1} us).", profile.ByteProgramUs));
+        }
+
+        profile.Source = "calibrated " + DateTime.Now.ToString("yyyy-MM-dd HH:mm", CultureInfo.InvariantCulture);
+        Console.WriteLine();
+        profile.Print();
+        profile.Save(serialPortName);
+    }
+
+    /// <summary>
+    /// Changes the baud rate of the serial link, checking that the link carries a test pattern intact at the new rate
+    /// (see processSerialBaudChange in the Arduino's communication_util.h). If it doesn't, both sides go back to the
+    /// old rate. On error (the Arduino refusing the rate), prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="baudRate">The new baud rate: one of Arduino.SERIAL_BAUD_RATES.</param>
+    /// <returns>Whether the link is now at the new rate.</returns>
+    internal static bool ChangeBaudRate(Arduino arduino, int baudRate) {
+        int previousRate = arduino.BaudRate;
+        Util.SendCommandMessage(arduino, Arduino.BAUD_MESSAGE);
+        byte[] rateBytes = { (byte)baudRate, (byte)(baudRate >> 8), (byte)(baudRate >> 16), (byte)(baudRate >> 24) };
+        arduino.Write(rateBytes, 0, rateBytes.Length);
+        Util.WaitForAck(arduino, "baud rate change", false);
+
+        byte[] pattern = TestPattern();
+        byte[] echo = new byte[pattern.Length];
+        bool changed = false;
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = Arduino.BAUD_CHANGE_TIMEOUT_MS;
+        try {
+            arduino.BaudRate = baudRate;
+            arduino.Write(pattern, 0, pattern.Length);
+            arduino.ReadFully(echo, 0, echo.Length);
+            if (echo.SequenceEqual(pattern)) {
+                arduino.Ack();
+                changed = arduino.ReadByte() == Arduino.ACK_BYTE;
+            }
+        } catch (TimeoutException) {
+            // the link lost bytes at the new rate
+        } catch (IOException) {
+            // the serial port can't run at the new rate: the Arduino times out waiting for the pattern
+        } catch (ArgumentOutOfRangeException) {
+            // as above
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+        if (changed) {
+            Util.WriteLineVerbose("Link is now at " + baudRate + " baud.");
+            return true;
+        }
+
+        /* Say nothing more: whatever we sent would arrive garbled. The Arduino goes back to the old rate once it has
+         * heard nothing for BAUD_CHANGE_TIMEOUT_MS, so wait for that, and discard anything it sent before. */
+        arduino.BaudRate = previousRate;
+        Thread.Sleep(2 * Arduino.BAUD_CHANGE_TIMEOUT_MS);
+        arduino.DiscardInBuffer();
+        Util.WriteLineVerbose("Link does not work at " + baudRate + " baud: back at " + previousRate + " baud.");
+        return false;
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Gets the test pattern for a baud rate change: bytes with the most bit transitions (0x55, 0xAA), which
+    /// suffer most from a mismatch in baud rates, then the fewest (0x00, 0xFF), then counting bytes.
+    /// </summary>
+    /// <returns>The test pattern, Arduino.BAUD_TEST_PATTERN_LENGTH bytes long.</returns>
+    private static byte[] TestPattern() {
+        byte[] pattern = new byte[Arduino.BAUD_TEST_PATTERN_LENGTH];
+        byte[] fixedBytes = { 0x55, 0xAA, 0x55, 0xAA, 0x00, 0xFF, 0x00, 0xFF };
+        for (int i = 0; i < pattern.Length; i++) {
+            pattern[i] = i < pattern.Length / 2 ? fixedBytes[i % fixedBytes.Length] : (byte)i;
+        }
+        return pattern;
+    }
+
+    /// <summary>
+    /// Gets the median of some values, which is not thrown off by the odd sample that the host was slow to handle.
+    /// </summary>
+    /// <param name="values">The values.</param>
+    /// <returns>Their median (the upper one, for an even number of values).</returns>
+    private static double Median(double[] values) {
+        double[] sorted = values.OrderBy(value => value).ToArray();
+        return sorted[sorted.Length / 2];
+    }
+}
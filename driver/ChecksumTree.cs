@@ -0,0 +1,179 @@
+﻿/*
+ * Class which walks the Arduino's checksum tree (the CRCTREE command) to find exactly which bytes of the chip differ
+ * from what they should be, without reading them all over the serial link.
+ *
+ * The tree has the chip at its root, then its sectors, then each sector's 256-byte blocks, then each block's 16-byte
+ * lines, then each line's bytes. Asking for a node's children gets their CRC-32s (or, for a line, its bytes) in one
+ * round trip, so the driver compares them against the CRCs of its own data, and only asks about the children which
+ * differ: a few bytes changed in a sector take a handful of round trips and a few hundred bytes of traffic. The root
+ * gives the CRC of every sector in one round trip, rather than one SECTORCRC each.
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+
+/// <summary> Class which finds the bytes of the chip which differ from some data, with the Arduino's checksum tree.
+/// </summary>
+internal static class ChecksumTree {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    // Levels of the tree, and the size of its nodes: these must match protocol.h
+    private const byte LEVEL_CHIP = 0;
+    private const byte LEVEL_SECTOR = 1;
+    private const byte LEVEL_BLOCK = 2;
+    private const byte LEVEL_LINE = 3;
+    private const int FANOUT = 16;
+    private const int BLOCK_SIZE = 256;
+    private const int LINE_SIZE = 16;
+
+    //=============================================================================
+    //             CORE FUNCTIONS - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Gets the CRC-32 of every sector of the chip, in one round trip. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>The CRC-32 of each sector, indexed by sector index.</returns>
+    internal static uint[] ReadSectorCrcs(Arduino arduino) {
+        // the Arduino reads the whole chip, but sends each sector's CRC as soon as it has it
+        return ReadCrcs(arduino, LEVEL_CHIP, 0);
+    }
+
+    /// <summary>
+    /// Finds the bytes of a sector which differ from some data, by walking down the checksum tree from the sector.
+    /// On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="data">What the sector should hold: Arduino.SST_SECTOR_SIZE bytes.</param>
+    /// <returns>The ranges of bytes which differ, as offsets in the sector of the first byte of each range and one
+    /// past its last, in order. Ranges which touch are merged.</returns>
+    internal static List<int[]> FindDifferences(Arduino arduino, int sectorIndex, byte[] data) {
+        List<int[]> ranges = new List<int[]>();
+        long sectorAddress = (long)sectorIndex * Arduino.SST_SECTOR_SIZE;
+
+        foreach (int block in DifferingChildren(arduino, LEVEL_SECTOR, sectorAddress, data, 0, BLOCK_SIZE)) {
+            int blockOffset = block * BLOCK_SIZE;
+            foreach (int line in DifferingChildren(arduino, LEVEL_BLOCK, sectorAddress + blockOffset, data,
+                                                   blockOffset, LINE_SIZE)) {
+                int lineOffset = blockOffset + line * LINE_SIZE;
+                byte[] onChip = ReadNode(arduino, LEVEL_LINE, sectorAddress + lineOffset, LINE_SIZE);
+                for (int i = 0; i < LINE_SIZE; i++) {
+                    if (onChip[i] != data[lineOffset + i]) AddToRanges(ranges, lineOffset + i);
+                }
+            }
+        }
+        return ranges;
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Gets the children of a node whose CRCs differ from those of the matching parts of some data.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="level">The node's level.</param>
+    /// <param name="address">The address of the node's first byte.</param>
+    /// <param name="data">The data.</param>
+    /// <param name="offset">Offset of the node in the data.</param>
+    /// <param name="childSize">The size of each child.</param>
+    /// <returns>The indices of the children which differ.</returns>
+    private static List<int> DifferingChildren(Arduino arduino, byte level, long address, byte[] data, int offset,
+                                               int childSize) {
+        uint[] crcs = ReadCrcs(arduino, level, address);
+        List<int> differing = new List<int>();
+        for (int child = 0; child < FANOUT; child++) {
+            if (crcs[child] != Crc32.Update(0, data, offset + child * childSize, childSize)) differing.Add(child);
+        }
+        return differing;
+    }
+
+    /// <summary>
+    /// Gets the CRC-32s of the children of a node. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="level">The node's level (not LEVEL_LINE, whose children are bytes).</param>
+    /// <param name="address">The address of the node's first byte.</param>
+    /// <returns>The CRC-32 of each child.</returns>
+    private static uint[] ReadCrcs(Arduino arduino, byte level, long address) {
+        byte[] response = ReadNode(arduino, level, address, level == LEVEL_CHIP ? -1 : FANOUT);
+        uint[] crcs = new uint[response.Length / 4];
+        for (int i = 0; i < crcs.Length; i++) {
+            crcs[i] = (uint)response[4 * i] | ((uint)response[4 * i + 1] << 8) | ((uint)response[4 * i + 2] << 16)
+                      | ((uint)response[4 * i + 3] << 24);
+        }
+        return crcs;
+    }
+
+    /// <summary>
+    /// Asks the Arduino for the children of a node of the checksum tree. On error, prints an error message and
+    /// exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="level">The node's level.</param>
+    /// <param name="address">The address of the node's first byte.</param>
+    /// <param name="expectedChildren">The number of children the node should have, or -1 for the chip, whose
+    /// number of sectors the Arduino knows better than we do.</param>
+    /// <returns>The response: 4 bytes (a CRC-32, little-endian) per child, or a line's bytes.</returns>
+    private static byte[] ReadNode(Arduino arduino, byte level, long address, int expectedChildren) {
+        Util.SendCommandMessage(arduino, Arduino.CRC_TREE_MESSAGE);
+        Util.WriteLineVerbose("Requesting checksum tree node at level " + level + ", address 0x" +
+                              address.ToString("X5") + " from Arduino...");
+        byte[] request = { level, (byte)address, (byte)(address >> 8), (byte)(address >> 16), (byte)(address >> 24) };
+        arduino.Write(request, 0, request.Length);
+        Util.WaitForAck(arduino, "checksum tree", false);
+
+        byte[] countBytes = new byte[2];
+        byte[] response = null;
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            arduino.ReadFully(countBytes, 0, countBytes.Length);
+            int children = countBytes[0] | (countBytes[1] << 8);
+            if (expectedChildren >= 0 ? children != expectedChildren : children == 0) {
+                Util.PrintAndExitFlushLogs("Arduino sent " + children + " children of a checksum tree node at level " +
+                                           level + ". Exiting.", arduino);
+            }
+            response = new byte[level == LEVEL_LINE ? children : 4 * children];
+            arduino.ReadFully(response, 0, response.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to " +
+                                       "send checksum tree node.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+        return response;
+    }
+
+    /// <summary>
+    /// Adds a byte to a list of ranges, extending the last range if the byte follows it.
+    /// </summary>
+    /// <param name="ranges">The ranges, in order: each is its first byte and one past its last.</param>
+    /// <param name="offset">The byte, after every range so far.</param>
+    private static void AddToRanges(List<int[]> ranges, int offset) {
+        if (ranges.Count > 0 && ranges[ranges.Count - 1][1] == offset) {
+            ranges[ranges.Count - 1][1] = offset + 1;
+        } else {
+            ranges.Add(new[] { offset, offset + 1 });
+        }
+    }
+}
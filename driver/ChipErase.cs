@@ -1,5 +1,6 @@
 ﻿/*
- * Class which implements chip erase functionality.
+ * Class which implements chip erase functionality: the whole chip (ERASECHIP), or a range of sectors (ERASERANGE),
+ * which the Arduino erases one after another, leaving alone those that are already blank and timing the rest.
  * 
  * Copyright (C) 2023 Alexander Gillon
  * 
@@ -20,6 +21,20 @@ using System;
 
 /// <summary> Class which handles erasing the chip. </summary>
 internal static class ChipErase {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    // What ERASERANGE did with each sector, and the length of its per-sector records: these must match protocol.h
+    private const byte ERASE_RANGE_ERASED = 0;
+    private const byte ERASE_RANGE_BLANK = 1;
+    private const byte ERASE_RANGE_NOT_ERASABLE = 2;
+    private const int ERASE_RANGE_RECORD_LENGTH = 9;
+
+    /* Longest wait for one sector's record: a 29F010 takes up to 8s to erase, and reading the sector to check that it
+     * is blank, before and after, takes a few more over a bit-banged bus. */
+    private const int SECTOR_TIMEOUT = 20000;  // ms
+
     //=============================================================================
     //             CORE FUNCTION - CALLED BY OTHER CLASSES
     //=============================================================================
@@ -32,7 +47,59 @@ internal static class ChipErase {
         Util.SendCommandMessage(arduino, Arduino.ERASE_CHIP_MESSAGE);
         ReceiveConfirmMessage(arduino);
         ConfirmWithUser(arduino);
-        Util.WaitForAck(arduino, "chip erase", false);
+        Util.WaitForAck(arduino, "chip erase", LatencyTracker.ChipErase);
+    }
+
+    /// <summary>
+    /// Erases a range of sectors, once the user confirms, and prints what the Arduino did with each and how long it
+    /// took. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="firstSector">The index of the first sector.</param>
+    /// <param name="sectorCount">The number of sectors.</param>
+    /// <returns>Whether every sector is now blank: false if the user declined, or a sector could not be
+    /// erased.</returns>
+    internal static bool EraseRange(Arduino arduino, int firstSector, int sectorCount) {
+        if (!AskUser("Erasing sectors " + firstSector + " to " + (firstSector + sectorCount - 1) + " of the SST39SF. " +
+                     "Confirm? (y/n)\n> ")) {
+            return false;
+        }
+
+        Util.SendCommandMessage(arduino, Arduino.ERASE_RANGE_MESSAGE);
+        byte[] request = { (byte)firstSector, (byte)(firstSector >> 8), (byte)sectorCount, (byte)(sectorCount >> 8) };
+        arduino.Write(request, 0, request.Length);
+        Util.WaitForAck(arduino, "erase range", false);
+
+        Console.WriteLine("    Sector    Result           Time          Erase");
+        int erased = 0;
+        int failed = 0;
+        double totalMs = 0;
+        byte[] record = new byte[ERASE_RANGE_RECORD_LENGTH];
+        for (int sectorIndex = firstSector; sectorIndex < firstSector + sectorCount; sectorIndex++) {
+            ReadRecord(arduino, record);
+            double elapsedMs = BitConverter.ToUInt32(record, 1) / 1000.0;
+            double eraseMs = BitConverter.ToUInt32(record, 5) / 1000.0;
+            string result;
+            switch (record[0]) {
+                case ERASE_RANGE_ERASED: result = "erased"; erased++; break;
+                case ERASE_RANGE_BLANK: result = "already blank"; break;
+                case ERASE_RANGE_NOT_ERASABLE: result = "NOT ERASABLE"; failed++; break;
+                default: result = "FAILED"; failed++; break;
+            }
+            totalMs += elapsedMs;
+            Console.WriteLine(String.Format("    {0,-6}    {1,-13}    {2,7:F1} ms    {3,7:F1} ms", sectorIndex, result,
+                elapsedMs, eraseMs));
+        }
+
+        Console.WriteLine();
+        Console.WriteLine(String.Format("Erased {0} of {1} sectors in {2:F1} s; {3} were already blank.", erased,
+            sectorCount, totalMs / 1000.0, sectorCount - erased - failed));
+        if (failed > 0) {
+            Console.WriteLine(failed + " sectors could not be erased: one that is NOT ERASABLE shares an erase block " +
+                              "with sectors outside the range which are not blank (erase the whole block to erase " +
+                              "it), and one that FAILED did not read back blank.");
+        }
+        return failed == 0;
     }
     
     //=============================================================================
@@ -68,17 +135,47 @@ internal static class ChipErase {
     /// </summary>
     /// <param name="arduino">A serial port connected to the Arduino.</param>
     private static void ConfirmWithUser(Arduino arduino) {
-        Console.Write("Erasing the SST39SF chip. Confirm? (y/n)\n> ");
+        if (AskUser("Erasing the SST39SF chip. Confirm? (y/n)\n> ")) {
+            arduino.Ack();
+        } else {
+            arduino.Nak();
+        }
+    }
+
+    /// <summary>
+    /// Reads a sector's record from the reply to ERASERANGE. On timeout, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="record">The buffer to read it into: ERASE_RANGE_RECORD_LENGTH bytes.</param>
+    private static void ReadRecord(Arduino arduino, byte[] record) {
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = SECTOR_TIMEOUT;
+        try {
+            arduino.ReadFully(record, 0, record.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to " +
+                                       "erase a sector.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Asks the user a yes/no question, until they answer y or n.
+    /// </summary>
+    /// <param name="prompt">The question, with the prompt for their answer.</param>
+    /// <returns>Whether they answered y.</returns>
+    private static bool AskUser(string prompt) {
+        Console.Write(prompt);
         string userInput = Console.ReadLine();
         while (userInput.ToLower() != "y" && userInput.ToLower() != "n") {
             Console.Write("Invalid input. Confirm? (y/n)\n> ");
             userInput = Console.ReadLine();
         }
-
-        if (userInput.ToLower() == "y") {
-            arduino.Ack();
-        } else {
-            arduino.Nak();
-        }
+        return userInput.ToLower() == "y";
     }
 }
@@ -0,0 +1,81 @@
+﻿/*
+ * Class which computes CRC-32 checksums, matching the Arduino's (see checksum.h in the Arduino sketch).
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// <summary> Computes the standard CRC-32 (as used by zlib, PNG, etc.): reflected polynomial 0xEDB88320, initial
+/// value 0xFFFFFFFF, final value inverted. </summary>
+internal static class Crc32 {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    private const uint POLYNOMIAL = 0xEDB88320;  // reflected
+
+    // Table of the CRC of each byte value, so that we can process a byte at a time rather than a bit at a time
+    private static readonly uint[] Table = BuildTable();
+
+    //=============================================================================
+    //             COMPUTING CRCS
+    //=============================================================================
+
+    /// <summary>
+    /// Computes the CRC-32 of some data.
+    /// </summary>
+    /// <param name="data">The data.</param>
+    /// <returns>The CRC-32 of the data.</returns>
+    internal static uint Compute(byte[] data) {
+        return Update(0, data, 0, data.Length);
+    }
+
+    /// <summary>
+    /// Continues a CRC-32 with more data. Update(Compute(a), b, 0, b.Length) is the CRC-32 of a followed by b, and
+    /// the CRC-32 of no data is 0, so a CRC-32 can be computed in pieces starting from 0.
+    /// </summary>
+    /// <param name="crc">The CRC-32 of the data so far.</param>
+    /// <param name="data">Buffer holding the data to add.</param>
+    /// <param name="offset">Offset of the data to add in the buffer.</param>
+    /// <param name="count">Number of bytes to add.</param>
+    /// <returns>The CRC-32 of the data so far, followed by the added data.</returns>
+    internal static uint Update(uint crc, byte[] data, int offset, int count) {
+        crc = ~crc;
+        for (int i = offset; i < offset + count; i++) {
+            crc = Table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    //=============================================================================
+    //             INITIALIZATION
+    //=============================================================================
+
+    /// <summary>
+    /// Builds the table of the CRC of each byte value.
+    /// </summary>
+    /// <returns>The table.</returns>
+    private static uint[] BuildTable() {
+        uint[] table = new uint[256];
+        for (uint b = 0; b < table.Length; b++) {
+            uint crc = b;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) != 0 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+            }
+            table[b] = crc;
+        }
+        return table;
+    }
+}
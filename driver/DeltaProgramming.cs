@@ -0,0 +1,146 @@
+﻿/*
+ * Class which programs a sector from a delta against what it already holds (the Arduino's DELTASECTOR command), for
+ * sectors whose current contents are known from the identity tag cache (see TagCache.cs).
+ *
+ * The delta is the XOR of the old and new contents, sent as runs of the bytes which differ: a run is an offset, a
+ * length, and that many XOR bytes. Runs closer together than a run header are merged, as sending the few unchanged
+ * bytes between them is cheaper than another header. The Arduino checks the CRC of what the sector holds before
+ * applying the delta, and of the result afterwards, so a stale cache or a corrupted delta never programs a sector
+ * with the wrong data. On a flash chip, a change that only clears bits is programmed without erasing the sector.
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.IO;
+
+/// <summary> Class which handles programming a sector of the SST39SF from a delta against its contents. </summary>
+internal static class DeltaProgramming {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    /* Bytes sent before the runs: the sector index and the CRC of its current contents, then the CRC of the new
+     * contents and the number of runs. */
+    private const int DELTA_HEADER_BYTES = 2 + 4 + 4 + 2;
+
+    //=============================================================================
+    //             CORE FUNCTION - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Programs a sector from a delta against its current contents, if that is worth it and the sector holds what we
+    /// think it does. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="known">What the sector is thought to hold: Arduino.SST_SECTOR_SIZE bytes.</param>
+    /// <param name="data">The data to program into the sector: Arduino.SST_SECTOR_SIZE bytes.</param>
+    /// <param name="sectorIndex">The index of the sector to program.</param>
+    /// <returns>Whether the sector was programmed. If not, program it in full (see SectorProgramming.cs).</returns>
+    internal static bool ProgramSector(Arduino arduino, byte[] known, byte[] data, int sectorIndex) {
+        byte[] delta = EncodeRuns(known, data);
+        if (delta == null) {
+            Util.WriteLineVerbose("Delta for sector " + sectorIndex + " is no smaller than the sector.");
+            return false;
+        }
+
+        Util.SendCommandMessage(arduino, Arduino.DELTA_SECTOR_MESSAGE);
+        Util.WriteLineVerbose("Sending delta of " + delta.Length + " bytes for sector " + sectorIndex + "...");
+        byte[] indexBytes = Util.SectorIndexToBytes(sectorIndex);
+        arduino.Write(indexBytes, 0, indexBytes.Length);
+        arduino.Write(CrcBytes(Crc32.Compute(known)), 0, 4);
+        if (!BaseConfirmed(arduino, sectorIndex)) return false;
+
+        arduino.Write(CrcBytes(Crc32.Compute(data)), 0, 4);
+        arduino.Write(delta, 0, delta.Length);
+        Util.WaitForAck(arduino, "delta sector programming", LatencyTracker.SectorProgramming);
+        return true;
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Reads the Arduino's response to the CRC of the sector's current contents: an ACK if the sector holds them, or
+    /// a NAK message if not. On any other response, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>Whether the sector holds what we think it does.</returns>
+    private static bool BaseConfirmed(Arduino arduino, int sectorIndex) {
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            byte response = (byte)arduino.ReadByte();
+            if (response == Arduino.ACK_BYTE) return true;
+            if (response != Arduino.NAK_BYTE) {
+                Util.PrintAndExitFlushLogs("While waiting for Arduino to check sector " + sectorIndex + " before a " +
+                                           "delta, got an unexpected response byte 0x" +
+                                           BitConverter.ToString(new[] { response }) + ". Exiting.", arduino);
+            }
+            Console.Write("Programming sector " + sectorIndex + " in full instead of from a delta: ");
+            arduino.GetAndPrintNakMessage();
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to " +
+                                       "check sector " + sectorIndex + " before a delta.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+        return false;
+    }
+
+    /// <summary>
+    /// Encodes the runs of a delta: the number of runs, then each run's offset, length and XOR bytes, all
+    /// little-endian.
+    /// </summary>
+    /// <param name="known">The sector's current contents.</param>
+    /// <param name="data">The sector's new contents.</param>
+    /// <returns>The encoded runs, or null if the delta would be no smaller than sending the sector in full.</returns>
+    private static byte[] EncodeRuns(byte[] known, byte[] data) {
+        List<int[]> runs = new List<int[]>();  // offset and length of each run
+        for (int i = 0; i < Arduino.SST_SECTOR_SIZE; i++) {
+            if (known[i] == data[i]) continue;
+            int[] last = runs.Count > 0 ? runs[runs.Count - 1] : null;
+            if (last != null && i - (last[0] + last[1]) <= Arduino.DELTA_RUN_HEADER_LENGTH) {
+                last[1] = i - last[0] + 1;
+            } else {
+                runs.Add(new[] { i, 1 });
+            }
+        }
+
+        MemoryStream encoded = new MemoryStream();
+        encoded.WriteByte((byte)runs.Count);
+        encoded.WriteByte((byte)(runs.Count >> 8));
+        foreach (int[] run in runs) {
+            encoded.Write(Util.SectorIndexToBytes(run[0]), 0, 2);  // same encoding as a sector index
+            encoded.Write(Util.SectorIndexToBytes(run[1]), 0, 2);
+            for (int i = run[0]; i < run[0] + run[1]; i++) {
+                encoded.WriteByte((byte)(known[i] ^ data[i]));
+            }
+        }
+        return DELTA_HEADER_BYTES + encoded.Length < Arduino.SST_SECTOR_SIZE ? encoded.ToArray() : null;
+    }
+
+    /// <summary>
+    /// Gets the little-endian bytes of a CRC.
+    /// </summary>
+    /// <param name="crc">The CRC.</param>
+    /// <returns>Its 4 bytes.</returns>
+    private static byte[] CrcBytes(uint crc) {
+        return new[] { (byte)crc, (byte)(crc >> 8), (byte)(crc >> 16), (byte)(crc >> 24) };
+    }
+}
@@ -0,0 +1,238 @@
+﻿/*
+ * Class which caches prepared sectors on disk, so that repeated builds don't prepare the same sector again: for now,
+ * the form a sector is stored in by pack --compress (see ImageContainer.cs), which costs a Deflate per sector, where
+ * everything else about a sector takes a CRC at most. Entries are addressed by the SHA-256 of the sector's data, so
+ * a sector is found again whichever job, address or programmer it turns up in, and the cache is shared by every run
+ * of the driver by the same user, in <LocalApplicationData>/SST39SF-programmer/frames-<FORMAT>.
+ *
+ * Each entry is a file named after the hash, in a subdirectory named after its first two hex digits. It holds the
+ * CRC-32 of the prepared form (4 bytes, little-endian), then the prepared form itself, or nothing if preparing the
+ * sector left it as it was (e.g. it doesn't compress). An entry which fails its CRC is ignored, and replaced.
+ *
+ * The cache is bounded in size: once a run has added to it, the least recently used entries (by the time their
+ * file was last written, which reading an entry updates) are deleted until it is within TRIM_BYTES. Failing to read
+ * or write the cache is never an error: the sector is just prepared again.
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Security.Cryptography;
+
+/// <summary> On-disk cache of prepared sectors, addressed by their content. See above. </summary>
+internal class FrameCache : IDisposable {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    /* The version of the way sectors are prepared, which names the cache's directory: change it whenever that
+     * changes, so that entries prepared the old way are not used. */
+    private const int FORMAT = 1;
+    private const string ENTRY_EXTENSION = ".frame";
+    private const int ENTRY_HEADER_LENGTH = 4;
+
+    /* Once a run has added to the cache, and the entries take up more than MAX_BYTES, the least recently used are
+     * deleted until they take up TRIM_BYTES: trimming a little further than needed means it isn't done on every run
+     * once the cache is full. Each entry counts as whole DISK_BLOCK_SIZE blocks, as most filesystems store it. */
+    private const long MAX_BYTES = 64L * 1024 * 1024;
+    private const long TRIM_BYTES = 56L * 1024 * 1024;
+    private const int DISK_BLOCK_SIZE = 4096;
+
+    //=============================================================================
+    //             INSTANCE VARIABLES
+    //=============================================================================
+
+    private string _directory;  // null if it can't be used: then nothing is cached
+    private SHA256 _sha = SHA256.Create();
+    private bool _added;        // whether this run has added an entry, and so may need to trim the cache
+
+    /** The number of sectors found in the cache so far. */
+    internal int Hits { get; private set; }
+    /** The number of sectors prepared (and added to the cache) so far. */
+    internal int Misses { get; private set; }
+
+    //=============================================================================
+    //             CONSTRUCTION
+    //=============================================================================
+
+    /// <summary>
+    /// Constructor.
+    /// </summary>
+    /// <param name="directory">The directory the cache is in, or null for a cache which stores nothing.</param>
+    private FrameCache(string directory) {
+        _directory = directory;
+    }
+
+    /// <summary>
+    /// Opens the cache, creating its directory if necessary. If that fails, prints a warning, and returns a cache
+    /// which stores nothing.
+    /// </summary>
+    /// <returns>The cache.</returns>
+    internal static FrameCache Open() {
+        string directory = Path.Combine(Path.Combine(
+            Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "SST39SF-programmer"),
+            "frames-" + FORMAT);
+        try {
+            Directory.CreateDirectory(directory);
+            return new FrameCache(directory);
+        } catch (Exception e) {
+            Console.WriteLine("Warning: could not open the frame cache in " + directory + " (" + e.Message + ").");
+            return new FrameCache(null);
+        }
+    }
+
+    //=============================================================================
+    //             CORE FUNCTIONS - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Gets the prepared form of a sector from the cache, or if it isn't there, prepares it and adds it.
+    /// </summary>
+    /// <param name="data">The sector's data.</param>
+    /// <param name="prepare">Prepares a sector, given its data. May return the data itself, if preparing it changes
+    /// nothing.</param>
+    /// <returns>The prepared form of the sector: the data itself, if preparing it changes nothing.</returns>
+    internal byte[] GetOrPrepare(byte[] data, Func<byte[], byte[]> prepare) {
+        string path = _directory == null ? null : EntryPath(_sha.ComputeHash(data));
+        byte[] prepared = path == null ? null : ReadEntry(path, data);
+        if (prepared != null) {
+            Hits++;
+            return prepared;
+        }
+
+        Misses++;
+        prepared = prepare(data);
+        if (path != null) WriteEntry(path, ReferenceEquals(prepared, data) ? new byte[0] : prepared);
+        return prepared;
+    }
+
+    /// <summary>
+    /// Trims the cache to size, if this run has added to it.
+    /// </summary>
+    public void Dispose() {
+        if (_added) Trim();
+        _sha.Dispose();
+    }
+
+    //=============================================================================
+    //             ENTRIES
+    //=============================================================================
+
+    /// <summary>
+    /// Gets the path of the entry for a sector.
+    /// </summary>
+    /// <param name="hash">The SHA-256 of the sector's data.</param>
+    /// <returns>The path of its entry.</returns>
+    private string EntryPath(byte[] hash) {
+        string name = BitConverter.ToString(hash).Replace("-", "");
+        return Path.Combine(Path.Combine(_directory, name.Substring(0, 2)), name + ENTRY_EXTENSION);
+    }
+
+    /// <summary>
+    /// Reads an entry, marking it as the most recently used.
+    /// </summary>
+    /// <param name="path">The path of the entry.</param>
+    /// <param name="data">The sector's data.</param>
+    /// <returns>The prepared form of the sector, or null if the entry does not exist or is corrupt.</returns>
+    private static byte[] ReadEntry(string path, byte[] data) {
+        byte[] entry;
+        try {
+            if (!File.Exists(path)) return null;
+            entry = File.ReadAllBytes(path);
+            File.SetLastWriteTimeUtc(path, DateTime.UtcNow);
+        } catch (Exception) {
+            return null;  // e.g. another run has just trimmed it: prepare it again
+        }
+
+        if (entry.Length < ENTRY_HEADER_LENGTH || BitConverter.ToUInt32(entry, 0)
+                != Crc32.Update(0, entry, ENTRY_HEADER_LENGTH, entry.Length - ENTRY_HEADER_LENGTH)) {
+            Util.WriteLineVerbose("Frame cache entry " + path + " is corrupt: preparing the sector again.");
+            return null;
+        }
+        if (entry.Length == ENTRY_HEADER_LENGTH) return data;
+        byte[] prepared = new byte[entry.Length - ENTRY_HEADER_LENGTH];
+        Array.Copy(entry, ENTRY_HEADER_LENGTH, prepared, 0, prepared.Length);
+        return prepared;
+    }
+
+    /// <summary>
+    /// Writes an entry, replacing any that is there. Another run may be writing the same entry at the same time, so
+    /// it is written to a file of its own, then renamed.
+    /// </summary>
+    /// <param name="path">The path of the entry.</param>
+    /// <param name="prepared">The prepared form of the sector, or nothing if preparing it changed nothing.</param>
+    private void WriteEntry(string path, byte[] prepared) {
+        byte[] entry = new byte[ENTRY_HEADER_LENGTH + prepared.Length];
+        Array.Copy(BitConverter.GetBytes(Crc32.Compute(prepared)), entry, ENTRY_HEADER_LENGTH);
+        Array.Copy(prepared, 0, entry, ENTRY_HEADER_LENGTH, prepared.Length);
+
+        string temporaryPath = path + "." + Guid.NewGuid().ToString("N") + ".tmp";
+        try {
+            Directory.CreateDirectory(Path.GetDirectoryName(path));
+            File.WriteAllBytes(temporaryPath, entry);
+            if (File.Exists(path)) File.Delete(path);
+            File.Move(temporaryPath, path);
+            _added = true;
+        } catch (Exception e) {
+            Util.WriteLineVerbose("Could not add " + path + " to the frame cache (" + e.Message + ").");
+            try {
+                File.Delete(temporaryPath);
+            } catch (Exception) {
+                // nothing more to do: it is only a temporary file
+            }
+        }
+    }
+
+    /// <summary>
+    /// Deletes the least recently used entries, if the cache takes up more than MAX_BYTES, until it takes up
+    /// TRIM_BYTES. On error, prints a warning.
+    /// </summary>
+    private void Trim() {
+        try {
+            List<FileInfo> entries = new List<FileInfo>(
+                new DirectoryInfo(_directory).GetFiles("*" + ENTRY_EXTENSION, SearchOption.AllDirectories));
+            long totalBytes = 0;
+            foreach (FileInfo entry in entries) totalBytes += DiskBytes(entry);
+            if (totalBytes <= MAX_BYTES) return;
+
+            entries.Sort((entry1, entry2) => entry1.LastWriteTimeUtc.CompareTo(entry2.LastWriteTimeUtc));
+            int evicted = 0;
+            foreach (FileInfo entry in entries) {
+                if (totalBytes <= TRIM_BYTES) break;
+                try {
+                    entry.Delete();
+                } catch (Exception) {
+                    continue;  // e.g. another run is reading it
+                }
+                totalBytes -= DiskBytes(entry);
+                evicted++;
+            }
+            Util.WriteLineVerbose("Evicted " + evicted + " sectors from the frame cache.");
+        } catch (Exception e) {
+            Console.WriteLine("Warning: could not trim the frame cache in " + _directory + " (" + e.Message + ").");
+        }
+    }
+
+    /// <summary>
+    /// Gets the space an entry takes up on disk, in whole blocks.
+    /// </summary>
+    /// <param name="entry">The entry.</param>
+    /// <returns>The space it takes up, in bytes.</returns>
+    private static long DiskBytes(FileInfo entry) {
+        return (entry.Length + DISK_BLOCK_SIZE - 1) / DISK_BLOCK_SIZE * DISK_BLOCK_SIZE;
+    }
+}
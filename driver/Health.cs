@@ -0,0 +1,161 @@
+﻿/*
+ * Class which reads and displays the Arduino's per-sector wear telemetry (see health.h in the Arduino sketch).
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+
+/// <summary> Class which handles reading the chip's wear telemetry from the Arduino. </summary>
+internal static class Health {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    private const int RECORD_LENGTH = 12;        // bytes per sector in the HEALTH reply
+    private const double TIME_UNIT_MS = 0.1;     // unit of the times in a record
+    private const double POLLS_SCALE = 16.0;     // average polls are sent x16
+    // A sector is flagged when its erases have slowed by this factor since they were first measured
+    private const double SLOW_ERASE_FACTOR = 1.5;
+    // ... or when polled writes take more than this many status reads on average (1 = done by the first read)
+    private const double SLOW_PROGRAM_POLLS = 2.0;
+
+    //=============================================================================
+    //             CORE FUNCTION - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Reads the wear telemetry from the Arduino and prints it as a table, flagging sectors that have slowed down.
+    /// On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    internal static void PrintHealth(Arduino arduino) {
+        byte[] records = ReadRecords(arduino);
+        int sectorCount = records.Length / RECORD_LENGTH;
+
+        Console.WriteLine("    Sector    Cycles    First erase    Avg erase    Last erase    Avg polls");
+        int flagged = 0;
+        int unused = 0;
+        for (int sector = 0; sector < sectorCount; sector++) {
+            int offset = sector * RECORD_LENGTH;
+            uint cycles = (uint)ReadUInt16(records, offset) | ((uint)ReadUInt16(records, offset + 2) << 16);
+            double firstErase = ReadUInt16(records, offset + 4) * TIME_UNIT_MS;
+            double averageErase = ReadUInt16(records, offset + 6) * TIME_UNIT_MS;
+            double lastErase = ReadUInt16(records, offset + 8) * TIME_UNIT_MS;
+            double averagePolls = ReadUInt16(records, offset + 10) / POLLS_SCALE;
+
+            if (cycles == 0) {
+                unused++;
+                continue;
+            }
+
+            bool slow = (firstErase > 0 && averageErase > firstErase * SLOW_ERASE_FACTOR)
+                        || averagePolls > SLOW_PROGRAM_POLLS;
+            if (slow) flagged++;
+            Console.WriteLine(String.Format("    {0,-6}    {1,-6}    {2,8:F1} ms    {3,6:F1} ms    {4,7:F1} ms    {5,9:F2}{6}",
+                sector, cycles, firstErase, averageErase, lastErase, averagePolls, slow ? "    SLOW" : ""));
+        }
+
+        Console.WriteLine();
+        if (unused > 0) Console.WriteLine(unused + " sectors have never been programmed, and are not shown.");
+        if (flagged > 0) {
+            Console.WriteLine(flagged + " sectors are marked SLOW: their erases are over " + SLOW_ERASE_FACTOR +
+                              "x slower than when first measured, or programming needs repeated polling. They " +
+                              "may be wearing out.");
+        } else {
+            Console.WriteLine("No sectors show signs of wear.");
+        }
+    }
+
+    /// <summary>
+    /// Reads the wear telemetry from the Arduino, and gets the average erase time over the sectors that have been
+    /// programmed. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>The average erase time, in milliseconds, or 0 if no sector has been programmed.</returns>
+    internal static double AverageEraseMs(Arduino arduino) {
+        byte[] records = ReadRecords(arduino);
+        double total = 0;
+        int used = 0;
+        for (int offset = 0; offset < records.Length; offset += RECORD_LENGTH) {
+            double averageErase = ReadUInt16(records, offset + 6) * TIME_UNIT_MS;
+            if (averageErase <= 0) continue;
+            total += averageErase;
+            used++;
+        }
+        return used == 0 ? 0 : total / used;
+    }
+
+    /// <summary>
+    /// Reads the wear telemetry from the Arduino, and gets how long the last erase of a sector took. On error,
+    /// prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>The time of the sector's last erase, in milliseconds, or 0 if it has never been programmed.</returns>
+    internal static double LastEraseMs(Arduino arduino, int sectorIndex) {
+        byte[] records = ReadRecords(arduino);
+        int offset = sectorIndex * RECORD_LENGTH;
+        return offset + RECORD_LENGTH <= records.Length ? ReadUInt16(records, offset + 8) * TIME_UNIT_MS : 0;
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Sends HEALTH, and reads the records that the Arduino replies with. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>The records, RECORD_LENGTH bytes per sector.</returns>
+    private static byte[] ReadRecords(Arduino arduino) {
+        Util.SendCommandMessage(arduino, Arduino.HEALTH_MESSAGE);
+
+        byte[] countBytes = new byte[2];
+        ReadOrExit(arduino, countBytes);
+        int sectorCount = countBytes[0] | (countBytes[1] << 8);
+        byte[] records = new byte[sectorCount * RECORD_LENGTH];
+        ReadOrExit(arduino, records);
+        return records;
+    }
+
+    /// <summary>
+    /// Reads a 16-bit value, transmitted little-endian.
+    /// </summary>
+    /// <param name="bytes">The buffer holding the value.</param>
+    /// <param name="offset">The offset of the value in the buffer.</param>
+    /// <returns>The value.</returns>
+    private static int ReadUInt16(byte[] bytes, int offset) {
+        return bytes[offset] | (bytes[offset + 1] << 8);
+    }
+
+    /// <summary>
+    /// Fills a buffer from the Arduino. On timeout, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="buffer">The buffer to fill.</param>
+    private static void ReadOrExit(Arduino arduino, byte[] buffer) {
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            arduino.ReadFully(buffer, 0, buffer.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting " +
+                                       "for Arduino to send wear telemetry.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+    }
+}
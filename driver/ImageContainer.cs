@@ -0,0 +1,267 @@
+﻿/*
+ * Class which reads and writes image containers (.sstimg): a precompiled write job, produced by the driver's pack
+ * subcommand, which the write (-w), verify (-v) and incremental (--incremental) modes consume directly.
+ * 
+ * A container holds only the populated sectors of an image, with the CRC-32 of each, so a job can be planned, and
+ * compared against a chip (see SECTORCRC), without reading or hashing any sector data. The format is, with all
+ * values little-endian:
+ * 
+ *     Offset   Length           Contents
+ *     0        4                Magic: "SSTI"
+ *     4        1                Version: 1
+ *     5        1                Flags: bit 0 set if sectors were compressed when packing (see below)
+ *     6        2                Sector size: 4096
+ *     8        2                N: number of sectors covered by the bitmap (the highest populated sector + 1)
+ *     10       2                P: number of populated sectors
+ *     12       32               SHA-256 of the image: each populated sector's index (2 bytes) and data, in order
+ *     44       ceil(N / 8)      Bitmap: bit i (least significant bit first) is set if sector i is populated
+ *     ...      8 * P            Sector table, in sector order: CRC-32 of the data (4), stored length (4)
+ *     ...      (stored lengths) Sector data, in sector order. A sector whose stored length is the sector size is
+ *                               stored as is, otherwise it is compressed with Deflate.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.Compression;
+using System.Security.Cryptography;
+using System.Text;
+
+/// <summary> Class which reads and writes image containers. See above for the format. </summary>
+internal static class ImageContainer {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    internal const string EXTENSION = ".sstimg";
+
+    private const string MAGIC = "SSTI";
+    private const byte VERSION = 1;
+    private const byte FLAG_COMPRESSED = 0x01;
+    private const int HEADER_LENGTH = 44;
+    private const int TABLE_ENTRY_LENGTH = 8;
+    private const int HASH_LENGTH = 32;
+
+    //=============================================================================
+    //             CORE FUNCTIONS - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Returns whether a path names an image container (rather than a binary file), by its extension.
+    /// </summary>
+    /// <param name="path">The path.</param>
+    /// <returns>Whether the path names an image container.</returns>
+    internal static bool IsContainerPath(string path) {
+        return path.EndsWith(EXTENSION, StringComparison.OrdinalIgnoreCase);
+    }
+
+    /// <summary>
+    /// Writes a plan to an image container. On error, prints a message and exits.
+    /// </summary>
+    /// <param name="path">The path of the container to write.</param>
+    /// <param name="plan">The plan to write.</param>
+    /// <param name="compress">Whether to compress sectors (each is only stored compressed if that is smaller).</param>
+    /// <returns>The hash of the image.</returns>
+    internal static byte[] Write(string path, ProgrammingPlan plan, bool compress) {
+        List<int> indices = new List<int>(plan.SectorIndices);
+        int bitmapSectors = indices.Count == 0 ? 0 : indices[indices.Count - 1] + 1;
+        byte[] bitmap = new byte[(bitmapSectors + 7) / 8];
+        List<byte[]> stored = new List<byte[]>(indices.Count);
+        long dataLength = 0;
+
+        // Compressed sectors come from the frame cache, if an earlier run has compressed the same data
+        using (FrameCache frames = compress ? FrameCache.Open() : null)
+        using (SHA256 sha = SHA256.Create()) {
+            foreach (int sectorIndex in indices) {
+                byte[] data = plan.SectorData(sectorIndex);
+                byte[] indexBytes = Util.SectorIndexToBytes(sectorIndex);
+                sha.TransformBlock(indexBytes, 0, indexBytes.Length, null, 0);
+                sha.TransformBlock(data, 0, data.Length, null, 0);
+
+                bitmap[sectorIndex / 8] |= (byte)(1 << (sectorIndex % 8));
+                stored.Add(compress ? frames.GetOrPrepare(data, StoredForm) : data);
+                dataLength += stored[stored.Count - 1].Length;
+            }
+            sha.TransformFinalBlock(new byte[0], 0, 0);
+            if (compress) {
+                Util.WriteLineVerbose(String.Format("Found {0} of {1} compressed sectors in the frame cache.",
+                    frames.Hits, indices.Count));
+            }
+
+            try {
+                using (BinaryWriter writer = new BinaryWriter(new FileStream(path, FileMode.Create, FileAccess.Write))) {
+                    writer.Write(Encoding.ASCII.GetBytes(MAGIC));
+                    writer.Write(VERSION);
+                    writer.Write(compress ? FLAG_COMPRESSED : (byte)0);
+                    writer.Write((ushort)Arduino.SST_SECTOR_SIZE);
+                    writer.Write((ushort)bitmapSectors);
+                    writer.Write((ushort)indices.Count);
+                    writer.Write(sha.Hash);
+                    writer.Write(bitmap);
+                    for (int i = 0; i < indices.Count; i++) {
+                        writer.Write(plan.SectorCrc(indices[i]));
+                        writer.Write(stored[i].Length);
+                    }
+                    foreach (byte[] sectorData in stored) {
+                        writer.Write(sectorData);
+                    }
+                }
+            } catch (Exception e) {
+                Util.PrintAndExit("Error while writing image container " + path + ":\n" + e);
+            }
+
+            Util.WriteLineVerbose(String.Format("Wrote {0} sectors ({1} bytes stored) to {2}.", indices.Count,
+                dataLength, path));
+            return sha.Hash;
+        }
+    }
+
+    /// <summary>
+    /// Reads an image container as a plan. Only the header and sector table are read: sector data is read (and
+    /// checked against its CRC) when the plan first needs it. On error, prints a message and exits.
+    /// </summary>
+    /// <param name="path">The path of the container.</param>
+    /// <returns>The plan.</returns>
+    internal static ProgrammingPlan Read(string path) {
+        SortedDictionary<int, uint> crcs = new SortedDictionary<int, uint>();
+        Dictionary<int, long> offsets = new Dictionary<int, long>();
+        Dictionary<int, int> lengths = new Dictionary<int, int>();
+
+        using (FileStream file = Util.OpenBinaryFile(path)) {
+            try {
+                BinaryReader reader = new BinaryReader(file);
+                byte[] header = reader.ReadBytes(HEADER_LENGTH);
+                if (header.Length < HEADER_LENGTH || Encoding.ASCII.GetString(header, 0, 4) != MAGIC) {
+                    Util.PrintAndExit(path + " is not an image container.");
+                }
+                if (header[4] != VERSION) {
+                    Util.PrintAndExit(path + " is an image container of an unsupported version (" + header[4] + ").");
+                }
+                int sectorSize = BitConverter.ToUInt16(header, 6);
+                int bitmapSectors = BitConverter.ToUInt16(header, 8);
+                int populated = BitConverter.ToUInt16(header, 10);
+                if (sectorSize != Arduino.SST_SECTOR_SIZE) {
+                    Util.PrintAndExit(path + " was packed for " + sectorSize + "-byte sectors, but sectors are " +
+                                      Arduino.SST_SECTOR_SIZE + " bytes.");
+                }
+                if ((long)bitmapSectors * Arduino.SST_SECTOR_SIZE > Arduino.MAX_FLASH_SIZE) {
+                    Util.PrintAndExit(path + " is too large to fit on any chip the programmer supports.");
+                }
+
+                byte[] bitmap = reader.ReadBytes((bitmapSectors + 7) / 8);
+                List<int> indices = new List<int>(populated);
+                for (int sectorIndex = 0; sectorIndex < bitmapSectors; sectorIndex++) {
+                    if ((bitmap[sectorIndex / 8] & (1 << (sectorIndex % 8))) != 0) indices.Add(sectorIndex);
+                }
+                if (indices.Count != populated) {
+                    Util.PrintAndExit(path + " is corrupt: its bitmap does not match its number of sectors.");
+                }
+
+                long offset = HEADER_LENGTH + bitmap.Length + (long)populated * TABLE_ENTRY_LENGTH;
+                foreach (int sectorIndex in indices) {
+                    crcs[sectorIndex] = reader.ReadUInt32();
+                    lengths[sectorIndex] = reader.ReadInt32();
+                    offsets[sectorIndex] = offset;
+                    offset += lengths[sectorIndex];
+                }
+                if (offset != file.Length) {
+                    Util.PrintAndExit(path + " is corrupt: its length does not match its sector table.");
+                }
+            } catch (EndOfStreamException) {
+                Util.PrintAndExit(path + " is corrupt: it ends part way through its header.");
+            }
+        }
+
+        Func<int, byte[]> loader = sectorIndex => ReadSector(path, sectorIndex, offsets[sectorIndex],
+                                                             lengths[sectorIndex], crcs[sectorIndex]);
+        return new ProgrammingPlan("-w " + path, crcs, loader);
+    }
+
+    //=============================================================================
+    //             SECTOR DATA
+    //=============================================================================
+
+    /// <summary>
+    /// Reads a sector's data from a container, and checks it against its CRC. On error, prints a message and exits.
+    /// </summary>
+    /// <param name="path">The path of the container.</param>
+    /// <param name="sectorIndex">The index of the sector, for error messages.</param>
+    /// <param name="offset">The offset of the sector's stored data in the container.</param>
+    /// <param name="length">The length of the sector's stored data.</param>
+    /// <param name="crc">The CRC-32 of the sector's data.</param>
+    /// <returns>The sector's data.</returns>
+    private static byte[] ReadSector(string path, int sectorIndex, long offset, int length, uint crc) {
+        byte[] stored = new byte[length];
+        using (FileStream file = Util.OpenBinaryFile(path)) {
+            file.Seek(offset, SeekOrigin.Begin);
+            if (file.Read(stored, 0, length) != length) {
+                Util.PrintAndExit(path + " is corrupt: sector " + sectorIndex + " is cut off.");
+            }
+        }
+
+        byte[] data = length == Arduino.SST_SECTOR_SIZE ? stored : Inflate(stored);
+        if (data == null || data.Length != Arduino.SST_SECTOR_SIZE || Crc32.Compute(data) != crc) {
+            Util.PrintAndExit(path + " is corrupt: sector " + sectorIndex + " does not match its CRC.");
+        }
+        return data;
+    }
+
+    /// <summary>
+    /// Gets the form a sector is stored in when compressing: compressed, if that is smaller.
+    /// </summary>
+    /// <param name="data">The sector's data.</param>
+    /// <returns>The compressed data, or data itself if compressing it doesn't make it smaller.</returns>
+    private static byte[] StoredForm(byte[] data) {
+        byte[] compressed = Deflate(data);
+        return compressed.Length < data.Length ? compressed : data;
+    }
+
+    /// <summary>
+    /// Compresses data with Deflate.
+    /// </summary>
+    /// <param name="data">The data.</param>
+    /// <returns>The compressed data.</returns>
+    private static byte[] Deflate(byte[] data) {
+        MemoryStream output = new MemoryStream();
+        using (DeflateStream deflate = new DeflateStream(output, CompressionMode.Compress, true)) {
+            deflate.Write(data, 0, data.Length);
+        }
+        return output.ToArray();
+    }
+
+    /// <summary>
+    /// Decompresses a sector compressed with Deflate.
+    /// </summary>
+    /// <param name="compressed">The compressed sector.</param>
+    /// <returns>The sector's data, or null if the compressed data is invalid.</returns>
+    private static byte[] Inflate(byte[] compressed) {
+        try {
+            using (DeflateStream inflate = new DeflateStream(new MemoryStream(compressed), CompressionMode.Decompress)) {
+                MemoryStream output = new MemoryStream(Arduino.SST_SECTOR_SIZE);
+                byte[] buffer = new byte[Arduino.SST_SECTOR_SIZE];
+                int read;
+                while ((read = inflate.Read(buffer, 0, buffer.Length)) > 0) {
+                    output.Write(buffer, 0, read);
+                    if (output.Length > Arduino.SST_SECTOR_SIZE) return null;
+                }
+                return output.ToArray();
+            }
+        } catch (InvalidDataException) {
+            return null;
+        }
+    }
+}
@@ -0,0 +1,252 @@
+﻿/*
+ * Class which records the progress of a write job (-w/-a) on disk, so that an interrupted job can be resumed with
+ * --resume rather than started again from the beginning.
+ * 
+ * The journal is a text file next to the job's input file, named <input file>.journal. The first line identifies
+ * the job (a CRC-32 over the plan's sector indices and data CRCs), so a journal can't be resumed against a different
+ * input. Each following line records one sector that the Arduino has programmed and verified, with the CRC-32 of
+ * its data, or one that it programmed without reading anything back (--verify none), marked unverified:
+ * 
+ *     job 1A2B3C4D 64
+ *     0 89ABCDEF
+ *     1 01234567 unverified
+ * 
+ * On resuming, the sectors marked unverified are checked by CRC before they are skipped. Lines are flushed as they
+ * are written, so the journal is at most one sector behind the chip whenever the driver dies. The journal is deleted
+ * once the job completes.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Text;
+
+/// <summary> On-disk record of the sectors of a write job that have been programmed. </summary>
+internal class JobJournal {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    internal const string JOURNAL_EXTENSION = ".journal";
+    private const string JOB_LINE_PREFIX = "job";
+    private const string UNVERIFIED_MARK = "unverified";
+
+    //=============================================================================
+    //             INSTANCE VARIABLES
+    //=============================================================================
+
+    private string _path;
+    private StreamWriter _writer;  // null if the journal could not be opened: progress is then not recorded
+    // Maps the index of each sector that has been programmed to the CRC-32 of its data
+    private Dictionary<int, uint> _completed = new Dictionary<int, uint>();
+    // The indices of the sectors among them which were programmed without being verified
+    private HashSet<int> _unverified = new HashSet<int>();
+
+    /** The most recently programmed sector, or -1 if none have been. */
+    internal int LastCompletedSector { get; private set; }
+
+    /** The number of sectors that have been programmed. */
+    internal int CompletedCount {
+        get { return _completed.Count; }
+    }
+
+    //=============================================================================
+    //             CONSTRUCTION
+    //=============================================================================
+
+    /// <summary> Constructor. Use Create or ResumeOrCreate. </summary>
+    private JobJournal(string path) {
+        _path = path;
+        LastCompletedSector = -1;
+    }
+
+    /// <summary>
+    /// Starts a new journal for a job, replacing any existing journal at that path. If the journal can't be written,
+    /// prints a warning and returns a journal which does not record anything: the job can still run, it just can't
+    /// be resumed.
+    /// </summary>
+    /// <param name="path">The path of the journal.</param>
+    /// <param name="plan">The plan of the job.</param>
+    /// <returns>The journal.</returns>
+    internal static JobJournal Create(string path, ProgrammingPlan plan) {
+        JobJournal journal = new JobJournal(path);
+        journal.Open(FileMode.Create);
+        if (journal._writer != null) {
+            journal._writer.WriteLine(JOB_LINE_PREFIX + " " + plan.JobId.ToString("X8") + " " + plan.SectorCount);
+            journal._writer.Flush();
+        }
+        return journal;
+    }
+
+    /// <summary>
+    /// Gets the journal to resume a job with. If there is a journal for this job, checks that the last sector it
+    /// records is really on the chip: if it is, the job carries on from the journal; otherwise, the chip has changed
+    /// since, and the job starts again from the beginning. If there is no journal, the job starts from the beginning.
+    /// On error (unreadable journal, or journal for a different job), prints an error message and exits.
+    /// </summary>
+    /// <param name="path">The path of the journal.</param>
+    /// <param name="plan">The plan of the job.</param>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>The journal.</returns>
+    internal static JobJournal ResumeOrCreate(string path, ProgrammingPlan plan, Arduino arduino) {
+        if (!File.Exists(path)) {
+            Console.WriteLine("No journal found at " + path + ": starting from the beginning.");
+            return Create(path, plan);
+        }
+
+        JobJournal journal = Load(path, plan, arduino);
+        if (journal.LastCompletedSector >= 0) {
+            uint onChip = SectorChecksum.ReadSectorCrc(arduino, journal.LastCompletedSector);
+            if (onChip != journal._completed[journal.LastCompletedSector]) {
+                Console.WriteLine("Sector " + journal.LastCompletedSector + " on the chip does not match the " +
+                                  "journal: starting from the beginning.");
+                return Create(path, plan);
+            }
+        }
+
+        journal.CheckUnverified(arduino);
+        journal.Open(FileMode.Append);
+        Console.WriteLine("Resuming: " + journal.CompletedCount + " of " + plan.SectorCount + " sectors already " +
+                          "programmed.");
+        return journal;
+    }
+
+    /// <summary>
+    /// Reads an existing journal. On error (unreadable journal, or journal for a different job), prints an error
+    /// message and exits.
+    /// </summary>
+    /// <param name="path">The path of the journal.</param>
+    /// <param name="plan">The plan of the job.</param>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>The journal, not yet open for writing.</returns>
+    private static JobJournal Load(string path, ProgrammingPlan plan, Arduino arduino) {
+        JobJournal journal = new JobJournal(path);
+        string[] lines = null;
+        try {
+            lines = File.ReadAllLines(path, Encoding.ASCII);
+        } catch (Exception e) {
+            Util.PrintAndExitFlushLogs("Error while reading journal " + path + ":\n" + e, arduino);
+        }
+
+        string expectedJobLine = JOB_LINE_PREFIX + " " + plan.JobId.ToString("X8") + " " + plan.SectorCount;
+        if (lines.Length == 0 || lines[0].Trim() != expectedJobLine) {
+            Util.PrintAndExitFlushLogs("Journal " + path + " is for a different job (the input has changed since " +
+                                       "it was written). Delete it, or run without --resume.", arduino);
+        }
+
+        for (int i = 1; i < lines.Length; i++) {
+            string[] fields = lines[i].Split(new[] { ' ' }, StringSplitOptions.RemoveEmptyEntries);
+            int sectorIndex;
+            uint crc;
+            if (fields.Length == 0) continue;
+            if (fields.Length < 2 || fields.Length > 3 || (fields.Length == 3 && fields[2] != UNVERIFIED_MARK)
+                    || !int.TryParse(fields[0], out sectorIndex)
+                    || !uint.TryParse(fields[1], NumberStyles.HexNumber, CultureInfo.InvariantCulture, out crc)) {
+                /* The last line may have been cut off if the driver died while writing it. Anything else means
+                 * the journal has been corrupted. */
+                if (i == lines.Length - 1) break;
+                Util.PrintAndExitFlushLogs("Journal " + path + " is corrupt (line " + (i + 1) + "). Delete it, or " +
+                                           "run without --resume.", arduino);
+                return null;  // for the compiler
+            }
+            journal._completed[sectorIndex] = crc;
+            if (fields.Length == 3) {
+                journal._unverified.Add(sectorIndex);
+            } else {
+                journal._unverified.Remove(sectorIndex);
+            }
+            journal.LastCompletedSector = sectorIndex;
+        }
+        return journal;
+    }
+
+    /// <summary>
+    /// Checks the sectors which the journal records as programmed without being verified, by CRC, and forgets those
+    /// which don't hold their data, so that they are programmed again. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    private void CheckUnverified(Arduino arduino) {
+        if (_unverified.Count == 0) return;
+        int forgotten = 0;
+        foreach (int sectorIndex in _unverified) {
+            if (SectorChecksum.ReadSectorCrc(arduino, sectorIndex) != _completed[sectorIndex]) {
+                _completed.Remove(sectorIndex);
+                forgotten++;
+            }
+        }
+        Console.WriteLine("Checked " + _unverified.Count + " sectors programmed without verification: " + forgotten +
+                          " do not hold their data, and will be programmed again.");
+        _unverified.Clear();
+    }
+
+    /// <summary>
+    /// Opens the journal for writing. On error, prints a warning, and the journal does not record anything.
+    /// </summary>
+    /// <param name="mode">FileMode.Create for a new journal, FileMode.Append to continue an existing one.</param>
+    private void Open(FileMode mode) {
+        try {
+            _writer = new StreamWriter(new FileStream(_path, mode, FileAccess.Write), Encoding.ASCII);
+        } catch (Exception e) {
+            Console.WriteLine("Warning: could not open journal " + _path + " (" + e.Message + "). This job will " +
+                              "not be resumable.");
+            _writer = null;
+        }
+    }
+
+    //=============================================================================
+    //             RECORDING PROGRESS
+    //=============================================================================
+
+    /// <summary>
+    /// Returns whether a sector has already been programmed, according to the journal.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="crc">The CRC-32 of the data the sector should hold.</param>
+    /// <returns>Whether the sector has been programmed with that data.</returns>
+    internal bool IsCompleted(int sectorIndex, uint crc) {
+        uint recordedCrc;
+        return _completed.TryGetValue(sectorIndex, out recordedCrc) && recordedCrc == crc;
+    }
+
+    /// <summary>
+    /// Records that a sector has been programmed, or found to hold its data already.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="crc">The CRC-32 of the data the sector was programmed with.</param>
+    /// <param name="verified">Whether the sector was checked: false if the Arduino programmed it without reading
+    /// anything back (--verify none).</param>
+    internal void RecordCompleted(int sectorIndex, uint crc, bool verified) {
+        _completed[sectorIndex] = crc;
+        LastCompletedSector = sectorIndex;
+        if (_writer == null) return;
+        _writer.WriteLine(sectorIndex + " " + crc.ToString("X8") + (verified ? "" : " " + UNVERIFIED_MARK));
+        _writer.Flush();
+    }
+
+    /// <summary> Closes and deletes the journal, once the job has completed: there is nothing left to resume. </summary>
+    internal void Finish() {
+        if (_writer == null) return;
+        _writer.Dispose();
+        _writer = null;
+        try {
+            File.Delete(_path);
+        } catch (Exception e) {
+            Console.WriteLine("Warning: could not delete journal " + _path + " (" + e.Message + ").");
+        }
+    }
+}
@@ -0,0 +1,119 @@
+﻿/*
+ * Class which learns how long the Arduino takes to respond to an operation, and sets timeouts from that rather than
+ * from fixed worst cases.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.Linq;
+
+/// <summary> Tracks the observed latency of one kind of operation, and derives its timeout: a high percentile of
+/// recent latencies, scaled and with a fixed margin added, clamped between a floor and a ceiling. Until enough
+/// latencies have been observed, the timeout is the ceiling (the fixed timeout that the driver used before). </summary>
+internal class LatencyTracker {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    private const int WINDOW = 32;           // number of recent latencies to take the percentile over
+    private const int MIN_SAMPLES = 4;       // number of latencies needed before the timeout adapts
+    private const double PERCENTILE = 0.95;
+    private const double SCALE = 1.5;        // headroom proportional to the latency (e.g. slower sectors)
+    private const double MARGIN_MS = 100.0;  // headroom for the host (scheduling, USB polling)
+
+    //=============================================================================
+    //             TRACKED OPERATIONS
+    //=============================================================================
+
+    /** From sending a sector index to receiving its echo. */
+    internal static readonly LatencyTracker IndexEcho =
+        new LatencyTracker("sector index echo", 150, ArduinoDriver.NORMAL_TIMEOUT);
+    /** From sending sector data to receiving the whole echo. */
+    internal static readonly LatencyTracker DataEcho =
+        new LatencyTracker("sector data echo", 500, ArduinoDriver.NORMAL_TIMEOUT);
+    /** From acknowledging the data echo to the Arduino's ACK that the sector is programmed. */
+    internal static readonly LatencyTracker SectorProgramming =
+        new LatencyTracker("sector programming", 500, ArduinoDriver.EXTENDED_TIMEOUT);
+    /** From confirming a chip erase to the Arduino's ACK that the chip is erased. */
+    internal static readonly LatencyTracker ChipErase =
+        new LatencyTracker("chip erase", 500, ArduinoDriver.EXTENDED_TIMEOUT);
+
+    private static readonly LatencyTracker[] All = { IndexEcho, DataEcho, SectorProgramming, ChipErase };
+
+    //=============================================================================
+    //             INSTANCE VARIABLES
+    //=============================================================================
+
+    private string _name;
+    private int _floorMs;
+    private int _ceilingMs;
+    private Queue<double> _samples = new Queue<double>(WINDOW);
+
+    //=============================================================================
+    //             CONSTRUCTOR
+    //=============================================================================
+
+    /// <summary>
+    /// Constructor.
+    /// </summary>
+    /// <param name="name">Name of the operation, for display.</param>
+    /// <param name="floorMs">The shortest timeout to ever use, however fast the operation has been.</param>
+    /// <param name="ceilingMs">The longest timeout to ever use, and the timeout until enough latencies have been
+    /// observed.</param>
+    private LatencyTracker(string name, int floorMs, int ceilingMs) {
+        _name = name;
+        _floorMs = floorMs;
+        _ceilingMs = ceilingMs;
+    }
+
+    //=============================================================================
+    //             LATENCIES AND TIMEOUTS
+    //=============================================================================
+
+    /** The latency of the last operation, in milliseconds, or 0 if none has been observed. */
+    internal double LastMs { get; private set; }
+
+    /** The timeout to use for the next operation, in milliseconds. */
+    internal int TimeoutMs {
+        get {
+            if (_samples.Count < MIN_SAMPLES) return _ceilingMs;
+            double[] sorted = _samples.OrderBy(sample => sample).ToArray();
+            double percentile = sorted[(int)Math.Ceiling(PERCENTILE * sorted.Length) - 1];
+            double timeout = percentile * SCALE + MARGIN_MS;
+            return (int)Math.Min(_ceilingMs, Math.Max(_floorMs, timeout));
+        }
+    }
+
+    /// <summary>
+    /// Records the latency of a completed operation.
+    /// </summary>
+    /// <param name="latencyMs">The latency, in milliseconds.</param>
+    internal void Observe(double latencyMs) {
+        if (_samples.Count >= WINDOW) _samples.Dequeue();
+        _samples.Enqueue(latencyMs);
+        LastMs = latencyMs;
+    }
+
+    /// <summary> Prints the latencies observed and the resulting timeouts, if compiled with VERBOSE = true. </summary>
+    internal static void PrintSummary() {
+        foreach (LatencyTracker tracker in All) {
+            if (tracker._samples.Count == 0) continue;
+            Util.WriteLineVerbose(String.Format("Latency of {0}: max {1:F1} ms over the last {2}, timeout now {3} ms.",
+                tracker._name, tracker._samples.Max(), tracker._samples.Count, tracker.TimeoutMs));
+        }
+    }
+}
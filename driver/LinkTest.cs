@@ -0,0 +1,259 @@
+﻿/*
+ * Class which characterises the serial link (the Arduino's LINKTEST command), to tell a slow link from a slow chip
+ * or firmware, and to qualify a host and cable. At each baud rate in Arduino.SERIAL_BAUD_RATES that the link
+ * carries, it measures:
+ *
+ *   round trips   the time from sending a payload to receiving the Arduino's echo of all of it. Beyond the time the
+ *                 bytes take on the wire, this is the latency of the USB-serial bridge (its latency timer, usually)
+ *                 and the host's serial stack.
+ *   to Arduino    the rate at which payloads sent back to back arrive, as timed by the Arduino.
+ *   from Arduino  the rate at which payloads the Arduino sends back to back arrive, as timed by the host.
+ *
+ * Both rates are shown as a share of the line rate, the most a link at that baud rate can carry. Payloads sent
+ * either way are checked, so that a link which loses or garbles bytes shows up.
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Diagnostics;
+using System.Linq;
+
+/// <summary> Class which measures the latency and throughput of the serial link at each baud rate. </summary>
+internal static class LinkTest {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    internal const int DEFAULT_PAYLOAD_LENGTH = 64;
+    internal const int DEFAULT_PAYLOAD_COUNT = 100;
+
+    // Modes and the largest payload: these must match protocol.h
+    private const byte MODE_ECHO = 0;
+    private const byte MODE_SINK = 1;
+    private const byte MODE_SOURCE = 2;
+    internal const int MAX_PAYLOAD_LENGTH = Arduino.SST_SECTOR_SIZE;
+
+    private const int BITS_PER_BYTE = 10;  // 8N1: a start bit, 8 data bits and a stop bit
+    private static readonly double[] PERCENTILES = { 0.50, 0.90, 0.99 };
+
+    //=============================================================================
+    //             CORE FUNCTION - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Tests the link at each baud rate that it carries, and prints the results. Leaves the link at the baud rate it
+    /// was at. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="payloadLength">The length of each payload: from 1 to MAX_PAYLOAD_LENGTH.</param>
+    /// <param name="payloadCount">The number of payloads sent each way at each baud rate: from 1 to 65535.</param>
+    /// <returns>Whether every payload arrived intact.</returns>
+    internal static bool Run(Arduino arduino, int payloadLength, int payloadCount) {
+        int startRate = arduino.BaudRate;
+        Console.WriteLine("Testing the link with " + payloadCount + " payloads of " + payloadLength + " bytes each " +
+                          "way, at each baud rate...");
+        Console.WriteLine("                     Round trip (ms)                              " +
+                          "To Arduino        From Arduino");
+        Console.WriteLine("       Baud      p50      p90      p99      max     wire      bytes/s   line" +
+                          "      bytes/s   line    Errors");
+
+        bool intact = true;
+        foreach (int baudRate in Arduino.SERIAL_BAUD_RATES) {
+            if (baudRate != arduino.BaudRate && !Calibration.ChangeBaudRate(arduino, baudRate)) {
+                Console.WriteLine(String.Format("    {0,7}    the link does not work at this baud rate", baudRate));
+                continue;
+            }
+
+            int errors = 0;
+            double[] roundTrips = Echo(arduino, payloadLength, payloadCount, ref errors);
+            double toArduino = Sink(arduino, payloadLength, payloadCount, ref errors);
+            double fromArduino = Source(arduino, payloadLength, payloadCount, ref errors);
+            if (errors > 0) intact = false;
+
+            double lineRate = (double)baudRate / BITS_PER_BYTE;
+            double[] sorted = roundTrips.OrderBy(ms => ms).ToArray();
+            Console.WriteLine(String.Format("    {0,7}   {1,6:F2}   {2,6:F2}   {3,6:F2}   {4,6:F2}   {5,6:F2}   " +
+                                            "{6,10:F0}   {7,3:F0}%   {8,10:F0}   {9,3:F0}%    {10}", baudRate,
+                Percentile(sorted, PERCENTILES[0]), Percentile(sorted, PERCENTILES[1]),
+                Percentile(sorted, PERCENTILES[2]), sorted[sorted.Length - 1],
+                (payloadLength + 1) * 1000.0 / lineRate, toArduino, toArduino * 100 / lineRate, fromArduino,
+                fromArduino * 100 / lineRate, errors > 0 ? errors + " BYTES WRONG" : "none"));
+        }
+
+        if (arduino.BaudRate != startRate && !Calibration.ChangeBaudRate(arduino, startRate)) {
+            Console.WriteLine("Warning: could not go back to " + startRate + " baud: staying at " + arduino.BaudRate +
+                              ".");
+        }
+        Console.WriteLine();
+        Console.WriteLine("\"wire\" is the least time a round trip could take, with the payload on the wire. The " +
+                          "rest of it is the latency of the USB-serial bridge, the host and the firmware.");
+        Console.WriteLine(intact ? "Every payload arrived intact." : "Some payloads did not arrive intact.");
+        return intact;
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Starts a link test at the current baud rate. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="mode">One of the MODE_ constants.</param>
+    /// <param name="payloadLength">The length of each payload.</param>
+    /// <param name="payloadCount">The number of payloads.</param>
+    private static void Start(Arduino arduino, byte mode, int payloadLength, int payloadCount) {
+        Util.SendCommandMessage(arduino, Arduino.LINK_TEST_MESSAGE);
+        byte[] request = { mode, (byte)payloadLength, (byte)(payloadLength >> 8), (byte)payloadCount,
+                           (byte)(payloadCount >> 8) };
+        arduino.Write(request, 0, request.Length);
+        Util.WaitForAck(arduino, "link test", false);
+    }
+
+    /// <summary>
+    /// Sends payloads of random bytes one at a time, and times how long the Arduino's echo of each takes to arrive.
+    /// On timeout, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="payloadLength">The length of each payload.</param>
+    /// <param name="payloadCount">The number of payloads.</param>
+    /// <param name="errors">[ref] Incremented for every byte which was not echoed as it was sent.</param>
+    /// <returns>The round trip time of each payload, in milliseconds.</returns>
+    private static double[] Echo(Arduino arduino, int payloadLength, int payloadCount, ref int errors) {
+        Start(arduino, MODE_ECHO, payloadLength, payloadCount);
+        Random random = new Random(payloadLength);
+        byte[] payload = new byte[payloadLength];
+        byte[] echo = new byte[payloadLength];
+        double[] roundTrips = new double[payloadCount];
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            for (int i = 0; i < payloadCount; i++) {
+                random.NextBytes(payload);
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                arduino.Write(payload, 0, payload.Length);
+                arduino.ReadFully(echo, 0, echo.Length);
+                roundTrips[i] = stopwatch.Elapsed.TotalMilliseconds;
+                for (int j = 0; j < payloadLength; j++) {
+                    if (echo[j] != payload[j]) errors++;
+                }
+            }
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to echo " +
+                                       "a payload: the link lost bytes at " + arduino.BaudRate + " baud.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+        Util.WaitForAck(arduino, "link test (echo)", false);
+        return roundTrips;
+    }
+
+    /// <summary>
+    /// Sends payloads of the link test pattern back to back, and gets the rate at which the Arduino received them. On
+    /// error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="payloadLength">The length of each payload.</param>
+    /// <param name="payloadCount">The number of payloads.</param>
+    /// <param name="errors">[ref] Incremented for every byte which did not arrive as it was sent.</param>
+    /// <returns>The rate at which the payloads arrived, in bytes per second.</returns>
+    private static double Sink(Arduino arduino, int payloadLength, int payloadCount, ref int errors) {
+        Start(arduino, MODE_SINK, payloadLength, payloadCount);
+        byte[] payload = new byte[payloadLength];
+        long position = 0;
+        for (int i = 0; i < payloadCount; i++) {
+            for (int j = 0; j < payloadLength; j++) payload[j] = PatternByte(position++);
+            arduino.Write(payload, 0, payload.Length);
+        }
+        Util.WaitForAck(arduino, "link test (sink)", false);
+
+        byte[] result = new byte[8];
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            arduino.ReadFully(result, 0, result.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to " +
+                                       "time the payloads it received.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+        uint elapsedUs = BitConverter.ToUInt32(result, 0);
+        errors += (int)BitConverter.ToUInt32(result, 4);
+        // the time runs from the first byte's arrival to the last's
+        return elapsedUs == 0 ? 0.0 : (position - 1) * 1000000.0 / elapsedUs;
+    }
+
+    /// <summary>
+    /// Has the Arduino send payloads of the link test pattern back to back, and times their arrival. On timeout,
+    /// prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="payloadLength">The length of each payload.</param>
+    /// <param name="payloadCount">The number of payloads.</param>
+    /// <param name="errors">[ref] Incremented for every byte which did not arrive as it was sent.</param>
+    /// <returns>The rate at which the payloads arrived, in bytes per second.</returns>
+    private static double Source(Arduino arduino, int payloadLength, int payloadCount, ref int errors) {
+        Start(arduino, MODE_SOURCE, payloadLength, payloadCount);
+        byte[] payload = new byte[payloadLength];
+        long position = 0;
+        Stopwatch stopwatch = null;
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            for (int i = 0; i < payloadCount; i++) {
+                int offset = 0;
+                if (stopwatch == null) {
+                    // the time runs from the first byte's arrival to the last's, as the Arduino times the sink
+                    payload[offset++] = (byte)arduino.ReadByte();
+                    stopwatch = Stopwatch.StartNew();
+                }
+                arduino.ReadFully(payload, offset, payloadLength - offset);
+                for (int j = 0; j < payloadLength; j++) {
+                    if (payload[j] != PatternByte(position++)) errors++;
+                }
+            }
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to send " +
+                                       "a payload: the link lost bytes at " + arduino.BaudRate + " baud.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+        double elapsedMs = stopwatch.Elapsed.TotalMilliseconds;
+        Util.WaitForAck(arduino, "link test (source)", false);
+        return elapsedMs <= 0 ? 0.0 : (position - 1) * 1000.0 / elapsedMs;
+    }
+
+    /// <summary>
+    /// Gets a byte of the link test pattern: see linkTestPatternByte in the Arduino's communication_util.cpp.
+    /// </summary>
+    /// <param name="position">The byte's position in the whole stream of payloads.</param>
+    /// <returns>The byte.</returns>
+    private static byte PatternByte(long position) {
+        return (byte)position;
+    }
+
+    /// <summary>
+    /// Gets a percentile of some values, by the nearest rank.
+    /// </summary>
+    /// <param name="sorted">The values, in ascending order.</param>
+    /// <param name="percentile">The percentile, from 0 to 1.</param>
+    /// <returns>The smallest value which is at least that fraction of the values.</returns>
+    private static double Percentile(double[] sorted, double percentile) {
+        int rank = (int)Math.Ceiling(percentile * sorted.Length);
+        return sorted[Math.Max(0, rank - 1)];
+    }
+}
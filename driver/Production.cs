@@ -0,0 +1,198 @@
+﻿/*
+ * Class which runs production line mode (--production): the plan is prepared once, then programmed into every chip
+ * the operator inserts, with no relaunch or reconnect between chips. See production.h in the Arduino sketch for the
+ * Arduino's side.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.IO.Ports;
+using System.Text;
+
+/// <summary> Class which programs chip after chip as the operator swaps them, in production line mode. </summary>
+internal static class Production {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    private const int MAX_EVENT_LENGTH = 32;
+    // pass (1), sectors programmed (2), sectors failed (2), CRC (4), milliseconds since the chip was detected (4)
+    private const int RESULT_LENGTH = 13;
+
+    //=============================================================================
+    //             CORE FUNCTION - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Puts the Arduino into production line mode, and programs the plan into each chip that is inserted, until the
+    /// program is stopped (Ctrl+C). On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="plan">The plan to program into each chip.</param>
+    /// <param name="template">The per-unit fields to patch into each chip (see UnitTemplate.cs), or null. Each chip
+    /// that passes uses up a unit number.</param>
+    internal static void Run(Arduino arduino, ProgrammingPlan plan, UnitTemplate template) {
+        // Load every sector up front, so that each chip only costs the transfer
+        List<int> sectorIndices = new List<int>(plan.SectorIndices);
+        uint expectedCrc = ImageCrc(plan, sectorIndices);
+
+        Util.SendCommandMessage(arduino, Arduino.PRODUCTION_MESSAGE);
+        Console.WriteLine("Production mode: insert a chip to program it with " + plan.Description + ". Press " +
+                          "Ctrl+C to stop.");
+
+        int passed = 0;
+        int failed = 0;
+        while (true) {
+            string chipEvent = WaitForEvent(arduino);
+            if (chipEvent == Arduino.CHIP_INSERTED_MESSAGE) {
+                byte[] idBytes = new byte[2];
+                ReadOrExit(arduino, idBytes, "chip ID");
+                Console.WriteLine(String.Format("Chip inserted (ID 0x{0:X4}): programming {1} sectors{2}...",
+                    idBytes[0] | (idBytes[1] << 8), sectorIndices.Count,
+                    template == null ? "" : " as unit " + template.NextUnit));
+
+                // Only the sectors holding fields differ from plan, so only they are rebuilt for each unit
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                ProgrammingPlan unitPlan = plan;
+                uint unitCrc = expectedCrc;
+                if (template != null) {
+                    unitPlan = template.BuildUnit();
+                    unitCrc = ImageCrc(unitPlan, sectorIndices);
+                }
+                foreach (int sectorIndex in sectorIndices) {
+                    SectorProgramming.ProgramSector(arduino, new MemoryStream(unitPlan.SectorData(sectorIndex)),
+                                                    sectorIndex);
+                }
+                if (EndChip(arduino, sectorIndices.Count, unitCrc)) {
+                    if (template != null) template.CommitUnit();
+                    passed++;
+                } else {
+                    failed++;
+                }
+                Console.WriteLine(String.Format("{0:F1} s. {1} passed, {2} failed this session. Remove the chip.",
+                    stopwatch.Elapsed.TotalSeconds, passed, failed));
+            } else if (chipEvent == Arduino.CHIP_REMOVED_MESSAGE) {
+                Console.WriteLine("Chip removed: insert the next one.");
+            } else {
+                Util.PrintAndExitFlushLogs("While waiting for a chip, got unexpected message " + chipEvent + ".",
+                                           arduino);
+            }
+        }
+    }
+
+    //=============================================================================
+    //             EVENTS AND RESULTS
+    //=============================================================================
+
+    /// <summary>
+    /// Waits, for as long as it takes, for the Arduino to send an event (a null-terminated message). On error, prints
+    /// an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>The event, including its null terminator (as in Arduino.CHIP_INSERTED_MESSAGE).</returns>
+    private static string WaitForEvent(Arduino arduino) {
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = SerialPort.InfiniteTimeout;  // the operator may take any time to swap chips
+        try {
+            byte b = (byte)arduino.ReadByte();
+            if (b == Arduino.NAK_BYTE) {
+                Console.WriteLine("While waiting for a chip, got a NAK with message:");
+                arduino.GetAndPrintNakMessage();
+                Util.Exit(1, arduino);
+            }
+
+            arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+            StringBuilder message = new StringBuilder();
+            message.Append((char)b);
+            while (b != Arduino.NULL_BYTE && message.Length < MAX_EVENT_LENGTH) {
+                b = (byte)arduino.ReadByte();
+                message.Append((char)b);
+            }
+            return message.ToString();
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting for Arduino to " +
+                                       "finish sending an event.", arduino);
+            return null;  // for the compiler
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+    }
+
+    /// <summary>
+    /// Tells the Arduino that the chip has been programmed, and prints the result record it sends back. On error,
+    /// prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="sectorCount">The number of sectors programmed.</param>
+    /// <param name="expectedCrc">The CRC-32 of the data programmed, in the order it was programmed.</param>
+    /// <returns>Whether the chip passed.</returns>
+    private static bool EndChip(Arduino arduino, int sectorCount, uint expectedCrc) {
+        Util.SendCommandMessage(arduino, Arduino.END_CHIP_MESSAGE);
+        byte[] expected = { (byte)sectorCount, (byte)(sectorCount >> 8), (byte)expectedCrc, (byte)(expectedCrc >> 8),
+                            (byte)(expectedCrc >> 16), (byte)(expectedCrc >> 24) };
+        arduino.Write(expected, 0, expected.Length);
+        Util.WaitForAck(arduino, "ending chip", false);
+
+        byte[] result = new byte[RESULT_LENGTH];
+        ReadOrExit(arduino, result, "chip result");
+        bool passed = result[0] == 1;
+        int programmed = result[1] | (result[2] << 8);
+        int failedSectors = result[3] | (result[4] << 8);
+        uint crc = BitConverter.ToUInt32(result, 5);
+        uint elapsedMs = BitConverter.ToUInt32(result, 9);
+
+        Console.WriteLine(String.Format("{0}: {1} sectors programmed, {2} failed, CRC 0x{3:X8} (expected 0x{4:X8}), " +
+                                        "{5} ms on the Arduino.", passed ? "PASS" : "FAIL", programmed, failedSectors,
+            crc, expectedCrc, elapsedMs));
+        return passed;
+    }
+
+    /// <summary>
+    /// Computes the CRC-32 of the data a plan programs, in the order it is programmed, as the Arduino computes it.
+    /// </summary>
+    /// <param name="plan">The plan.</param>
+    /// <param name="sectorIndices">The indices of the plan's sectors, in order.</param>
+    /// <returns>The CRC-32.</returns>
+    private static uint ImageCrc(ProgrammingPlan plan, List<int> sectorIndices) {
+        uint crc = 0;
+        foreach (int sectorIndex in sectorIndices) {
+            crc = Crc32.Update(crc, plan.SectorData(sectorIndex), 0, Arduino.SST_SECTOR_SIZE);
+        }
+        return crc;
+    }
+
+    /// <summary>
+    /// Fills a buffer from the Arduino. On timeout, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="buffer">The buffer to fill.</param>
+    /// <param name="what">What is being read, for the error message.</param>
+    private static void ReadOrExit(Arduino arduino, byte[] buffer, string what) {
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            arduino.ReadFully(buffer, 0, buffer.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting " +
+                                       "for Arduino to send " + what + ".", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+    }
+}
@@ -0,0 +1,370 @@
+﻿/*
+ * Class which represents the sectors a write job (-w/-a) will program. Plans are built in full before any
+ * communication with the Arduino, so that they can be inspected and estimated (--plan) as well as executed.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.IO;
+
+/// <summary> The sectors that a write job will program, and the data to program into each of them. </summary>
+internal class ProgrammingPlan {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    /* Bytes on the wire for one sector (see SectorProgramming.cs): the PROGRAMSECTOR command, the sector index and the
+     * sector data from us, each answered by the Arduino with an ACK and/or an echo, plus our ACKs of the echoes. The
+     * data's echo is not counted in SECTOR_BYTES_FROM_ARDUINO, as its length depends on the verification policy. */
+    private static readonly int SECTOR_BYTES_TO_ARDUINO = (Arduino.PROGRAM_SECTOR_MESSAGE.Length + 1) + 2 + 1
+                                                          + Arduino.SST_SECTOR_SIZE + 1;
+    private const int SECTOR_BYTES_FROM_ARDUINO = 1 + (1 + 2) + 1;
+    // Round trips per sector: command ACK, index echo, data echo, programming ACK
+    private const int SECTOR_ROUND_TRIPS = 4;
+
+    private const int MAX_DIFFERENCES_PRINTED = 8;  // ranges of differing bytes printed per sector by Verify
+
+    //=============================================================================
+    //             INSTANCE VARIABLES
+    //=============================================================================
+
+    /** Maps the index of each sector to program to the CRC-32 of its data. Sorted by sector index, which is also
+     * the order in which sectors are programmed. */
+    private SortedDictionary<int, uint> _crcs = new SortedDictionary<int, uint>();
+    /** Maps the index of each sector to its data (exactly Arduino.SST_SECTOR_SIZE bytes), once it has been loaded. */
+    private Dictionary<int, byte[]> _data = new Dictionary<int, byte[]>();
+    /** Loads a sector's data on first use, for plans whose data is not all in memory (e.g. image containers). */
+    private Func<int, byte[]> _loader;
+
+    /** Human-readable description of the job this plan is for, e.g. '-w program.bin'. */
+    internal string Description { get; private set; }
+
+    /** The indices of the sectors to program, in the order they will be programmed. */
+    internal IEnumerable<int> SectorIndices {
+        get { return _crcs.Keys; }
+    }
+
+    /** The number of sectors to program. */
+    internal int SectorCount {
+        get { return _crcs.Count; }
+    }
+
+    /** Identifies the job: a CRC-32 over the index and data CRC of every sector, in order. Two plans with the same
+     * JobId (almost certainly) program the same data to the same sectors. */
+    internal uint JobId {
+        get {
+            uint crc = 0;
+            foreach (KeyValuePair<int, uint> entry in _crcs) {
+                crc = Crc32.Update(crc, Util.SectorIndexToBytes(entry.Key), 0, 2);
+                crc = Crc32.Update(crc, BitConverter.GetBytes(entry.Value), 0, 4);
+            }
+            return crc;
+        }
+    }
+
+    //=============================================================================
+    //             CONSTRUCTION
+    //=============================================================================
+
+    /// <summary>
+    /// Constructor.
+    /// </summary>
+    /// <param name="description">Human-readable description of the job this plan is for.</param>
+    /// <param name="sectors">Map from the index of each sector to program to its data. Each sector's data must be
+    /// exactly Arduino.SST_SECTOR_SIZE bytes.</param>
+    internal ProgrammingPlan(string description, IDictionary<int, byte[]> sectors) {
+        Description = description;
+        foreach (KeyValuePair<int, byte[]> entry in sectors) {
+            _data[entry.Key] = entry.Value;
+            _crcs[entry.Key] = Crc32.Compute(entry.Value);
+        }
+    }
+
+    /// <summary>
+    /// Constructor, for a plan whose sector CRCs are known up front but whose data is loaded on first use.
+    /// </summary>
+    /// <param name="description">Human-readable description of the job this plan is for.</param>
+    /// <param name="crcs">Map from the index of each sector to program to the CRC-32 of its data.</param>
+    /// <param name="loader">Loads a sector's data, given its index. Must return exactly Arduino.SST_SECTOR_SIZE
+    /// bytes, with the CRC-32 given in crcs.</param>
+    internal ProgrammingPlan(string description, IDictionary<int, uint> crcs, Func<int, byte[]> loader) {
+        Description = description;
+        foreach (KeyValuePair<int, uint> entry in crcs) {
+            _crcs[entry.Key] = entry.Value;
+        }
+        _loader = loader;
+    }
+
+    /// <summary>
+    /// Builds the plan to write a file to the SST39SF: an image container (see ImageContainer.cs) if it has the
+    /// container's extension, otherwise a binary file (see FromBinary). On error, prints a message and exits.
+    /// </summary>
+    /// <param name="path">The path of the file to write to the SST39SF.</param>
+    /// <returns>The plan.</returns>
+    internal static ProgrammingPlan FromFile(string path) {
+        if (ImageContainer.IsContainerPath(path)) return ImageContainer.Read(path);
+        return FromBinary(path);
+    }
+
+    /// <summary>
+    /// Builds the plan to write a binary file to the SST39SF, starting at address 0x0. The last sector is padded with
+    /// zeroes if the file does not fill it. On error, prints a message and exits.
+    /// </summary>
+    /// <param name="binaryPath">The path of the file to write to the SST39SF.</param>
+    /// <returns>The plan.</returns>
+    internal static ProgrammingPlan FromBinary(string binaryPath) {
+        Dictionary<int, byte[]> sectors = new Dictionary<int, byte[]>();
+
+        using (FileStream binaryFile = Util.OpenBinaryFile(binaryPath)) {
+            if (binaryFile.Length > Arduino.MAX_FLASH_SIZE) {
+                Util.PrintAndExit("File is too large to fit on any chip the programmer supports.");
+            }
+
+            for (int sectorIndex = 0; binaryFile.Position < binaryFile.Length; sectorIndex++) {
+                // Sector data is initialized to all zeroes: this implicitly pads the last sector
+                byte[] sectorData = new byte[Arduino.SST_SECTOR_SIZE];
+                if (binaryFile.Read(sectorData, 0, sectorData.Length) < Arduino.SST_SECTOR_SIZE
+                        && binaryFile.Position != binaryFile.Length) {
+                    Util.PrintAndExit("Internal error: binary filestream did not read a full sector, but is not" +
+                                      "at the end of file.");
+                }
+                sectors[sectorIndex] = sectorData;
+            }
+        }
+
+        return new ProgrammingPlan("-w " + binaryPath, sectors);
+    }
+
+    /// <summary>
+    /// Builds a plan which programs the same sectors as this one, with some of them replaced by different data. The
+    /// rest share this plan's data, and are only loaded when first used by either plan.
+    /// </summary>
+    /// <param name="description">Human-readable description of the job the new plan is for.</param>
+    /// <param name="replacements">Map from the index of each sector to replace to its new data. Each sector must be
+    /// in this plan, and its data must be exactly Arduino.SST_SECTOR_SIZE bytes.</param>
+    /// <returns>The new plan.</returns>
+    internal ProgrammingPlan WithReplacedSectors(string description, IDictionary<int, byte[]> replacements) {
+        Dictionary<int, uint> crcs = new Dictionary<int, uint>(_crcs);
+        foreach (KeyValuePair<int, byte[]> entry in replacements) {
+            crcs[entry.Key] = Crc32.Compute(entry.Value);
+        }
+        ProgrammingPlan plan = new ProgrammingPlan(description, crcs, SectorData);
+        foreach (KeyValuePair<int, byte[]> entry in replacements) {
+            plan._data[entry.Key] = entry.Value;
+        }
+        return plan;
+    }
+
+    //=============================================================================
+    //             SECTORS
+    //=============================================================================
+
+    /// <summary>
+    /// Gets the data of a sector in the plan, loading it if necessary.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>The data to program into the sector (exactly Arduino.SST_SECTOR_SIZE bytes).</returns>
+    internal byte[] SectorData(int sectorIndex) {
+        byte[] data;
+        if (!_data.TryGetValue(sectorIndex, out data)) {
+            data = _loader(sectorIndex);
+            _data[sectorIndex] = data;
+        }
+        return data;
+    }
+
+    /// <summary>
+    /// Returns whether the plan programs a sector.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>Whether the plan programs the sector.</returns>
+    internal bool ContainsSector(int sectorIndex) {
+        return _crcs.ContainsKey(sectorIndex);
+    }
+
+    /// <summary>
+    /// Gets the CRC-32 of the data of a sector in the plan. Does not load the sector's data.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>The CRC-32 of the data to program into the sector.</returns>
+    internal uint SectorCrc(int sectorIndex) {
+        return _crcs[sectorIndex];
+    }
+
+    //=============================================================================
+    //             EXECUTION
+    //=============================================================================
+
+    /// <summary>
+    /// Programs every sector in the plan that the journal does not record as already programmed, recording each
+    /// sector in the journal as it completes. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="journal">The journal of this job.</param>
+    /// <param name="incremental">Whether to skip sectors which already hold their data on the chip (checked by
+    /// CRC, which is much quicker than programming).</param>
+    /// <param name="cache">The chip's identity tag cache (see TagCache.cs), or null. Sectors which the cache knows
+    /// already hold their data are skipped without checking the chip, and if the chip's tag was found, the rest
+    /// are checked by CRC as if incremental was set. Sectors whose current contents the cache knows are programmed
+    /// from a delta against them (see DeltaProgramming.cs). Every sector is recorded in the cache.</param>
+    internal void Execute(Arduino arduino, JobJournal journal, bool incremental, TagCache cache) {
+        incremental = incremental || (cache != null && cache.Found);
+        bool verified = arduino.VerifyPolicy.Policy != Arduino.VERIFY_NONE;  // whether sectors programmed are checked
+        int skipped = 0;
+        int deltas = 0;
+        foreach (int sectorIndex in _crcs.Keys) {
+            uint crc = _crcs[sectorIndex];
+            if (journal.IsCompleted(sectorIndex, crc)) {
+                Util.WriteLineVerbose("Sector " + sectorIndex + " already programmed according to journal: skipping.");
+                continue;
+            }
+            if (cache != null && cache.Holds(sectorIndex, crc)) {
+                Util.WriteLineVerbose("Sector " + sectorIndex + " holds its data according to tag cache: skipping.");
+                journal.RecordCompleted(sectorIndex, crc, true);
+                skipped++;
+                continue;
+            }
+            byte[] known = cache != null ? cache.KnownContents(sectorIndex) : null;
+            if (known != null && DeltaProgramming.ProgramSector(arduino, known, SectorData(sectorIndex), sectorIndex)) {
+                Util.WriteLineVerbose("Sector " + sectorIndex + " programmed from a delta against tag cache.");
+                cache.RecordProgrammed(sectorIndex, SectorData(sectorIndex));
+                journal.RecordCompleted(sectorIndex, crc, verified);
+                deltas++;
+                continue;
+            }
+            if (incremental && SectorChecksum.ReadSectorCrc(arduino, sectorIndex) == crc) {
+                Util.WriteLineVerbose("Sector " + sectorIndex + " already holds its data: skipping.");
+                if (cache != null) cache.RecordMatched(sectorIndex, SectorData(sectorIndex));
+                journal.RecordCompleted(sectorIndex, crc, true);
+                skipped++;
+                continue;
+            }
+            SectorProgramming.ProgramSector(arduino, new MemoryStream(SectorData(sectorIndex)), sectorIndex);
+            if (cache != null) cache.RecordProgrammed(sectorIndex, SectorData(sectorIndex));
+            journal.RecordCompleted(sectorIndex, crc, verified);
+        }
+        if (incremental || cache != null) {
+            Console.WriteLine(skipped + " of " + SectorCount + " sectors already held their data, and were skipped.");
+        }
+        if (deltas > 0) {
+            Console.WriteLine(deltas + " sectors were programmed from a delta against their cached contents.");
+        }
+    }
+
+    /// <summary>
+    /// Checks that every sector in the plan holds its data on the chip, by comparing CRCs, and prints the sectors
+    /// which don't, with the ranges of bytes in them which differ (found with the checksum tree: see
+    /// ChecksumTree.cs). On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <returns>Whether every sector matched.</returns>
+    internal bool Verify(Arduino arduino) {
+        /* Asking for the CRC of every sector at once saves a round trip per sector, but the Arduino then reads the
+         * whole chip, and reading a sector takes far longer than a round trip: so it only pays off if the plan covers
+         * the whole chip. Otherwise, each sector in the plan is asked for on its own. */
+        uint[] sectorCrcs = null;
+        if (SectorCount == arduino.ChipSectors) {
+            sectorCrcs = ChecksumTree.ReadSectorCrcs(arduino);
+        }
+        int mismatches = 0;
+        foreach (KeyValuePair<int, uint> entry in _crcs) {
+            if (sectorCrcs != null && entry.Key >= sectorCrcs.Length) {
+                Util.PrintAndExitFlushLogs("Sector " + entry.Key + " is past the end of the chip, which has " +
+                                           sectorCrcs.Length + " sectors.", arduino);
+            }
+            uint onChip = sectorCrcs != null ? sectorCrcs[entry.Key]
+                                             : SectorChecksum.ReadSectorCrc(arduino, entry.Key);
+            if (onChip != entry.Value) {
+                Console.WriteLine(String.Format("Sector {0} (0x{1:X5}) does not match: CRC on chip 0x{2:X8}, " +
+                                                "expected 0x{3:X8}.", entry.Key,
+                    (long)entry.Key * Arduino.SST_SECTOR_SIZE, onChip, entry.Value));
+                PrintDifferences(arduino, entry.Key);
+                mismatches++;
+            }
+        }
+        Console.WriteLine(mismatches == 0 ? "All " + SectorCount + " sectors match."
+                                          : mismatches + " of " + SectorCount + " sectors do not match.");
+        return mismatches == 0;
+    }
+
+    /// <summary>
+    /// Prints the ranges of bytes of a sector which differ from its data in the plan. On error, prints an error
+    /// message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    private void PrintDifferences(Arduino arduino, int sectorIndex) {
+        List<int[]> ranges = ChecksumTree.FindDifferences(arduino, sectorIndex, SectorData(sectorIndex));
+        long startAddress = (long)sectorIndex * Arduino.SST_SECTOR_SIZE;
+        int differingBytes = 0;
+        for (int i = 0; i < ranges.Count; i++) {
+            differingBytes += ranges[i][1] - ranges[i][0];
+            if (i < MAX_DIFFERENCES_PRINTED) {
+                Console.WriteLine(String.Format("    0x{0:X5} - 0x{1:X5} differ", startAddress + ranges[i][0],
+                    startAddress + ranges[i][1] - 1));
+            }
+        }
+        if (ranges.Count > MAX_DIFFERENCES_PRINTED) {
+            Console.WriteLine("    ... and " + (ranges.Count - MAX_DIFFERENCES_PRINTED) + " more ranges");
+        }
+        Console.WriteLine("    " + differingBytes + " bytes differ in " + ranges.Count + " ranges.");
+    }
+
+    //=============================================================================
+    //             ESTIMATION
+    //=============================================================================
+
+    /// <summary>
+    /// Prints the plan, with an estimate of how long it will take to execute and how much it will send over the
+    /// serial link, without communicating with the Arduino.
+    /// </summary>
+    /// <param name="profile">The timing profile to estimate with.</param>
+    /// <param name="verify">The verification policy the plan will be executed with.</param>
+    internal void PrintEstimate(TimingProfile profile, VerifyPolicy verify) {
+        Console.WriteLine("Plan for " + Description + ":");
+        Console.WriteLine("    Sector    Addresses");
+        foreach (int sectorIndex in _crcs.Keys) {
+            long startAddress = (long)sectorIndex * Arduino.SST_SECTOR_SIZE;
+            Console.WriteLine(String.Format("    {0,-6}    0x{1:X5} - 0x{2:X5}", sectorIndex, startAddress,
+                startAddress + Arduino.SST_SECTOR_SIZE - 1));
+        }
+
+        long bytesToArduino = (long)SectorCount * SECTOR_BYTES_TO_ARDUINO;
+        long bytesFromArduino = (long)SectorCount * (SECTOR_BYTES_FROM_ARDUINO + verify.EchoLength);
+        long bytesProgrammed = (long)SectorCount * Arduino.SST_SECTOR_SIZE;
+
+        double serialMs = (bytesToArduino + bytesFromArduino) * profile.ByteTimeMs;
+        double latencyMs = (double)SectorCount * SECTOR_ROUND_TRIPS * profile.TurnaroundMs;
+        // each sector is erased while its data is on the wire: only the part of the erase that outlasts that counts
+        double dataMs = Arduino.SST_SECTOR_SIZE * profile.ByteTimeMs;
+        double eraseMs = SectorCount * Math.Max(0.0, profile.SectorEraseMs - dataMs);
+        double programMs = bytesProgrammed * profile.ByteProgramUs / 1000.0;
+        double verifyMs = (double)SectorCount * verify.BytesReadBack * profile.ByteVerifyUs / 1000.0;
+        double totalMs = serialMs + latencyMs + eraseMs + programMs + verifyMs;
+
+        Console.WriteLine();
+        Console.WriteLine(String.Format("{0} sector erases, {1} byte programs, 0 chip erases.", SectorCount,
+            bytesProgrammed));
+        Console.WriteLine(String.Format("Bytes on the wire: {0} to the Arduino, {1} from the Arduino.", bytesToArduino,
+            bytesFromArduino));
+        Console.WriteLine(String.Format("Estimated time: {0:F1} s (serial {1:F1} s, round trips {2:F1} s, " +
+                                        "erase {3:F1} s, program {4:F1} s, verify {5:F1} s).", totalMs / 1000.0,
+            serialMs / 1000.0, latencyMs / 1000.0, eraseMs / 1000.0, programMs / 1000.0, verifyMs / 1000.0));
+        Console.WriteLine("Verification policy: " + verify.Name + ".");
+        profile.Print();
+    }
+}
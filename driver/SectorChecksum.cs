@@ -0,0 +1,63 @@
+﻿/*
+ * Class which implements reading sector checksums from the Arduino.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+
+/// <summary> Class which handles reading the checksum of a sector of the SST39SF via the Arduino. This lets us check
+/// what is on the chip without reading the whole sector back over serial. </summary>
+internal static class SectorChecksum {
+    //=============================================================================
+    //             CORE FUNCTION - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Reads the CRC-32 of a sector's contents (see Crc32.cs). On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>The CRC-32 of the sector's contents.</returns>
+    internal static uint ReadSectorCrc(Arduino arduino, int sectorIndex) {
+        Util.SendCommandMessage(arduino, Arduino.SECTOR_CRC_MESSAGE);
+        Util.WriteLineVerbose("Requesting CRC of sector " + sectorIndex + " from Arduino...");
+        byte[] indexBytes = Util.SectorIndexToBytes(sectorIndex);
+        arduino.Write(indexBytes, 0, indexBytes.Length);
+        Util.WaitForAck(arduino, "sector CRC", false);
+
+        // ACK is followed by the sector index (2 bytes) and the CRC (4 bytes), both little-endian
+        byte[] response = new byte[6];
+        arduino.PushTimeoutStack();
+        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
+        try {
+            arduino.ReadFully(response, 0, response.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting " +
+                                       "for Arduino to send sector CRC.", arduino);
+        } finally {
+            arduino.PopTimeoutStack();
+        }
+
+        int echoedIndex = Util.SectorIndexFromBytes(response);
+        if (echoedIndex != sectorIndex) {
+            Util.PrintAndExitFlushLogs("Requested CRC of sector " + sectorIndex + ", but Arduino sent CRC of sector " +
+                                       echoedIndex + ". Exiting.", arduino);
+        }
+        uint crc = (uint)response[2] | ((uint)response[3] << 8) | ((uint)response[4] << 16) | ((uint)response[5] << 24);
+        Util.WriteLineVerbose("Sector " + sectorIndex + " has CRC 0x" + crc.ToString("X8") + ".");
+        return crc;
+    }
+}
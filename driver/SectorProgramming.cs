@@ -17,6 +17,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 using System;
+using System.Diagnostics;
 using System.IO;
 using System.Linq;
 
@@ -47,7 +48,7 @@ internal static class SectorProgramming {
         Util.SendCommandMessage(arduino, Arduino.PROGRAM_SECTOR_MESSAGE);
         SendAndConfirmSectorIndex(arduino, sectorIndex);
         SendAndConfirmSectorData(arduino, sectorData);
-        Util.WaitForAck(arduino, "sector programming", true);
+        Util.WaitForAck(arduino, "sector programming", LatencyTracker.SectorProgramming);
     }
     
     //=============================================================================
@@ -63,16 +64,19 @@ internal static class SectorProgramming {
     /// <param name="sectorIndex">The sector index to send to the Arduino.</param>
     private static void SendAndConfirmSectorIndex(Arduino arduino, int sectorIndex) {
         arduino.PushTimeoutStack();
-        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
         Util.WriteLineVerbose("Sending sector index " + sectorIndex + " to Arduino...");
         
-        byte[] indexBytes = { (byte)sectorIndex, (byte)(sectorIndex >> 4) };  // little-endian
+        byte[] indexBytes = Util.SectorIndexToBytes(sectorIndex);
         
         try {
             for (int i = 0; i < ArduinoDriver.NUM_RETRIES; i++) {
                 if (i != 0) Console.WriteLine("Retrying...");
+                arduino.ReadTimeout = LatencyTracker.IndexEcho.TimeoutMs;
+                Stopwatch stopwatch = Stopwatch.StartNew();
                 arduino.Write(indexBytes, 0, indexBytes.Length);
-                if (ProcessSectorIndexResponse(arduino, sectorIndex)) return;
+                bool confirmed = ProcessSectorIndexResponse(arduino, sectorIndex);
+                LatencyTracker.IndexEcho.Observe(stopwatch.Elapsed.TotalMilliseconds);
+                if (confirmed) return;
                 // else retry
             }
             
@@ -126,8 +130,7 @@ internal static class SectorProgramming {
                               "for Arduino to echo sector index.", arduino);
         }
 
-        // bytes are automatically promoted to int before shifting, so no truncation can occur
-        int echoedIndex = (echoedIndexBytes[1] << 4) | echoedIndexBytes[0];  // index is transmitted little-endian
+        int echoedIndex = Util.SectorIndexFromBytes(echoedIndexBytes);
         if (echoedIndex != sectorIndex) {
             arduino.Nak();
             Console.WriteLine("Echoed sector index from Arduino did not match, sent NAK.");
@@ -153,14 +156,17 @@ internal static class SectorProgramming {
     /// <param name="data">The sector data to send to the Arduino.</param>
     private static void SendAndConfirmSectorData(Arduino arduino, byte[] data) {
         arduino.PushTimeoutStack();
-        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
         Util.WriteLineVerbose("Sending sector data to Arduino...");
 
         try {
             for (int i = 0; i < ArduinoDriver.NUM_RETRIES; i++) {
                 if (i != 0) Console.WriteLine("Retrying...");
+                arduino.ReadTimeout = LatencyTracker.DataEcho.TimeoutMs;
+                Stopwatch stopwatch = Stopwatch.StartNew();
                 arduino.Write(data, 0, data.Length);
-                if (ProcessSectorDataResponse(arduino, data)) return;
+                bool confirmed = ProcessSectorDataResponse(arduino, data);
+                LatencyTracker.DataEcho.Observe(stopwatch.Elapsed.TotalMilliseconds);
+                if (confirmed) return;
                 // else retry
             }
             
@@ -173,36 +179,39 @@ internal static class SectorProgramming {
     
     /// <summary>
     /// Reads the response from the Arduino, after we have sent the sector data. We are expecting the sector data
-    /// we sent to be echoed. If the Arduino echoes the correct data, this function returns true. If it echoes
-    /// incorrect data, it returns false. Otherwise, on error, this function exits and prints an error message.
+    /// we sent to be echoed, or only its CRC-32 if the verification policy says so (see VerifyPolicy.cs). If the
+    /// Arduino echoes the correct data, this function returns true. If it echoes incorrect data, it returns false.
+    /// Otherwise, on error, this function exits and prints an error message.
     /// </summary>
     /// <param name="arduino">A serial port connected to the Arduino.</param>
     /// <param name="data">The sector data we sent the Arduino.</param>
     /// <returns>Whether the data the Arduino echoed back to us matched what we sent it.</returns>
     private static bool ProcessSectorDataResponse(Arduino arduino, byte[] data) {
-        arduino.PushTimeoutStack();
-        arduino.ReadTimeout = ArduinoDriver.NORMAL_TIMEOUT;
-        try {
-            byte[] echoedData = new byte[data.Length];
+        byte[] echoedData = new byte[arduino.VerifyPolicy.EchoLength];
 
-            try {
-                arduino.ReadFully(echoedData, 0, echoedData.Length);
-            } catch (TimeoutException) {
-                Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting " +
-                                  "for Arduino to echo sector data.", arduino);
-            }
+        try {
+            arduino.ReadFully(echoedData, 0, echoedData.Length);
+        } catch (TimeoutException) {
+            Util.PrintAndExitFlushLogs("Timed out (>" + arduino.ReadTimeout + "ms) while waiting " +
+                              "for Arduino to echo sector data.", arduino);
+        }
 
-            if (!echoedData.SequenceEqual(data)) {  // slow, but probably good enough for these small amounts of data
-                arduino.Nak();
-                Console.WriteLine("Echoed sector data from Arduino did not match, sent NAK.");
-                return false;
-            } else {
-                arduino.Ack();
-                Util.WriteLineVerbose("Echoed sector data matched, acknowledged.");
-                return true;
-            }
-        } finally {
-            arduino.PopTimeoutStack();
+        bool matched;
+        if (arduino.VerifyPolicy.EchoesData) {
+            matched = echoedData.SequenceEqual(data);  // slow, but probably good enough for these small amounts of data
+        } else {
+            uint crc = (uint)echoedData[0] | ((uint)echoedData[1] << 8) | ((uint)echoedData[2] << 16)
+                       | ((uint)echoedData[3] << 24);
+            matched = crc == Crc32.Compute(data);
+        }
+        if (!matched) {
+            arduino.Nak();
+            Console.WriteLine("Echoed sector data from Arduino did not match, sent NAK.");
+            return false;
+        } else {
+            arduino.Ack();
+            Util.WriteLineVerbose("Echoed sector data matched, acknowledged.");
+            return true;
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+﻿/*
+ * Class which keeps a local cache of what the driver last wrote to each chip, keyed by an identity tag on the chip
+ * itself (--tag). With the cache, an update only needs to check and program the sectors whose contents change.
+ * 
+ * The tag is a sector, chosen by the user, that holds nothing else: the magic bytes "SSTIDTAG" and 16 random bytes,
+ * with the rest of the sector 0xFF. It is read with SECTORCRC: the CRC-32 of the tag sector identifies the chip. For
+ * each tag, the cache holds an image container (see ImageContainer.cs) of every sector the driver knows the contents
+ * of, named after the tag, in %LOCALAPPDATA%\SST39SF-programmer\tags. A chip with no tag, or one whose tag has no
+ * cache on this computer, is given a new tag.
+ * 
+ * A cache is deleted as soon as it is loaded, and only written back once a job has finished, so an interrupted job
+ * never leaves a cache that disagrees with the chip: the next job just tags the chip again. Erasing the chip (-e)
+ * erases the tag too. Writing to a tagged chip without --tag (or with another programmer) makes its cache stale:
+ * use -v to check a chip against an image in full.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Text;
+
+/// <summary> The contents of a tagged chip, as last written by the driver. </summary>
+internal class TagCache {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    private const string TAG_MAGIC = "SSTIDTAG";
+    private const int TAG_ID_LENGTH = 16;
+
+    /* Sectors per erase block of the chip with the largest erase blocks (the 29F010, with 16KB blocks). On such a
+     * chip, an erase takes the whole block with it (the Arduino only erases a sector if the rest of its block is
+     * blank, but a chip may have been erased some other way), so after programming a sector, we no longer trust the
+     * cache for the rest of its block without checking. */
+    private const int ERASE_BLOCK_SECTORS = 4;
+
+    //=============================================================================
+    //             INSTANCE VARIABLES
+    //=============================================================================
+
+    /** The CRC-32 of the tag sector, which identifies the chip. */
+    private uint _tag;
+    /** Maps the index of each sector whose contents we know to those contents. */
+    private SortedDictionary<int, byte[]> _data = new SortedDictionary<int, byte[]>();
+    /** Maps the index of each sector whose contents we know to the CRC-32 of those contents. */
+    private Dictionary<int, uint> _crcs = new Dictionary<int, uint>();
+    /** The indices of the sectors programmed during this job. */
+    private HashSet<int> _programmed = new HashSet<int>();
+
+    /** Whether the chip's tag was found in the cache, i.e. whether the cache knows anything beyond the tag. */
+    internal bool Found { get; private set; }
+
+    //=============================================================================
+    //             CONSTRUCTION
+    //=============================================================================
+
+    /// <summary> Private constructor: use Open. </summary>
+    private TagCache() { }
+
+    /// <summary>
+    /// Reads a chip's identity tag and loads its cache. If the chip has no tag, or its tag is not in the cache,
+    /// writes a new tag to the chip. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="tagSector">The index of the sector that holds the tag.</param>
+    /// <returns>The chip's cache.</returns>
+    internal static TagCache Open(Arduino arduino, int tagSector) {
+        TagCache cache = new TagCache();
+        cache._tag = SectorChecksum.ReadSectorCrc(arduino, tagSector);
+        string path = CachePath(cache._tag);
+
+        if (File.Exists(path)) {
+            ProgrammingPlan cached = ImageContainer.Read(path);
+            foreach (int sectorIndex in cached.SectorIndices) {
+                cache.Record(sectorIndex, cached.SectorData(sectorIndex));
+            }
+            File.Delete(path);
+            cache.Found = true;
+            Console.WriteLine("Chip has identity tag " + cache._tag.ToString("X8") + ": contents of " +
+                              cache._data.Count + " sectors known.");
+        } else {
+            byte[] tagData = NewTagSector();
+            SectorProgramming.ProgramSector(arduino, new MemoryStream(tagData), tagSector);
+            cache._tag = Crc32.Compute(tagData);
+            cache.Record(tagSector, tagData);
+            Console.WriteLine("Chip has no known identity tag: tagged it as " + cache._tag.ToString("X8") +
+                              " in sector " + tagSector + ".");
+        }
+        return cache;
+    }
+
+    //=============================================================================
+    //             CORE FUNCTIONS - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Returns whether a sector is known to hold some data, without communicating with the Arduino.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="crc">The CRC-32 of the data.</param>
+    /// <returns>Whether the sector is known to hold the data.</returns>
+    internal bool Holds(int sectorIndex, uint crc) {
+        uint knownCrc;
+        return _crcs.TryGetValue(sectorIndex, out knownCrc) && knownCrc == crc && !BlockProgrammed(sectorIndex);
+    }
+
+    /// <summary>
+    /// Gets what a sector is known to hold, without communicating with the Arduino, for programming it from a delta
+    /// (see DeltaProgramming.cs).
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>The sector's contents, or null if they are not known.</returns>
+    internal byte[] KnownContents(int sectorIndex) {
+        byte[] data;
+        return _data.TryGetValue(sectorIndex, out data) && !BlockProgrammed(sectorIndex) ? data : null;
+    }
+
+    /// <summary>
+    /// Records that a sector was found to already hold some data.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="data">The sector's data.</param>
+    internal void RecordMatched(int sectorIndex, byte[] data) {
+        Record(sectorIndex, data);
+    }
+
+    /// <summary>
+    /// Records that a sector was programmed with some data.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="data">The sector's data.</param>
+    internal void RecordProgrammed(int sectorIndex, byte[] data) {
+        Record(sectorIndex, data);
+        _programmed.Add(sectorIndex);
+    }
+
+    /// <summary>
+    /// Writes the cache back, once a job has finished. Sectors which share an erase block with a sector programmed
+    /// during the job, but which were not programmed themselves, are checked by CRC first, and forgotten if they
+    /// changed. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    internal void Save(Arduino arduino) {
+        List<int> forgotten = new List<int>();
+        foreach (int sectorIndex in _data.Keys) {
+            if (!_programmed.Contains(sectorIndex) && BlockProgrammed(sectorIndex)
+                    && SectorChecksum.ReadSectorCrc(arduino, sectorIndex) != _crcs[sectorIndex]) {
+                forgotten.Add(sectorIndex);
+            }
+        }
+        foreach (int sectorIndex in forgotten) {
+            _data.Remove(sectorIndex);
+            _crcs.Remove(sectorIndex);
+        }
+
+        ImageContainer.Write(CachePath(_tag), new ProgrammingPlan("tag " + _tag.ToString("X8"), _data), false);
+        Util.WriteLineVerbose("Saved contents of " + _data.Count + " sectors to identity tag cache.");
+    }
+
+    //=============================================================================
+    //             UTILITY METHODS
+    //=============================================================================
+
+    /// <summary>
+    /// Records the contents of a sector.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <param name="data">The sector's data.</param>
+    private void Record(int sectorIndex, byte[] data) {
+        _data[sectorIndex] = data;
+        _crcs[sectorIndex] = Crc32.Compute(data);
+    }
+
+    /// <summary>
+    /// Returns whether any sector in the same erase block as a sector was programmed during this job.
+    /// </summary>
+    /// <param name="sectorIndex">The index of the sector.</param>
+    /// <returns>Whether any sector in its erase block was programmed.</returns>
+    private bool BlockProgrammed(int sectorIndex) {
+        int firstSector = sectorIndex - sectorIndex % ERASE_BLOCK_SECTORS;
+        for (int i = firstSector; i < firstSector + ERASE_BLOCK_SECTORS; i++) {
+            if (_programmed.Contains(i)) return true;
+        }
+        return false;
+    }
+
+    /// <summary>
+    /// Builds the contents of a new tag sector, with a random ID.
+    /// </summary>
+    /// <returns>The contents of the tag sector.</returns>
+    private static byte[] NewTagSector() {
+        byte[] tagData = new byte[Arduino.SST_SECTOR_SIZE];
+        for (int i = 0; i < tagData.Length; i++) {
+            tagData[i] = 0xFF;
+        }
+        byte[] magic = Encoding.ASCII.GetBytes(TAG_MAGIC);
+        Array.Copy(magic, tagData, magic.Length);
+        Array.Copy(Guid.NewGuid().ToByteArray(), 0, tagData, magic.Length, TAG_ID_LENGTH);
+        return tagData;
+    }
+
+    /// <summary>
+    /// Gets the path of the cache for a tag, creating the cache directory if necessary.
+    /// </summary>
+    /// <param name="tag">The tag.</param>
+    /// <returns>The path of the cache.</returns>
+    private static string CachePath(uint tag) {
+        string directory = Path.Combine(Path.Combine(
+            Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "SST39SF-programmer"), "tags");
+        Directory.CreateDirectory(directory);
+        return Path.Combine(directory, tag.ToString("X8") + ImageContainer.EXTENSION);
+    }
+}
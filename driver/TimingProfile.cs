@@ -0,0 +1,222 @@
+﻿/*
+ * Class which holds the timing parameters of a programmer setup, used to estimate how long jobs will take.
+ *
+ * Profiles measured by --calibrate (see Calibration.cs) are saved per serial port, as text files in the user's local
+ * application data directory (SST39SF-programmer/profiles/<PORT>.txt). Each line is a key and a value:
+ *
+ *     source calibrated 2023-06-01 14:02
+ *     baud 1000000
+ *     turnaround_ms 1.3
+ *     sector_erase_ms 18.2
+ *     chip_erase_ms 105.0
+ *     byte_program_us 41.7
+ *     byte_verify_us 7.9
+ *
+ * Missing keys take their default values.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Text;
+
+/// <summary> Timing parameters of a programmer setup (serial link, firmware and chip). Used to estimate how long a job
+/// will take without running it. </summary>
+internal class TimingProfile {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    // 8N1: a start bit, 8 data bits and a stop bit per byte
+    private const int BITS_PER_BYTE = 10;
+
+    /* Defaults, for the stock firmware. It bit-bangs the bus with digitalWrite (~4us per pin) and waits fixed delays
+     * for the chip, so these are dominated by the firmware rather than the chip. */
+    private const double DEFAULT_TURNAROUND_MS = 4.0;      // host + USB latency, per round trip
+    private const double DEFAULT_SECTOR_ERASE_MS = 30.0;   // fixed delay in eraseSectorStartingAt
+    private const double DEFAULT_CHIP_ERASE_MS = 105.0;    // fixed delay in eraseChip
+    private const double DEFAULT_BYTE_PROGRAM_US = 525.0;  // 4 bus cycles of ~30 pin writes each, plus a 25us delay
+    private const double DEFAULT_BYTE_VERIFY_US = 130.0;   // 1 bus cycle of ~30 pin reads/writes
+
+    //=============================================================================
+    //             PROPERTIES
+    //=============================================================================
+
+    /** Baud rate of the serial link. */
+    internal int BaudRate { get; set; }
+    /** Time for one round trip (we send, the Arduino responds) on top of the time the bytes take on the wire. */
+    internal double TurnaroundMs { get; set; }
+    /** Time the Arduino takes to erase a sector. */
+    internal double SectorEraseMs { get; set; }
+    /** Time the Arduino takes to erase the whole chip. */
+    internal double ChipEraseMs { get; set; }
+    /** Time the Arduino takes to program one byte. */
+    internal double ByteProgramUs { get; set; }
+    /** Time the Arduino takes to read back and verify one byte. */
+    internal double ByteVerifyUs { get; set; }
+    /** Where these values came from, for display. */
+    internal string Source { get; set; }
+
+    /** Time that one byte takes on the wire. */
+    internal double ByteTimeMs {
+        get { return 1000.0 * BITS_PER_BYTE / BaudRate; }
+    }
+
+    //=============================================================================
+    //             CONSTRUCTION
+    //=============================================================================
+
+    /// <summary>
+    /// Gets the default timing profile, which assumes the stock firmware at the driver's baud rate.
+    /// </summary>
+    /// <returns>The default timing profile.</returns>
+    internal static TimingProfile Defaults() {
+        TimingProfile profile = new TimingProfile();
+        profile.BaudRate = Arduino.BAUD_RATE;
+        profile.TurnaroundMs = DEFAULT_TURNAROUND_MS;
+        profile.SectorEraseMs = DEFAULT_SECTOR_ERASE_MS;
+        profile.ChipEraseMs = DEFAULT_CHIP_ERASE_MS;
+        profile.ByteProgramUs = DEFAULT_BYTE_PROGRAM_US;
+        profile.ByteVerifyUs = DEFAULT_BYTE_VERIFY_US;
+        profile.Source = "defaults for the stock firmware";
+        return profile;
+    }
+
+    /// <summary>
+    /// Gets the timing profile for a serial port: the one --calibrate saved for it, or the defaults if it hasn't been
+    /// calibrated. On error (unreadable or malformed profile), prints an error message and exits.
+    /// </summary>
+    /// <param name="serialPortName">The name of the serial port.</param>
+    /// <returns>The timing profile.</returns>
+    internal static TimingProfile ForPort(string serialPortName) {
+        TimingProfile profile = Defaults();
+        string path = ProfilePath(serialPortName);
+        if (!File.Exists(path)) return profile;
+
+        string[] lines = null;
+        try {
+            lines = File.ReadAllLines(path, Encoding.ASCII);
+        } catch (Exception e) {
+            Util.PrintAndExit("Error while reading timing profile " + path + ":\n" + e);
+        }
+        for (int i = 0; i < lines.Length; i++) {
+            string line = lines[i].Trim();
+            if (line.Length == 0) continue;
+            int split = line.IndexOf(' ');
+            string key = split < 0 ? line : line.Substring(0, split);
+            string value = split < 0 ? "" : line.Substring(split + 1).Trim();
+            if (!profile.TrySet(key, value)) {
+                Util.PrintAndExit("Timing profile " + path + " is malformed (line " + (i + 1) + "). Delete it, or " +
+                                  "run --calibrate again.");
+            }
+        }
+        return profile;
+    }
+
+    /// <summary>
+    /// Sets a value from a line of a saved profile.
+    /// </summary>
+    /// <param name="key">The key of the line.</param>
+    /// <param name="value">The value of the line.</param>
+    /// <returns>Whether the key is known and the value is valid for it.</returns>
+    private bool TrySet(string key, string value) {
+        if (key == "source") {
+            Source = value;
+            return true;
+        }
+        if (key == "baud") {
+            int baudRate;
+            if (!int.TryParse(value, NumberStyles.None, CultureInfo.InvariantCulture, out baudRate)
+                    || Array.IndexOf(Arduino.SERIAL_BAUD_RATES, baudRate) < 0) {
+                return false;
+            }
+            BaudRate = baudRate;
+            return true;
+        }
+
+        double number;
+        if (!double.TryParse(value, NumberStyles.AllowDecimalPoint, CultureInfo.InvariantCulture, out number)) {
+            return false;
+        }
+        switch (key) {
+            case "turnaround_ms": TurnaroundMs = number; return true;
+            case "sector_erase_ms": SectorEraseMs = number; return true;
+            case "chip_erase_ms": ChipEraseMs = number; return true;
+            case "byte_program_us": ByteProgramUs = number; return true;
+            case "byte_verify_us": ByteVerifyUs = number; return true;
+            default: return false;
+        }
+    }
+
+    //=============================================================================
+    //             SAVING
+    //=============================================================================
+
+    /// <summary>
+    /// Saves the profile for a serial port, for ForPort to find. On error, prints a warning: later jobs then use
+    /// whatever was saved before.
+    /// </summary>
+    /// <param name="serialPortName">The name of the serial port.</param>
+    internal void Save(string serialPortName) {
+        string path = ProfilePath(serialPortName);
+        List<string> lines = new List<string>();
+        lines.Add("source " + Source);
+        lines.Add("baud " + BaudRate.ToString(CultureInfo.InvariantCulture));
+        lines.Add("turnaround_ms " + TurnaroundMs.ToString("F2", CultureInfo.InvariantCulture));
+        lines.Add("sector_erase_ms " + SectorEraseMs.ToString("F2", CultureInfo.InvariantCulture));
+        lines.Add("chip_erase_ms " + ChipEraseMs.ToString("F2", CultureInfo.InvariantCulture));
+        lines.Add("byte_program_us " + ByteProgramUs.ToString("F2", CultureInfo.InvariantCulture));
+        lines.Add("byte_verify_us " + ByteVerifyUs.ToString("F2", CultureInfo.InvariantCulture));
+        try {
+            File.WriteAllLines(path, lines.ToArray(), Encoding.ASCII);
+            Console.WriteLine("Saved timing profile to " + path + ".");
+        } catch (Exception e) {
+            Console.WriteLine("Warning: could not save timing profile to " + path + " (" + e.Message + ").");
+        }
+    }
+
+    /// <summary>
+    /// Gets the path of the saved profile for a serial port, creating the profile directory if necessary.
+    /// </summary>
+    /// <param name="serialPortName">The name of the serial port.</param>
+    /// <returns>The path of the profile.</returns>
+    private static string ProfilePath(string serialPortName) {
+        string directory = Path.Combine(Path.Combine(
+            Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "SST39SF-programmer"),
+            "profiles");
+        Directory.CreateDirectory(directory);
+        // port names can be paths (e.g. /dev/ttyUSB0): keep only what is safe in a file name
+        StringBuilder name = new StringBuilder();
+        foreach (char c in serialPortName) {
+            name.Append(char.IsLetterOrDigit(c) ? c : '_');
+        }
+        return Path.Combine(directory, name + ".txt");
+    }
+
+    //=============================================================================
+    //             DISPLAY
+    //=============================================================================
+
+    /// <summary> Prints the profile to the console. </summary>
+    internal void Print() {
+        Console.WriteLine("Timing profile (" + Source + "):");
+        Console.WriteLine(String.Format("    baud rate {0}, round trip {1:F1} ms, sector erase {2:F1} ms, chip erase " +
+                                        "{3:F1} ms, byte program {4:F1} us, byte verify {5:F1} us",
+            BaudRate, TurnaroundMs, SectorEraseMs, ChipEraseMs, ByteProgramUs, ByteVerifyUs));
+    }
+}
@@ -0,0 +1,425 @@
+﻿/*
+ * Class which implements per-unit fields (--fields): values such as a serial number, which are different for every
+ * chip, patched on top of the image that the write job (-w/-a) programs into all of them. Only the sectors which
+ * hold a field differ between units, so the job's own plan is shared by every unit, and each unit's plan replaces
+ * just those sectors. See FILE FORMAT below for how to declare fields.
+ *
+ * FILE FORMAT
+ *   Each line declares one field, and is of the form: 0x<ADDRESS> <KIND> [<ARGS>], separated by single spaces. The
+ *   field is written at <ADDRESS>, which must be in a sector that the write job programs. <KIND> is one of:
+ *
+ *     counter <WIDTH>          The unit number, little-endian, in <WIDTH> bytes (1 to 8).
+ *     id <PREFIX> <WIDTH>      A <WIDTH>-byte ID, as for MAC addresses: the bytes of <PREFIX> (hex, e.g. 0200AC),
+ *                              followed by the unit number, big-endian, in the rest of the bytes.
+ *     timestamp                The time the unit was programmed, as 4 bytes: seconds since 1970-01-01 (UTC),
+ *                              little-endian.
+ *     crc32 0x<START> 0x<END>  The CRC-32 of the final image from address <START> up to (not including) <END>,
+ *                              little-endian, in 4 bytes. The range must be within sectors that the write job
+ *                              programs, and must not include the field itself. Computed after every other kind of
+ *                              field, in the order they are declared, so may cover other fields (including earlier
+ *                              crc32 fields).
+ *
+ *   A line which starts with a '#' is a comment and is ignored, as are empty lines. Fields must not overlap.
+ *
+ *   The unit number starts at 1, and goes up by one for each unit which is programmed successfully. It is kept in
+ *   <FILE>.next: to start from a different number, write that number into <FILE>.next.
+ *
+ * ---------------------------------------------------------------------------------------------------------------------
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+
+/// <summary> Per-unit fields, patched on top of a write job's plan to give each chip its own copy. Uses a special
+/// file format, detailed above. </summary>
+internal class UnitTemplate {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    internal const string NEXT_UNIT_EXTENSION = ".next";
+    private const int TIMESTAMP_WIDTH = 4;
+    private const int CRC_WIDTH = 4;
+
+    /// <summary> Enum of the kinds of field: see FILE FORMAT above. </summary>
+    private enum FieldKind {
+        COUNTER,
+        ID,
+        TIMESTAMP,
+        CRC32
+    }
+
+    /// <summary> POCO class which holds one declared field. </summary>
+    private class Field {
+        public FieldKind Kind { get; set; }
+        public int Address { get; set; }
+        public int Width { get; set; }
+        public byte[] Prefix { get; set; }     // id only
+        public int RangeStart { get; set; }    // crc32 only
+        public int RangeEnd { get; set; }      // crc32 only: exclusive
+    }
+
+    //=============================================================================
+    //             INSTANCE VARIABLES
+    //=============================================================================
+
+    private string _path;
+    private ProgrammingPlan _basePlan;
+    // In declaration order, except that crc32 fields come after all the others
+    private List<Field> _fields = new List<Field>();
+    // The indices of the sectors which hold a field, and so are different for every unit
+    private SortedSet<int> _patchedSectors = new SortedSet<int>();
+
+    /** The unit number that the next unit will be given. */
+    internal long NextUnit { get; private set; }
+
+    //=============================================================================
+    //             CONSTRUCTION
+    //=============================================================================
+
+    /// <summary> Constructor. Use Load. </summary>
+    private UnitTemplate(string path, ProgrammingPlan basePlan) {
+        _path = path;
+        _basePlan = basePlan;
+    }
+
+    /// <summary>
+    /// Reads a fields file, and the next unit number from beside it. On error (unreadable file, or a field which
+    /// is malformed, overlaps another or is outside the job's sectors), prints an error message and exits.
+    /// </summary>
+    /// <param name="path">The path of the fields file.</param>
+    /// <param name="basePlan">The plan of the write job, which the fields are patched on top of.</param>
+    /// <returns>The template.</returns>
+    internal static UnitTemplate Load(string path, ProgrammingPlan basePlan) {
+        UnitTemplate template = new UnitTemplate(path, basePlan);
+        string[] lines = null;
+        try {
+            lines = File.ReadAllLines(path, Encoding.ASCII);
+        } catch (Exception e) {
+            Util.PrintAndExit("Error while reading fields file " + path + ":\n" + e);
+        }
+
+        foreach (string line in lines) {
+            if (line.Length == 0 || line[0] == '#') continue;
+            Field field = template.ParseField(line);
+            template.CheckField(field, line);
+            template._fields.Add(field);
+        }
+        // CRCs go last, so that they cover the other fields' values. OrderBy is stable, so the order is otherwise kept.
+        template._fields = template._fields.OrderBy(f => f.Kind == FieldKind.CRC32).ToList();
+        if (template._fields.Count == 0) Util.PrintAndExit("Fields file " + path + " does not declare any fields.");
+
+        template.NextUnit = 1;
+        string nextPath = path + NEXT_UNIT_EXTENSION;
+        if (File.Exists(nextPath)) {
+            long nextUnit;
+            string text = null;
+            try {
+                text = File.ReadAllText(nextPath, Encoding.ASCII).Trim();
+            } catch (Exception e) {
+                Util.PrintAndExit("Error while reading " + nextPath + ":\n" + e);
+            }
+            if (!long.TryParse(text, NumberStyles.None, CultureInfo.InvariantCulture, out nextUnit)) {
+                Util.PrintAndExit(nextPath + " must hold the next unit number, in decimal.");
+            }
+            template.NextUnit = nextUnit;
+        }
+        return template;
+    }
+
+    //=============================================================================
+    //             UNITS
+    //=============================================================================
+
+    /// <summary>
+    /// Builds the plan for the next unit: the job's plan, with the sectors that hold a field replaced by copies with
+    /// the fields filled in. The timestamp is taken now. Does not advance the unit number: see CommitUnit. On error
+    /// (the unit number does not fit in a field), prints an error message and exits.
+    /// </summary>
+    /// <returns>The plan for the next unit.</returns>
+    internal ProgrammingPlan BuildUnit() {
+        Dictionary<int, byte[]> patched = new Dictionary<int, byte[]>();
+        foreach (int sectorIndex in _patchedSectors) {
+            patched[sectorIndex] = (byte[])_basePlan.SectorData(sectorIndex).Clone();
+        }
+
+        uint timestamp = (uint)(DateTime.UtcNow - new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc)).TotalSeconds;
+        foreach (Field field in _fields) {
+            byte[] value = new byte[field.Width];
+            switch (field.Kind) {
+                case FieldKind.COUNTER:
+                    PutUnitNumber(value, 0, field.Width, false, field);
+                    break;
+                case FieldKind.ID:
+                    Array.Copy(field.Prefix, value, field.Prefix.Length);
+                    PutUnitNumber(value, field.Prefix.Length, field.Width - field.Prefix.Length, true, field);
+                    break;
+                case FieldKind.TIMESTAMP:
+                    value = BitConverter.GetBytes(timestamp);
+                    break;
+                case FieldKind.CRC32:
+                    value = BitConverter.GetBytes(RangeCrc(patched, field.RangeStart, field.RangeEnd));
+                    break;
+            }
+            Write(patched, field.Address, value);
+        }
+
+        return _basePlan.WithReplacedSectors(_basePlan.Description + " (unit " + NextUnit + ")", patched);
+    }
+
+    /// <summary>
+    /// Records that the unit from the last BuildUnit was programmed successfully, so the next unit gets the next
+    /// number. If the number can't be saved, prints a warning: the next run will then reuse it.
+    /// </summary>
+    internal void CommitUnit() {
+        NextUnit++;
+        string nextPath = _path + NEXT_UNIT_EXTENSION;
+        try {
+            File.WriteAllText(nextPath, NextUnit.ToString(CultureInfo.InvariantCulture) + Environment.NewLine,
+                              Encoding.ASCII);
+        } catch (Exception e) {
+            Console.WriteLine("Warning: could not save the next unit number to " + nextPath + " (" + e.Message +
+                              "). The next run will reuse unit " + (NextUnit - 1) + ".");
+        }
+    }
+
+    /// <summary> Prints the fields, and which sectors they make different for every unit. </summary>
+    internal void PrintFields() {
+        Console.WriteLine("Per-unit fields from " + _path + ", next unit " + NextUnit + ":");
+        foreach (Field field in _fields) {
+            string detail = field.Kind == FieldKind.CRC32
+                ? String.Format(" of 0x{0:X5} - 0x{1:X5}", field.RangeStart, field.RangeEnd - 1)
+                : "";
+            Console.WriteLine(String.Format("    0x{0:X5}    {1} ({2} bytes){3}", field.Address,
+                field.Kind.ToString().ToLowerInvariant(), field.Width, detail));
+        }
+        Console.WriteLine("Sectors which differ between units: " + String.Join(", ", _patchedSectors) + ". The " +
+                          "other " + (_basePlan.SectorCount - _patchedSectors.Count) + " are the same for every unit.");
+    }
+
+    //=============================================================================
+    //             FILLING IN FIELDS
+    //=============================================================================
+
+    /// <summary>
+    /// Writes the unit number into part of a field's value. On error (it does not fit), prints an error message and
+    /// exits.
+    /// </summary>
+    /// <param name="value">The field's value.</param>
+    /// <param name="offset">Where the unit number starts in the value.</param>
+    /// <param name="width">The number of bytes for the unit number.</param>
+    /// <param name="bigEndian">Whether to write it big-endian, rather than little-endian.</param>
+    /// <param name="field">The field, for the error message.</param>
+    private void PutUnitNumber(byte[] value, int offset, int width, bool bigEndian, Field field) {
+        if (width < 8 && (NextUnit >> (8 * width)) != 0) {
+            Util.PrintAndExit(String.Format("Unit number {0} does not fit in the {1}-byte field at 0x{2:X5}.",
+                NextUnit, width, field.Address));
+        }
+        for (int i = 0; i < width; i++) {
+            value[offset + (bigEndian ? width - 1 - i : i)] = (byte)(NextUnit >> (8 * i));
+        }
+    }
+
+    /// <summary>
+    /// Writes bytes into the patched copies of the sectors, possibly spanning a sector boundary.
+    /// </summary>
+    /// <param name="patched">Map from the index of each patched sector to its data.</param>
+    /// <param name="address">The address to write at.</param>
+    /// <param name="value">The bytes to write.</param>
+    private static void Write(Dictionary<int, byte[]> patched, int address, byte[] value) {
+        for (int i = 0; i < value.Length; i++) {
+            patched[(address + i) / Arduino.SST_SECTOR_SIZE][(address + i) % Arduino.SST_SECTOR_SIZE] = value[i];
+        }
+    }
+
+    /// <summary>
+    /// Computes the CRC-32 of a range of the unit's image: patched sectors from their copies, the rest from the
+    /// job's plan.
+    /// </summary>
+    /// <param name="patched">Map from the index of each patched sector to its data.</param>
+    /// <param name="start">The first address of the range.</param>
+    /// <param name="end">The address after the last address of the range.</param>
+    /// <returns>The CRC-32 of the range.</returns>
+    private uint RangeCrc(Dictionary<int, byte[]> patched, int start, int end) {
+        uint crc = 0;
+        for (int address = start; address < end; ) {
+            int sectorIndex = address / Arduino.SST_SECTOR_SIZE;
+            int offset = address % Arduino.SST_SECTOR_SIZE;
+            int count = Math.Min(Arduino.SST_SECTOR_SIZE - offset, end - address);
+            byte[] data;
+            if (!patched.TryGetValue(sectorIndex, out data)) data = _basePlan.SectorData(sectorIndex);
+            crc = Crc32.Update(crc, data, offset, count);
+            address += count;
+        }
+        return crc;
+    }
+
+    //=============================================================================
+    //             PARSING
+    //=============================================================================
+
+    /// <summary>
+    /// Parses one field declaration. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="line">The line declaring the field.</param>
+    /// <returns>The field.</returns>
+    private Field ParseField(string line) {
+        string[] parts = line.Split(' ');
+        Field field = new Field();
+        field.Address = ParseAddress(parts[0], line);
+        int argCount = parts.Length - 2;
+        string kind = parts.Length > 1 ? parts[1] : "";
+        switch (kind) {
+            case "counter":
+                field.Kind = FieldKind.COUNTER;
+                if (argCount != 1) FieldError(line, "counter takes a width.");
+                field.Width = ParseWidth(parts[2], 1, line);
+                break;
+            case "id":
+                field.Kind = FieldKind.ID;
+                if (argCount != 2) FieldError(line, "id takes a prefix and a width.");
+                field.Prefix = ParsePrefix(parts[2], line);
+                field.Width = ParseWidth(parts[3], field.Prefix.Length + 1, line);
+                break;
+            case "timestamp":
+                field.Kind = FieldKind.TIMESTAMP;
+                if (argCount != 0) FieldError(line, "timestamp takes no arguments.");
+                field.Width = TIMESTAMP_WIDTH;
+                break;
+            case "crc32":
+                field.Kind = FieldKind.CRC32;
+                if (argCount != 2) FieldError(line, "crc32 takes a start and an end address.");
+                field.Width = CRC_WIDTH;
+                field.RangeStart = ParseAddress(parts[2], line);
+                field.RangeEnd = ParseAddress(parts[3], line);
+                if (field.RangeEnd <= field.RangeStart) FieldError(line, "the end address must be after the start.");
+                break;
+            default:
+                FieldError(line, "unknown kind of field '" + kind + "'.");
+                break;
+        }
+        return field;
+    }
+
+    /// <summary>
+    /// Checks that a field is within the job's sectors and does not overlap an earlier one, and records the sectors
+    /// it patches. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="field">The field.</param>
+    /// <param name="line">The line declaring the field, for the error message.</param>
+    private void CheckField(Field field, string line) {
+        int end = field.Address + field.Width;
+        CheckInPlan(field.Address, end, line);
+        if (field.Kind == FieldKind.CRC32) {
+            CheckInPlan(field.RangeStart, field.RangeEnd, line);
+            if (field.Address < field.RangeEnd && field.RangeStart < end) {
+                FieldError(line, "the CRC's range includes the field itself.");
+            }
+        }
+        foreach (Field other in _fields) {
+            if (field.Address < other.Address + other.Width && other.Address < end) {
+                FieldError(line, String.Format("overlaps the field at 0x{0:X5}.", other.Address));
+            }
+        }
+        for (int address = field.Address; address < end; address++) {
+            _patchedSectors.Add(address / Arduino.SST_SECTOR_SIZE);
+        }
+    }
+
+    /// <summary>
+    /// Checks that every sector in a range of addresses is programmed by the job. On error, prints an error message
+    /// and exits.
+    /// </summary>
+    /// <param name="start">The first address of the range.</param>
+    /// <param name="end">The address after the last address of the range.</param>
+    /// <param name="line">The line declaring the field, for the error message.</param>
+    private void CheckInPlan(int start, int end, string line) {
+        if (end > Arduino.MAX_FLASH_SIZE) FieldError(line, "it runs past the end of the chip.");
+        for (int sectorIndex = start / Arduino.SST_SECTOR_SIZE; sectorIndex <= (end - 1) / Arduino.SST_SECTOR_SIZE;
+                sectorIndex++) {
+            if (!_basePlan.ContainsSector(sectorIndex)) {
+                FieldError(line, "sector " + sectorIndex + " is not programmed by " + _basePlan.Description + ".");
+            }
+        }
+    }
+
+    /// <summary>
+    /// Parses an address, of the form 0x<HEX>. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="text">The text to parse.</param>
+    /// <param name="line">The line declaring the field, for the error message.</param>
+    /// <returns>The address.</returns>
+    private int ParseAddress(string text, string line) {
+        int address;
+        if (text.Length < 3 || text[0] != '0' || (text[1] != 'x' && text[1] != 'X')
+                || !int.TryParse(text.Substring(2), NumberStyles.HexNumber, CultureInfo.InvariantCulture, out address)
+                || address < 0) {
+            FieldError(line, "'" + text + "' is not an address of the form 0x<HEX>.");
+            return -1;  // for the compiler
+        }
+        return address;
+    }
+
+    /// <summary>
+    /// Parses a field width. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="text">The text to parse.</param>
+    /// <param name="minimum">The smallest width allowed.</param>
+    /// <param name="line">The line declaring the field, for the error message.</param>
+    /// <returns>The width, in bytes.</returns>
+    private int ParseWidth(string text, int minimum, string line) {
+        int width;
+        if (!int.TryParse(text, NumberStyles.None, CultureInfo.InvariantCulture, out width) || width < minimum
+                || width > minimum + 7) {
+            FieldError(line, "the width must be from " + minimum + " to " + (minimum + 7) + " bytes.");
+        }
+        return width;
+    }
+
+    /// <summary>
+    /// Parses an id prefix: an even number of hex digits. On error, prints an error message and exits.
+    /// </summary>
+    /// <param name="text">The text to parse.</param>
+    /// <param name="line">The line declaring the field, for the error message.</param>
+    /// <returns>The bytes of the prefix.</returns>
+    private byte[] ParsePrefix(string text, string line) {
+        byte[] prefix = new byte[text.Length / 2];
+        for (int i = 0; i < prefix.Length; i++) {
+            if (!byte.TryParse(text.Substring(2 * i, 2), NumberStyles.HexNumber, CultureInfo.InvariantCulture,
+                               out prefix[i])) {
+                break;
+            }
+        }
+        if (text.Length % 2 != 0 || BitConverter.ToString(prefix).Replace("-", "") != text.ToUpperInvariant()) {
+            FieldError(line, "the prefix must be hex bytes, e.g. 0200AC.");
+        }
+        return prefix;
+    }
+
+    /// <summary>
+    /// Prints an error message about a field declaration and exits.
+    /// </summary>
+    /// <param name="line">The line declaring the field.</param>
+    /// <param name="problem">What is wrong with it.</param>
+    private void FieldError(string line, string problem) {
+        Util.PrintAndExit("Invalid field '" + line + "' in fields file " + _path + ": " + problem);
+    }
+}
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 using System;
+using System.Diagnostics;
 using System.IO;
 using System.Security;
 
@@ -99,6 +100,29 @@ internal static class Util {
         return null;  // for the compiler
     }
     
+    //=============================================================================
+    //             ENCODING
+    //=============================================================================
+
+    /// <summary>
+    /// Encodes a sector index as it is transmitted to/from the Arduino: 2 bytes, little-endian.
+    /// </summary>
+    /// <param name="sectorIndex">The sector index to encode.</param>
+    /// <returns>The encoded sector index.</returns>
+    internal static byte[] SectorIndexToBytes(int sectorIndex) {
+        return new[] { (byte)sectorIndex, (byte)(sectorIndex >> 8) };
+    }
+
+    /// <summary>
+    /// Decodes a sector index transmitted to/from the Arduino: 2 bytes, little-endian.
+    /// </summary>
+    /// <param name="indexBytes">The encoded sector index.</param>
+    /// <returns>The sector index.</returns>
+    internal static int SectorIndexFromBytes(byte[] indexBytes) {
+        // bytes are automatically promoted to int before shifting, so no truncation can occur
+        return (indexBytes[1] << 8) | indexBytes[0];
+    }
+
     //=============================================================================
     //             COMMUNICATING WITH THE ARDUINO
     //=============================================================================
@@ -158,8 +182,33 @@ internal static class Util {
     /// for console output to the user.</param>
     /// <param name="extendedTimeout">Whether to use an extended timeout, or a normal timeout.</param>
     internal static void WaitForAck(Arduino arduino, string operation, bool extendedTimeout) {
+        WaitForAck(arduino, operation, extendedTimeout ? ArduinoDriver.EXTENDED_TIMEOUT : ArduinoDriver.NORMAL_TIMEOUT);
+    }
+
+    /// <summary>
+    /// As WaitForAck above, but the timeout is learned from how long the operation has taken before (see
+    /// LatencyTracker.cs), and how long it took this time is recorded.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="operation">A string representation of the operation that is waiting for acknowledgement,
+    /// for console output to the user.</param>
+    /// <param name="tracker">The latency tracker of the operation.</param>
+    internal static void WaitForAck(Arduino arduino, string operation, LatencyTracker tracker) {
+        Stopwatch stopwatch = Stopwatch.StartNew();
+        WaitForAck(arduino, operation, tracker.TimeoutMs);
+        tracker.Observe(stopwatch.Elapsed.TotalMilliseconds);
+    }
+
+    /// <summary>
+    /// As WaitForAck above, with a timeout in milliseconds.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    /// <param name="operation">A string representation of the operation that is waiting for acknowledgement,
+    /// for console output to the user.</param>
+    /// <param name="timeoutMs">The timeout, in milliseconds.</param>
+    private static void WaitForAck(Arduino arduino, string operation, int timeoutMs) {
         arduino.PushTimeoutStack();
-        arduino.ReadTimeout = extendedTimeout ? ArduinoDriver.EXTENDED_TIMEOUT : ArduinoDriver.NORMAL_TIMEOUT;
+        arduino.ReadTimeout = timeoutMs;
 
         try {
             byte response = (byte)arduino.ReadByte();
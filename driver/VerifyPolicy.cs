@@ -0,0 +1,127 @@
+﻿/*
+ * Class which holds how the sectors of a write job are verified (the Arduino's VERIFYPOLICY command), trading
+ * assurance against time per product line:
+ *
+ *   full          The Arduino echoes each sector's data back to us, and compares every byte it reads back from the
+ *                 chip. The default.
+ *   crc           The Arduino echoes only the data's CRC-32, and compares the CRC of the sector it reads back: as
+ *                 sure as full for the chip, with a 4-byte echo rather than a whole sector on the wire.
+ *   sampled[:N]   As crc, but the Arduino reads back only N bytes of each sector (DEFAULT_SAMPLE_COUNT if N is not
+ *                 given), at random offsets.
+ *   none          As crc, but the Arduino reads nothing back: check the chip afterwards, e.g. with -v.
+ *
+ * The CRC echo still catches data corrupted on its way to the Arduino (and the sector is sent again), whatever the
+ * policy.
+ *
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/// <summary> How the Arduino verifies the sectors it programs. </summary>
+internal class VerifyPolicy {
+    //=============================================================================
+    //             CONSTANTS
+    //=============================================================================
+
+    internal const int DEFAULT_SAMPLE_COUNT = 64;  // bytes read back per sector by sampled, if not given
+
+    /** The policy the Arduino starts with. */
+    internal static readonly VerifyPolicy Full = new VerifyPolicy(Arduino.VERIFY_FULL, 0, "full");
+
+    //=============================================================================
+    //             PROPERTIES
+    //=============================================================================
+
+    /** The policy: one of the Arduino.VERIFY_ constants. */
+    internal byte Policy { get; private set; }
+    /** The number of bytes read back per sector, for Arduino.VERIFY_SAMPLED. */
+    internal int SampleCount { get; private set; }
+    /** The policy as it is given on the command line, for display. */
+    internal string Name { get; private set; }
+
+    /** Whether the Arduino echoes a sector's data back in full, rather than just its CRC-32. */
+    internal bool EchoesData {
+        get { return Policy == Arduino.VERIFY_FULL; }
+    }
+
+    /** The number of bytes the Arduino echoes back for a sector's data. */
+    internal int EchoLength {
+        get { return EchoesData ? Arduino.SST_SECTOR_SIZE : Arduino.VERIFY_CRC_ECHO_LENGTH; }
+    }
+
+    /** The number of bytes the Arduino reads back from the chip to verify a sector. */
+    internal int BytesReadBack {
+        get {
+            switch (Policy) {
+                case Arduino.VERIFY_NONE: return 0;
+                case Arduino.VERIFY_SAMPLED: return SampleCount;
+                default: return Arduino.SST_SECTOR_SIZE;
+            }
+        }
+    }
+
+    //=============================================================================
+    //             CONSTRUCTION
+    //=============================================================================
+
+    /// <summary>
+    /// Constructor.
+    /// </summary>
+    /// <param name="policy">The policy: one of the Arduino.VERIFY_ constants.</param>
+    /// <param name="sampleCount">The number of bytes read back per sector, for Arduino.VERIFY_SAMPLED.</param>
+    /// <param name="name">The policy as it is given on the command line.</param>
+    private VerifyPolicy(byte policy, int sampleCount, string name) {
+        Policy = policy;
+        SampleCount = sampleCount;
+        Name = name;
+    }
+
+    /// <summary>
+    /// Parses a policy as it is given on the command line: none, crc, full, or sampled[:N].
+    /// </summary>
+    /// <param name="s">The string to parse.</param>
+    /// <returns>The policy, or null if s is not one.</returns>
+    internal static VerifyPolicy Parse(string s) {
+        switch (s) {
+            case "none": return new VerifyPolicy(Arduino.VERIFY_NONE, 0, s);
+            case "crc": return new VerifyPolicy(Arduino.VERIFY_CRC, 0, s);
+            case "full": return Full;
+            case "sampled": return new VerifyPolicy(Arduino.VERIFY_SAMPLED, DEFAULT_SAMPLE_COUNT, s);
+        }
+        int sampleCount;
+        if (s.StartsWith("sampled:") && int.TryParse(s.Substring("sampled:".Length), out sampleCount)
+                && sampleCount >= 1 && sampleCount <= Arduino.SST_SECTOR_SIZE) {
+            return new VerifyPolicy(Arduino.VERIFY_SAMPLED, sampleCount, s);
+        }
+        return null;
+    }
+
+    //=============================================================================
+    //             CORE FUNCTION - CALLED BY OTHER CLASSES
+    //=============================================================================
+
+    /// <summary>
+    /// Sets the Arduino's verification policy to this one, for the sectors it programs from now on. On error, prints
+    /// an error message and exits.
+    /// </summary>
+    /// <param name="arduino">A serial port connected to the Arduino.</param>
+    internal void Apply(Arduino arduino) {
+        Util.SendCommandMessage(arduino, Arduino.VERIFY_POLICY_MESSAGE);
+        Util.WriteLineVerbose("Setting verification policy to " + Name + "...");
+        byte[] request = { Policy, (byte)SampleCount, (byte)(SampleCount >> 8) };
+        arduino.Write(request, 0, request.Length);
+        Util.WaitForAck(arduino, "verification policy", false);
+        arduino.VerifyPolicy = this;
+    }
+}
@@ -0,0 +1,193 @@
+/*
+ * Minimal host implementation of the parts of the Arduino API (and of avr/io.h, which it includes) that the firmware
+ * uses, so that the unmodified firmware sources can be compiled and run on a Linux host against a simulated flash chip.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_SIM_ARDUINO_H
+#define SST39SF_SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+#define SST39SF_HOST_SIMULATION
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define HEX 16
+#define DEC 10
+
+#define NUM_DIGITAL_PINS 70
+#define A12 66
+#define A13 67
+#define A14 68
+#define A15 69
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+/* Pin mode introspection, as used by read_write.cpp's DEBUG checks. Each pin is given its own one-bit 'port' so that
+the real AVR register lookup code works unchanged. */
+uint8_t digitalPinToBitMask(uint8_t pin);
+uint8_t digitalPinToPort(uint8_t pin);
+volatile uint8_t *portModeRegister(uint8_t port);
+volatile uint8_t *portOutputRegister(uint8_t port);
+
+//=============================================================================
+//             DATA SPACE
+//=============================================================================
+
+/* The AVR's data space, as used by the XMEM bus backend: the registers that it configures, and the external memory
+window. Accesses go through a proxy, so that the simulation sees every bus cycle rather than a plain memory access. */
+
+uint8_t simDataRead(uint16_t address);
+void simDataWrite(uint16_t address, uint8_t value);
+
+/** @brief A byte of the AVR's data space, as used through avr/io.h's _MMIO_BYTE. */
+class SimDataByte {
+public:
+    explicit SimDataByte(uint16_t address) : _address(address) {}
+
+    operator uint8_t() const { return simDataRead(_address); }
+    SimDataByte &operator=(uint8_t value) { simDataWrite(_address, value); return *this; }
+    SimDataByte &operator|=(uint8_t value) { return *this = (uint8_t)(*this | value); }
+    SimDataByte &operator&=(uint8_t value) { return *this = (uint8_t)(*this & value); }
+
+private:
+    uint16_t _address;
+};
+
+#define _BV(bit) (1 << (bit))
+#define _MMIO_BYTE(address) SimDataByte((uint16_t)(address))
+#define _SFR_MEM8(address) _MMIO_BYTE(address)
+
+// ATmega2560 register addresses and bits, from avr/iom2560.h
+#define DDRL _SFR_MEM8(0x10A)
+#define PORTL _SFR_MEM8(0x10B)
+#define XMCRA _SFR_MEM8(0x74)
+#define XMCRB _SFR_MEM8(0x75)
+#define SRW00 0
+#define SRW01 1
+#define SRW10 2
+#define SRW11 3
+#define SRL0 4
+#define SRL1 5
+#define SRL2 6
+#define SRE 7
+#define XMM0 0
+#define XMM1 1
+#define XMM2 2
+#define XMBK 7
+
+//=============================================================================
+//             STRING
+//=============================================================================
+
+/** @brief The subset of Arduino's String class that the firmware uses. */
+class String {
+public:
+    String() {}
+    String(const char *s) : _s(s) {}
+    String(char c) : _s(1, c) {}
+    String(int value, int base = DEC) : _s(toString((long)value, base)) {}
+    String(unsigned int value, int base = DEC) : _s(toString((unsigned long)value, base)) {}
+    String(long value, int base = DEC) : _s(toString(value, base)) {}
+    String(unsigned long value, int base = DEC) : _s(toString(value, base)) {}
+
+    unsigned int length() const { return (unsigned int)_s.size(); }
+    const char *c_str() const { return _s.c_str(); }
+
+    String &operator+=(const String &other) { _s += other._s; return *this; }
+    String &operator+=(const char *other) { _s += other; return *this; }
+    String &operator+=(char c) { _s += c; return *this; }
+
+    friend String operator+(const String &a, const String &b) { String r(a); r += b; return r; }
+    friend String operator+(const String &a, const char *b) { String r(a); r += b; return r; }
+    friend String operator+(const char *a, const String &b) { String r(a); r += b; return r; }
+    friend String operator+(const String &a, char b) { String r(a); r += b; return r; }
+
+private:
+    static std::string toString(long value, int base);
+    static std::string toString(unsigned long value, int base);
+
+    std::string _s;
+};
+
+//=============================================================================
+//             SERIAL
+//=============================================================================
+
+/** @brief Serial port, backed by the master side of a pseudo-terminal. */
+class HardwareSerial {
+public:
+    void begin(unsigned long baud);
+    void end();
+    int available();
+    int availableForWrite();
+    int read();
+    int peek();
+    void flush();
+
+    size_t write(uint8_t b);
+    size_t write(const char *s);
+    size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = DEC) { return print(String(value, base)); }
+    size_t print(unsigned int value, int base = DEC) { return print(String(value, base)); }
+    size_t print(long value, int base = DEC) { return print(String(value, base)); }
+    size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+    size_t print(uint8_t value, int base) { return print(String((unsigned int)value, base)); }
+    template <typename T> size_t println(T value) { return print(value) + print("\r\n"); }
+
+    unsigned long baudRate() const { return _baud; }
+
+private:
+    unsigned long _baud = 0;
+};
+
+extern HardwareSerial Serial;
+
+//=============================================================================
+//             PINS AND TIME
+//=============================================================================
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+#endif  // SST39SF_SIM_ARDUINO_H
@@ -0,0 +1,58 @@
+/*
+ * Host implementation of the Arduino EEPROM library, for the host simulation: the ATmega2560's 4KB of EEPROM, kept in
+ * memory, and persisted next to the flash image (if there is one).
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_SIM_EEPROM_H
+#define SST39SF_SIM_EEPROM_H
+
+#include "Arduino.h"
+
+#include <string.h>
+
+/** @brief The subset of the EEPROM library's EEPROMClass that the firmware uses. */
+class EEPROMClass {
+public:
+    EEPROMClass() { memset(bytes, 0xFF, sizeof(bytes)); }
+
+    uint8_t read(int address) { return bytes[address]; }
+    void write(int address, uint8_t value) { bytes[address] = value; }
+    void update(int address, uint8_t value) { if (bytes[address] != value) write(address, value); }
+    uint16_t length() { return sizeof(bytes); }
+
+    template <typename T> T &get(int address, T &t) {
+        memcpy(&t, bytes + address, sizeof(T));
+        return t;
+    }
+
+    template <typename T> const T &put(int address, const T &t) {
+        const uint8_t *p = (const uint8_t *)&t;
+        for (size_t i = 0; i < sizeof(T); i++) update(address + (int)i, p[i]);
+        return t;
+    }
+
+    uint8_t bytes[4096];
+};
+
+extern EEPROMClass EEPROM;
+
+/** @brief Loads the contents of EEPROM from a file, if it exists, and saves them back to it in simEepromSave. */
+void simEepromLoad(const char *path);
+/** @brief Saves the contents of EEPROM to the file given to simEepromLoad, if any. */
+void simEepromSave();
+
+#endif  // SST39SF_SIM_EEPROM_H
@@ -0,0 +1,385 @@
+/*
+ * Host implementation of the Arduino API declared in Arduino.h. The flash chip model (flash_model.h) is connected
+ * using the same wiring as pinout.h, for whichever BUS_BACKEND is selected: to the pins, or to the external memory
+ * interface. Serial is connected to a pseudo-terminal, with incoming bytes paced at the baud rate and received into
+ * a model of the Mega's 64-byte receive buffer.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Arduino.h"
+#include "sim.h"
+#include "flash_model.h"
+#include "pinout.h"
+#include "sst_constants.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+
+HardwareSerial Serial;
+
+//=============================================================================
+//             TIME
+//=============================================================================
+
+/* Time on the simulated Arduino is real (monotonic) time since startup, plus time 'spent' in delay() calls and in
+simulated I/O. Delays are not actually slept (except long ones, see delay()), so that simulated programming runs as
+fast as the host allows while the firmware still sees plausible timings. */
+static struct timespec startTime;
+static unsigned long virtualMicros = 0;
+
+/* Approximate cost of a digitalWrite/digitalRead/pinMode call on a 16 MHz ATmega2560. */
+static const unsigned long DIGITAL_IO_COST_US = 4;
+/* Approximate cost of an external memory bus cycle on a 16 MHz ATmega2560: the ld/st, its extra cycle for the
+address latch, and one wait state. */
+static const unsigned long XMEM_CYCLE_COST_NS = 250;
+static unsigned long virtualNanos = 0;  // time spent that does not yet add up to a whole microsecond
+
+static unsigned long realMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - startTime.tv_sec) * 1000000L + (now.tv_nsec - startTime.tv_nsec) / 1000L);
+}
+
+unsigned long micros() {
+    return realMicros() + virtualMicros;
+}
+
+unsigned long millis() {
+    return micros() / 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+    virtualMicros += us;
+}
+
+/** @brief Accounts for time spent in simulated I/O which is too short to count in whole microseconds. */
+static void spendNanos(unsigned long ns) {
+    virtualNanos += ns;
+    virtualMicros += virtualNanos / 1000;
+    virtualNanos %= 1000;
+}
+
+void delay(unsigned long ms) {
+    /* Long delays only occur in loops that wait for a human or for the driver (e.g. the 'WAITING' broadcast, fail()):
+    actually sleep for those, so the simulation doesn't spin or flood the serial port. */
+    if (ms >= 500) {
+        usleep((useconds_t)(ms > 1000 ? 1000000 : ms * 1000));
+    } else {
+        virtualMicros += ms * 1000;
+    }
+}
+
+long random(long max) {
+    return max <= 0 ? 0 : ::random() % max;
+}
+
+long random(long min, long max) {
+    return min >= max ? min : min + ::random() % (max - min);
+}
+
+void randomSeed(unsigned long seed) {
+    ::srandom((unsigned int)seed);
+}
+
+//=============================================================================
+//             PINS
+//=============================================================================
+
+static uint8_t pinModes[NUM_DIGITAL_PINS];
+static uint8_t pinValues[NUM_DIGITAL_PINS];
+static volatile uint8_t modeRegisters[NUM_DIGITAL_PINS];
+static volatile uint8_t outputRegisters[NUM_DIGITAL_PINS];
+
+uint8_t digitalPinToBitMask(uint8_t) { return 1; }
+uint8_t digitalPinToPort(uint8_t pin) { return pin; }
+volatile uint8_t *portModeRegister(uint8_t port) { return &modeRegisters[port]; }
+volatile uint8_t *portOutputRegister(uint8_t port) { return &outputRegisters[port]; }
+
+#if BUS_BACKEND == BUS_BACKEND_PINS
+
+static uint8_t dataBusLatch = 0;  // what the chip drives onto the data bus during a read cycle
+
+/** @return the address currently on the address pins */
+static uint32_t addressBus() {
+    uint32_t address = 0;
+    for (int i = 0; i < ADDRESS_BUS_LENGTH; i++) {
+        if (pinValues[ADDR0 + i]) address |= ((uint32_t)1 << i);
+    }
+    return address;
+}
+
+/** @return the byte currently driven onto the data pins by the Arduino */
+static uint8_t dataBus() {
+    uint8_t data = 0;
+    for (int i = 0; i < DATA_BUS_LENGTH; i++) {
+        if (pinValues[DQ0 + i]) data |= (uint8_t)(1 << i);
+    }
+    return data;
+}
+
+#endif  // BUS_BACKEND == BUS_BACKEND_PINS
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= NUM_DIGITAL_PINS) return;
+    virtualMicros += DIGITAL_IO_COST_US;
+    pinModes[pin] = mode;
+    modeRegisters[pin] = (mode == OUTPUT);
+    outputRegisters[pin] = (mode == INPUT_PULLUP) || (mode == OUTPUT && pinValues[pin]);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin >= NUM_DIGITAL_PINS) return;
+    virtualMicros += DIGITAL_IO_COST_US;
+    uint8_t previous = pinValues[pin];
+    pinValues[pin] = value ? HIGH : LOW;
+    if (pinModes[pin] == OUTPUT) outputRegisters[pin] = pinValues[pin];
+
+#if BUS_BACKEND == BUS_BACKEND_PINS
+    // CE# is tied to ground: the chip latches data on the rising edge of WE#, and drives the bus while OE# is low
+    if (pin == WRITE_ENABLE && previous == LOW && value == HIGH && pinValues[OUTPUT_ENABLE] == HIGH) {
+        flashModelWrite(addressBus(), dataBus());
+    } else if (pin == OUTPUT_ENABLE && previous == HIGH && value == LOW && pinValues[WRITE_ENABLE] == HIGH) {
+        dataBusLatch = flashModelRead(addressBus());
+    }
+#else
+    (void)previous;
+#endif
+}
+
+int digitalRead(uint8_t pin) {
+    if (pin >= NUM_DIGITAL_PINS) return LOW;
+    virtualMicros += DIGITAL_IO_COST_US;
+#if BUS_BACKEND == BUS_BACKEND_PINS
+    if (pin >= DQ0 && pin < DQ0 + DATA_BUS_LENGTH && pinValues[OUTPUT_ENABLE] == LOW) {
+        return bitRead(dataBusLatch, pin - DQ0);
+    }
+#endif
+    if (pin == DEBUG_MODE_PIN) return simDebugModePin() ? LOW : HIGH;
+    return pinModes[pin] == INPUT_PULLUP ? HIGH : pinValues[pin];
+}
+
+//=============================================================================
+//             DATA SPACE
+//=============================================================================
+
+/* Start of external memory in the ATmega2560's data space: below this are the registers and internal SRAM, which are
+just memory here (only registers are ever accessed through SimDataByte). */
+static const uint16_t EXTERNAL_MEMORY_START = 0x2200;
+static uint8_t internalDataSpace[EXTERNAL_MEMORY_START];
+
+/**
+ * @brief Gets the chip address that an external memory bus cycle reaches, with the wiring in pinout.h. Stops the
+ * simulation if the firmware accesses external memory without enabling the interface, as on the real Arduino that
+ * would silently read and write nothing.
+ *
+ * @param address the address in the AVR's data space
+ * @return the chip address
+ */
+static uint32_t externalChipAddress(uint16_t address) {
+    if (!bitRead(internalDataSpace[0x74], SRE)) {  // XMCRA
+        fprintf(stderr, "sst39sf-sim: external memory access (0x%04X) with the interface disabled\n", address);
+        abort();
+    }
+    spendNanos(XMEM_CYCLE_COST_NS);
+#if BUS_BACKEND == BUS_BACKEND_XMEM
+    // A0-7 from the latch, A8-14 from port C (A15 from PC7 is not connected), and the rest from the bank pins
+    uint32_t bank = (uint8_t)XMEM_BANK_PORT & (uint8_t)XMEM_BANK_DDR;
+    return (bank << XMEM_WINDOW_BITS) | (address & ((1UL << XMEM_WINDOW_BITS) - 1));
+#else
+    // Nothing is connected to the interface
+    return address;
+#endif
+}
+
+uint8_t simDataRead(uint16_t address) {
+    if (address < EXTERNAL_MEMORY_START) return internalDataSpace[address];
+    return flashModelRead(externalChipAddress(address));
+}
+
+void simDataWrite(uint16_t address, uint8_t value) {
+    if (address < EXTERNAL_MEMORY_START) {
+        internalDataSpace[address] = value;
+        return;
+    }
+    flashModelWrite(externalChipAddress(address), value);
+}
+
+//=============================================================================
+//             STRING
+//=============================================================================
+
+std::string String::toString(long value, int base) {
+    if (value < 0) return "-" + toString((unsigned long)(-value), base);
+    return toString((unsigned long)value, base);
+}
+
+std::string String::toString(unsigned long value, int base) {
+    const char digits[] = "0123456789ABCDEF";
+    std::string s;
+    do {
+        s.insert(s.begin(), digits[value % base]);
+        value /= base;
+    } while (value != 0);
+    return s;
+}
+
+//=============================================================================
+//             SERIAL
+//=============================================================================
+
+/* The Mega's HardwareSerial receives into a 64-byte ring buffer, which holds at most 63 unread bytes: bytes that
+arrive while it is full are lost. Bytes read from the pseudo-terminal are queued "on the wire" (lineBuffer) with the
+time they finish arriving, paced at the current baud rate as though the driver sent them back to back, and are moved
+into rxBuffer (or dropped) once that time has passed, so firmware that leaves the serial port unread for too long
+loses bytes as it would on the real board. The wire is timed by the time the firmware spends in simulated I/O and
+delays only (virtualMicros), not by real time: otherwise the host descheduling the simulation would lose bytes. */
+static const size_t RX_BUFFER_SIZE = 64;
+static std::deque<uint8_t> rxBuffer;
+
+struct LineByte {
+    uint8_t value;
+    unsigned long arrivalUs;  // virtualMicros when its stop bit has arrived
+};
+static std::deque<LineByte> lineBuffer;
+static unsigned long lastArrivalUs = 0;
+
+/* What bytes are XORed with while the link is garbled (see linkGarbled): different in each direction, so that
+garbled bytes echoed back don't come out intact. */
+static const uint8_t RX_GARBLE_MASK = 0xA5;
+static const uint8_t TX_GARBLE_MASK = 0x3C;
+
+/** @return whether the firmware is running faster than the simulated link carries intact (see sim_main.cpp, -b) */
+static bool linkGarbled() {
+    return simMaxBaudRate() != 0 && Serial.baudRate() > simMaxBaudRate();
+}
+
+/** @return how long a byte takes to arrive at the current baud rate (8N1: 10 bits), in microseconds */
+static unsigned long byteTimeUs() {
+    return Serial.baudRate() == 0 ? 0 : (10000000UL + Serial.baudRate() - 1) / Serial.baudRate();
+}
+
+/**
+ * @brief Moves any bytes waiting on the pseudo-terminal onto the wire, without blocking, then moves the bytes that
+ * have finished arriving into rxBuffer, dropping those that don't fit.
+ */
+static void pollSerial() {
+    uint8_t buffer[256];
+    while (true) {
+        ssize_t n = ::read(simSerialFd(), buffer, sizeof(buffer));
+        if (n <= 0) break;
+        if (lastArrivalUs < virtualMicros) lastArrivalUs = virtualMicros;
+        for (ssize_t i = 0; i < n; i++) {
+            LineByte b = { linkGarbled() ? (uint8_t)(buffer[i] ^ RX_GARBLE_MASK) : buffer[i], 0 };
+            lastArrivalUs += byteTimeUs();
+            b.arrivalUs = lastArrivalUs;
+            lineBuffer.push_back(b);
+        }
+    }
+    while (!lineBuffer.empty() && lineBuffer.front().arrivalUs <= virtualMicros) {
+        if (rxBuffer.size() < RX_BUFFER_SIZE - 1) rxBuffer.push_back(lineBuffer.front().value);
+        lineBuffer.pop_front();
+    }
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+    _baud = baud;
+}
+
+void HardwareSerial::end() {}
+
+int HardwareSerial::available() {
+    pollSerial();
+    if (rxBuffer.empty()) {
+        if (!lineBuffer.empty()) {
+            /* The firmware spins on available() until the next byte arrives: let that time pass. */
+            if (lineBuffer.front().arrivalUs > virtualMicros) virtualMicros = lineBuffer.front().arrivalUs;
+        } else {
+            /* The firmware spins on available(): yield the host CPU briefly, accounting for it as real time
+            passing. */
+            struct pollfd pfd = { simSerialFd(), POLLIN, 0 };
+            ::poll(&pfd, 1, 1);
+        }
+        pollSerial();
+    }
+    return (int)rxBuffer.size();
+}
+
+int HardwareSerial::availableForWrite() {
+    return 63;
+}
+
+int HardwareSerial::read() {
+    if (rxBuffer.empty()) pollSerial();
+    if (rxBuffer.empty()) return -1;
+    uint8_t b = rxBuffer.front();
+    rxBuffer.pop_front();
+    return b;
+}
+
+int HardwareSerial::peek() {
+    if (rxBuffer.empty()) pollSerial();
+    return rxBuffer.empty() ? -1 : rxBuffer.front();
+}
+
+void HardwareSerial::flush() {
+    ::tcdrain(simSerialFd());
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t HardwareSerial::write(const char *s) {
+    return write((const uint8_t *)s, strlen(s));
+}
+
+/** @brief Writes bytes to the pseudo-terminal as they are, waiting for room if need be. */
+static size_t writeSerial(const uint8_t *buffer, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = ::write(simSerialFd(), buffer + written, size - written);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                struct pollfd pfd = { simSerialFd(), POLLOUT, 0 };
+                ::poll(&pfd, 1, 10);
+                continue;
+            }
+            return written;
+        }
+        written += (size_t)n;
+    }
+    return written;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    if (!linkGarbled()) return writeSerial(buffer, size);
+    size_t written = 0;
+    while (written < size) {
+        uint8_t garbled[256];
+        size_t length = size - written < sizeof(garbled) ? size - written : sizeof(garbled);
+        for (size_t i = 0; i < length; i++) garbled[i] = buffer[written + i] ^ TX_GARBLE_MASK;
+        size_t n = writeSerial(garbled, length);
+        written += n;
+        if (n < length) break;
+    }
+    return written;
+}
@@ -0,0 +1,233 @@
+/*
+ * Implementation of the SST39SF flash chip model. See flash_model.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "flash_model.h"
+#include "Arduino.h"
+#include "sst_constants.h"
+
+#include <stdio.h>
+#include <vector>
+
+/** @brief Where the chip is in a software command sequence (see the SST39SF datasheet). */
+enum CommandState {
+    IDLE,
+    GOT_AA,
+    GOT_55,
+    PROGRAM,
+    ERASE_GOT_80,
+    ERASE_GOT_AA,
+    ERASE_GOT_55
+};
+
+static std::vector<uint8_t> memory;
+static uint32_t flashSizeBytes;
+static const char *imageFile = nullptr;
+
+static CommandState commandState = IDLE;
+static bool softwareIdMode = false;
+
+/* An internal operation (program/erase) is in progress until busyUntil. While it is, reads return status bits rather
+than data: DQ7 is the complement of the data being programmed (0 for erase), and DQ6 toggles on every read. */
+static unsigned long busyUntil = 0;
+static uint8_t busyDq7 = 0;
+static uint8_t toggleBit = 0;
+static unsigned long sectorErases = 0;
+
+#if CHIP_FAMILY == CHIP_FAMILY_29F010
+static const uint32_t SIM_SECTOR_SIZE = 16384;
+static const uint8_t SST_MANUFACTURER_ID = 0x01;
+#else
+static const uint32_t SIM_SECTOR_SIZE = 4096;
+static const uint8_t SST_MANUFACTURER_ID = 0xBF;
+#endif
+
+#if CHIP_FAMILY == CHIP_FAMILY_AT28C256
+/* AT28C256 page buffer: bytes written within SIM_BYTE_LOAD_WINDOW_US of each other are latched, then written in one
+write cycle. */
+static const unsigned long SIM_BYTE_LOAD_WINDOW_US = 150;
+static const unsigned long SIM_WRITE_CYCLE_US = 5000;
+static const uint32_t SIM_PAGE_SIZE = 64;
+static bool pageLoading = false;
+static unsigned long lastLoad = 0;
+static uint32_t pageAddress = 0;
+static uint8_t pageBuffer[SIM_PAGE_SIZE];
+static bool pageValid[SIM_PAGE_SIZE];
+
+/** @brief Starts the write cycle of the loaded page, if the byte load window has passed. */
+static void commitPageIfDue() {
+    if (!pageLoading || micros() - lastLoad < SIM_BYTE_LOAD_WINDOW_US) return;
+    uint8_t last = 0;
+    for (uint32_t i = 0; i < SIM_PAGE_SIZE; i++) {
+        if (pageValid[i]) { memory[pageAddress + i] = pageBuffer[i]; last = pageBuffer[i]; }
+    }
+    pageLoading = false;
+    busyDq7 = (uint8_t)(~last & 0x80);
+    busyUntil = lastLoad + SIM_BYTE_LOAD_WINDOW_US + SIM_WRITE_CYCLE_US;
+}
+
+/** @brief Latches a byte into the page buffer. */
+static void loadPageByte(uint32_t address, uint8_t data) {
+    uint32_t page = address & ~(SIM_PAGE_SIZE - 1);
+    if (!pageLoading || page != pageAddress) {
+        pageLoading = true;
+        pageAddress = page;
+        for (uint32_t i = 0; i < SIM_PAGE_SIZE; i++) pageValid[i] = false;
+    }
+    pageBuffer[address - page] = data;
+    pageValid[address - page] = true;
+    lastLoad = micros();
+}
+#endif
+
+// See header comment.
+void flashModelInit(uint32_t flashSize, const char *imagePath) {
+    flashSizeBytes = flashSize;
+    memory.assign(flashSize, 0xFF);
+    imageFile = imagePath;
+    if (imageFile == nullptr) return;
+
+    FILE *f = fopen(imageFile, "rb");
+    if (f != nullptr) {
+        size_t n = fread(memory.data(), 1, memory.size(), f);
+        (void)n;
+        fclose(f);
+    }
+}
+
+// See header comment.
+void flashModelSave() {
+    if (imageFile == nullptr) return;
+    FILE *f = fopen(imageFile, "wb");
+    if (f == nullptr) return;
+    fwrite(memory.data(), 1, memory.size(), f);
+    fclose(f);
+}
+
+/** @return whether an internal program/erase operation is still in progress */
+static bool busy() {
+    return micros() < busyUntil;
+}
+
+/** @return the device ID of the simulated chip, which depends on its size */
+static uint8_t deviceId() {
+#if CHIP_FAMILY == CHIP_FAMILY_29F010
+    return 0x20;
+#endif
+    return flashSizeBytes <= 131072 ? 0xB5 : flashSizeBytes <= 262144 ? 0xB6 : 0xB7;
+}
+
+// See header comment.
+volatile bool flashModelPresent = true;
+
+// See header comment.
+void flashModelWrite(uint32_t address, uint8_t data) {
+    if (!flashModelPresent) return;
+    address %= flashSizeBytes;
+#if CHIP_FAMILY == CHIP_FAMILY_AT28C256
+    commitPageIfDue();
+    if (busy()) return;
+    uint16_t commandAddress = address & 0x7FFF;
+    if (pageLoading) {
+        loadPageByte(address, data);
+    } else if (commandState == IDLE && commandAddress == 0x5555 && data == 0xAA) {
+        commandState = GOT_AA;
+    } else if (commandState == GOT_AA && commandAddress == 0x2AAA && data == 0x55) {
+        commandState = GOT_55;
+    } else if (commandState == GOT_55 && commandAddress == 0x5555 && data == 0xA0) {
+        commandState = PROGRAM;
+    } else {
+        // software data protection disabled, or write after the SDP sequence: a page load
+        commandState = IDLE;
+        loadPageByte(address, data);
+    }
+    return;
+#else
+    if (busy()) return;  // the chip ignores commands while busy
+
+    uint16_t commandAddress = address & 0x7FFF;  // only A14-A0 are decoded for command cycles
+    switch (commandState) {
+        case IDLE:
+            if (data == 0xF0) {
+                softwareIdMode = false;
+            } else if (commandAddress == 0x5555 && data == 0xAA) {
+                commandState = GOT_AA;
+            }
+            return;
+        case GOT_AA:
+            commandState = (commandAddress == 0x2AAA && data == 0x55) ? GOT_55 : IDLE;
+            return;
+        case GOT_55:
+            commandState = IDLE;
+            if (commandAddress != 0x5555) return;
+            if (data == 0xA0) commandState = PROGRAM;
+            else if (data == 0x80) commandState = ERASE_GOT_80;
+            else if (data == 0x90) softwareIdMode = true;
+            else if (data == 0xF0) softwareIdMode = false;
+            return;
+        case PROGRAM:
+            commandState = IDLE;
+            memory[address] &= data;  // programming can only clear bits
+            busyDq7 = (uint8_t)(~data & 0x80);
+            busyUntil = micros() + SIM_BYTE_PROGRAM_US;
+            return;
+        case ERASE_GOT_80:
+            commandState = (commandAddress == 0x5555 && data == 0xAA) ? ERASE_GOT_AA : IDLE;
+            return;
+        case ERASE_GOT_AA:
+            commandState = (commandAddress == 0x2AAA && data == 0x55) ? ERASE_GOT_55 : IDLE;
+            return;
+        case ERASE_GOT_55:
+            commandState = IDLE;
+            if (data == 0x30) {
+                uint32_t sectorStart = address & ~(SIM_SECTOR_SIZE - 1);
+                for (uint32_t i = 0; i < SIM_SECTOR_SIZE; i++) memory[sectorStart + i] = 0xFF;
+                busyUntil = micros() + SIM_SECTOR_ERASE_US;
+                sectorErases++;
+            } else if (data == 0x10 && commandAddress == 0x5555) {
+                memory.assign(flashSizeBytes, 0xFF);
+                busyUntil = micros() + SIM_CHIP_ERASE_US;
+            } else {
+                return;
+            }
+            busyDq7 = 0;
+            return;
+    }
+#endif
+}
+
+// See header comment.
+uint8_t flashModelRead(uint32_t address) {
+    if (!flashModelPresent) return 0xFF;  // floating bus, read as pulled up
+    address %= flashSizeBytes;
+#if CHIP_FAMILY == CHIP_FAMILY_AT28C256
+    commitPageIfDue();
+#endif
+    if (busy()) {
+        toggleBit ^= 0x40;
+        return busyDq7 | toggleBit;
+    }
+    if (softwareIdMode) {
+        return (address & 1) ? deviceId() : SST_MANUFACTURER_ID;
+    }
+    return memory[address];
+}
+
+// See header comment.
+unsigned long flashModelSectorErases() {
+    return sectorErases;
+}
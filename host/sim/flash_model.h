@@ -0,0 +1,63 @@
+/*
+ * Behavioural model of an SST39SF flash chip, as seen from its pins. Used by the host simulation.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_SIM_FLASH_MODEL_H
+#define SST39SF_SIM_FLASH_MODEL_H
+
+#include <stdint.h>
+
+/* Timings used by the model, in microseconds. These are the typical values from the SST39SF datasheet. */
+const unsigned long SIM_BYTE_PROGRAM_US = 14;
+const unsigned long SIM_SECTOR_ERASE_US = 18000;
+const unsigned long SIM_CHIP_ERASE_US = 70000;
+
+/**
+ * @brief Initializes the model: all of flash is erased (0xFF). If imagePath is non-null and the file exists, the
+ * initial contents of flash are loaded from it, and flash is written back to it when the simulation exits.
+ * 
+ * @param flashSize the size of the simulated chip, in bytes
+ * @param imagePath path of a file to persist flash contents in, or null
+ */
+void flashModelInit(uint32_t flashSize, const char *imagePath);
+
+/** @brief Writes the contents of flash back to the image file, if one was given to flashModelInit. */
+void flashModelSave();
+
+/**
+ * @brief A bus write cycle (i.e. a rising edge on WE# while CE# is low and OE# is high).
+ * 
+ * @param address the address on the address bus
+ * @param data the data on the data bus
+ */
+void flashModelWrite(uint32_t address, uint8_t data);
+
+/**
+ * @brief A bus read cycle (i.e. a falling edge on OE# while CE# is low and WE# is high).
+ * 
+ * @param address the address on the address bus
+ * @return the data that the chip drives onto the data bus
+ */
+uint8_t flashModelRead(uint32_t address);
+
+/** @brief Whether a chip is in the socket (toggled with SIGUSR1). With no chip, reads return 0xFF. */
+extern volatile bool flashModelPresent;
+
+/** @brief Total number of sector erase operations performed by the model, for reporting. */
+unsigned long flashModelSectorErases();
+
+#endif  // SST39SF_SIM_FLASH_MODEL_H
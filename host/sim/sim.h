@@ -0,0 +1,35 @@
+/*
+ * Interface between the host simulation's main program and its Arduino API implementation.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_SIM_SIM_H
+#define SST39SF_SIM_SIM_H
+
+/** @return the file descriptor of the master side of the pseudo-terminal that Serial is connected to */
+int simSerialFd();
+
+/** @return whether the simulated DEBUG_MODE_PIN is tied low */
+bool simDebugModePin();
+
+/** @return the fastest baud rate that the simulated link carries intact, or 0 if there is no limit */
+unsigned long simMaxBaudRate();
+
+/* The firmware's entry points. */
+void setup();
+void loop();
+
+#endif  // SST39SF_SIM_SIM_H
@@ -0,0 +1,140 @@
+/*
+ * Host simulation of the programmer. Runs the firmware's setup() and loop() on a Linux host, with its bus connected
+ * to a model of an SST39SF chip and its serial port connected to a pseudo-terminal. The path of the pseudo-terminal
+ * is printed on startup: point the driver (or the host client library) at it as if it were the Arduino's port.
+ * Sending the simulation SIGUSR1 removes the chip from the socket, or puts it back.
+ *
+ * The firmware is compiled from the unmodified sketch sources, with the same CHIP_FAMILY and BUS_BACKEND options as
+ * for the Arduino (see the README for the build line).
+ *
+ * usage: sst39sf-sim [-i <IMAGE>] [-l <LINK>] [-d] [-b <BAUD>]
+ *     -i <IMAGE>   File to load initial flash contents from, and to save flash contents to on exit
+ *     -l <LINK>    Create a symlink to the pseudo-terminal at this path (e.g. /tmp/sst39sf)
+ *     -d           Start with DEBUG_MODE_PIN tied low (dumps flash contents to serial)
+ *     -b <BAUD>    Garble serial traffic while the firmware runs faster than this baud rate, like a link that
+ *                  can't keep up (for trying out the driver's --calibrate)
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Arduino.h"
+#include "sim.h"
+#include "flash_model.h"
+#include "EEPROM.h"
+#include <string>
+#include "sst_constants.h"
+
+#include <fcntl.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static int masterFd = -1;
+static int slaveFd = -1;  // kept open so that the master never sees a hangup between driver runs
+static bool debugModePin = false;
+static unsigned long maxBaudRate = 0;
+static const char *linkPath = nullptr;
+
+int simSerialFd() {
+    return masterFd;
+}
+
+bool simDebugModePin() {
+    return debugModePin;
+}
+
+unsigned long simMaxBaudRate() {
+    return maxBaudRate;
+}
+
+EEPROMClass EEPROM;
+static std::string eepromPath;
+
+void simEepromLoad(const char *path) {
+    eepromPath = path;
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) return;
+    size_t n = fread(EEPROM.bytes, 1, sizeof(EEPROM.bytes), f);
+    (void)n;
+    fclose(f);
+}
+
+void simEepromSave() {
+    if (eepromPath.empty()) return;
+    FILE *f = fopen(eepromPath.c_str(), "wb");
+    if (f == nullptr) return;
+    fwrite(EEPROM.bytes, 1, sizeof(EEPROM.bytes), f);
+    fclose(f);
+}
+
+static void onExit(int) {
+    flashModelSave();
+    simEepromSave();
+    if (linkPath != nullptr) unlink(linkPath);
+    _exit(0);
+}
+
+static void onToggleChip(int) {
+    flashModelPresent = !flashModelPresent;
+}
+
+int main(int argc, char **argv) {
+    const char *imagePath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            imagePath = argv[++i];
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            linkPath = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            debugModePin = true;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            maxBaudRate = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-i <IMAGE>] [-l <LINK>] [-d] [-b <BAUD>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char slaveName[256];
+    if (openpty(&masterFd, &slaveFd, slaveName, nullptr, nullptr) != 0) {
+        perror("openpty");
+        return 1;
+    }
+    struct termios tio;
+    tcgetattr(slaveFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slaveFd, TCSANOW, &tio);
+    fcntl(masterFd, F_SETFL, fcntl(masterFd, F_GETFL) | O_NONBLOCK);
+
+    if (linkPath != nullptr) {
+        unlink(linkPath);
+        if (symlink(slaveName, linkPath) != 0) perror("symlink");
+    }
+    printf("%s\n", linkPath != nullptr ? linkPath : slaveName);
+    fflush(stdout);
+
+    signal(SIGINT, onExit);
+    signal(SIGTERM, onExit);
+    signal(SIGUSR1, onToggleChip);
+    flashModelInit(SST_FLASH_SIZE, imagePath);
+    if (imagePath != nullptr) simEepromLoad((std::string(imagePath) + ".eeprom").c_str());
+
+    setup();
+    while (true) loop();
+}
@@ -0,0 +1,32 @@
+/*
+ * The sketch's .ino file, as a translation unit for the host simulation. The Arduino IDE declares the functions
+ * defined in the .ino before compiling it, so that they can be used before they are defined: this does the same, so
+ * must be kept in step with the functions in the .ino.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sim.h"
+
+static void serialTask();
+static void flashTask();
+static void productionTask();
+static void processSerial();
+static void checkForDebugMode();
+static void processIncomingCommand();
+static void checkForCommand(char *command);
+static void processSerialEraseChip();
+
+#include "SST39SF-programmer.ino"
@@ -0,0 +1,528 @@
+/*
+ * Implementation of the native Linux client library. See sst39sf_client.h for more information.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "sst39sf_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+//=============================================================================
+//             CONSTANTS
+//=============================================================================
+
+// the number of times to retry a corrupted echo or read before giving up, as in the C# driver
+static const int NUM_RETRIES = 2;
+
+static const int CONNECT_TIMEOUT_MS = 5000;    // opening the device resets the Arduino, which then boots
+static const int NORMAL_TIMEOUT_MS = 2000;
+static const int EXTENDED_TIMEOUT_MS = 10000;  // programming or erasing a sector, erasing the chip
+
+//=============================================================================
+//             UTILITIES
+//=============================================================================
+
+/** @brief Gets a monotonic timestamp, in microseconds. */
+static uint64_t nowMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** @brief Reads a little-endian 16-bit value. */
+static uint16_t readUint16(const uint8_t *bytes) {
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+/** @brief Reads a little-endian 32-bit value. */
+static uint32_t readUint32(const uint8_t *bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+//=============================================================================
+//             CONSTRUCTION
+//=============================================================================
+
+ProgrammerClient::ProgrammerClient() : _fd(-1), _chipSectors(0) {
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+ProgrammerClient::~ProgrammerClient() {
+    close();
+}
+
+// See header comment.
+bool ProgrammerClient::open(const char *devicePath) {
+    close();
+    memset(&_stats, 0, sizeof(_stats));
+
+    _fd = ::open(devicePath, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (_fd < 0) return failWith(std::string("Could not open ") + devicePath + ": " + strerror(errno));
+
+    struct termios tty;
+    if (tcgetattr(_fd, &tty) != 0) return failWith(std::string(devicePath) + " is not a serial device.");
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | PARENB);  // 8N1
+    cfsetispeed(&tty, B115200);         // SERIAL_BAUD_RATE
+    cfsetospeed(&tty, B115200);
+    if (tcsetattr(_fd, TCSANOW, &tty) != 0) {
+        return failWith(std::string("Could not configure ") + devicePath + ": " + strerror(errno));
+    }
+
+    // The Arduino repeatedly sends WAITING (null-terminated) and the chip's number of sectors, until we acknowledge it
+    const size_t waitLength = sizeof(WAIT_MESSAGE);
+    size_t matched = 0;
+    uint64_t deadline = nowMicros() + (uint64_t)CONNECT_TIMEOUT_MS * 1000;
+    while (matched < waitLength) {
+        int remainingMs = (int)(((int64_t)deadline - (int64_t)nowMicros()) / 1000);
+        uint8_t b;
+        if (remainingMs <= 0 || !receiveAll(&b, 1, remainingMs)) {
+            return failWith("Timed out waiting for the Arduino to send " + std::string(WAIT_MESSAGE) + ".");
+        }
+        if (b == (uint8_t)WAIT_MESSAGE[matched]) {
+            matched++;
+        } else {
+            matched = (b == (uint8_t)WAIT_MESSAGE[0]) ? 1 : 0;
+        }
+    }
+    uint8_t sectorsBytes[2];
+    if (!receiveAll(sectorsBytes, sizeof(sectorsBytes), NORMAL_TIMEOUT_MS)) {
+        return failWith("Timed out waiting for the Arduino to send the chip's number of sectors.");
+    }
+    _chipSectors = readUint16(sectorsBytes);
+
+    uint8_t ack = ACK;
+    if (!sendAll(&ack, 1, NORMAL_TIMEOUT_MS)) return false;
+    /* We may acknowledge just as the Arduino sends another broadcast: give it time to arrive, then discard it (as
+    the C# driver does). */
+    usleep(50000);
+    tcflush(_fd, TCIFLUSH);
+    _lastError.clear();
+    return true;
+}
+
+// See header comment.
+bool ProgrammerClient::finish() {
+    bool acknowledged = sendCommand(DONE_MESSAGE);
+    close();
+    return acknowledged;
+}
+
+// See header comment.
+void ProgrammerClient::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+//=============================================================================
+//             WRITING
+//=============================================================================
+
+// See header comment.
+bool ProgrammerClient::programSector(uint16_t sectorIndex, const uint8_t *data) {
+    uint64_t start = nowMicros();
+    if (!sendCommand(PROGRAM_SECTOR_MESSAGE)) return false;
+
+    // The Arduino echoes the index: we ACK if it matches, or NAK to send it again
+    uint8_t indexBytes[SECTOR_INDEX_LENGTH_BYTES] = { (uint8_t)sectorIndex, (uint8_t)(sectorIndex >> 8) };
+    for (int attempt = 0; ; attempt++) {
+        uint8_t echo[SECTOR_INDEX_LENGTH_BYTES];
+        if (!sendAll(indexBytes, sizeof(indexBytes), NORMAL_TIMEOUT_MS)) return false;
+        if (!waitForAck("sector programming (sending sector index)", NORMAL_TIMEOUT_MS)) return false;
+        if (!receiveAll(echo, sizeof(echo), NORMAL_TIMEOUT_MS)) return false;
+
+        uint8_t response = memcmp(echo, indexBytes, sizeof(echo)) == 0 ? ACK : NAK;
+        if (!sendAll(&response, 1, NORMAL_TIMEOUT_MS)) return false;
+        if (response == ACK) break;
+        if (attempt >= NUM_RETRIES) return failWith("Sector index echo did not match after retrying.");
+        _stats.retries++;
+    }
+
+    // Likewise for the data
+    for (int attempt = 0; ; attempt++) {
+        if (!sendAll(data, SST_SECTOR_SIZE, NORMAL_TIMEOUT_MS)) return false;
+        if (!receiveAll(_echo, SST_SECTOR_SIZE, NORMAL_TIMEOUT_MS)) return false;
+
+        uint8_t response = memcmp(_echo, data, SST_SECTOR_SIZE) == 0 ? ACK : NAK;
+        if (!sendAll(&response, 1, NORMAL_TIMEOUT_MS)) return false;
+        if (response == ACK) break;
+        if (attempt >= NUM_RETRIES) return failWith("Sector data echo did not match after retrying.");
+        _stats.retries++;
+    }
+
+    if (!waitForAck("sector programming", EXTENDED_TIMEOUT_MS)) return false;
+    _stats.sectorsProgrammed++;
+    _stats.programMicros += nowMicros() - start;
+    return true;
+}
+
+// See header comment.
+bool ProgrammerClient::write(const uint8_t *image, size_t length, uint16_t firstSector) {
+    if (!checkOnChip(firstSector, length)) return false;
+    size_t fullSectors = length / SST_SECTOR_SIZE;
+    for (size_t i = 0; i < fullSectors; i++) {
+        if (!programSector((uint16_t)(firstSector + i), image + i * SST_SECTOR_SIZE)) return false;
+    }
+
+    size_t remainder = length % SST_SECTOR_SIZE;
+    if (remainder != 0) {
+        // only the last, partial, sector is copied, to pad it
+        uint8_t lastSector[SST_SECTOR_SIZE];
+        memset(lastSector, 0, sizeof(lastSector));
+        memcpy(lastSector, image + fullSectors * SST_SECTOR_SIZE, remainder);
+        if (!programSector((uint16_t)(firstSector + fullSectors), lastSector)) return false;
+    }
+    return true;
+}
+
+// See header comment.
+bool ProgrammerClient::eraseChip() {
+    if (!sendCommand(ERASE_CHIP_MESSAGE)) return false;
+
+    char confirm[sizeof(CONFIRM_ERASE_MESSAGE)];
+    if (!receiveAll(confirm, sizeof(confirm), NORMAL_TIMEOUT_MS)) return false;
+    if (memcmp(confirm, CONFIRM_ERASE_MESSAGE, sizeof(confirm)) != 0) {
+        return failWith("Expected the Arduino to send " + std::string(CONFIRM_ERASE_MESSAGE) + " during chip erase.");
+    }
+
+    uint8_t ack = ACK;
+    if (!sendAll(&ack, 1, NORMAL_TIMEOUT_MS)) return false;
+    return waitForAck("chip erase", EXTENDED_TIMEOUT_MS);
+}
+
+// See header comment.
+bool ProgrammerClient::eraseRange(uint16_t firstSector, uint16_t sectorCount, std::vector<EraseRangeRecord> *records) {
+    if (!sendCommand(ERASE_RANGE_MESSAGE)) return false;
+    uint8_t request[4] = { (uint8_t)firstSector, (uint8_t)(firstSector >> 8), (uint8_t)sectorCount,
+                           (uint8_t)(sectorCount >> 8) };
+    if (!sendAll(request, sizeof(request), NORMAL_TIMEOUT_MS)) return false;
+    if (!waitForAck("erase range", NORMAL_TIMEOUT_MS)) return false;
+
+    records->clear();
+    for (uint16_t i = 0; i < sectorCount; i++) {
+        uint8_t bytes[ERASE_RANGE_RECORD_LENGTH];
+        if (!receiveAll(bytes, sizeof(bytes), EXTENDED_TIMEOUT_MS)) return false;
+        EraseRangeRecord record;
+        record.status = bytes[0];
+        record.elapsedMicros = readUint32(bytes + 1);
+        record.eraseMicros = readUint32(bytes + 5);
+        records->push_back(record);
+    }
+    return true;
+}
+
+//=============================================================================
+//             READING
+//=============================================================================
+
+// See header comment.
+bool ProgrammerClient::readSector(uint16_t sectorIndex, uint8_t *data) {
+    uint8_t indexBytes[SECTOR_INDEX_LENGTH_BYTES] = { (uint8_t)sectorIndex, (uint8_t)(sectorIndex >> 8) };
+    for (int attempt = 0; ; attempt++) {
+        if (!sendCommand(READ_SECTOR_MESSAGE)) return false;
+        if (!sendAll(indexBytes, sizeof(indexBytes), NORMAL_TIMEOUT_MS)) return false;
+        if (!waitForAck("sector read", NORMAL_TIMEOUT_MS)) return false;
+
+        // ACK is followed by the sector index, the sector's contents, and their CRC-32
+        uint8_t echo[SECTOR_INDEX_LENGTH_BYTES];
+        uint8_t crcBytes[4];
+        if (!receiveAll(echo, sizeof(echo), NORMAL_TIMEOUT_MS)) return false;
+        if (!receiveAll(data, SST_SECTOR_SIZE, NORMAL_TIMEOUT_MS)) return false;
+        if (!receiveAll(crcBytes, sizeof(crcBytes), NORMAL_TIMEOUT_MS)) return false;
+
+        if (readUint16(echo) == sectorIndex && readUint32(crcBytes) == crc32(data, SST_SECTOR_SIZE)) break;
+        if (attempt >= NUM_RETRIES) return failWith("Sector read was corrupted in transit after retrying.");
+        _stats.retries++;
+    }
+    _stats.sectorsRead++;
+    return true;
+}
+
+// See header comment.
+bool ProgrammerClient::read(uint8_t *buffer, size_t length, uint16_t firstSector) {
+    if (!checkOnChip(firstSector, length)) return false;
+    size_t fullSectors = length / SST_SECTOR_SIZE;
+    for (size_t i = 0; i < fullSectors; i++) {
+        if (!readSector((uint16_t)(firstSector + i), buffer + i * SST_SECTOR_SIZE)) return false;
+    }
+
+    size_t remainder = length % SST_SECTOR_SIZE;
+    if (remainder != 0) {
+        uint8_t lastSector[SST_SECTOR_SIZE];
+        if (!readSector((uint16_t)(firstSector + fullSectors), lastSector)) return false;
+        memcpy(buffer + fullSectors * SST_SECTOR_SIZE, lastSector, remainder);
+    }
+    return true;
+}
+
+// See header comment.
+bool ProgrammerClient::sectorCrc(uint16_t sectorIndex, uint32_t *crc) {
+    uint8_t indexBytes[SECTOR_INDEX_LENGTH_BYTES] = { (uint8_t)sectorIndex, (uint8_t)(sectorIndex >> 8) };
+    if (!sendCommand(SECTOR_CRC_MESSAGE)) return false;
+    if (!sendAll(indexBytes, sizeof(indexBytes), NORMAL_TIMEOUT_MS)) return false;
+    if (!waitForAck("sector CRC", NORMAL_TIMEOUT_MS)) return false;
+
+    // ACK is followed by the sector index and the CRC-32
+    uint8_t response[SECTOR_INDEX_LENGTH_BYTES + 4];
+    if (!receiveAll(response, sizeof(response), NORMAL_TIMEOUT_MS)) return false;
+    if (readUint16(response) != sectorIndex) {
+        return failWith("Requested CRC of one sector, but the Arduino sent the CRC of another.");
+    }
+    *crc = readUint32(response + SECTOR_INDEX_LENGTH_BYTES);
+    _stats.crcsRead++;
+    return true;
+}
+
+// See header comment.
+bool ProgrammerClient::verify(const uint8_t *image, size_t length, uint16_t firstSector,
+                              std::vector<uint16_t> *mismatches) {
+    if (!checkOnChip(firstSector, length)) return false;
+    bool allMatch = true;
+    size_t sectors = (length + SST_SECTOR_SIZE - 1) / SST_SECTOR_SIZE;
+    for (size_t i = 0; i < sectors; i++) {
+        uint32_t expected;
+        size_t offset = i * SST_SECTOR_SIZE;
+        if (length - offset >= SST_SECTOR_SIZE) {
+            expected = crc32(image + offset, SST_SECTOR_SIZE);
+        } else {
+            // the last sector was padded with zeroes when it was written
+            uint8_t lastSector[SST_SECTOR_SIZE];
+            memset(lastSector, 0, sizeof(lastSector));
+            memcpy(lastSector, image + offset, length - offset);
+            expected = crc32(lastSector, SST_SECTOR_SIZE);
+        }
+
+        uint32_t onChip;
+        if (!sectorCrc((uint16_t)(firstSector + i), &onChip)) return false;
+        if (onChip != expected) {
+            allMatch = false;
+            if (mismatches != NULL) mismatches->push_back((uint16_t)(firstSector + i));
+        }
+    }
+    _lastError.clear();
+    return allMatch;
+}
+
+// See header comment.
+bool ProgrammerClient::readHealth(std::vector<SectorHealthRecord> *records) {
+    if (!sendCommand(HEALTH_MESSAGE)) return false;
+
+    uint8_t countBytes[2];
+    if (!receiveAll(countBytes, sizeof(countBytes), NORMAL_TIMEOUT_MS)) return false;
+    uint16_t count = readUint16(countBytes);
+
+    records->clear();
+    for (uint16_t i = 0; i < count; i++) {
+        uint8_t bytes[HEALTH_RECORD_LENGTH];
+        if (!receiveAll(bytes, sizeof(bytes), NORMAL_TIMEOUT_MS)) return false;
+        SectorHealthRecord record;
+        record.cycles = readUint32(bytes);
+        record.firstEraseTime = readUint16(bytes + 4);
+        record.averageEraseTime = readUint16(bytes + 6);
+        record.lastEraseTime = readUint16(bytes + 8);
+        record.averagePolls = readUint16(bytes + 10);
+        records->push_back(record);
+    }
+    return true;
+}
+
+// See header comment.
+uint32_t ProgrammerClient::crc32(const uint8_t *data, size_t length) {
+    static uint32_t table[256];
+    static bool tableBuilt = false;
+    if (!tableBuilt) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+            }
+            table[n] = c;
+        }
+        tableBuilt = true;
+    }
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+//=============================================================================
+//             RAW ACCESS
+//=============================================================================
+
+// See header comment.
+bool ProgrammerClient::sendRaw(const uint8_t *data, size_t length, int timeoutMs) {
+    return sendAll(data, length, timeoutMs);
+}
+
+// See header comment.
+bool ProgrammerClient::receiveRaw(uint8_t *data, size_t length, int timeoutMs) {
+    return receiveAll(data, length, timeoutMs);
+}
+
+// See header comment.
+size_t ProgrammerClient::discardInput(int quietMs) {
+    size_t discarded = 0;
+    uint8_t b;
+    while (receiveAll(&b, 1, quietMs)) discarded++;
+    _lastError.clear();  // the timeout is how this ends
+    return discarded;
+}
+
+// See header comment.
+bool ProgrammerClient::setBaudRate(uint32_t baudRate) {
+    if (_fd < 0) return failWith("Not connected to the Arduino.");
+    speed_t speed;
+    switch (baudRate) {
+        case 2000000: speed = B2000000; break;
+        case 1000000: speed = B1000000; break;
+        case 500000: speed = B500000; break;
+        case 230400: speed = B230400; break;
+        case 115200: speed = B115200; break;
+        default:
+            // termios has no constant for the rest of SERIAL_BAUD_RATES (250000)
+            return failWith("The serial device can't be set to " + std::to_string(baudRate) + " baud.");
+    }
+
+    struct termios tty;
+    if (tcgetattr(_fd, &tty) != 0) {
+        return failWith(std::string("Could not read the serial device's settings: ") + strerror(errno));
+    }
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if (tcsetattr(_fd, TCSADRAIN, &tty) != 0) {
+        return failWith("Could not set the serial device to " + std::to_string(baudRate) + " baud: " + strerror(errno));
+    }
+    return true;
+}
+
+//=============================================================================
+//             SERIAL COMMUNICATION
+//=============================================================================
+
+/**
+ * @brief Sends bytes to the Arduino, waiting for the device to accept them for at most timeoutMs milliseconds at a
+ * time.
+ */
+bool ProgrammerClient::sendAll(const void *buffer, size_t length, int timeoutMs) {
+    if (_fd < 0) return failWith("Not connected to the Arduino.");
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    while (length > 0) {
+        ssize_t written = ::write(_fd, bytes, length);
+        if (written > 0) {
+            bytes += written;
+            length -= written;
+            _stats.bytesSent += written;
+            continue;
+        }
+        if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return failWith(std::string("Error writing to the Arduino: ") + strerror(errno));
+        }
+        struct pollfd pfd = { _fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, timeoutMs) <= 0) {
+            return failWith("Timed out (>" + std::to_string(timeoutMs) + "ms) while sending to the Arduino.");
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Receives exactly length bytes from the Arduino, waiting at most timeoutMs milliseconds for each chunk.
+ */
+bool ProgrammerClient::receiveAll(void *buffer, size_t length, int timeoutMs) {
+    if (_fd < 0) return failWith("Not connected to the Arduino.");
+    uint8_t *bytes = (uint8_t *)buffer;
+    while (length > 0) {
+        ssize_t received = ::read(_fd, bytes, length);
+        if (received > 0) {
+            bytes += received;
+            length -= received;
+            _stats.bytesReceived += received;
+            continue;
+        }
+        if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return failWith(std::string("Error reading from the Arduino: ") + strerror(errno));
+        }
+        struct pollfd pfd = { _fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeoutMs) <= 0) {
+            return failWith("Timed out (>" + std::to_string(timeoutMs) + "ms) while waiting for data from the "
+                            "Arduino.");
+        }
+    }
+    return true;
+}
+
+/** @brief Sends a command (null-terminated) and waits for the Arduino to acknowledge it. */
+bool ProgrammerClient::sendCommand(const char *command) {
+    if (!sendAll(command, strlen(command) + 1, NORMAL_TIMEOUT_MS)) return false;
+    return waitForAck((std::string("command ") + command).c_str(), NORMAL_TIMEOUT_MS);
+}
+
+/**
+ * @brief Waits for an ACK from the Arduino. If it sends a NAK message instead, that message becomes the last error.
+ */
+bool ProgrammerClient::waitForAck(const char *operation, int timeoutMs) {
+    uint8_t b;
+    if (!receiveAll(&b, 1, timeoutMs)) return false;
+    if (b == ACK) return true;
+    if (b != NAK) {
+        char hex[8];
+        snprintf(hex, sizeof(hex), "0x%02X", b);
+        return failWith(std::string("Expected ACK during ") + operation + ", got " + hex + ".");
+    }
+
+    std::string message;
+    for (int i = 0; i < MAX_NAK_MESSAGE_LENGTH; i++) {
+        char c;
+        if (!receiveAll(&c, 1, NORMAL_TIMEOUT_MS) || c == '\0') break;
+        message += c;
+    }
+    return failWith(std::string("Arduino sent NAK during ") + operation + ": " + message);
+}
+
+/**
+ * @brief Checks that an image fits on the chip, so that it isn't found not to part-way through an operation.
+ * 
+ * @param firstSector the index of the sector the image starts at
+ * @param length the length of the image, in bytes
+ * @return whether it fits: if not, the last error says so
+ */
+bool ProgrammerClient::checkOnChip(uint16_t firstSector, size_t length) {
+    size_t sectors = (length + SST_SECTOR_SIZE - 1) / SST_SECTOR_SIZE;
+    if (firstSector + sectors <= _chipSectors) return true;
+    char message[128];
+    snprintf(message, sizeof(message), "%zu bytes from sector %u do not fit on the chip, which has %u sectors.",
+             length, (unsigned)firstSector, (unsigned)_chipSectors);
+    return failWith(message);
+}
+
+/** @brief Records the last error, and returns false (for use in return statements). */
+bool ProgrammerClient::failWith(const std::string &message) {
+    _lastError = message;
+    return false;
+}
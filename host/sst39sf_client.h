@@ -0,0 +1,261 @@
+/*
+ * Native Linux client library for the SST39SF programmer. Talks to the Arduino over a serial device with termios,
+ * using the same protocol header (protocol.h) that the firmware compiles against, so that it can be linked into
+ * other flashing tools. See sst39sf_flash.cpp for a command line program built on it.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SST39SF_PROGRAMMER_SST39SF_CLIENT_H
+#define SST39SF_PROGRAMMER_SST39SF_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+
+//=============================================================================
+//             TYPES
+//=============================================================================
+
+/** @brief Counters kept by a client since it was opened. */
+struct ClientStats {
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint32_t sectorsProgrammed;
+    uint32_t sectorsRead;
+    uint32_t crcsRead;
+    uint32_t retries;          // echoes or reads that were corrupted in transit, and were sent again
+    uint64_t programMicros;    // total time spent in programSector
+};
+
+/** @brief The wear telemetry the Arduino keeps for one sector (see SectorHealth in health.h). */
+struct SectorHealthRecord {
+    uint32_t cycles;
+    uint16_t firstEraseTime;    // in units of 100us, 0 if never measured
+    uint16_t averageEraseTime;
+    uint16_t lastEraseTime;
+    uint16_t averagePolls;      // toggle-bit reads per polled write, x16
+};
+
+/** @brief What erasing a range did with one sector (see processSerialEraseRange in program_sector.h). */
+struct EraseRangeRecord {
+    uint8_t status;             // one of the ERASE_RANGE_ values in protocol.h
+    uint32_t elapsedMicros;     // time spent on the sector, including checking whether it was blank
+    uint32_t eraseMicros;       // the erase itself, or 0 if the sector was not erased
+};
+
+//=============================================================================
+//             CLIENT
+//=============================================================================
+
+/**
+ * @brief A connection to the Arduino. 
+ * 
+ * All operations return true on success. On failure, they return false and lastError() describes what went wrong
+ * (including the Arduino's message, if it sent a NAK). The serial device is used in non-blocking mode, with every
+ * wait bounded by a timeout, so a wedged Arduino can never hang the caller.
+ * 
+ * Data is sent to the Arduino straight from the caller's buffers, without being copied.
+ */
+class ProgrammerClient {
+public:
+    ProgrammerClient();
+    ~ProgrammerClient();
+
+    /**
+     * @brief Opens a serial device and connects to the Arduino (which must have just been reset, and be waiting for
+     * communication).
+     * 
+     * @param devicePath the path of the serial device, e.g. /dev/ttyACM0
+     * @return whether the Arduino was connected to
+     */
+    bool open(const char *devicePath);
+
+    /**
+     * @brief Tells the Arduino that we are done (it then shows the finished LED, and must be reset before it can be
+     * used again), and closes the serial device.
+     * 
+     * @return whether the Arduino acknowledged
+     */
+    bool finish();
+
+    /** @brief Closes the serial device, without telling the Arduino. */
+    void close();
+
+    /**
+     * @brief Programs one sector.
+     * 
+     * @param sectorIndex the index of the sector
+     * @param data the data to program: SST_SECTOR_SIZE bytes
+     * @return whether the sector was programmed (and verified by the Arduino)
+     */
+    bool programSector(uint16_t sectorIndex, const uint8_t *data);
+
+    /**
+     * @brief Writes an image to the chip, a sector at a time. The last sector is padded with zeroes if the image
+     * does not fill it. Fails without writing anything if the image doesn't fit on the chip.
+     * 
+     * @param image the image
+     * @param length the length of the image, in bytes
+     * @param firstSector the index of the sector to write the start of the image to
+     * @return whether the whole image was written
+     */
+    bool write(const uint8_t *image, size_t length, uint16_t firstSector = 0);
+
+    /**
+     * @brief Erases the whole chip. Unlike the C# driver, does not ask for confirmation: that is up to the caller.
+     * 
+     * @return whether the chip was erased
+     */
+    bool eraseChip();
+
+    /**
+     * @brief Erases a range of sectors, leaving those that are already blank alone. Like eraseChip, does not ask for
+     * confirmation.
+     * 
+     * @param firstSector the index of the first sector
+     * @param sectorCount the number of sectors
+     * @param records where to store what was done with each sector, in order
+     * @return whether a record was received for every sector. The records tell which sectors could not be erased.
+     */
+    bool eraseRange(uint16_t firstSector, uint16_t sectorCount, std::vector<EraseRangeRecord> *records);
+
+    /**
+     * @brief Reads one sector.
+     * 
+     * @param sectorIndex the index of the sector
+     * @param data where to store the sector's contents: SST_SECTOR_SIZE bytes
+     * @return whether the sector was read
+     */
+    bool readSector(uint16_t sectorIndex, uint8_t *data);
+
+    /**
+     * @brief Reads part of the chip, a sector at a time.
+     * 
+     * @param buffer where to store the contents
+     * @param length the number of bytes to read
+     * @param firstSector the index of the sector to start reading at
+     * @return whether everything was read
+     */
+    bool read(uint8_t *buffer, size_t length, uint16_t firstSector = 0);
+
+    /**
+     * @brief Gets the CRC-32 of one sector, computed by the Arduino.
+     * 
+     * @param sectorIndex the index of the sector
+     * @param crc where to store the CRC-32
+     * @return whether the CRC-32 was received
+     */
+    bool sectorCrc(uint16_t sectorIndex, uint32_t *crc);
+
+    /**
+     * @brief Checks that the chip holds an image, by comparing sector CRCs (as if it had been written with write).
+     * 
+     * @param image the image
+     * @param length the length of the image, in bytes
+     * @param firstSector the index of the sector the image starts at
+     * @param mismatches where to store the indices of sectors that don't match (may be NULL)
+     * @return whether every sector matched. Check lastError() to tell a mismatch from a communication failure: it
+     *         is empty after a mismatch.
+     */
+    bool verify(const uint8_t *image, size_t length, uint16_t firstSector, std::vector<uint16_t> *mismatches);
+
+    /**
+     * @brief Reads the wear telemetry the Arduino keeps for each sector (see health.h).
+     * 
+     * @param records where to store one record per sector of the chip
+     * @return whether the telemetry was read
+     */
+    bool readHealth(std::vector<SectorHealthRecord> *records);
+
+    /**
+     * @brief Sends bytes to the Arduino as they are, outside of any operation: for tools which drive the protocol
+     * themselves, such as sst39sf-replay.
+     * 
+     * @param data the bytes
+     * @param length the number of bytes
+     * @param timeoutMs the longest to wait for the device to accept some of them
+     * @return whether they were sent
+     */
+    bool sendRaw(const uint8_t *data, size_t length, int timeoutMs);
+
+    /**
+     * @brief Receives exactly length bytes from the Arduino, outside of any operation (see sendRaw).
+     * 
+     * @param data where to store the bytes
+     * @param length the number of bytes
+     * @param timeoutMs the longest to wait for the next of them to arrive
+     * @return whether they were received
+     */
+    bool receiveRaw(uint8_t *data, size_t length, int timeoutMs);
+
+    /**
+     * @brief Receives and throws away whatever the Arduino sends, until it has sent nothing for quietMs
+     * milliseconds.
+     * 
+     * @param quietMs how long the Arduino must be quiet for
+     * @return the number of bytes thrown away
+     */
+    size_t discardInput(int quietMs);
+
+    /**
+     * @brief Changes the baud rate of the serial device, once everything sent so far has gone out. The Arduino must
+     * be switched to the same rate (with BAUD) by the caller.
+     * 
+     * @param baudRate one of SERIAL_BAUD_RATES
+     * @return whether the device supports the rate
+     */
+    bool setBaudRate(uint32_t baudRate);
+
+    /** @brief Gets the number of sectors on the chip, as the Arduino reported when connecting. */
+    uint16_t chipSectors() const { return _chipSectors; }
+
+    /** @brief Gets the counters kept since the client was opened. */
+    const ClientStats &stats() const { return _stats; }
+
+    /** @brief Gets a description of why the last failed operation failed. */
+    const std::string &lastError() const { return _lastError; }
+
+    /**
+     * @brief Computes a CRC-32, as computed by the Arduino (see checksum.h).
+     * 
+     * @param data the data
+     * @param length the length of the data
+     * @return the CRC-32
+     */
+    static uint32_t crc32(const uint8_t *data, size_t length);
+
+private:
+    ProgrammerClient(const ProgrammerClient &);             // not copyable
+    ProgrammerClient &operator=(const ProgrammerClient &);
+
+    bool sendAll(const void *buffer, size_t length, int timeoutMs);
+    bool receiveAll(void *buffer, size_t length, int timeoutMs);
+    bool sendCommand(const char *command);
+    bool waitForAck(const char *operation, int timeoutMs);
+    bool checkOnChip(uint16_t firstSector, size_t length);
+    bool failWith(const std::string &message);
+
+    int _fd;
+    uint16_t _chipSectors;
+    ClientStats _stats;
+    std::string _lastError;
+    uint8_t _echo[SST_SECTOR_SIZE];  // the Arduino's echo of the sector being programmed
+};
+
+#endif  // SST39SF_PROGRAMMER_SST39SF_CLIENT_H
@@ -0,0 +1,182 @@
+/*
+ * Command line program for the SST39SF programmer on Linux, built on the client library (sst39sf_client.h). A thin
+ * counterpart to the C# driver, for build servers and scripts.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "sst39sf_client.h"
+
+static const char USAGE[] =
+    "usage: sst39sf-flash <DEVICE> <MODE> [-y]\n"
+    "\n"
+    "    sst39sf-flash <DEVICE> -w <BIN>             Writes a binary file to the chip, starting at address 0x0\n"
+    "    sst39sf-flash <DEVICE> -v <BIN>             Checks that the chip holds a binary file, by sector CRCs\n"
+    "    sst39sf-flash <DEVICE> -r <OUT> <LENGTH>    Reads the first <LENGTH> bytes of the chip into a file\n"
+    "    sst39sf-flash <DEVICE> -e [-y]              Erases the chip (-y: without asking for confirmation)\n"
+    "    sst39sf-flash <DEVICE> -e <FIRST> <COUNT> [-y]\n"
+    "                                                Erases <COUNT> sectors from sector <FIRST>, skipping blank ones\n"
+    "    sst39sf-flash <DEVICE> --health             Prints the wear telemetry recorded by the Arduino\n"
+    "\n"
+    "        <DEVICE>            Serial device the Arduino is connected to (e.g. /dev/ttyACM0)\n";
+
+/** @brief Prints an error message, followed by the usage message, and exits. */
+static void printUsageAndExit(const char *errorMessage) {
+    fprintf(stderr, "Error: %s\n%s", errorMessage, USAGE);
+    exit(1);
+}
+
+/** @brief Prints the client's last error and exits. */
+static void printErrorAndExit(const ProgrammerClient &client) {
+    fprintf(stderr, "Error: %s\n", client.lastError().c_str());
+    exit(1);
+}
+
+/** @brief Reads a whole file into memory. On error, prints a message and exits. */
+static std::vector<uint8_t> readFile(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: could not open %s.\n", path);
+        exit(1);
+    }
+    std::vector<uint8_t> contents;
+    uint8_t buffer[SST_SECTOR_SIZE];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.insert(contents.end(), buffer, buffer + read);
+    }
+    fclose(file);
+    return contents;
+}
+
+/** @brief Prints the client's counters. */
+static void printStats(const ProgrammerClient &client) {
+    const ClientStats &stats = client.stats();
+    printf("%llu bytes sent, %llu received; %u sectors programmed, %u read, %u CRCs; %u retries.\n",
+           (unsigned long long)stats.bytesSent, (unsigned long long)stats.bytesReceived, stats.sectorsProgrammed,
+           stats.sectorsRead, stats.crcsRead, stats.retries);
+    if (stats.sectorsProgrammed > 0) {
+        printf("Average time to program a sector: %.1f ms.\n",
+               stats.programMicros / 1000.0 / stats.sectorsProgrammed);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) printUsageAndExit(argc < 2 ? "No serial device supplied." : "No mode supplied.");
+    const char *mode = argv[2];
+    bool assumeYes = argc > 3 && strcmp(argv[argc - 1], "-y") == 0;
+
+    // read input before connecting, so that bad input fails before touching the chip
+    std::vector<uint8_t> image;
+    size_t readLength = 0;
+    unsigned long eraseFirst = 0;
+    unsigned long eraseCount = 0;  // 0: the whole chip
+    if (strcmp(mode, "-w") == 0 || strcmp(mode, "-v") == 0) {
+        if (argc < 4) printUsageAndExit("No binary file supplied.");
+        image = readFile(argv[3]);
+    } else if (strcmp(mode, "-r") == 0) {
+        if (argc < 5) printUsageAndExit("-r needs an output file and a length.");
+        readLength = strtoul(argv[4], NULL, 0);
+        if (readLength == 0) printUsageAndExit("Invalid length.");
+    } else if (strcmp(mode, "-e") == 0) {
+        if (argc > 4 && strcmp(argv[3], "-y") != 0) {
+            eraseFirst = strtoul(argv[3], NULL, 0);
+            eraseCount = strtoul(argv[4], NULL, 0);
+            // the Arduino checks that the range is on the chip
+            if (eraseCount == 0 || eraseFirst + eraseCount > 0xFFFF) printUsageAndExit("Invalid sector range.");
+        }
+        if (!assumeYes) {
+            if (eraseCount == 0) {
+                printf("Erasing the chip. Confirm? (y/n)\n> ");
+            } else {
+                printf("Erasing sectors %lu to %lu. Confirm? (y/n)\n> ", eraseFirst, eraseFirst + eraseCount - 1);
+            }
+            char answer[16];
+            if (fgets(answer, sizeof(answer), stdin) == NULL || (answer[0] != 'y' && answer[0] != 'Y')) return 1;
+        }
+    } else if (strcmp(mode, "--health") != 0) {
+        printUsageAndExit("Mode not recognized.");
+    }
+
+    ProgrammerClient client;
+    if (!client.open(argv[1])) printErrorAndExit(client);
+    printf("Connected to Arduino on %s (%u sectors).\n", argv[1], (unsigned)client.chipSectors());
+
+    int exitCode = 0;
+    if (strcmp(mode, "-w") == 0) {
+        if (!client.write(image.data(), image.size())) printErrorAndExit(client);
+        printf("Finished writing %s.\n", argv[3]);
+    } else if (strcmp(mode, "-v") == 0) {
+        std::vector<uint16_t> mismatches;
+        if (!client.verify(image.data(), image.size(), 0, &mismatches) && !client.lastError().empty()) {
+            printErrorAndExit(client);
+        }
+        for (size_t i = 0; i < mismatches.size(); i++) {
+            printf("Sector %u does not match.\n", mismatches[i]);
+        }
+        printf(mismatches.empty() ? "All sectors match.\n" : "%zu sectors do not match.\n", mismatches.size());
+        exitCode = mismatches.empty() ? 0 : 1;
+    } else if (strcmp(mode, "-r") == 0) {
+        std::vector<uint8_t> contents(readLength);
+        if (!client.read(contents.data(), contents.size())) printErrorAndExit(client);
+        FILE *file = fopen(argv[3], "wb");
+        if (file == NULL || fwrite(contents.data(), 1, contents.size(), file) != contents.size()) {
+            fprintf(stderr, "Error: could not write %s.\n", argv[3]);
+            return 1;
+        }
+        fclose(file);
+        printf("Read %zu bytes into %s.\n", contents.size(), argv[3]);
+    } else if (strcmp(mode, "-e") == 0 && eraseCount == 0) {
+        if (!client.eraseChip()) printErrorAndExit(client);
+        printf("Erased chip.\n");
+    } else if (strcmp(mode, "-e") == 0) {
+        std::vector<EraseRangeRecord> records;
+        if (!client.eraseRange((uint16_t)eraseFirst, (uint16_t)eraseCount, &records)) printErrorAndExit(client);
+        static const char *const STATUSES[] = { "erased", "already blank", "NOT ERASABLE", "FAILED" };
+        printf("Sector    Result           Time          Erase\n");
+        unsigned erased = 0;
+        double totalMs = 0;
+        for (size_t i = 0; i < records.size(); i++) {
+            const EraseRangeRecord &r = records[i];
+            printf("%-6lu    %-13s    %7.1f ms    %7.1f ms\n", eraseFirst + i,
+                   r.status <= ERASE_RANGE_FAILED ? STATUSES[r.status] : "?", r.elapsedMicros / 1000.0,
+                   r.eraseMicros / 1000.0);
+            if (r.status == ERASE_RANGE_ERASED) erased++;
+            if (r.status != ERASE_RANGE_ERASED && r.status != ERASE_RANGE_BLANK) exitCode = 1;
+            totalMs += r.elapsedMicros / 1000.0;
+        }
+        printf("Erased %u of %zu sectors in %.1f ms%s.\n", erased, records.size(), totalMs,
+               exitCode == 0 ? "; the rest were already blank" : "; some could not be erased");
+    } else {
+        std::vector<SectorHealthRecord> records;
+        if (!client.readHealth(&records)) printErrorAndExit(client);
+        printf("Sector    Cycles    First erase    Avg erase    Last erase    Avg polls\n");
+        for (size_t i = 0; i < records.size(); i++) {
+            const SectorHealthRecord &r = records[i];
+            if (r.cycles == 0) continue;
+            printf("%-6zu    %-6u    %7.1f ms     %7.1f ms   %7.1f ms    %6.2f\n", i, r.cycles,
+                   r.firstEraseTime / 10.0, r.averageEraseTime / 10.0, r.lastEraseTime / 10.0, r.averagePolls / 16.0);
+        }
+    }
+
+    printStats(client);
+    if (!client.finish()) printErrorAndExit(client);
+    return exitCode;
+}
@@ -0,0 +1,401 @@
+/*
+ * Replays a session captured by the C# driver against a programmer (real, or the simulation in /host/sim/), to
+ * reproduce a problem seen in the field and to benchmark a new firmware build on the same traffic. The driver's
+ * traffic is sent as it was captured, and the Arduino's responses are compared with the captured ones, byte for byte
+ * and in time.
+ * 
+ * The driver captures every session to ArduinoDriver.capture (see ArduinoDriverLogger.cs). The file starts with
+ * "SSTCAP1" and a null byte, and the baud rate the session started at (4 bytes), followed by one record per
+ * transfer:
+ * 
+ *     type     1 byte    'S' sent by the driver, 'R' received, 'D' received and discarded unread, or 'B' the
+ *                        driver's side of the link changing baud rate (the data is the new rate, 4 bytes)
+ *     time     8 bytes   microseconds since the capture started
+ *     length   4 bytes   the number of bytes of data
+ *     data     length bytes
+ * 
+ * All values are little-endian. The replay is in lockstep: the driver's traffic is split into exchanges (what it sent
+ * in one go, and what it received in response), and each exchange is only sent once the previous one's response has
+ * all arrived, as the driver would have. With --paced, the time the driver took between exchanges (such as an
+ * operator confirming a chip erase) is kept as well, so that the whole replay takes as long as the session did.
+ * 
+ * The chip should hold what it held when the session was captured, or responses that read it back will differ.
+ * Responses that report timings (BENCH, ERASERANGE, HEALTH, LINKTEST) differ from run to run anyway.
+ * 
+ * Copyright (C) 2023 Alexander Gillon
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "sst39sf_client.h"
+
+static const char USAGE[] =
+    "usage: sst39sf-replay <DEVICE> <CAPTURE> [--paced]\n"
+    "\n"
+    "    Replays a session captured by the driver (ArduinoDriver.capture) against the Arduino on <DEVICE>, and\n"
+    "    compares its responses and their timing with the captured ones. Exits with 1 if any response differs.\n"
+    "\n"
+    "        <DEVICE>            Serial device the Arduino is connected to (e.g. /dev/ttyACM0, or the simulation's\n"
+    "                            pseudo-terminal)\n"
+    "        --paced             Also wait as long as the driver did between exchanges\n";
+
+//=============================================================================
+//             CONSTANTS
+//=============================================================================
+
+static const char CAPTURE_MAGIC[] = "SSTCAP1";  // followed by its null terminator in the file
+static const uint8_t RECORD_SEND = 'S';
+static const uint8_t RECORD_RECEIVE = 'R';
+static const uint8_t RECORD_DISCARD = 'D';
+static const uint8_t RECORD_BAUD = 'B';
+static const size_t RECORD_HEADER_LENGTH = 13;
+
+static const int SEND_TIMEOUT_MS = 2000;
+/* The longest to wait for the next byte of a response: twice as long as the whole response took when captured, and
+some. */
+static const int RESPONSE_TIMEOUT_MARGIN_MS = 5000;
+static const int DISCARD_QUIET_MS = 50;          // the driver discards input after a 50ms wait, too
+static const size_t MAX_MISMATCHES_SHOWN = 10;
+
+//=============================================================================
+//             TYPES
+//=============================================================================
+
+/** @brief A record of the capture file. */
+struct CaptureRecord {
+    uint8_t type;
+    uint64_t timeUs;
+    std::vector<uint8_t> data;
+};
+
+/** @brief What the driver sent in one go, and what it received in response, as captured and as replayed. */
+struct Exchange {
+    std::string command;             // the command of the transaction the exchange is part of
+    std::vector<uint8_t> sent;
+    std::vector<uint8_t> expected;   // the captured response
+    uint64_t capturedStartUs;
+    uint64_t capturedEndUs;
+    uint64_t replayedStartUs;
+    uint64_t replayedEndUs;
+};
+
+/** @brief Totals over the exchanges of one command. */
+struct CommandTotals {
+    uint32_t exchanges;
+    uint64_t capturedUs;
+    uint64_t replayedUs;
+};
+
+//=============================================================================
+//             UTILITIES
+//=============================================================================
+
+/** @brief Prints an error message, followed by the usage message, and exits. */
+static void printUsageAndExit(const char *errorMessage) {
+    fprintf(stderr, "Error: %s\n%s", errorMessage, USAGE);
+    exit(1);
+}
+
+/** @brief Prints the client's last error and exits. */
+static void printErrorAndExit(const ProgrammerClient &client) {
+    fprintf(stderr, "Error: %s\n", client.lastError().c_str());
+    exit(1);
+}
+
+/** @brief Gets a monotonic timestamp, in microseconds. */
+static uint64_t nowMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** @brief Reads a little-endian value of up to 8 bytes. */
+static uint64_t readLittleEndian(const uint8_t *bytes, size_t length) {
+    uint64_t value = 0;
+    for (size_t i = length; i > 0; i--) value = (value << 8) | bytes[i - 1];
+    return value;
+}
+
+/**
+ * @brief Reads a capture file. On error, prints a message and exits.
+ * 
+ * @param path the path of the file
+ * @param baudRate where to store the baud rate the session started at
+ * @return the file's records
+ */
+static std::vector<CaptureRecord> readCapture(const char *path, uint32_t *baudRate) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: could not open %s.\n", path);
+        exit(1);
+    }
+    uint8_t header[sizeof(CAPTURE_MAGIC) + 4];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)
+            || memcmp(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+        fprintf(stderr, "Error: %s is not a session capture.\n", path);
+        exit(1);
+    }
+    *baudRate = (uint32_t)readLittleEndian(header + sizeof(CAPTURE_MAGIC), 4);
+
+    std::vector<CaptureRecord> records;
+    uint8_t recordHeader[RECORD_HEADER_LENGTH];
+    size_t read;
+    while ((read = fread(recordHeader, 1, sizeof(recordHeader), file)) > 0) {
+        CaptureRecord record;
+        record.type = recordHeader[0];
+        record.timeUs = readLittleEndian(recordHeader + 1, 8);
+        record.data.resize((size_t)readLittleEndian(recordHeader + 9, 4));
+        // a capture cut short (the driver was killed) is replayed up to its last whole record
+        if (read < sizeof(recordHeader)
+                || fread(record.data.data(), 1, record.data.size(), file) != record.data.size()) {
+            printf("Warning: %s ends part way through a record: replaying the records before it.\n", path);
+            break;
+        }
+        if (record.type != RECORD_SEND && record.type != RECORD_RECEIVE && record.type != RECORD_DISCARD
+                && record.type != RECORD_BAUD) {
+            fprintf(stderr, "Error: %s has a record of unknown type 0x%02X.\n", path, record.type);
+            exit(1);
+        }
+        records.push_back(record);
+    }
+    fclose(file);
+    return records;
+}
+
+/**
+ * @brief Gets the command that some bytes sent by the driver are, if they are one: a run of capital letters and a
+ * null terminator, as every command in protocol.h is.
+ * 
+ * @param sent the bytes
+ * @return the command, or an empty string if they are not one
+ */
+static std::string commandIn(const std::vector<uint8_t> &sent) {
+    if (sent.size() < 2 || sent.size() > MAX_COMMAND_LENGTH || sent.back() != '\0') return "";
+    for (size_t i = 0; i + 1 < sent.size(); i++) {
+        if (sent[i] < 'A' || sent[i] > 'Z') return "";
+    }
+    return std::string(sent.begin(), sent.end() - 1);
+}
+
+//=============================================================================
+//             REPLAY
+//=============================================================================
+
+/** @brief Replays exchanges, and keeps what is needed to report on them. */
+class Replayer {
+public:
+    Replayer(ProgrammerClient &client, bool paced)
+            : _client(client), _paced(paced), _command("(connect)"), _open(false), _mismatches(0) {}
+
+    /** @brief Replays a record. On a communication error, prints a message and exits. */
+    void replay(const CaptureRecord &record) {
+        switch (record.type) {
+            case RECORD_SEND:
+                if (_open && !_current.expected.empty()) finishExchange();
+                if (!_open) startExchange(record.timeUs);
+                send(record.data);
+                break;
+            case RECORD_RECEIVE:
+                if (!_open) startExchange(record.timeUs);  // sent unprompted, as in production mode
+                _current.expected.insert(_current.expected.end(), record.data.begin(), record.data.end());
+                _current.capturedEndUs = record.timeUs;
+                break;
+            case RECORD_DISCARD:
+                if (_open) finishExchange();
+                _client.discardInput(DISCARD_QUIET_MS);
+                break;
+            case RECORD_BAUD:
+                if (_open) finishExchange();
+                if (!_client.setBaudRate((uint32_t)readLittleEndian(record.data.data(), 4))) {
+                    printErrorAndExit(_client);
+                }
+                break;
+        }
+    }
+
+    /** @brief Finishes the last exchange, if it is still open. */
+    void finish() {
+        if (_open) finishExchange();
+    }
+
+    /** @brief Prints the time each command took, as captured and as replayed, and the responses that differed. */
+    void printReport() const {
+        std::map<std::string, CommandTotals> totals;
+        std::vector<std::string> order;  // commands in the order they first appear
+        uint64_t capturedUs = 0;
+        uint64_t replayedUs = 0;
+        for (size_t i = 0; i < _exchanges.size(); i++) {
+            const Exchange &exchange = _exchanges[i];
+            if (totals.count(exchange.command) == 0) {
+                CommandTotals zero = { 0, 0, 0 };
+                totals[exchange.command] = zero;
+                order.push_back(exchange.command);
+            }
+            CommandTotals &command = totals[exchange.command];
+            command.exchanges++;
+            command.capturedUs += exchange.capturedEndUs - exchange.capturedStartUs;
+            command.replayedUs += exchange.replayedEndUs - exchange.replayedStartUs;
+            capturedUs += exchange.capturedEndUs - exchange.capturedStartUs;
+            replayedUs += exchange.replayedEndUs - exchange.replayedStartUs;
+        }
+
+        printf("Command            Exchanges    Captured      Replayed      Change\n");
+        for (size_t i = 0; i < order.size(); i++) {
+            const CommandTotals &command = totals[order[i]];
+            printCommandLine(order[i].c_str(), command.exchanges, command.capturedUs, command.replayedUs);
+        }
+        printCommandLine("Total", (uint32_t)_exchanges.size(), capturedUs, replayedUs);
+        printf("(From the start of each exchange to the end of its response: not the driver's time between them.)\n\n");
+
+        if (_mismatches == 0) {
+            printf("Every response matched the capture.\n");
+            return;
+        }
+        printf("%zu of %zu responses differed from the capture", _mismatches, _exchanges.size());
+        printf(_mismatchLines.size() < _mismatches ? ", the first %zu of them:\n" : ":\n", _mismatchLines.size());
+        for (size_t i = 0; i < _mismatchLines.size(); i++) printf("    %s\n", _mismatchLines[i].c_str());
+    }
+
+    /** @brief Gets whether every response matched the capture. */
+    bool matched() const { return _mismatches == 0; }
+
+private:
+    /** @brief Starts an exchange, with the driver's first transfer of it captured at capturedUs. */
+    void startExchange(uint64_t capturedUs) {
+        if (_paced && !_exchanges.empty()) {
+            // wait as long after the last exchange as the driver did
+            uint64_t gapUs = capturedUs - _exchanges.back().capturedEndUs;
+            uint64_t elapsedUs = nowMicros() - _exchanges.back().replayedEndUs;
+            if (gapUs > elapsedUs) usleep((useconds_t)(gapUs - elapsedUs));
+        }
+        _current = Exchange();
+        _current.capturedStartUs = capturedUs;
+        _current.capturedEndUs = capturedUs;
+        _current.replayedStartUs = nowMicros();
+        _open = true;
+    }
+
+    /** @brief Sends some of the exchange. */
+    void send(const std::vector<uint8_t> &data) {
+        _current.sent.insert(_current.sent.end(), data.begin(), data.end());
+        if (!_client.sendRaw(data.data(), data.size(), SEND_TIMEOUT_MS)) printErrorAndExit(_client);
+    }
+
+    /** @brief Receives the exchange's response, and compares it with the captured one. */
+    void finishExchange() {
+        std::string command = commandIn(_current.sent);
+        if (!command.empty()) _command = command;
+        _current.command = _command;
+
+        std::vector<uint8_t> response(_current.expected.size());
+        uint64_t capturedMs = (_current.capturedEndUs - _current.capturedStartUs) / 1000;
+        int timeoutMs = (int)(2 * capturedMs) + RESPONSE_TIMEOUT_MARGIN_MS;
+        if (!_client.receiveRaw(response.data(), response.size(), timeoutMs)) {
+            fprintf(stderr, "Error: %s (exchange %zu, during %s, %.1f ms into the capture). The Arduino has stopped "
+                    "following the capture: replay abandoned.\n", _client.lastError().c_str(), _exchanges.size() + 1,
+                    _command.c_str(), _current.capturedStartUs / 1000.0);
+            exit(1);
+        }
+        _current.replayedEndUs = nowMicros();
+
+        for (size_t i = 0; i < response.size(); i++) {
+            if (response[i] == _current.expected[i]) continue;
+            _mismatches++;
+            if (_mismatchLines.size() < MAX_MISMATCHES_SHOWN) {
+                char line[160];
+                snprintf(line, sizeof(line), "exchange %zu (%s, %.1f ms into the capture): byte %zu of %zu is "
+                         "0x%02X, captured 0x%02X", _exchanges.size() + 1, _command.c_str(),
+                         _current.capturedStartUs / 1000.0, i, response.size(), response[i], _current.expected[i]);
+                _mismatchLines.push_back(line);
+            }
+            break;
+        }
+        _exchanges.push_back(_current);
+        _open = false;
+    }
+
+    /** @brief Prints a line of the report's table. */
+    static void printCommandLine(const char *command, uint32_t exchanges, uint64_t capturedUs, uint64_t replayedUs) {
+        printf("%-18s %9u  %9.1f ms  %9.1f ms", command, exchanges, capturedUs / 1000.0, replayedUs / 1000.0);
+        if (capturedUs > 0) {
+            printf("  %+8.1f%%\n", (replayedUs - (double)capturedUs) * 100.0 / capturedUs);
+        } else {
+            printf("\n");
+        }
+    }
+
+    ProgrammerClient &_client;
+    bool _paced;
+    std::string _command;  // the command of the transaction in progress
+    Exchange _current;
+    bool _open;            // whether _current has started, and not yet been finished
+    std::vector<Exchange> _exchanges;
+    size_t _mismatches;
+    std::vector<std::string> _mismatchLines;
+};
+
+//=============================================================================
+//             MAIN
+//=============================================================================
+
+int main(int argc, char **argv) {
+    if (argc < 3) printUsageAndExit(argc < 2 ? "No serial device supplied." : "No capture file supplied.");
+    bool paced = false;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--paced") != 0) printUsageAndExit("Unrecognized option.");
+        paced = true;
+    }
+
+    uint32_t baudRate;
+    std::vector<CaptureRecord> records = readCapture(argv[2], &baudRate);
+    if (baudRate != SERIAL_BAUD_RATE) {
+        fprintf(stderr, "Error: the session started at %u baud, rather than %u.\n", baudRate,
+                (uint32_t)SERIAL_BAUD_RATE);
+        return 1;
+    }
+
+    /* The driver's first transfer is its ACK of the Arduino's WAITING, which ends the connection handshake: the
+    client's own handshake stands in for everything up to there. */
+    size_t first = 0;
+    while (first < records.size() && records[first].type != RECORD_SEND) first++;
+    if (first == records.size()) {
+        fprintf(stderr, "Error: the driver never connected to the Arduino in %s.\n", argv[2]);
+        return 1;
+    }
+
+    ProgrammerClient client;
+    if (!client.open(argv[1])) printErrorAndExit(client);
+    printf("Connected to Arduino on %s. Replaying %zu transfers from %s%s...\n", argv[1], records.size() - first - 1,
+           argv[2], paced ? ", paced as captured" : "");
+
+    uint64_t startUs = nowMicros();
+    Replayer replayer(client, paced);
+    for (size_t i = first + 1; i < records.size(); i++) replayer.replay(records[i]);
+    replayer.finish();
+    uint64_t replayedUs = nowMicros() - startUs;
+
+    printf("Replayed in %.1f ms; the session took %.1f ms after connecting.\n\n", replayedUs / 1000.0,
+           (records.back().timeUs - records[first].timeUs) / 1000.0);
+    replayer.printReport();
+    client.close();  // the capture ends with the driver's DONE, if it finished
+    return replayer.matched() ? 0 : 1;
+}